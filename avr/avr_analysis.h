@@ -0,0 +1,532 @@
+#ifndef AVR_ANALYSIS_H
+#define AVR_ANALYSIS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <disasm_stream.h>
+#include <symbol_table.h>
+
+#include "avr_instruction_set.h"
+
+/******************************************************************************/
+/* AVR Program */
+/******************************************************************************/
+
+/* Structure for a fully disassembled program */
+struct avrProgram {
+    /* Disassembled instructions, in stream order */
+    struct avrInstructionDisasm *instructions;
+    /* Number of disassembled instructions */
+    unsigned int len;
+    /* Allocated number of instructions */
+    unsigned int capacity;
+    /* Instructions sorted by address flag */
+    int sorted;
+};
+
+/* AVR Program Support */
+int avr_program_read(struct avrProgram *program, struct DisasmStream *ds);
+int avr_program_append(struct avrProgram *program, const struct avrInstructionDisasm *instrDisasm);
+void avr_program_free(struct avrProgram *program);
+void avr_program_sort(struct avrProgram *program);
+int avr_program_find(const struct avrProgram *program, uint32_t address);
+
+/******************************************************************************/
+/* AVR Incremental Disassembly */
+/******************************************************************************/
+
+/* AVR Incremental Disassembly Support. A program is decoded from a Byte Image,
+ * and saved with it as a decode result. A new image is then disassembled by
+ * redecoding only the changed parts against a previous decode result. */
+int avr_program_decode(struct avrProgram *program, const struct ByteImage *image);
+int avr_program_save(FILE *out, const struct ByteImage *image, const struct avrProgram *program);
+int avr_program_load(FILE *in, struct ByteImage *image, struct avrProgram *program);
+int avr_program_update(struct avrProgram *program, const struct ByteImage *image, const struct ByteImage *oldImage, const struct avrProgram *oldProgram, uint32_t *redecoded);
+
+/******************************************************************************/
+/* AVR Range Disassembly */
+/******************************************************************************/
+
+/* Instruction-boundary index of a Byte Image, with a bit set for each image
+ * data byte that starts an instruction */
+struct avrBoundaryIndex {
+    uint8_t *bitmap;
+    /* Number of image data bytes */
+    uint32_t len;
+};
+
+/* AVR Range Disassembly Support. A range is decoded from the known
+ * instruction boundary at or before its start, so only the requested window
+ * of the image is decoded. */
+int avr_boundary_index_build(struct avrBoundaryIndex *index, const struct ByteImage *image);
+void avr_boundary_index_free(struct avrBoundaryIndex *index);
+int avr_boundary_index_first(const struct avrBoundaryIndex *index, uint32_t offset, uint32_t len);
+int avr_program_decode_range(struct avrProgram *program, const struct ByteImage *image, const struct avrBoundaryIndex *index, uint32_t start, uint32_t end);
+
+/******************************************************************************/
+/* AVR Control Flow */
+/******************************************************************************/
+
+/* Control flow classes of instructions */
+enum {
+    AVR_FLOW_NONE,
+    AVR_FLOW_BRANCH,            /* brXX conditional relative branches */
+    AVR_FLOW_SKIP,              /* cpse, sbrc, sbrs, sbic, sbis */
+    AVR_FLOW_JUMP,              /* rjmp, jmp */
+    AVR_FLOW_CALL,              /* rcall, call */
+    AVR_FLOW_INDIRECT_JUMP,     /* ijmp, eijmp */
+    AVR_FLOW_INDIRECT_CALL,     /* icall, eicall */
+    AVR_FLOW_RETURN,            /* ret, reti */
+};
+
+/* AVR Control Flow Support */
+int avr_instruction_flow(const struct avrInstructionInfo *instructionInfo);
+int avr_instruction_target(const struct avrInstructionDisasm *instrDisasm, uint32_t *target);
+
+/******************************************************************************/
+/* AVR Functions */
+/******************************************************************************/
+
+/* Sources of a function boundary */
+enum {
+    AVR_FUNCTION_ENTRY          = (1<<0),   /* First instruction of program */
+    AVR_FUNCTION_VECTORS        = (1<<1),   /* Interrupt vector table */
+    AVR_FUNCTION_VECTOR_TARGET  = (1<<2),   /* Target of an interrupt vector */
+    AVR_FUNCTION_CALL_TARGET    = (1<<3),   /* Target of a call */
+    AVR_FUNCTION_SYMBOL         = (1<<4),   /* Symbol input */
+    AVR_FUNCTION_PROLOGUE       = (1<<5),   /* Compiler prologue */
+    AVR_FUNCTION_EPILOGUE       = (1<<6),   /* After a compiler epilogue */
+    AVR_FUNCTION_FINGERPRINT    = (1<<7),   /* Named by fingerprint */
+};
+
+/* Structure for a function of a program */
+struct avrFunction {
+    /* Start address */
+    uint32_t address;
+    /* Symbol name, or NULL */
+    const char *name;
+    /* Function boundary sources bit flags */
+    unsigned int sources;
+    /* Index of first instruction and number of instructions in program */
+    unsigned int first;
+    unsigned int len;
+};
+
+/* Structure for the functions of a program */
+struct avrFunctionTable {
+    /* Functions, sorted by address */
+    struct avrFunction *functions;
+    /* Number of functions */
+    unsigned int len;
+};
+
+/* AVR Function Support */
+int avr_functions_find(struct avrFunctionTable *table, struct avrProgram *program, const struct SymbolTable *symbols);
+void avr_functions_free(struct avrFunctionTable *table);
+int avr_function_name(const struct avrFunction *function, char *name, size_t size);
+
+/* Adds the function boundaries of avr-gcc prologue and epilogue signatures to
+ * a function table, matching all signatures in one pass over the program.
+ * A prologue starts a function and an epilogue ends one, where no branch or
+ * jump lands and the previous instruction doesn't fall through. */
+int avr_functions_detect(struct avrFunctionTable *table, struct avrProgram *program);
+
+/* Basic block leaders of a sorted program. Sets leaders[i] for each
+ * instruction i that starts a block: the start of the program, an address
+ * discontinuity, a function, a branch or jump target, or the instruction after
+ * one that ends a block. leaders holds program->len + 2 zeroed flags. */
+void avr_block_leaders(const struct avrProgram *program, const struct avrFunctionTable *table, uint8_t *leaders);
+
+/******************************************************************************/
+/* AVR Register Liveness */
+/******************************************************************************/
+
+/* Liveness bits of a register or SREG flag, registers R0-R31 in bits 0-31
+ * and SREG flags in bits 32-39 */
+#define AVR_LIVE_REG(mask)      ((uint64_t)(mask))
+#define AVR_LIVE_SREG(mask)     ((uint64_t)(mask) << 32)
+#define AVR_LIVE_ALL            (AVR_LIVE_REG(0xffffffff) | AVR_LIVE_SREG(0xff))
+
+/* Structure for the registers and SREG flags read and written by an
+ * instruction */
+struct avrRegisterEffects {
+    uint32_t uses;
+    uint32_t defs;
+    uint8_t sregUses;
+    uint8_t sregDefs;
+    /* No effects besides its register and SREG writes */
+    int pure;
+};
+
+/* Structure for the register liveness of a program */
+struct avrLiveness {
+    /* Registers and SREG flags live after each instruction, in program order */
+    uint64_t *liveOut;
+    /* Dead store flag of each instruction */
+    uint8_t *dead;
+    /* Number of dead stores */
+    unsigned int numDead;
+};
+
+/* AVR Register Liveness Support. Liveness is solved backward over the basic
+ * blocks of a sorted program. Calls, returns, indirect jumps and control flow
+ * leaving the program keep every register live, so a dead store is a pure
+ * instruction whose results are all overwritten before any read. */
+void avr_instruction_effects(const struct avrInstructionDisasm *instrDisasm, struct avrRegisterEffects *effects);
+int avr_liveness_analyze(struct avrLiveness *liveness, const struct avrProgram *program, const struct avrFunctionTable *table);
+void avr_liveness_free(struct avrLiveness *liveness);
+
+/******************************************************************************/
+/* AVR Flash Tables */
+/******************************************************************************/
+
+/* Kinds of a code/data map region */
+enum {
+    AVR_REGION_DATA,            /* Table read by lpm / elpm */
+    AVR_REGION_CODE_ROOT,       /* Target of ijmp / icall, or jump table entry */
+};
+
+/* Structure for a region of a code/data map */
+struct avrCodeRegion {
+    /* Start address */
+    uint32_t address;
+    /* Number of bytes of a data region, 0 for a code root */
+    uint32_t len;
+    /* Region kind */
+    unsigned int kind;
+    /* Address of the instruction resolving the region */
+    uint32_t source;
+};
+
+/* Structure for the code/data map of a program */
+struct avrCodeMap {
+    /* Regions, sorted by address, with no code root inside a data region */
+    struct avrCodeRegion *regions;
+    unsigned int len;
+    unsigned int capacity;
+};
+
+/* AVR Flash Table Support. Constants loaded into Z by ldi, mov, movw, adiw,
+ * sbiw, subi / sbci and add / adc within a basic block, and RAMPZ written by
+ * out, resolve the flash addresses read by lpm / elpm and jumped to by ijmp /
+ * icall. Resolved tables are redecoded as .dw data and resolved targets as
+ * code roots, in place, by redecoding only the instructions they overlap
+ * until the decode resynchronizes. Newly decoded code is scanned in turn. The
+ * function table extents are updated to the new program. */
+int avr_tables_resolve(struct avrCodeMap *map, struct avrProgram *program, struct avrFunctionTable *table);
+void avr_code_map_free(struct avrCodeMap *map);
+
+/******************************************************************************/
+/* AVR Signature Search */
+/******************************************************************************/
+
+/* Maximum number of class strings a signature expands to */
+#define AVR_SIGNATURE_MAX_EXPANSIONS    4096
+/* No signature */
+#define AVR_SIGNATURE_NONE              0xffffffff
+
+/* Structure for a compiled set of signatures. Each opcode word maps to the
+ * class of words matching the same signature words, and the signatures,
+ * expanded to strings of classes, to an Aho-Corasick automaton over classes. */
+struct avrSignatureSet {
+    /* Signature names and lengths in words */
+    char **names;
+    unsigned int *lengths;
+    unsigned int numSignatures;
+    /* Class of each opcode word */
+    uint16_t *classes;
+    unsigned int numClasses;
+    /* Transitions, numStates x numClasses, from state 0 */
+    uint32_t *transitions;
+    uint32_t numStates;
+    /* First accepted signature entry of each state, or AVR_SIGNATURE_NONE */
+    uint32_t *accepts;
+    /* Nearest proper suffix state accepting a signature, or 0 */
+    uint32_t *outputs;
+    /* Accepted signature entries, chained by the next entry of the same
+     * state, or AVR_SIGNATURE_NONE */
+    uint32_t *acceptSignatures;
+    uint32_t *acceptNext;
+    uint32_t numAccepts;
+};
+
+/* Structure for a signature match */
+struct avrSignatureMatch {
+    /* Address of the first word */
+    uint32_t address;
+    /* Index of signature */
+    unsigned int signature;
+};
+
+/* Structure for the signature matches of an image */
+struct avrSignatureMatches {
+    struct avrSignatureMatch *matches;
+    unsigned int len;
+    unsigned int capacity;
+};
+
+/* AVR Signature Search Support. A signature file has one signature per line,
+ *      <name>: <word> <word> ...
+ * where a word is four hex digits with ? for don't care nibbles, a
+ * <value>/<mask> pair of hex words, a mnemonic for any of its encodings with
+ * the operand bits don't care, or * for any word. # starts a comment. On a
+ * parse error, line is set to its line number. Images are scanned by word at
+ * even addresses, and a compiled set is read-only while scanning. */
+int avr_signatures_load(struct avrSignatureSet *set, FILE *in, unsigned int *line);
+void avr_signatures_free(struct avrSignatureSet *set);
+int avr_signatures_scan(const struct avrSignatureSet *set, const struct ByteImage *image, struct avrSignatureMatches *matches);
+void avr_signature_matches_free(struct avrSignatureMatches *matches);
+
+/******************************************************************************/
+/* AVR Analysis Database */
+/******************************************************************************/
+
+/* Analysis database file layout version */
+#define AVR_DATABASE_VERSION    1
+/* No block, function or name */
+#define AVR_DATABASE_NONE       0xffffffff
+
+/* Structure for an instruction record of an analysis database */
+struct avrDatabaseInstruction {
+    uint32_t address;
+    uint8_t opcode[4];
+    int32_t operandDisasms[2];
+    /* Instruction set index */
+    uint16_t index;
+    /* Control flow class */
+    uint16_t flow;
+    /* Index of basic block */
+    uint32_t block;
+};
+
+/* Structure for a basic block record of an analysis database */
+struct avrDatabaseBlock {
+    /* Start address */
+    uint32_t address;
+    /* Index of first instruction and number of instructions */
+    uint32_t first;
+    uint32_t len;
+    /* Index of function, or AVR_DATABASE_NONE */
+    uint32_t function;
+};
+
+/* Structure for a function record of an analysis database */
+struct avrDatabaseFunction {
+    /* Start address */
+    uint32_t address;
+    /* String table offset of symbol name, or AVR_DATABASE_NONE */
+    uint32_t name;
+    /* Function boundary sources bit flags */
+    uint32_t sources;
+    /* Index of first instruction and number of instructions */
+    uint32_t first;
+    uint32_t len;
+};
+
+/* Structure for a cross reference record of an analysis database */
+struct avrDatabaseXref {
+    /* Referenced address */
+    uint32_t target;
+    /* Index of referencing instruction */
+    uint32_t source;
+};
+
+/* Structure for an open analysis database. The record arrays point into the
+ * read-only mapping of the database file. */
+struct avrDatabase {
+    /* Key of the analyzed program */
+    uint64_t key;
+    /* Instructions, sorted by address */
+    const struct avrDatabaseInstruction *instructions;
+    uint32_t numInstructions;
+    /* Basic blocks, sorted by address */
+    const struct avrDatabaseBlock *blocks;
+    uint32_t numBlocks;
+    /* Functions, sorted by address */
+    const struct avrDatabaseFunction *functions;
+    uint32_t numFunctions;
+    /* Cross references, sorted by target */
+    const struct avrDatabaseXref *xrefs;
+    uint32_t numXrefs;
+    /* String table */
+    const char *strings;
+    uint32_t stringsLen;
+    /* Mapping */
+    void *base;
+    size_t size;
+};
+
+/* AVR Analysis Database Support. A database holds the instructions, basic
+ * blocks, functions and cross references of an analyzed program as flat
+ * arrays, and is mapped into memory on open, so queries don't redecode. */
+int avr_database_write(FILE *out, uint64_t key, struct avrProgram *program, const struct avrFunctionTable *table);
+int avr_database_open(struct avrDatabase *db, const char *path);
+void avr_database_close(struct avrDatabase *db);
+int avr_database_instruction(const struct avrDatabase *db, uint32_t index, struct avrInstructionDisasm *instrDisasm);
+uint32_t avr_database_seek(const struct avrDatabase *db, uint32_t address);
+uint32_t avr_database_xrefs(const struct avrDatabase *db, uint32_t target, uint32_t *first);
+const char *avr_database_string(const struct avrDatabase *db, uint32_t offset);
+
+/******************************************************************************/
+/* AVR Function Fingerprints */
+/******************************************************************************/
+
+/* Fingerprint database file layout version */
+#define AVR_FINGERPRINTS_VERSION            1
+/* Functions shorter than this many instructions are too common to name */
+#define AVR_FINGERPRINT_MIN_INSTRUCTIONS    4
+
+/* Structure for a fingerprint record of a fingerprint database */
+struct avrFingerprint {
+    /* Hash of the normalized instructions */
+    uint64_t hash;
+    /* Number of instructions of the body */
+    uint32_t len;
+    /* String table offset of function name */
+    uint32_t name;
+};
+
+/* Structure for the fingerprints of reference programs being collected */
+struct avrFingerprintTable {
+    struct avrFingerprint *fingerprints;
+    uint32_t len;
+    uint32_t capacity;
+    /* String table */
+    char *strings;
+    uint32_t stringsLen;
+    uint32_t stringsCapacity;
+};
+
+/* Structure for an open fingerprint database. The records point into the
+ * read-only mapping of the database file. */
+struct avrFingerprintDatabase {
+    /* Fingerprints, sorted by hash and length */
+    const struct avrFingerprint *fingerprints;
+    uint32_t numFingerprints;
+    /* String table */
+    const char *strings;
+    uint32_t stringsLen;
+    /* Mapping */
+    void *base;
+    size_t size;
+};
+
+/* AVR Function Fingerprint Support. A fingerprint hashes the instructions of
+ * the body of a function, up to its last return or jump, with the operands
+ * that change with relocation left out: absolute addresses, lds / sts data
+ * addresses, and relative addresses outside of the body. Named functions of
+ * reference programs are collected into a table and written sorted as a
+ * database, which is mapped into memory on open and searched by binary
+ * search. A fingerprint shared by functions of different names names none. */
+uint64_t avr_function_fingerprint(const struct avrProgram *program, const struct avrFunction *function, uint32_t *len);
+void avr_fingerprints_init(struct avrFingerprintTable *table);
+int avr_fingerprints_add(struct avrFingerprintTable *table, const struct avrProgram *program, const struct avrFunctionTable *functions);
+int avr_fingerprints_merge(struct avrFingerprintTable *table, const struct avrFingerprintDatabase *db);
+int avr_fingerprints_write(FILE *out, struct avrFingerprintTable *table);
+void avr_fingerprints_free(struct avrFingerprintTable *table);
+int avr_fingerprints_open(struct avrFingerprintDatabase *db, const char *path);
+void avr_fingerprints_close(struct avrFingerprintDatabase *db);
+const char *avr_fingerprints_lookup(const struct avrFingerprintDatabase *db, uint64_t hash, uint32_t len);
+
+/* Names the unnamed functions of a function table whose fingerprints are in
+ * a database, with names that point into the database mapping. Returns the
+ * number of functions named. */
+unsigned int avr_fingerprints_identify(const struct avrFingerprintDatabase *db, const struct avrProgram *program, struct avrFunctionTable *table);
+
+/******************************************************************************/
+/* AVR Clone Detection */
+/******************************************************************************/
+
+/* Default number of instructions of the shortest clone */
+#define AVR_CLONE_DEFAULT_WINDOW    8
+
+/* Structure for the normalized instructions of a program searched for
+ * clones */
+struct avrCloneProgram {
+    /* Normalized instruction tokens, in address order */
+    uint32_t *tokens;
+    /* Instruction addresses and widths */
+    uint32_t *addresses;
+    uint8_t *widths;
+    /* Number of tokens of contiguous code from each position */
+    uint32_t *runs;
+    /* Rolling hash of the window starting at each position */
+    uint64_t *hashes;
+    uint32_t len;
+};
+
+/* Structure for a copy of a clone */
+struct avrCloneOccurrence {
+    /* Index of program, and position and address of first instruction */
+    unsigned int program;
+    uint32_t pos;
+    uint32_t address;
+};
+
+/* Structure for a group of copies of the same instructions */
+struct avrCloneGroup {
+    unsigned int numInstructions;
+    unsigned int bytes;
+    /* Non-overlapping copies outside the groups of more savings, in program
+     * and address order */
+    struct avrCloneOccurrence *occurrences;
+    unsigned int numOccurrences;
+    /* Estimated bytes saved by calling one copy from the others of the same
+     * program */
+    unsigned int savings;
+};
+
+/* Structure for the clone groups of programs, covering disjoint code, sorted
+ * by savings */
+struct avrClones {
+    struct avrCloneGroup *groups;
+    unsigned int len;
+};
+
+/* AVR Clone Detection Support. Instructions are normalized to their
+ * instruction set index and register and constant operands, leaving out
+ * addresses, and data and address discontinuities break them. Programs are
+ * prepared independently, and may be prepared on multiple threads, for a
+ * window of the same number of instructions. Clones are the longest
+ * instruction sequences of at least a window that repeat alike. */
+int avr_clones_prepare(struct avrCloneProgram *clones, struct avrProgram *program, unsigned int window);
+void avr_clone_program_free(struct avrCloneProgram *clones);
+int avr_clones_find(struct avrClones *clones, const struct avrCloneProgram *programs, unsigned int numPrograms, unsigned int window);
+void avr_clones_free(struct avrClones *clones);
+
+/******************************************************************************/
+/* AVR Instruction Statistics */
+/******************************************************************************/
+
+/* Structure for instruction statistics over one or more programs */
+struct avrStats {
+    /* Number of programs, bytes and instructions */
+    uint64_t files;
+    uint64_t bytes;
+    uint64_t instructions;
+    /* Counts indexed by instruction set index */
+    uint64_t instructionCounts[AVR_ISET_MAX_INSTRUCTIONS];
+    /* Counts indexed by operand type */
+    uint64_t operandCounts[AVR_TOTAL_OPERAND_TYPES];
+};
+
+/* AVR Instruction Statistics Support */
+void avr_stats_init(struct avrStats *stats);
+int avr_stats_read(struct avrStats *stats, struct DisasmStream *ds);
+void avr_stats_merge(struct avrStats *stats, const struct avrStats *other);
+int avr_stats_print(FILE *out, const struct avrStats *stats, int json);
+
+/******************************************************************************/
+/* AVR Reports */
+/******************************************************************************/
+
+/* AVR Report Support */
+int avr_report_size(FILE *out, const struct avrProgram *program, const struct avrFunctionTable *table);
+int avr_report_diff(FILE *out, struct avrProgram *oldProgram, struct avrProgram *newProgram, const struct SymbolTable *symbols, int detect);
+int avr_report_liveness(FILE *out, const struct avrProgram *program, const struct avrLiveness *liveness, int flags);
+int avr_report_functions(FILE *out, const struct avrProgram *program, const struct avrFunctionTable *table, int flags);
+int avr_report_clones(FILE *out, const struct avrClones *clones, const char *const *names);
+
+#endif
+
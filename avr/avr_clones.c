@@ -0,0 +1,439 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "avr_instruction_set.h"
+#include "avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Clone Detection */
+/******************************************************************************/
+
+/* Programs are searched for clones as sequences of normalized instruction
+ * tokens, which leave out address operands so copies at different addresses
+ * compare equal. Every window of tokens is bucketed by its rolling hash into
+ * one hash table over all programs, windows of equal tokens form a group, and
+ * a group is extended over the following groups for as long as every copy
+ * continues alike, giving the maximal clones. */
+
+/* Rolling hash multiplier */
+#define CLONE_HASH_PRIME    0x100000001b3ULL
+
+/* Hash table entry of a distinct window */
+struct clone_bucket {
+    uint64_t hash;
+    /* Program and position of the first window, and its group */
+    uint32_t program;
+    uint32_t pos;
+    uint32_t group;
+};
+
+/* Window group */
+struct clone_group {
+    /* Number of windows, and index of first window in occurrence order */
+    uint32_t count;
+    uint32_t first;
+    /* Walk stamp */
+    uint32_t visited;
+};
+
+static uint32_t util_clone_token(const struct avrInstructionDisasm *instrDisasm) {
+    const struct avrInstructionInfo *instructionInfo = instrDisasm->instructionInfo;
+    uint32_t token;
+    int i;
+
+    /* Instruction set index and up to two 8-bit operands */
+    token = (uint32_t)AVR_ISET_INDEX(instructionInfo) << 16;
+    for (i = 0; i < instructionInfo->numOperands; i++) {
+        switch (instructionInfo->operandTypes[i]) {
+            case OPERAND_BRANCH_ADDRESS:
+            case OPERAND_RELATIVE_ADDRESS:
+            case OPERAND_LONG_ABSOLUTE_ADDRESS:
+                /* Relocation sensitive */
+                break;
+            case OPERAND_DATA:
+                /* lds / sts data addresses are relocation sensitive */
+                if (strcmp(instructionInfo->mnemonic, "lds") == 0 || strcmp(instructionInfo->mnemonic, "sts") == 0)
+                    break;
+                /* Fall through */
+            default:
+                token |= ((uint32_t)instrDisasm->operandDisasms[i] & 0xff) << (8*(1-i));
+                break;
+        }
+    }
+
+    return token;
+}
+
+int avr_clones_prepare(struct avrCloneProgram *clones, struct avrProgram *program, unsigned int window) {
+    const struct avrInstructionDisasm *instrDisasm;
+    uint64_t hash, power;
+    uint32_t i;
+    int index;
+
+    memset(clones, 0, sizeof(struct avrCloneProgram));
+
+    /* Tokens are taken in address order */
+    avr_program_sort(program);
+
+    clones->len = program->len;
+    clones->tokens = malloc((program->len > 0 ? program->len : 1)*sizeof(uint32_t));
+    clones->addresses = malloc((program->len > 0 ? program->len : 1)*sizeof(uint32_t));
+    clones->widths = malloc(program->len > 0 ? program->len : 1);
+    clones->runs = malloc((program->len > 0 ? program->len : 1)*sizeof(uint32_t));
+    clones->hashes = malloc((program->len > 0 ? program->len : 1)*sizeof(uint64_t));
+    if (clones->tokens == NULL || clones->addresses == NULL || clones->widths == NULL || clones->runs == NULL || clones->hashes == NULL) {
+        avr_clone_program_free(clones);
+        return -1;
+    }
+
+    for (i = 0; i < program->len; i++) {
+        instrDisasm = &program->instructions[i];
+        clones->tokens[i] = util_clone_token(instrDisasm);
+        clones->addresses[i] = instrDisasm->address;
+        clones->widths[i] = (uint8_t)instrDisasm->instructionInfo->width;
+    }
+
+    /* Number of tokens of contiguous code at each position, which data and
+     * address discontinuities break */
+    for (i = program->len; i-- > 0; ) {
+        index = AVR_ISET_INDEX(program->instructions[i].instructionInfo);
+        if (index == AVR_ISET_INDEX_WORD || index == AVR_ISET_INDEX_BYTE)
+            clones->runs[i] = 0;
+        else if (i+1 < program->len && clones->addresses[i+1] == clones->addresses[i] + clones->widths[i])
+            clones->runs[i] = clones->runs[i+1] + 1;
+        else
+            clones->runs[i] = 1;
+    }
+
+    /* Rolling hashes of the windows ending at each position, stored at the
+     * window start */
+    for (i = 1, power = 1; i < window; i++)
+        power *= CLONE_HASH_PRIME;
+    for (i = 0, hash = 0; i < program->len; i++) {
+        clones->hashes[i] = 0;
+        if (i >= window)
+            hash -= clones->tokens[i - window] * power;
+        hash = hash*CLONE_HASH_PRIME + clones->tokens[i];
+        if (i+1 >= window)
+            clones->hashes[i+1 - window] = hash;
+    }
+
+    return 0;
+}
+
+void avr_clone_program_free(struct avrCloneProgram *clones) {
+    free(clones->tokens);
+    free(clones->addresses);
+    free(clones->widths);
+    free(clones->runs);
+    free(clones->hashes);
+    memset(clones, 0, sizeof(struct avrCloneProgram));
+}
+
+/* Estimated bytes saved by moving the copies of a clone within one program
+ * into one function: all copies but one, less an rcall per copy and the ret */
+static unsigned int util_clone_savings(unsigned int bytes, unsigned int copies) {
+    uint64_t saved = (uint64_t)bytes*(copies - 1), cost = 2*(uint64_t)copies + 2;
+
+    return (saved > cost) ? (unsigned int)(saved - cost) : 0;
+}
+
+/* Estimated bytes saved by a clone group, summed over the programs, as a call
+ * can't reach a copy in another program */
+static unsigned int util_clone_group_savings(const struct avrCloneGroup *group) {
+    unsigned int i, j, savings;
+
+    savings = 0;
+    for (i = 0; i < group->numOccurrences; i = j) {
+        for (j = i + 1; j < group->numOccurrences && group->occurrences[j].program == group->occurrences[i].program; j++)
+            ;
+        savings += util_clone_savings(group->bytes, j - i);
+    }
+
+    return savings;
+}
+
+static int util_clone_group_compare(const void *a, const void *b) {
+    const struct avrCloneGroup *ga = (const struct avrCloneGroup *)a;
+    const struct avrCloneGroup *gb = (const struct avrCloneGroup *)b;
+
+    if (ga->savings != gb->savings)
+        return (ga->savings > gb->savings) ? -1 : 1;
+    if (ga->occurrences[0].program != gb->occurrences[0].program)
+        return (ga->occurrences[0].program < gb->occurrences[0].program) ? -1 : 1;
+    return (ga->occurrences[0].address < gb->occurrences[0].address) ? -1 : (ga->occurrences[0].address > gb->occurrences[0].address);
+}
+
+/* Common group of the windows next to the windows of a group, delta positions
+ * away, if they all share one group of as many windows, or UINT32_MAX */
+static uint32_t util_clone_neighbor(const struct avrCloneProgram *programs, const struct clone_group *groups, const uint32_t *occurrences, uint32_t **windowGroups, uint32_t g, int delta, unsigned int window) {
+    uint32_t i, program, pos, neighbor = UINT32_MAX;
+
+    for (i = 0; i < groups[g].count; i++) {
+        program = occurrences[2*(groups[g].first + i)];
+        pos = occurrences[2*(groups[g].first + i) + 1];
+        if (delta < 0 && pos == 0)
+            return UINT32_MAX;
+        pos += delta;
+        if (pos >= programs[program].len || programs[program].runs[pos] < window)
+            return UINT32_MAX;
+        if (i == 0)
+            neighbor = windowGroups[program][pos];
+        else if (windowGroups[program][pos] != neighbor)
+            return UINT32_MAX;
+    }
+
+    if (neighbor == UINT32_MAX || neighbor == g || groups[neighbor].count != groups[g].count)
+        return UINT32_MAX;
+
+    return neighbor;
+}
+
+int avr_clones_find(struct avrClones *clones, const struct avrCloneProgram *programs, unsigned int numPrograms, unsigned int window) {
+    struct clone_bucket *buckets = NULL, *bucket;
+    struct clone_group *groups = NULL;
+    uint32_t **windowGroups = NULL;
+    uint32_t *occurrences = NULL;
+    uint64_t numWindows, numBuckets, slot;
+    uint32_t numGroups, p, i, j, k, g, next, pos, len, kept, bytes, capacity;
+    struct avrCloneOccurrence *occurrence;
+    struct avrCloneGroup *grown, group;
+    uint8_t **covered = NULL;
+    int ret = -1;
+
+    memset(clones, 0, sizeof(struct avrClones));
+    capacity = 0;
+
+    if (window == 0)
+        return -1;
+
+    /* Count the windows of contiguous code */
+    numWindows = 0;
+    for (p = 0; p < numPrograms; p++) {
+        for (i = 0; i < programs[p].len; i++) {
+            if (programs[p].runs[i] >= window)
+                numWindows++;
+        }
+    }
+    if (numWindows >= UINT32_MAX/2)
+        return -1;
+
+    /* Open addressing hash table at most half full */
+    for (numBuckets = 64; numBuckets < 2*numWindows; numBuckets *= 2)
+        ;
+    buckets = malloc(numBuckets*sizeof(struct clone_bucket));
+    groups = malloc((numWindows > 0 ? numWindows : 1)*sizeof(struct clone_group));
+    occurrences = malloc((numWindows > 0 ? numWindows : 1)*2*sizeof(uint32_t));
+    windowGroups = calloc(numPrograms > 0 ? numPrograms : 1, sizeof(uint32_t *));
+    if (buckets == NULL || groups == NULL || occurrences == NULL || windowGroups == NULL)
+        goto cleanup;
+    for (slot = 0; slot < numBuckets; slot++)
+        buckets[slot].group = UINT32_MAX;
+    for (p = 0; p < numPrograms; p++) {
+        if ((windowGroups[p] = malloc((programs[p].len > 0 ? programs[p].len : 1)*sizeof(uint32_t))) == NULL)
+            goto cleanup;
+    }
+
+    /* Bucket every window by hash, telling colliding windows apart by their
+     * tokens */
+    numGroups = 0;
+    for (p = 0; p < numPrograms; p++) {
+        for (i = 0; i < programs[p].len; i++) {
+            windowGroups[p][i] = UINT32_MAX;
+            if (programs[p].runs[i] < window)
+                continue;
+
+            for (slot = programs[p].hashes[i] & (numBuckets - 1); ; slot = (slot + 1) & (numBuckets - 1)) {
+                bucket = &buckets[slot];
+                if (bucket->group == UINT32_MAX) {
+                    bucket->hash = programs[p].hashes[i];
+                    bucket->program = p;
+                    bucket->pos = i;
+                    bucket->group = numGroups;
+                    groups[numGroups].count = 0;
+                    groups[numGroups].visited = UINT32_MAX;
+                    numGroups++;
+                    break;
+                }
+                if (bucket->hash == programs[p].hashes[i] && memcmp(&programs[bucket->program].tokens[bucket->pos], &programs[p].tokens[i], window*sizeof(uint32_t)) == 0)
+                    break;
+            }
+
+            windowGroups[p][i] = bucket->group;
+            groups[bucket->group].count++;
+        }
+    }
+
+    /* Windows of each group, in program and position order */
+    for (g = 0, next = 0; g < numGroups; g++) {
+        groups[g].first = next;
+        next += groups[g].count;
+        groups[g].count = 0;
+    }
+    for (p = 0; p < numPrograms; p++) {
+        for (i = 0; i < programs[p].len; i++) {
+            if ((g = windowGroups[p][i]) == UINT32_MAX)
+                continue;
+            occurrences[2*(groups[g].first + groups[g].count)] = p;
+            occurrences[2*(groups[g].first + groups[g].count) + 1] = i;
+            groups[g].count++;
+        }
+    }
+
+    for (g = 0; g < numGroups; g++) {
+        /* A clone starts at a repeated window that doesn't continue the
+         * clone of the windows before it */
+        if (groups[g].count < 2 || util_clone_neighbor(programs, groups, occurrences, windowGroups, g, -1, window) != UINT32_MAX)
+            continue;
+
+        /* Extend over the following windows while every copy continues
+         * alike */
+        len = window;
+        groups[g].visited = g;
+        for (next = g; (next = util_clone_neighbor(programs, groups, occurrences, windowGroups, next, 1, window)) != UINT32_MAX && groups[next].visited != g; len++)
+            groups[next].visited = g;
+
+        /* Grow the clone group array if needed */
+        if (clones->len == capacity) {
+            capacity = (capacity == 0) ? 64 : capacity*2;
+            if ((grown = realloc(clones->groups, capacity*sizeof(struct avrCloneGroup))) == NULL)
+                goto cleanup;
+            clones->groups = grown;
+        }
+        if ((clones->groups[clones->len].occurrences = malloc(groups[g].count*sizeof(struct avrCloneOccurrence))) == NULL)
+            goto cleanup;
+
+        /* Keep the copies that don't overlap the last kept copy */
+        occurrence = clones->groups[clones->len].occurrences;
+        for (i = 0, kept = 0; i < groups[g].count; i++) {
+            p = occurrences[2*(groups[g].first + i)];
+            pos = occurrences[2*(groups[g].first + i) + 1];
+            if (kept > 0 && occurrence[kept-1].program == p && pos < occurrence[kept-1].pos + len)
+                continue;
+            occurrence[kept].program = p;
+            occurrence[kept].pos = pos;
+            occurrence[kept].address = programs[p].addresses[pos];
+            kept++;
+        }
+        if (kept < 2) {
+            free(clones->groups[clones->len].occurrences);
+            continue;
+        }
+
+        /* Copies have the same instructions, and so the same size */
+        p = occurrence[0].program;
+        pos = occurrence[0].pos;
+        bytes = programs[p].addresses[pos + len - 1] + programs[p].widths[pos + len - 1] - programs[p].addresses[pos];
+
+        clones->groups[clones->len].numInstructions = len;
+        clones->groups[clones->len].bytes = bytes;
+        clones->groups[clones->len].numOccurrences = kept;
+        clones->groups[clones->len].savings = util_clone_group_savings(&clones->groups[clones->len]);
+        clones->len++;
+    }
+
+    if (clones->len > 0)
+        qsort(clones->groups, clones->len, sizeof(struct avrCloneGroup), util_clone_group_compare);
+
+    /* Clones of a longer clone's copies, and clones overlapping them, save
+     * nothing once the longer clone is moved, so going by savings, drop the
+     * copies covered by a group already taken and discount the group */
+    if ((covered = calloc(numPrograms > 0 ? numPrograms : 1, sizeof(uint8_t *))) == NULL)
+        goto cleanup;
+    for (p = 0; p < numPrograms; p++) {
+        if ((covered[p] = calloc(programs[p].len > 0 ? programs[p].len : 1, 1)) == NULL)
+            goto cleanup;
+    }
+    for (g = 0, next = 0; g < clones->len; g++) {
+        group = clones->groups[g];
+        len = group.numInstructions;
+
+        for (i = 0, kept = 0; i < group.numOccurrences; i++) {
+            occurrence = &group.occurrences[i];
+            if (memchr(&covered[occurrence->program][occurrence->pos], 1, len) == NULL)
+                group.occurrences[kept++] = *occurrence;
+        }
+        group.numOccurrences = kept;
+        group.savings = util_clone_group_savings(&group);
+        if (group.savings == 0) {
+            free(group.occurrences);
+            continue;
+        }
+
+        /* Cover the copies of programs with two or more of them */
+        for (i = 0; i < group.numOccurrences; i = j) {
+            for (j = i + 1; j < group.numOccurrences && group.occurrences[j].program == group.occurrences[i].program; j++)
+                ;
+            if (util_clone_savings(group.bytes, j - i) == 0)
+                continue;
+            for (k = i; k < j; k++)
+                memset(&covered[group.occurrences[k].program][group.occurrences[k].pos], 1, len);
+        }
+
+        clones->groups[next++] = group;
+    }
+    clones->len = next;
+
+    if (clones->len > 0)
+        qsort(clones->groups, clones->len, sizeof(struct avrCloneGroup), util_clone_group_compare);
+
+    ret = 0;
+
+    cleanup:
+    if (covered != NULL) {
+        for (p = 0; p < numPrograms; p++)
+            free(covered[p]);
+    }
+    free(covered);
+    if (windowGroups != NULL) {
+        for (p = 0; p < numPrograms; p++)
+            free(windowGroups[p]);
+    }
+    free(windowGroups);
+    free(occurrences);
+    free(groups);
+    free(buckets);
+    if (ret < 0)
+        avr_clones_free(clones);
+    return ret;
+}
+
+void avr_clones_free(struct avrClones *clones) {
+    unsigned int i;
+
+    for (i = 0; i < clones->len; i++)
+        free(clones->groups[i].occurrences);
+    free(clones->groups);
+    memset(clones, 0, sizeof(struct avrClones));
+}
+
+int avr_report_clones(FILE *out, const struct avrClones *clones, const char *const *names) {
+    const struct avrCloneGroup *group;
+    uint64_t totalSavings;
+    unsigned int i, j, numGroups;
+
+    totalSavings = 0;
+    numGroups = 0;
+    for (i = 0; i < clones->len; i++) {
+        group = &clones->groups[i];
+        if (group->savings == 0)
+            continue;
+
+        if (fprintf(out, "Clone %u: %u instructions, %u bytes, %u copies, saves %u bytes\n", numGroups + 1, group->numInstructions, group->bytes, group->numOccurrences, group->savings) < 0)
+            return -1;
+        for (j = 0; j < group->numOccurrences; j++) {
+            if (fprintf(out, "    %s:0x%08x\n", names[group->occurrences[j].program], group->occurrences[j].address) < 0)
+                return -1;
+        }
+
+        totalSavings += group->savings;
+        numGroups++;
+    }
+
+    if (fprintf(out, "%sClones: %u groups, saves %llu bytes\n", (numGroups > 0) ? "\n" : "", numGroups, (unsigned long long)totalSavings) < 0)
+        return -1;
+
+    return 0;
+}
@@ -0,0 +1,425 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "avr_instruction_set.h"
+#include "avr_support.h"
+#include "avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Analysis Database Files */
+/******************************************************************************/
+
+/* An analysis database file holds flat record arrays, in host byte order,
+ * each at an 8-byte aligned offset recorded in the header:
+ *      struct database_file_header
+ *      struct avrDatabaseInstruction [numInstructions]
+ *      struct avrDatabaseBlock [numBlocks]
+ *      struct avrDatabaseFunction [numFunctions]
+ *      struct avrDatabaseXref [numXrefs]
+ *      char strings [stringsLen]
+ */
+
+#define DATABASE_FILE_MAGIC "VAVRADB1"
+
+struct database_file_header {
+    char magic[8];
+    uint32_t version;
+    /* Instruction set size, to reject databases of another instruction set */
+    uint32_t numInstructionSet;
+    uint64_t key;
+    uint32_t numInstructions;
+    uint32_t numBlocks;
+    uint32_t numFunctions;
+    uint32_t numXrefs;
+    uint32_t stringsLen;
+    uint32_t reserved;
+    uint64_t instructionsOffset;
+    uint64_t blocksOffset;
+    uint64_t functionsOffset;
+    uint64_t xrefsOffset;
+    uint64_t stringsOffset;
+};
+
+#define DATABASE_ALIGN(x)   (((x) + 7) & ~(uint64_t)7)
+
+/* Structure for the records of a database being written */
+struct database_tables {
+    struct avrDatabaseInstruction *instructions;
+    struct avrDatabaseBlock *blocks;
+    uint32_t numBlocks;
+    struct avrDatabaseFunction *functions;
+    struct avrDatabaseXref *xrefs;
+    uint32_t numXrefs;
+    char *strings;
+    uint32_t stringsLen;
+};
+
+static int util_xref_compare(const void *a, const void *b) {
+    const struct avrDatabaseXref *xa = (const struct avrDatabaseXref *)a;
+    const struct avrDatabaseXref *xb = (const struct avrDatabaseXref *)b;
+
+    if (xa->target != xb->target)
+        return (xa->target < xb->target) ? -1 : 1;
+    if (xa->source != xb->source)
+        return (xa->source < xb->source) ? -1 : 1;
+    return 0;
+}
+
+/* Split a sorted program into basic blocks, with the function each block
+ * falls in */
+static int util_database_blocks(struct database_tables *tables, const struct avrProgram *program, const struct avrFunctionTable *table) {
+    uint8_t *leaders;
+    uint32_t i, f;
+    int index;
+
+    if ((leaders = calloc(program->len + 2, 1)) == NULL)
+        return -1;
+
+    avr_block_leaders(program, table, leaders);
+
+    for (i = 0, tables->numBlocks = 0; i < program->len; i++)
+        tables->numBlocks += leaders[i];
+
+    if ((tables->blocks = malloc((tables->numBlocks > 0 ? tables->numBlocks : 1)*sizeof(struct avrDatabaseBlock))) == NULL) {
+        free(leaders);
+        return -1;
+    }
+
+    /* Fill in blocks, with the function each block falls in */
+    for (i = 0, f = 0, index = -1; i < program->len; i++) {
+        if (leaders[i]) {
+            struct avrDatabaseBlock *block = &tables->blocks[++index];
+            while (f+1 < table->len && table->functions[f+1].first <= i)
+                f++;
+            block->address = program->instructions[i].address;
+            block->first = i;
+            block->len = 0;
+            block->function = (f < table->len && table->functions[f].first <= i) ? f : AVR_DATABASE_NONE;
+        }
+        tables->blocks[index].len++;
+        tables->instructions[i].block = (uint32_t)index;
+    }
+
+    free(leaders);
+
+    return 0;
+}
+
+static int util_database_tables(struct database_tables *tables, const struct avrProgram *program, const struct avrFunctionTable *table) {
+    const struct avrInstructionDisasm *instrDisasm;
+    uint32_t i, target, capacity;
+
+    memset(tables, 0, sizeof(struct database_tables));
+
+    tables->instructions = calloc(program->len > 0 ? program->len : 1, sizeof(struct avrDatabaseInstruction));
+    tables->functions = calloc(table->len > 0 ? table->len : 1, sizeof(struct avrDatabaseFunction));
+    tables->xrefs = malloc((program->len > 0 ? program->len : 1)*sizeof(struct avrDatabaseXref));
+    if (tables->instructions == NULL || tables->functions == NULL || tables->xrefs == NULL)
+        return -1;
+
+    /* Instructions and cross references */
+    for (i = 0; i < program->len; i++) {
+        instrDisasm = &program->instructions[i];
+
+        tables->instructions[i].address = instrDisasm->address;
+        memcpy(tables->instructions[i].opcode, instrDisasm->opcode, sizeof(instrDisasm->opcode));
+        tables->instructions[i].operandDisasms[0] = instrDisasm->operandDisasms[0];
+        tables->instructions[i].operandDisasms[1] = instrDisasm->operandDisasms[1];
+        tables->instructions[i].index = (uint16_t)AVR_ISET_INDEX(instrDisasm->instructionInfo);
+        tables->instructions[i].flow = (uint16_t)avr_instruction_flow(instrDisasm->instructionInfo);
+
+        if (avr_instruction_target(instrDisasm, &target)) {
+            tables->xrefs[tables->numXrefs].target = target;
+            tables->xrefs[tables->numXrefs].source = i;
+            tables->numXrefs++;
+        }
+    }
+    qsort(tables->xrefs, tables->numXrefs, sizeof(struct avrDatabaseXref), util_xref_compare);
+
+    /* Functions and their names */
+    for (i = 0, capacity = 0; i < table->len; i++) {
+        tables->functions[i].address = table->functions[i].address;
+        tables->functions[i].sources = table->functions[i].sources;
+        tables->functions[i].first = table->functions[i].first;
+        tables->functions[i].len = table->functions[i].len;
+        tables->functions[i].name = AVR_DATABASE_NONE;
+
+        if (table->functions[i].name != NULL) {
+            uint32_t len = (uint32_t)strlen(table->functions[i].name) + 1;
+            if (capacity - tables->stringsLen < len) {
+                char *strings;
+                capacity = (capacity == 0) ? 4096 : capacity;
+                while (capacity - tables->stringsLen < len)
+                    capacity *= 2;
+                if ((strings = realloc(tables->strings, capacity)) == NULL)
+                    return -1;
+                tables->strings = strings;
+            }
+            memcpy(tables->strings + tables->stringsLen, table->functions[i].name, len);
+            tables->functions[i].name = tables->stringsLen;
+            tables->stringsLen += len;
+        }
+    }
+
+    return util_database_blocks(tables, program, table);
+}
+
+static void util_database_tables_free(struct database_tables *tables) {
+    free(tables->instructions);
+    free(tables->blocks);
+    free(tables->functions);
+    free(tables->xrefs);
+    free(tables->strings);
+}
+
+/* Write an array, padded to an 8-byte boundary */
+static int util_database_write_array(FILE *out, const void *data, size_t size, uint64_t *offset) {
+    static const uint8_t padding[8] = {0};
+    uint64_t padded = DATABASE_ALIGN(*offset + size);
+
+    if (size > 0 && fwrite(data, 1, size, out) != size)
+        return -1;
+    if (padded != *offset + size && fwrite(padding, 1, (size_t)(padded - *offset - size), out) != (size_t)(padded - *offset - size))
+        return -1;
+    *offset = padded;
+
+    return 0;
+}
+
+int avr_database_write(FILE *out, uint64_t key, struct avrProgram *program, const struct avrFunctionTable *table) {
+    struct database_file_header header;
+    struct database_tables tables;
+    uint64_t offset;
+    int ret = -1;
+
+    /* Instructions are recorded by address */
+    avr_program_sort(program);
+
+    if (util_database_tables(&tables, program, table) < 0)
+        goto write_done;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DATABASE_FILE_MAGIC, sizeof(header.magic));
+    header.version = AVR_DATABASE_VERSION;
+    header.numInstructionSet = (uint32_t)AVR_TOTAL_INSTRUCTIONS;
+    header.key = key;
+    header.numInstructions = program->len;
+    header.numBlocks = tables.numBlocks;
+    header.numFunctions = table->len;
+    header.numXrefs = tables.numXrefs;
+    header.stringsLen = tables.stringsLen;
+
+    /* Lay out the arrays */
+    offset = DATABASE_ALIGN(sizeof(header));
+    header.instructionsOffset = offset;
+    offset = DATABASE_ALIGN(offset + (uint64_t)header.numInstructions*sizeof(struct avrDatabaseInstruction));
+    header.blocksOffset = offset;
+    offset = DATABASE_ALIGN(offset + (uint64_t)header.numBlocks*sizeof(struct avrDatabaseBlock));
+    header.functionsOffset = offset;
+    offset = DATABASE_ALIGN(offset + (uint64_t)header.numFunctions*sizeof(struct avrDatabaseFunction));
+    header.xrefsOffset = offset;
+    offset = DATABASE_ALIGN(offset + (uint64_t)header.numXrefs*sizeof(struct avrDatabaseXref));
+    header.stringsOffset = offset;
+
+    offset = 0;
+    if (util_database_write_array(out, &header, sizeof(header), &offset) < 0)
+        goto write_done;
+    if (util_database_write_array(out, tables.instructions, (size_t)header.numInstructions*sizeof(struct avrDatabaseInstruction), &offset) < 0)
+        goto write_done;
+    if (util_database_write_array(out, tables.blocks, (size_t)header.numBlocks*sizeof(struct avrDatabaseBlock), &offset) < 0)
+        goto write_done;
+    if (util_database_write_array(out, tables.functions, (size_t)header.numFunctions*sizeof(struct avrDatabaseFunction), &offset) < 0)
+        goto write_done;
+    if (util_database_write_array(out, tables.xrefs, (size_t)header.numXrefs*sizeof(struct avrDatabaseXref), &offset) < 0)
+        goto write_done;
+    if (header.stringsLen > 0 && fwrite(tables.strings, 1, header.stringsLen, out) != header.stringsLen)
+        goto write_done;
+
+    ret = 0;
+
+    write_done:
+    util_database_tables_free(&tables);
+    return ret;
+}
+
+/******************************************************************************/
+/* AVR Analysis Database Support */
+/******************************************************************************/
+
+void *avr_file_map(const char *path, size_t *size) {
+#ifndef _MSC_VER
+    struct stat st;
+    void *base;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    *size = (size_t)st.st_size;
+    return base;
+#else
+    /* No mmap(), fall back to reading the whole file */
+    FILE *in;
+    void *base;
+    long len;
+
+    if ((in = fopen(path, "rb")) == NULL)
+        return NULL;
+    if (fseek(in, 0, SEEK_END) != 0 || (len = ftell(in)) <= 0 || fseek(in, 0, SEEK_SET) != 0 || (base = malloc((size_t)len)) == NULL) {
+        fclose(in);
+        return NULL;
+    }
+    if (fread(base, 1, (size_t)len, in) != (size_t)len) {
+        free(base);
+        fclose(in);
+        return NULL;
+    }
+    fclose(in);
+
+    *size = (size_t)len;
+    return base;
+#endif
+}
+
+void avr_file_unmap(void *base, size_t size) {
+#ifndef _MSC_VER
+    munmap(base, size);
+#else
+    (void)size;
+    free(base);
+#endif
+}
+
+/* Check that an array of a database lies within the file */
+static int util_database_array_valid(uint64_t offset, uint64_t len, size_t recordSize, size_t size) {
+    return (offset % 8) == 0 && offset <= size && len <= (size - offset)/recordSize;
+}
+
+int avr_database_open(struct avrDatabase *db, const char *path) {
+    const struct database_file_header *header;
+
+    memset(db, 0, sizeof(struct avrDatabase));
+
+    if ((db->base = avr_file_map(path, &db->size)) == NULL)
+        return -1;
+
+    /* Validate the header and the array extents */
+    header = (const struct database_file_header *)db->base;
+    if (db->size < sizeof(struct database_file_header))
+        goto open_error;
+    if (memcmp(header->magic, DATABASE_FILE_MAGIC, sizeof(header->magic)) != 0 || header->version != AVR_DATABASE_VERSION || header->numInstructionSet != (uint32_t)AVR_TOTAL_INSTRUCTIONS)
+        goto open_error;
+    if (!util_database_array_valid(header->instructionsOffset, header->numInstructions, sizeof(struct avrDatabaseInstruction), db->size) ||
+        !util_database_array_valid(header->blocksOffset, header->numBlocks, sizeof(struct avrDatabaseBlock), db->size) ||
+        !util_database_array_valid(header->functionsOffset, header->numFunctions, sizeof(struct avrDatabaseFunction), db->size) ||
+        !util_database_array_valid(header->xrefsOffset, header->numXrefs, sizeof(struct avrDatabaseXref), db->size) ||
+        !util_database_array_valid(header->stringsOffset, header->stringsLen, 1, db->size))
+        goto open_error;
+
+    db->key = header->key;
+    db->instructions = (const struct avrDatabaseInstruction *)((const uint8_t *)db->base + header->instructionsOffset);
+    db->numInstructions = header->numInstructions;
+    db->blocks = (const struct avrDatabaseBlock *)((const uint8_t *)db->base + header->blocksOffset);
+    db->numBlocks = header->numBlocks;
+    db->functions = (const struct avrDatabaseFunction *)((const uint8_t *)db->base + header->functionsOffset);
+    db->numFunctions = header->numFunctions;
+    db->xrefs = (const struct avrDatabaseXref *)((const uint8_t *)db->base + header->xrefsOffset);
+    db->numXrefs = header->numXrefs;
+    db->strings = (const char *)db->base + header->stringsOffset;
+    db->stringsLen = header->stringsLen;
+
+    /* The string table must be terminated */
+    if (db->stringsLen > 0 && db->strings[db->stringsLen-1] != '\0')
+        goto open_error;
+
+    return 0;
+
+    open_error:
+    avr_database_close(db);
+    return -1;
+}
+
+void avr_database_close(struct avrDatabase *db) {
+    if (db->base != NULL)
+        avr_file_unmap(db->base, db->size);
+    memset(db, 0, sizeof(struct avrDatabase));
+}
+
+int avr_database_instruction(const struct avrDatabase *db, uint32_t index, struct avrInstructionDisasm *instrDisasm) {
+    const struct avrDatabaseInstruction *record;
+
+    if (index >= db->numInstructions || db->instructions[index].index >= (uint32_t)AVR_TOTAL_INSTRUCTIONS)
+        return -1;
+    record = &db->instructions[index];
+
+    memset(instrDisasm, 0, sizeof(struct avrInstructionDisasm));
+    instrDisasm->address = record->address;
+    memcpy(instrDisasm->opcode, record->opcode, sizeof(record->opcode));
+    instrDisasm->operandDisasms[0] = record->operandDisasms[0];
+    instrDisasm->operandDisasms[1] = record->operandDisasms[1];
+    instrDisasm->instructionInfo = &AVR_Instruction_Set[record->index];
+
+    return 0;
+}
+
+uint32_t avr_database_seek(const struct avrDatabase *db, uint32_t address) {
+    uint32_t lo, hi, mid;
+
+    /* Binary search for the first instruction at or after address */
+    lo = 0;
+    hi = db->numInstructions;
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if (db->instructions[mid].address < address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+uint32_t avr_database_xrefs(const struct avrDatabase *db, uint32_t target, uint32_t *first) {
+    uint32_t lo, hi, mid;
+
+    /* Binary search for the first cross reference to target */
+    lo = 0;
+    hi = db->numXrefs;
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if (db->xrefs[mid].target < target)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *first = lo;
+
+    for (hi = lo; hi < db->numXrefs && db->xrefs[hi].target == target; hi++)
+        ;
+
+    return hi - lo;
+}
+
+const char *avr_database_string(const struct avrDatabase *db, uint32_t offset) {
+    if (offset >= db->stringsLen)
+        return NULL;
+
+    return db->strings + offset;
+}
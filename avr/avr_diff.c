@@ -0,0 +1,446 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <symbol_table.h>
+
+#include "avr_instruction_set.h"
+#include "avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Program Diff */
+/******************************************************************************/
+
+/* Programs are diffed as sequences of normalized instruction tokens, which
+ * leave out address operands so code shifted by an insertion compares equal.
+ * Windows of tokens whose rolling hash is unique in both programs anchor the
+ * alignment, the longest run of anchors in order on both sides is kept, and
+ * the matches are then extended over equal tokens around each anchor. */
+
+/* Number of tokens in an anchor window */
+#define DIFF_WINDOW         8
+/* Rolling hash multiplier */
+#define DIFF_HASH_PRIME     0x100000001b3ULL
+
+/* Window hash at a token position */
+struct diff_window {
+    uint64_t hash;
+    unsigned int pos;
+};
+
+/* Anchor pair of token positions */
+struct diff_anchor {
+    unsigned int oldPos;
+    unsigned int newPos;
+};
+
+/* Function changes */
+enum {
+    DIFF_UNCHANGED,
+    DIFF_MOVED,
+    DIFF_MODIFIED,
+};
+
+/* Diffed program */
+struct diff_side {
+    struct avrProgram *program;
+    struct avrFunctionTable functions;
+    uint32_t *tokens;
+    /* Matched token position on the other side, or -1 */
+    int *match;
+};
+
+static uint32_t util_diff_token(const struct avrInstructionDisasm *instrDisasm) {
+    const struct avrInstructionInfo *instructionInfo = instrDisasm->instructionInfo;
+    uint32_t token;
+    int i;
+
+    token = (uint32_t)AVR_ISET_INDEX(instructionInfo) * 0x9e3779b1U;
+    for (i = 0; i < instructionInfo->numOperands; i++) {
+        switch (instructionInfo->operandTypes[i]) {
+            case OPERAND_BRANCH_ADDRESS:
+            case OPERAND_RELATIVE_ADDRESS:
+            case OPERAND_LONG_ABSOLUTE_ADDRESS:
+                /* Relocation sensitive */
+                break;
+            default:
+                token = (token ^ (uint32_t)instrDisasm->operandDisasms[i]) * 0x01000193U;
+                break;
+        }
+    }
+
+    return token;
+}
+
+static int util_diff_window_compare(const void *a, const void *b) {
+    const struct diff_window *wa = (const struct diff_window *)a;
+    const struct diff_window *wb = (const struct diff_window *)b;
+
+    if (wa->hash != wb->hash)
+        return (wa->hash < wb->hash) ? -1 : 1;
+    return (wa->pos < wb->pos) ? -1 : (wa->pos > wb->pos);
+}
+
+static int util_diff_anchor_compare(const void *a, const void *b) {
+    const struct diff_anchor *aa = (const struct diff_anchor *)a;
+    const struct diff_anchor *ab = (const struct diff_anchor *)b;
+
+    return (aa->oldPos < ab->oldPos) ? -1 : (aa->oldPos > ab->oldPos);
+}
+
+/* Rolling hashes of all token windows, sorted by hash */
+static struct diff_window *util_diff_windows(const uint32_t *tokens, unsigned int len, unsigned int *numWindows) {
+    struct diff_window *windows;
+    uint64_t hash, power;
+    unsigned int i;
+
+    *numWindows = (len >= DIFF_WINDOW) ? len - DIFF_WINDOW + 1 : 0;
+    windows = malloc((*numWindows > 0 ? *numWindows : 1)*sizeof(struct diff_window));
+    if (windows == NULL)
+        return NULL;
+
+    /* Multiplier of the token leaving the window */
+    for (i = 1, power = 1; i < DIFF_WINDOW; i++)
+        power *= DIFF_HASH_PRIME;
+
+    for (i = 0, hash = 0; i < len; i++) {
+        if (i >= DIFF_WINDOW)
+            hash -= tokens[i - DIFF_WINDOW] * power;
+        hash = hash*DIFF_HASH_PRIME + tokens[i];
+        if (i + 1 >= DIFF_WINDOW) {
+            windows[i + 1 - DIFF_WINDOW].hash = hash;
+            windows[i + 1 - DIFF_WINDOW].pos = i + 1 - DIFF_WINDOW;
+        }
+    }
+
+    qsort(windows, *numWindows, sizeof(struct diff_window), util_diff_window_compare);
+
+    return windows;
+}
+
+/* Window hashes that occur exactly once, compacted in place */
+static unsigned int util_diff_unique(struct diff_window *windows, unsigned int numWindows) {
+    unsigned int i, j, n;
+
+    for (i = 0, n = 0; i < numWindows; i = j) {
+        for (j = i + 1; j < numWindows && windows[j].hash == windows[i].hash; j++)
+            ;
+        if (j == i + 1)
+            windows[n++] = windows[i];
+    }
+
+    return n;
+}
+
+/* Keep the longest chain of anchors increasing on both sides, in place */
+static unsigned int util_diff_chain(struct diff_anchor *anchors, unsigned int numAnchors) {
+    unsigned int *tails, *prev, *chain;
+    unsigned int i, len, lo, hi, mid, k;
+
+    if (numAnchors == 0)
+        return 0;
+
+    tails = malloc(numAnchors*sizeof(unsigned int));
+    prev = malloc(numAnchors*sizeof(unsigned int));
+    chain = malloc(numAnchors*sizeof(unsigned int));
+    if (tails == NULL || prev == NULL || chain == NULL) {
+        free(tails); free(prev); free(chain);
+        return 0;
+    }
+
+    /* Patience sort on new positions, anchors are sorted by old position */
+    for (i = 0, len = 0; i < numAnchors; i++) {
+        lo = 0;
+        hi = len;
+        while (lo < hi) {
+            mid = lo + (hi - lo)/2;
+            if (anchors[tails[mid]].newPos < anchors[i].newPos)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        prev[i] = (lo > 0) ? tails[lo-1] : (unsigned int)-1;
+        tails[lo] = i;
+        if (lo == len)
+            len++;
+    }
+
+    /* Walk back the longest chain */
+    for (k = len, i = tails[len-1]; k > 0; k--, i = prev[i])
+        chain[k-1] = i;
+    for (k = 0; k < len; k++)
+        anchors[k] = anchors[chain[k]];
+
+    free(tails);
+    free(prev);
+    free(chain);
+
+    return len;
+}
+
+static void util_diff_match(struct diff_side *old, struct diff_side *new, unsigned int oldPos, unsigned int newPos) {
+    old->match[oldPos] = (int)newPos;
+    new->match[newPos] = (int)oldPos;
+}
+
+/* Align the tokens of two programs, filling in the match arrays */
+static int util_diff_align(struct diff_side *old, struct diff_side *new) {
+    struct diff_window *oldWindows, *newWindows;
+    struct diff_anchor *anchors;
+    unsigned int numOld, numNew, numAnchors, i, j, k;
+    unsigned int oldLen = old->program->len, newLen = new->program->len;
+    unsigned int oldEnd, newEnd, oldNext, newNext, gapEnd;
+
+    for (i = 0; i < oldLen; i++)
+        old->match[i] = -1;
+    for (i = 0; i < newLen; i++)
+        new->match[i] = -1;
+
+    oldWindows = util_diff_windows(old->tokens, oldLen, &numOld);
+    newWindows = util_diff_windows(new->tokens, newLen, &numNew);
+    anchors = malloc(((numOld < numNew ? numOld : numNew) + 1)*sizeof(struct diff_anchor));
+    if (oldWindows == NULL || newWindows == NULL || anchors == NULL) {
+        free(oldWindows); free(newWindows); free(anchors);
+        return -1;
+    }
+
+    /* Pair up window hashes unique to both sides */
+    numOld = util_diff_unique(oldWindows, numOld);
+    numNew = util_diff_unique(newWindows, numNew);
+    for (i = 0, j = 0, numAnchors = 0; i < numOld && j < numNew; ) {
+        if (oldWindows[i].hash < newWindows[j].hash)
+            i++;
+        else if (oldWindows[i].hash > newWindows[j].hash)
+            j++;
+        else {
+            /* Verify the tokens against hash collisions */
+            if (memcmp(&old->tokens[oldWindows[i].pos], &new->tokens[newWindows[j].pos], DIFF_WINDOW*sizeof(uint32_t)) == 0) {
+                anchors[numAnchors].oldPos = oldWindows[i].pos;
+                anchors[numAnchors].newPos = newWindows[j].pos;
+                numAnchors++;
+            }
+            i++;
+            j++;
+        }
+    }
+    free(oldWindows);
+    free(newWindows);
+
+    qsort(anchors, numAnchors, sizeof(struct diff_anchor), util_diff_anchor_compare);
+    numAnchors = util_diff_chain(anchors, numAnchors);
+
+    /* Match the anchor windows, skipping overlaps off the current diagonal */
+    for (i = 0, oldEnd = 0, newEnd = 0; i < numAnchors; i++) {
+        for (k = 0; k < DIFF_WINDOW; k++) {
+            unsigned int o = anchors[i].oldPos + k, n = anchors[i].newPos + k;
+            if (o < oldEnd || n < newEnd)
+                continue;
+            util_diff_match(old, new, o, n);
+            oldEnd = o + 1;
+            newEnd = n + 1;
+        }
+    }
+    free(anchors);
+
+    /* Extend matches over equal tokens into each unmatched gap, forwards from
+     * the match before it and backwards from the match after it */
+    for (i = 0, j = 0; ; ) {
+        /* Gap [i, gapEnd) on the old side, [j, newNext) on the new side */
+        for (gapEnd = i; gapEnd < oldLen && old->match[gapEnd] < 0; gapEnd++)
+            ;
+        oldNext = gapEnd;
+        newNext = (gapEnd < oldLen) ? (unsigned int)old->match[gapEnd] : newLen;
+
+        while (i < oldNext && j < newNext && old->tokens[i] == new->tokens[j]) {
+            util_diff_match(old, new, i, j);
+            i++; j++;
+        }
+        while (oldNext > i && newNext > j && old->tokens[oldNext-1] == new->tokens[newNext-1]) {
+            util_diff_match(old, new, oldNext-1, newNext-1);
+            oldNext--; newNext--;
+        }
+
+        if (gapEnd == oldLen)
+            break;
+
+        /* Skip the matched run after the gap */
+        for (i = gapEnd; i < oldLen && old->match[i] >= 0; i++)
+            ;
+        j = (unsigned int)old->match[i-1] + 1;
+    }
+
+    return 0;
+}
+
+/* Function of one side containing a token position */
+static int util_diff_function_of(const struct avrFunctionTable *functions, unsigned int pos) {
+    unsigned int lo = 0, hi = functions->len, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if (functions->functions[mid].first <= pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return (int)lo - 1;
+}
+
+/* Function on the other side sharing the most matched instructions with a
+ * function, or -1 */
+static int util_diff_best(const struct diff_side *side, const struct diff_side *other, unsigned int f, unsigned int *counts) {
+    const struct avrFunction *function = &side->functions.functions[f];
+    unsigned int i;
+    int g, best = -1;
+
+    for (i = function->first; i < function->first + function->len; i++) {
+        if (side->match[i] < 0 || (g = util_diff_function_of(&other->functions, (unsigned int)side->match[i])) < 0)
+            continue;
+        counts[g]++;
+        if (best < 0 || counts[g] > counts[best])
+            best = g;
+    }
+
+    /* Reset the counts */
+    for (i = function->first; i < function->first + function->len; i++) {
+        if (side->match[i] >= 0 && (g = util_diff_function_of(&other->functions, (unsigned int)side->match[i])) >= 0)
+            counts[g] = 0;
+    }
+
+    return best;
+}
+
+int avr_report_diff(FILE *out, struct avrProgram *oldProgram, struct avrProgram *newProgram, const struct SymbolTable *symbols, int detect) {
+    struct diff_side old, new;
+    const struct avrFunction *oldFunction, *newFunction;
+    unsigned int *counts = NULL;
+    int *oldPair = NULL, *newPair = NULL;
+    unsigned int i, k, numMatched;
+    unsigned int numUnchanged = 0, numMoved = 0, numModified = 0, numRemoved = 0, numInserted = 0;
+    char oldName[64], newName[64];
+    int ret = -1, change;
+
+    memset(&old, 0, sizeof(old));
+    memset(&new, 0, sizeof(new));
+    old.program = oldProgram;
+    new.program = newProgram;
+
+    /* Function boundaries, which also sorts the programs by address. Symbols
+     * describe only the new build, so the old program is split by call
+     * targets, and by prologues if detecting, alone. */
+    if (avr_functions_find(&old.functions, oldProgram, NULL) < 0 || avr_functions_find(&new.functions, newProgram, symbols) < 0)
+        goto cleanup;
+    if (detect && (avr_functions_detect(&old.functions, oldProgram) < 0 || avr_functions_detect(&new.functions, newProgram) < 0))
+        goto cleanup;
+
+    old.tokens = malloc((oldProgram->len + 1)*sizeof(uint32_t));
+    new.tokens = malloc((newProgram->len + 1)*sizeof(uint32_t));
+    old.match = malloc((oldProgram->len + 1)*sizeof(int));
+    new.match = malloc((newProgram->len + 1)*sizeof(int));
+    counts = calloc(old.functions.len + new.functions.len + 1, sizeof(unsigned int));
+    oldPair = malloc((old.functions.len + 1)*sizeof(int));
+    newPair = malloc((new.functions.len + 1)*sizeof(int));
+    if (old.tokens == NULL || new.tokens == NULL || old.match == NULL || new.match == NULL || counts == NULL || oldPair == NULL || newPair == NULL)
+        goto cleanup;
+
+    for (i = 0; i < oldProgram->len; i++)
+        old.tokens[i] = util_diff_token(&oldProgram->instructions[i]);
+    for (i = 0; i < newProgram->len; i++)
+        new.tokens[i] = util_diff_token(&newProgram->instructions[i]);
+
+    if (util_diff_align(&old, &new) < 0)
+        goto cleanup;
+
+    /* Pair up functions that are each other's best match */
+    for (i = 0; i < new.functions.len; i++)
+        newPair[i] = util_diff_best(&new, &old, i, counts);
+    for (i = 0; i < old.functions.len; i++) {
+        oldPair[i] = util_diff_best(&old, &new, i, counts);
+        if (oldPair[i] >= 0 && newPair[oldPair[i]] != (int)i)
+            oldPair[i] = -1;
+    }
+    for (i = 0; i < new.functions.len; i++)
+        newPair[i] = -1;
+    for (i = 0; i < old.functions.len; i++) {
+        if (oldPair[i] >= 0)
+            newPair[oldPair[i]] = (int)i;
+    }
+
+    for (i = 0, numMatched = 0; i < oldProgram->len; i++)
+        numMatched += (old.match[i] >= 0);
+
+    if (fprintf(out, "Old: %u instructions, %u functions\nNew: %u instructions, %u functions\n", oldProgram->len, old.functions.len, newProgram->len, new.functions.len) < 0)
+        goto cleanup;
+    if (fprintf(out, "Instructions: %u matched, %u removed, %u inserted\n\n", numMatched, oldProgram->len - numMatched, newProgram->len - numMatched) < 0)
+        goto cleanup;
+
+    if (fprintf(out, "%-9s %-32s %-32s %10s %10s %8s\n", "Change", "Old Function", "New Function", "Old Addr", "New Addr", "Instrs") < 0)
+        goto cleanup;
+
+    /* Old functions in address order: paired, or removed */
+    for (i = 0; i < old.functions.len; i++) {
+        oldFunction = &old.functions.functions[i];
+        avr_function_name(oldFunction, oldName, sizeof(oldName));
+
+        if (oldPair[i] < 0) {
+            numRemoved++;
+            if (fprintf(out, "%-9s %-32s %-32s 0x%08x %10s %8u\n", "removed", oldName, "", oldFunction->address, "", oldFunction->len) < 0)
+                goto cleanup;
+            continue;
+        }
+
+        newFunction = &new.functions.functions[oldPair[i]];
+        avr_function_name(newFunction, newName, sizeof(newName));
+
+        /* Unchanged if every instruction matches in place */
+        change = (oldFunction->len == newFunction->len) ? DIFF_UNCHANGED : DIFF_MODIFIED;
+        for (k = 0; k < oldFunction->len && change == DIFF_UNCHANGED; k++) {
+            if (old.match[oldFunction->first + k] != (int)(newFunction->first + k))
+                change = DIFF_MODIFIED;
+        }
+        if (change == DIFF_UNCHANGED && oldFunction->address != newFunction->address)
+            change = DIFF_MOVED;
+
+        if (change == DIFF_UNCHANGED) {
+            numUnchanged++;
+        } else if (change == DIFF_MOVED) {
+            numMoved++;
+            if (fprintf(out, "%-9s %-32s %-32s 0x%08x 0x%08x %8u\n", "moved", oldName, newName, oldFunction->address, newFunction->address, newFunction->len) < 0)
+                goto cleanup;
+        } else {
+            numModified++;
+            if (fprintf(out, "%-9s %-32s %-32s 0x%08x 0x%08x %+8d\n", "modified", oldName, newName, oldFunction->address, newFunction->address, (int)newFunction->len - (int)oldFunction->len) < 0)
+                goto cleanup;
+        }
+    }
+
+    /* New functions without a pair */
+    for (i = 0; i < new.functions.len; i++) {
+        if (newPair[i] >= 0)
+            continue;
+        numInserted++;
+        avr_function_name(&new.functions.functions[i], newName, sizeof(newName));
+        if (fprintf(out, "%-9s %-32s %-32s %10s 0x%08x %8u\n", "inserted", "", newName, "", new.functions.functions[i].address, new.functions.functions[i].len) < 0)
+            goto cleanup;
+    }
+
+    if (fprintf(out, "\nFunctions: %u unchanged, %u moved, %u modified, %u removed, %u inserted\n", numUnchanged, numMoved, numModified, numRemoved, numInserted) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+    cleanup:
+    avr_functions_free(&old.functions);
+    avr_functions_free(&new.functions);
+    free(old.tokens);
+    free(new.tokens);
+    free(old.match);
+    free(new.match);
+    free(counts);
+    free(oldPair);
+    free(newPair);
+    return ret;
+}
+
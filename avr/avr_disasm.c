@@ -2,10 +2,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
 
 #include <byte_stream.h>
 #include <disasm_stream.h>
 #include <instruction.h>
+#include <profile.h>
 
 #include "avr_instruction_set.h"
 #include "avr_support.h"
@@ -35,6 +39,9 @@ int disasm_stream_avr_init(struct DisasmStream *self) {
     /* Initialize stream state */
     memset(self->state, 0, sizeof(struct disasm_stream_avr_state));
 
+    /* Build the opcode lookup table, if it hasn't been built already */
+    avr_iset_lookup_init();
+
     /* Reset the error to NULL */
     self->error = NULL;
 
@@ -84,7 +91,7 @@ static int util_bits_data_from_mask(uint16_t data, uint16_t mask) {
     return result;
 }
 
-static struct avrInstructionInfo *util_iset_lookup_by_opcode(uint16_t opcode) {
+static struct avrInstructionInfo *util_iset_lookup_by_opcode_linear(uint16_t opcode) {
     int i, j;
 
     uint16_t instructionBits;
@@ -104,6 +111,43 @@ static struct avrInstructionInfo *util_iset_lookup_by_opcode(uint16_t opcode) {
     return NULL;
 }
 
+/* Opcode to instruction set index lookup table, built once from the linear
+ * lookup above and read-only afterwards */
+static uint8_t AVR_Opcode_Lookup_Table[65536];
+#ifndef _MSC_VER
+static pthread_once_t AVR_Opcode_Lookup_Table_Once = PTHREAD_ONCE_INIT;
+#else
+static int AVR_Opcode_Lookup_Table_Initialized = 0;
+#endif
+
+static void util_iset_lookup_build(void) {
+    struct avrInstructionInfo *instructionInfo;
+    uint32_t opcode;
+
+    for (opcode = 0; opcode < 65536; opcode++) {
+        instructionInfo = util_iset_lookup_by_opcode_linear((uint16_t)opcode);
+        /* The .DW instruction matches any 16-bit opcode */
+        if (instructionInfo == NULL)
+            instructionInfo = &AVR_Instruction_Set[AVR_ISET_INDEX_WORD];
+        AVR_Opcode_Lookup_Table[opcode] = (uint8_t)AVR_ISET_INDEX(instructionInfo);
+    }
+}
+
+void avr_iset_lookup_init(void) {
+#ifndef _MSC_VER
+    pthread_once(&AVR_Opcode_Lookup_Table_Once, util_iset_lookup_build);
+#else
+    if (AVR_Opcode_Lookup_Table_Initialized)
+        return;
+    util_iset_lookup_build();
+    AVR_Opcode_Lookup_Table_Initialized = 1;
+#endif
+}
+
+static struct avrInstructionInfo *util_iset_lookup_by_opcode(uint16_t opcode) {
+    return &AVR_Instruction_Set[AVR_Opcode_Lookup_Table[opcode]];
+}
+
 #if 0
 static struct avrInstructionInfo *util_iset_lookup_by_mnemonic(char *mnemonic) {
     int i;
@@ -207,17 +251,107 @@ static int32_t util_disasm_operand(uint32_t operand, int operandType) {
     return operandDisasm;
 }
 
+int avr_disasm_decode(const uint8_t *data, unsigned int len, uint32_t address, struct avrInstructionDisasm *instrDisasm) {
+    struct avrInstructionInfo *instructionInfo;
+    uint16_t opcode;
+    uint32_t operand;
+    int i;
+
+    if (len == 0)
+        return 0;
+
+    memset(instrDisasm, 0, sizeof(struct avrInstructionDisasm));
+    instrDisasm->address = address;
+
+    /* Edge case: one lone byte at some address or at EOF */
+    if (len == 1) {
+        /* Decode a raw .DB byte "instruction" */
+        instrDisasm->opcode[0] = data[0];
+        instrDisasm->instructionInfo = &AVR_Instruction_Set[AVR_ISET_INDEX_BYTE];
+        instrDisasm->operandDisasms[0] = (int32_t)data[0];
+        return 1;
+    }
+
+    /* Assemble the 16-bit opcode from little-endian input */
+    opcode = (uint16_t)(data[1] << 8) | (uint16_t)(data[0]);
+    /* Look up the instruction in our instruction set */
+    instructionInfo = util_iset_lookup_by_opcode(opcode);
+
+    instrDisasm->opcode[0] = data[0]; instrDisasm->opcode[1] = data[1];
+
+    /* Edge case: three or two lone bytes of a 32-bit instruction at some
+     * address or at EOF */
+    if (instructionInfo->width == 4 && len < 4) {
+        /* Decode a raw .DW word "instruction", with the operands of the
+         * instruction */
+        instrDisasm->instructionInfo = &AVR_Instruction_Set[AVR_ISET_INDEX_WORD];
+        for (i = 0; i < instructionInfo->numOperands; i++) {
+            /* Extract the operand bits */
+            operand = util_bits_data_from_mask(opcode, instructionInfo->operandMasks[i]);
+            /* Disassemble the operand */
+            instrDisasm->operandDisasms[i] = util_disasm_operand(operand, instructionInfo->operandTypes[i]);
+        }
+        return 2;
+    }
+
+    /* Decode a 16-bit or 32-bit instruction */
+    if (instructionInfo->width == 4) {
+        instrDisasm->opcode[2] = data[2]; instrDisasm->opcode[3] = data[3];
+    }
+    instrDisasm->instructionInfo = instructionInfo;
+    /* Disassemble the operands */
+    for (i = 0; i < instructionInfo->numOperands; i++) {
+        /* Extract the operand bits */
+        operand = util_bits_data_from_mask(opcode, instructionInfo->operandMasks[i]);
+
+        /* Append the extra bits if it's a long operand */
+        if (instructionInfo->operandTypes[i] == OPERAND_LONG_ABSOLUTE_ADDRESS)
+            operand = (uint32_t)(operand << 16) | (uint32_t)(data[3] << 8) | (uint32_t)(data[2]);
+
+        /* Disassemble the operand */
+        instrDisasm->operandDisasms[i] = util_disasm_operand(operand, instructionInfo->operandTypes[i]);
+    }
+
+    return instructionInfo->width;
+}
+
+int avr_disasm_width(const uint8_t *data, unsigned int len) {
+    unsigned int width;
+
+    /* Same widths as avr_disasm_decode() */
+    if (len < 2)
+        return (int)len;
+
+    width = util_iset_lookup_by_opcode((uint16_t)(data[1] << 8) | (uint16_t)(data[0]))->width;
+    if (width == 4 && len < 4)
+        return 2;
+
+    return (int)width;
+}
+
+void avr_disasm_boundaries(const uint8_t *data, uint32_t len, uint8_t *bitmap, uint32_t first) {
+    uint32_t offset, bit;
+
+    /* Walk the instruction widths of the run, marking each start */
+    for (offset = 0; offset < len; offset += avr_disasm_width(data + offset, (len - offset > 4) ? 4 : len - offset)) {
+        bit = first + offset;
+        bitmap[bit/8] |= (uint8_t)(1 << (bit % 8));
+    }
+}
+
 int disasm_stream_avr_read(struct DisasmStream *self, struct instruction *instr) {
     struct disasm_stream_avr_state *state = (struct disasm_stream_avr_state *)self->state;
 
-    int decodeAttempts, lenConsecutive;
+    int decodeAttempts, lenConsecutive, runEnded, width;
     uint8_t readData;
     uint32_t readAddr;
+    uint64_t parseStart = 0;
     int ret;
 
     /* Fill disassembled instruction pointer and print functions in instruction
      * structure */
     instr->instructionDisasm = (void *)&(state->instrDisasm);
+    instr->symbols = NULL;
     instr->print_origin = avr_instruction_print_origin;
     instr->print = avr_instruction_print;
 
@@ -226,132 +360,56 @@ int disasm_stream_avr_read(struct DisasmStream *self, struct instruction *instr)
         lenConsecutive = util_opbuffer_len_consecutive(state);
 
         /* If we decoded all bytes and reached EOF, return EOF too */
-        if (lenConsecutive == 0 && state->len == 0 && state->eof)
+        if (lenConsecutive == 0 && state->len == 0 && state->eof) {
+            if (parseStart != 0)
+                PROFILE_TIME(PROFILE_TIMER_PARSE, parseStart);
             return STREAM_EOF;
+        }
+
+        /* Whether the input stream changed address or reached EOF after the
+         * consecutive bytes */
+        runEnded = (state->len > lenConsecutive || state->eof);
+
+        /* Decode an instruction once we have all of its bytes: a complete
+         * 32-bit instruction, a 16-bit instruction, or the lone bytes before
+         * an address change or EOF */
+        if (lenConsecutive == 4 || (lenConsecutive > 0 && runEnded) ||
+            (lenConsecutive >= 2 && util_iset_lookup_by_opcode((uint16_t)(state->data[1] << 8) | (uint16_t)(state->data[0]))->width == 2)) {
+            if (parseStart != 0)
+                PROFILE_TIME(PROFILE_TIMER_PARSE, parseStart);
+
+            width = avr_disasm_decode(state->data, lenConsecutive, state->address[0], &(state->instrDisasm));
+
+#ifndef PROFILE_DISABLE
+            if (profile_enabled) {
+                int index = AVR_ISET_INDEX(state->instrDisasm.instructionInfo);
+                if (index == AVR_ISET_INDEX_BYTE)
+                    profile_count(PROFILE_DATA_BYTES, 1);
+                else if (index == AVR_ISET_INDEX_WORD)
+                    profile_count(PROFILE_DATA_WORDS, 1);
+                else if (state->instrDisasm.instructionInfo->width == 4)
+                    profile_count(PROFILE_INSTRUCTIONS_32, 1);
+                else
+                    profile_count(PROFILE_INSTRUCTIONS_16, 1);
+            }
+#endif
 
-        /* Edge case: when input stream changes address with 1 undecoded
-         * byte */
-            /* One lone byte at some address or at EOF */
-        if (lenConsecutive == 1 && (state->len > 1 || state->eof)) {
-            /* Decode a raw .DB byte "instruction" */
-            memset(&(state->instrDisasm), 0, sizeof(struct avrInstructionDisasm));
-            state->instrDisasm.address = state->address[0];
-            state->instrDisasm.opcode[0] = state->data[0];
-            state->instrDisasm.instructionInfo = &AVR_Instruction_Set[AVR_ISET_INDEX_BYTE];
-            state->instrDisasm.operandDisasms[0] = (int32_t)state->data[0];
             /* Shift out the processed byte(s) from our opcode buffer */
-            util_opbuffer_shift(state, 1);
+            util_opbuffer_shift(state, width);
 
             /* Fill the instruction structure */
             instr->address = state->instrDisasm.address;
             instr->width = state->instrDisasm.instructionInfo->width;
+
             return 0;
         }
 
-        /* Two or more consecutive bytes */
-        if (lenConsecutive >= 2) {
-            uint16_t opcode;
-            uint32_t operand;
-            struct avrInstructionInfo *instructionInfo;
-            int i;
-
-            /* Assemble the 16-bit opcode from little-endian input */
-            opcode = (uint16_t)(state->data[1] << 8) | (uint16_t)(state->data[0]);
-            /* Look up the instruction in our instruction set */
-            if ( (instructionInfo = util_iset_lookup_by_opcode(opcode)) == NULL) {
-                /* This should never happen because of the .DW instruction that
-                 * matches any 16-bit opcode */
-                self->error = "Error, catastrophic failure! Malformed instruction set!";
-                return STREAM_ERROR_FAILURE;
-            }
-
-            /* If this is a 16-bit wide instruction */
-            if (instructionInfo->width == 2) {
-                /* Decode and return a 16-bit instruction */
-                memset(&(state->instrDisasm), 0, sizeof(struct avrInstructionDisasm));
-                state->instrDisasm.address = state->address[0];
-                state->instrDisasm.opcode[0] = state->data[0]; state->instrDisasm.opcode[1] = state->data[1];
-                state->instrDisasm.instructionInfo = instructionInfo;
-                /* Disassemble the operands */
-                for (i = 0; i < instructionInfo->numOperands; i++) {
-                    /* Extract the operand bits */
-                    operand = util_bits_data_from_mask(opcode, instructionInfo->operandMasks[i]);
-                    /* Disassemble the operand */
-                    state->instrDisasm.operandDisasms[i] = util_disasm_operand(operand, instructionInfo->operandTypes[i]);
-                }
-                /* Shift out the processed byte(s) from our opcode buffer */
-                util_opbuffer_shift(state, 2);
-
-                /* Fill the instruction structure */
-                instr->address = state->instrDisasm.address;
-                instr->width = state->instrDisasm.instructionInfo->width;
-
-                return 0;
-
-            /* Else, this is a 32-bit wide instruction */
-            } else {
-                /* We have read the complete 32-bit instruction */
-                if (lenConsecutive == 4) {
-                    /* Decode a 32-bit instruction */
-                    memset(&(state->instrDisasm), 0, sizeof(struct avrInstructionDisasm));
-                    state->instrDisasm.address = state->address[0];
-                    state->instrDisasm.opcode[0] = state->data[0]; state->instrDisasm.opcode[1] = state->data[1];
-                    state->instrDisasm.opcode[2] = state->data[2]; state->instrDisasm.opcode[3] = state->data[3];
-                    state->instrDisasm.instructionInfo = instructionInfo;
-                    /* Disassemble the operands */
-                    for (i = 0; i < instructionInfo->numOperands; i++) {
-                        /* Extract the operand bits */
-                        operand = util_bits_data_from_mask(opcode, instructionInfo->operandMasks[i]);
-
-                        /* Append the extra bits if it's a long operand */
-                        if (instructionInfo->operandTypes[i] == OPERAND_LONG_ABSOLUTE_ADDRESS)
-                            operand = (uint32_t)(operand << 16) | (uint32_t)(state->data[3] << 8) | (uint32_t)(state->data[2]);
-
-                        /* Disassemble the operand */
-                        state->instrDisasm.operandDisasms[i] = util_disasm_operand(operand, instructionInfo->operandTypes[i]);
-                    }
-                    /* Shift out the processed byte(s) from our opcode buffer */
-                    util_opbuffer_shift(state, 4);
-
-                    /* Fill the instruction structure */
-                    instr->address = state->instrDisasm.address;
-                    instr->width = state->instrDisasm.instructionInfo->width;
-
-                    return 0;
-
-                /* Edge case: when input stream changes address with 3 or 2
-                 * undecoded long instruction bytes */
-                    /* Three lone bytes at some address or at EOF */
-                    /* Two lone bytes at some address or at EOF */
-                } else if ((lenConsecutive == 3 && (state->len > 3 || state->eof)) ||
-                           (lenConsecutive == 2 && (state->len > 2 || state->eof))) {
-                    /* Return a raw .DW word "instruction" */
-                    memset(&(state->instrDisasm), 0, sizeof(struct avrInstructionDisasm));
-                    state->instrDisasm.address = state->address[0];
-                    state->instrDisasm.opcode[0] = state->data[0]; state->instrDisasm.opcode[1] = state->data[1];
-                    state->instrDisasm.instructionInfo = &AVR_Instruction_Set[AVR_ISET_INDEX_WORD];
-                    /* Disassemble the operands */
-                    for (i = 0; i < instructionInfo->numOperands; i++) {
-                        /* Extract the operand bits */
-                        operand = util_bits_data_from_mask(opcode, instructionInfo->operandMasks[i]);
-                        /* Disassemble the operand */
-                        state->instrDisasm.operandDisasms[i] = util_disasm_operand(operand, instructionInfo->operandTypes[i]);
-                    }
-                    /* Shift out the processed byte(s) from our opcode buffer */
-                    util_opbuffer_shift(state, 2);
-
-                    /* Fill the instruction structure */
-                    instr->address = state->instrDisasm.address;
-                    instr->width = state->instrDisasm.instructionInfo->width;
-
-                    return 0;
-                }
-
-                /* Otherwise, read another byte into our opcode buffer below */
-            }
-        }
+        /* Otherwise, read another byte into our opcode buffer below */
 
-        /* Read the next data byte from the opcode stream */
+        /* Read the next data byte from the opcode stream, timing the reads up
+         * to the next decode */
+        if (parseStart == 0)
+            parseStart = PROFILE_NOW();
         ret = self->in->stream_read(self->in, &readData, &readAddr);
         if (ret == STREAM_EOF) {
             /* Record encountered EOF */
@@ -377,7 +435,5 @@ int disasm_stream_avr_read(struct DisasmStream *self, struct instruction *instr)
     /* We should have returned an instruction above */
     self->error = "Error, catastrophic failure! No decoding logic invoked!";
     return STREAM_ERROR_FAILURE;
-
-    return 0;
 }
 
@@ -0,0 +1,422 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "avr_instruction_set.h"
+#include "avr_support.h"
+#include "avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Function Fingerprints */
+/******************************************************************************/
+
+/* A fingerprint database file holds the fingerprint records, sorted by hash,
+ * length and name, and their names, in host byte order, each at an 8-byte
+ * aligned offset recorded in the header:
+ *      struct fingerprints_file_header
+ *      struct avrFingerprint [numFingerprints]
+ *      char strings [stringsLen]
+ */
+
+#define FINGERPRINTS_FILE_MAGIC "VAVRFPD1"
+
+struct fingerprints_file_header {
+    char magic[8];
+    uint32_t version;
+    /* Instruction set size, to reject databases of another instruction set */
+    uint32_t numInstructionSet;
+    uint32_t numFingerprints;
+    uint32_t stringsLen;
+    uint64_t fingerprintsOffset;
+    uint64_t stringsOffset;
+};
+
+#define FINGERPRINTS_ALIGN(x)   (((x) + 7) & ~(uint64_t)7)
+
+/* FNV-1a 64 */
+#define FINGERPRINT_HASH_INIT   0xcbf29ce484222325ULL
+#define FINGERPRINT_HASH_PRIME  0x100000001b3ULL
+
+static uint64_t util_fingerprint_hash(uint64_t hash, uint32_t value) {
+    unsigned int i;
+
+    for (i = 0; i < 4; i++, value >>= 8) {
+        hash ^= (value & 0xff);
+        hash *= FINGERPRINT_HASH_PRIME;
+    }
+
+    return hash;
+}
+
+/* Whether a data address operand of lds / sts, which moves with the data
+ * layout */
+static int util_fingerprint_data_address(const struct avrInstructionInfo *instructionInfo, int operand) {
+    if (instructionInfo->operandTypes[operand] != OPERAND_DATA)
+        return 0;
+    return strcmp(instructionInfo->mnemonic, "lds") == 0 || strcmp(instructionInfo->mnemonic, "sts") == 0;
+}
+
+/* Number of instructions of the body of a function: up to the first return or
+ * jump that isn't skipped and that no branch of the body jumps over. A body
+ * ends the same whether the function extends to the next symbol or, stripped
+ * of symbols, over the unnamed code after it. */
+static unsigned int util_fingerprint_body(const struct avrProgram *program, const struct avrFunction *function) {
+    const struct avrInstructionDisasm *instrDisasm;
+    uint32_t start, reach, target;
+    unsigned int i;
+    int flow, skipped;
+
+    start = program->instructions[function->first].address;
+    reach = start;
+    skipped = 0;
+    for (i = function->first; i < function->first + function->len; i++) {
+        instrDisasm = &program->instructions[i];
+        flow = avr_instruction_flow(instrDisasm->instructionInfo);
+
+        /* Forward branches and jumps within the function extend the body */
+        if ((flow == AVR_FLOW_BRANCH || flow == AVR_FLOW_JUMP) && avr_instruction_target(instrDisasm, &target)) {
+            if (target > reach && avr_program_find(program, target) >= (int)function->first && avr_program_find(program, target) < (int)(function->first + function->len))
+                reach = target;
+        }
+
+        if ((flow == AVR_FLOW_JUMP || flow == AVR_FLOW_INDIRECT_JUMP || flow == AVR_FLOW_RETURN) && !skipped && instrDisasm->address + instrDisasm->instructionInfo->width > reach)
+            return i - function->first + 1;
+
+        skipped = (flow == AVR_FLOW_SKIP);
+    }
+
+    return function->len;
+}
+
+uint64_t avr_function_fingerprint(const struct avrProgram *program, const struct avrFunction *function, uint32_t *len) {
+    const struct avrInstructionDisasm *instrDisasm;
+    const struct avrInstructionInfo *instructionInfo;
+    uint32_t start, end, target;
+    uint64_t hash;
+    unsigned int i, last;
+    int j;
+
+    *len = 0;
+    if (function->len == 0)
+        return FINGERPRINT_HASH_INIT;
+
+    *len = util_fingerprint_body(program, function);
+    last = function->first + *len - 1;
+    start = program->instructions[function->first].address;
+    end = program->instructions[last].address + program->instructions[last].instructionInfo->width;
+
+    hash = FINGERPRINT_HASH_INIT;
+    for (i = function->first; i <= last; i++) {
+        instrDisasm = &program->instructions[i];
+        instructionInfo = instrDisasm->instructionInfo;
+
+        hash = util_fingerprint_hash(hash, (uint32_t)AVR_ISET_INDEX(instructionInfo));
+        for (j = 0; j < instructionInfo->numOperands; j++) {
+            switch (instructionInfo->operandTypes[j]) {
+                case OPERAND_BRANCH_ADDRESS:
+                case OPERAND_RELATIVE_ADDRESS:
+                    /* Branches within the body move with it */
+                    target = instrDisasm->address + 2 + instrDisasm->operandDisasms[j];
+                    if (target >= start && target < end)
+                        hash = util_fingerprint_hash(hash, target - start);
+                    break;
+                case OPERAND_LONG_ABSOLUTE_ADDRESS:
+                    /* Relocation sensitive */
+                    break;
+                default:
+                    if (!util_fingerprint_data_address(instructionInfo, j))
+                        hash = util_fingerprint_hash(hash, (uint32_t)instrDisasm->operandDisasms[j]);
+                    break;
+            }
+        }
+    }
+
+    return hash;
+}
+
+/******************************************************************************/
+/* AVR Fingerprint Table Support */
+/******************************************************************************/
+
+void avr_fingerprints_init(struct avrFingerprintTable *table) {
+    memset(table, 0, sizeof(struct avrFingerprintTable));
+}
+
+static int util_fingerprints_append(struct avrFingerprintTable *table, uint64_t hash, uint32_t len, const char *name) {
+    size_t nameLen = strlen(name) + 1;
+
+    /* Grow the fingerprint array if needed */
+    if (table->len == table->capacity) {
+        uint32_t capacity = (table->capacity == 0) ? 256 : table->capacity*2;
+        struct avrFingerprint *grown = realloc(table->fingerprints, capacity*sizeof(struct avrFingerprint));
+        if (grown == NULL)
+            return -1;
+        table->fingerprints = grown;
+        table->capacity = capacity;
+    }
+
+    /* Grow the string table if needed */
+    if (nameLen > UINT32_MAX - table->stringsLen)
+        return -1;
+    if (table->stringsLen + nameLen > table->stringsCapacity) {
+        uint32_t capacity = (table->stringsCapacity == 0) ? 4096 : table->stringsCapacity;
+        char *grown;
+        while (capacity < table->stringsLen + nameLen)
+            capacity *= 2;
+        if ((grown = realloc(table->strings, capacity)) == NULL)
+            return -1;
+        table->strings = grown;
+        table->stringsCapacity = capacity;
+    }
+
+    table->fingerprints[table->len].hash = hash;
+    table->fingerprints[table->len].len = len;
+    table->fingerprints[table->len].name = table->stringsLen;
+    table->len++;
+    memcpy(table->strings + table->stringsLen, name, nameLen);
+    table->stringsLen += (uint32_t)nameLen;
+
+    return 0;
+}
+
+int avr_fingerprints_add(struct avrFingerprintTable *table, const struct avrProgram *program, const struct avrFunctionTable *functions) {
+    const struct avrFunction *function;
+    unsigned int i;
+    uint64_t hash;
+    uint32_t len;
+
+    /* Only functions named by symbols are references */
+    for (i = 0; i < functions->len; i++) {
+        function = &functions->functions[i];
+        if (function->name == NULL)
+            continue;
+        hash = avr_function_fingerprint(program, function, &len);
+        if (len >= AVR_FINGERPRINT_MIN_INSTRUCTIONS && util_fingerprints_append(table, hash, len, function->name) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int avr_fingerprints_merge(struct avrFingerprintTable *table, const struct avrFingerprintDatabase *db) {
+    uint32_t i;
+
+    for (i = 0; i < db->numFingerprints; i++) {
+        if (util_fingerprints_append(table, db->fingerprints[i].hash, db->fingerprints[i].len, db->strings + db->fingerprints[i].name) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int util_fingerprint_compare(const void *a, const void *b) {
+    const struct avrFingerprint *fa = (const struct avrFingerprint *)a;
+    const struct avrFingerprint *fb = (const struct avrFingerprint *)b;
+
+    if (fa->hash != fb->hash)
+        return (fa->hash < fb->hash) ? -1 : 1;
+    if (fa->len != fb->len)
+        return (fa->len < fb->len) ? -1 : 1;
+    return (fa->name < fb->name) ? -1 : (fa->name > fb->name);
+}
+
+/* Sort a run of fingerprints of equal hash and length by name, and drop
+ * duplicate names. Runs are short, so by insertion. Returns the new run
+ * length. */
+static uint32_t util_fingerprints_run(struct avrFingerprint *run, uint32_t len, const char *strings) {
+    struct avrFingerprint fingerprint;
+    uint32_t i, j, k;
+
+    for (i = 1; i < len; i++) {
+        fingerprint = run[i];
+        for (j = i; j > 0 && strcmp(strings + run[j-1].name, strings + fingerprint.name) > 0; j--)
+            run[j] = run[j-1];
+        run[j] = fingerprint;
+    }
+
+    for (i = 0, k = 0; i < len; i++) {
+        if (k > 0 && strcmp(strings + run[k-1].name, strings + run[i].name) == 0)
+            continue;
+        run[k++] = run[i];
+    }
+
+    return k;
+}
+
+static int util_fingerprints_write_array(FILE *out, const void *data, size_t size, uint64_t *offset) {
+    static const uint8_t padding[8] = {0};
+    uint64_t padded = FINGERPRINTS_ALIGN(*offset + size);
+
+    if (size > 0 && fwrite(data, 1, size, out) != size)
+        return -1;
+    if (padded != *offset + size && fwrite(padding, 1, (size_t)(padded - *offset - size), out) != (size_t)(padded - *offset - size))
+        return -1;
+    *offset = padded;
+
+    return 0;
+}
+
+int avr_fingerprints_write(FILE *out, struct avrFingerprintTable *table) {
+    struct fingerprints_file_header header;
+    struct avrFingerprint *fingerprints;
+    uint32_t i, j, k, stringsLen;
+    uint64_t offset;
+    size_t nameLen;
+    int ret = -1;
+
+    /* Sort by hash, length and name, and drop duplicates */
+    if (table->len > 0)
+        qsort(table->fingerprints, table->len, sizeof(struct avrFingerprint), util_fingerprint_compare);
+    for (i = 0, k = 0; i < table->len; i = j) {
+        for (j = i + 1; j < table->len && table->fingerprints[j].hash == table->fingerprints[i].hash && table->fingerprints[j].len == table->fingerprints[i].len; j++)
+            ;
+        memmove(&table->fingerprints[k], &table->fingerprints[i], (j - i)*sizeof(struct avrFingerprint));
+        k += util_fingerprints_run(&table->fingerprints[k], j - i, table->strings);
+    }
+    table->len = k;
+
+    /* Renumber the names of the kept records into a compact string table */
+    fingerprints = malloc((table->len > 0 ? table->len : 1)*sizeof(struct avrFingerprint));
+    if (fingerprints == NULL)
+        return -1;
+    stringsLen = 0;
+    for (i = 0; i < table->len; i++) {
+        fingerprints[i] = table->fingerprints[i];
+        fingerprints[i].name = stringsLen;
+        stringsLen += (uint32_t)strlen(table->strings + table->fingerprints[i].name) + 1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FINGERPRINTS_FILE_MAGIC, sizeof(header.magic));
+    header.version = AVR_FINGERPRINTS_VERSION;
+    header.numInstructionSet = (uint32_t)AVR_TOTAL_INSTRUCTIONS;
+    header.numFingerprints = table->len;
+    header.stringsLen = stringsLen;
+    header.fingerprintsOffset = FINGERPRINTS_ALIGN(sizeof(header));
+    header.stringsOffset = FINGERPRINTS_ALIGN(header.fingerprintsOffset + (uint64_t)table->len*sizeof(struct avrFingerprint));
+
+    offset = 0;
+    if (util_fingerprints_write_array(out, &header, sizeof(header), &offset) < 0)
+        goto write_done;
+    if (util_fingerprints_write_array(out, fingerprints, (size_t)table->len*sizeof(struct avrFingerprint), &offset) < 0)
+        goto write_done;
+    for (i = 0; i < table->len; i++) {
+        nameLen = strlen(table->strings + table->fingerprints[i].name) + 1;
+        if (fwrite(table->strings + table->fingerprints[i].name, 1, nameLen, out) != nameLen)
+            goto write_done;
+    }
+
+    ret = 0;
+
+    write_done:
+    free(fingerprints);
+    return ret;
+}
+
+void avr_fingerprints_free(struct avrFingerprintTable *table) {
+    free(table->fingerprints);
+    free(table->strings);
+    memset(table, 0, sizeof(struct avrFingerprintTable));
+}
+
+/******************************************************************************/
+/* AVR Fingerprint Database Support */
+/******************************************************************************/
+
+int avr_fingerprints_open(struct avrFingerprintDatabase *db, const char *path) {
+    const struct fingerprints_file_header *header;
+    uint32_t i;
+
+    memset(db, 0, sizeof(struct avrFingerprintDatabase));
+
+    if ((db->base = avr_file_map(path, &db->size)) == NULL)
+        return -1;
+
+    /* Validate the header and the array extents */
+    header = (const struct fingerprints_file_header *)db->base;
+    if (db->size < sizeof(struct fingerprints_file_header))
+        goto open_error;
+    if (memcmp(header->magic, FINGERPRINTS_FILE_MAGIC, sizeof(header->magic)) != 0 || header->version != AVR_FINGERPRINTS_VERSION || header->numInstructionSet != (uint32_t)AVR_TOTAL_INSTRUCTIONS)
+        goto open_error;
+    if ((header->fingerprintsOffset % 8) != 0 || header->fingerprintsOffset > db->size || header->numFingerprints > (db->size - header->fingerprintsOffset)/sizeof(struct avrFingerprint))
+        goto open_error;
+    if (header->stringsOffset > db->size || header->stringsLen > db->size - header->stringsOffset)
+        goto open_error;
+
+    db->fingerprints = (const struct avrFingerprint *)((const uint8_t *)db->base + header->fingerprintsOffset);
+    db->numFingerprints = header->numFingerprints;
+    db->strings = (const char *)db->base + header->stringsOffset;
+    db->stringsLen = header->stringsLen;
+
+    /* The string table must be terminated, and the names within it */
+    if (db->stringsLen > 0 && db->strings[db->stringsLen-1] != '\0')
+        goto open_error;
+    for (i = 0; i < db->numFingerprints; i++) {
+        if (db->fingerprints[i].name >= db->stringsLen)
+            goto open_error;
+    }
+
+    return 0;
+
+    open_error:
+    avr_fingerprints_close(db);
+    return -1;
+}
+
+void avr_fingerprints_close(struct avrFingerprintDatabase *db) {
+    if (db->base != NULL)
+        avr_file_unmap(db->base, db->size);
+    memset(db, 0, sizeof(struct avrFingerprintDatabase));
+}
+
+const char *avr_fingerprints_lookup(const struct avrFingerprintDatabase *db, uint64_t hash, uint32_t len) {
+    const struct avrFingerprint *fingerprint;
+    uint32_t lo, hi, mid;
+    const char *name;
+
+    /* Binary search for the first fingerprint at or after hash and length */
+    lo = 0;
+    hi = db->numFingerprints;
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        fingerprint = &db->fingerprints[mid];
+        if (fingerprint->hash < hash || (fingerprint->hash == hash && fingerprint->len < len))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == db->numFingerprints || db->fingerprints[lo].hash != hash || db->fingerprints[lo].len != len)
+        return NULL;
+
+    /* Identical functions of different names are ambiguous */
+    name = db->strings + db->fingerprints[lo].name;
+    if (lo + 1 < db->numFingerprints && db->fingerprints[lo+1].hash == hash && db->fingerprints[lo+1].len == len)
+        return NULL;
+
+    return name;
+}
+
+unsigned int avr_fingerprints_identify(const struct avrFingerprintDatabase *db, const struct avrProgram *program, struct avrFunctionTable *table) {
+    struct avrFunction *function;
+    const char *name;
+    unsigned int i, count;
+    uint64_t hash;
+    uint32_t len;
+
+    for (i = 0, count = 0; i < table->len; i++) {
+        function = &table->functions[i];
+        if (function->name != NULL)
+            continue;
+
+        hash = avr_function_fingerprint(program, function, &len);
+        if (len >= AVR_FINGERPRINT_MIN_INSTRUCTIONS && (name = avr_fingerprints_lookup(db, hash, len)) != NULL) {
+            function->name = name;
+            function->sources |= AVR_FUNCTION_FINGERPRINT;
+            count++;
+        }
+    }
+
+    return count;
+}
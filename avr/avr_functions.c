@@ -0,0 +1,512 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <symbol_table.h>
+
+#include "avr_instruction_set.h"
+#include "avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Control Flow Support */
+/******************************************************************************/
+
+int avr_instruction_flow(const struct avrInstructionInfo *instructionInfo) {
+    const char *mnemonic = instructionInfo->mnemonic;
+
+    /* Conditional branches are the only instructions with a branch address */
+    if (instructionInfo->operandTypes[0] == OPERAND_BRANCH_ADDRESS || instructionInfo->operandTypes[1] == OPERAND_BRANCH_ADDRESS)
+        return AVR_FLOW_BRANCH;
+
+    switch (mnemonic[0]) {
+        case 'c':
+            if (strcmp(mnemonic, "call") == 0)
+                return AVR_FLOW_CALL;
+            if (strcmp(mnemonic, "cpse") == 0)
+                return AVR_FLOW_SKIP;
+            break;
+        case 'e':
+            if (strcmp(mnemonic, "eicall") == 0)
+                return AVR_FLOW_INDIRECT_CALL;
+            if (strcmp(mnemonic, "eijmp") == 0)
+                return AVR_FLOW_INDIRECT_JUMP;
+            break;
+        case 'i':
+            if (strcmp(mnemonic, "icall") == 0)
+                return AVR_FLOW_INDIRECT_CALL;
+            if (strcmp(mnemonic, "ijmp") == 0)
+                return AVR_FLOW_INDIRECT_JUMP;
+            break;
+        case 'j':
+            if (strcmp(mnemonic, "jmp") == 0)
+                return AVR_FLOW_JUMP;
+            break;
+        case 'r':
+            if (strcmp(mnemonic, "rjmp") == 0)
+                return AVR_FLOW_JUMP;
+            if (strcmp(mnemonic, "rcall") == 0)
+                return AVR_FLOW_CALL;
+            if (strcmp(mnemonic, "ret") == 0 || strcmp(mnemonic, "reti") == 0)
+                return AVR_FLOW_RETURN;
+            break;
+        case 's':
+            if (strcmp(mnemonic, "sbrc") == 0 || strcmp(mnemonic, "sbrs") == 0 ||
+                strcmp(mnemonic, "sbic") == 0 || strcmp(mnemonic, "sbis") == 0)
+                return AVR_FLOW_SKIP;
+            break;
+        default:
+            break;
+    }
+
+    return AVR_FLOW_NONE;
+}
+
+int avr_instruction_target(const struct avrInstructionDisasm *instrDisasm, uint32_t *target) {
+    int i, flow;
+
+    flow = avr_instruction_flow(instrDisasm->instructionInfo);
+    if (flow != AVR_FLOW_BRANCH && flow != AVR_FLOW_JUMP && flow != AVR_FLOW_CALL)
+        return 0;
+
+    for (i = 0; i < instrDisasm->instructionInfo->numOperands; i++) {
+        switch (instrDisasm->instructionInfo->operandTypes[i]) {
+            case OPERAND_BRANCH_ADDRESS:
+            case OPERAND_RELATIVE_ADDRESS:
+                /* Relative to the next instruction */
+                *target = instrDisasm->address + 2 + instrDisasm->operandDisasms[i];
+                return 1;
+            case OPERAND_LONG_ABSOLUTE_ADDRESS:
+                /* Already disassembled to a byte address */
+                *target = (uint32_t)instrDisasm->operandDisasms[i];
+                return 1;
+            default:
+                break;
+        }
+    }
+
+    return 0;
+}
+
+void avr_block_leaders(const struct avrProgram *program, const struct avrFunctionTable *table, uint8_t *leaders) {
+    const struct avrInstructionDisasm *instrDisasm;
+    uint32_t i, f, target;
+    int flow, index;
+
+    for (i = 0; i < program->len; i++) {
+        instrDisasm = &program->instructions[i];
+        flow = avr_instruction_flow(instrDisasm->instructionInfo);
+
+        if (i == 0 || instrDisasm->address != program->instructions[i-1].address + program->instructions[i-1].instructionInfo->width)
+            leaders[i] = 1;
+
+        switch (flow) {
+            case AVR_FLOW_SKIP:
+                /* Both the next instruction and the one after it */
+                leaders[i+1] = leaders[i+2] = 1;
+                break;
+            case AVR_FLOW_BRANCH:
+            case AVR_FLOW_JUMP:
+            case AVR_FLOW_INDIRECT_JUMP:
+            case AVR_FLOW_RETURN:
+                leaders[i+1] = 1;
+                break;
+            default:
+                break;
+        }
+
+        if ((flow == AVR_FLOW_BRANCH || flow == AVR_FLOW_JUMP) && avr_instruction_target(instrDisasm, &target)) {
+            if ((index = avr_program_find(program, target)) >= 0)
+                leaders[index] = 1;
+        }
+    }
+    for (f = 0; f < table->len; f++)
+        leaders[table->functions[f].first] = 1;
+}
+
+/******************************************************************************/
+/* AVR Function Support */
+/******************************************************************************/
+
+static int util_function_compare(const void *a, const void *b) {
+    const struct avrFunction *fa = (const struct avrFunction *)a;
+    const struct avrFunction *fb = (const struct avrFunction *)b;
+
+    if (fa->address < fb->address)
+        return -1;
+    else if (fa->address > fb->address)
+        return 1;
+    return 0;
+}
+
+static int util_functions_add(struct avrFunctionTable *table, unsigned int *capacity, const struct avrProgram *program, uint32_t address, unsigned int sources) {
+    int index;
+
+    /* Function must start on an instruction of the program */
+    if ((index = avr_program_find(program, address)) < 0)
+        return 0;
+
+    /* Grow the function array if needed */
+    if (table->len == *capacity) {
+        unsigned int newCapacity = (*capacity == 0) ? 256 : *capacity*2;
+        struct avrFunction *functions = realloc(table->functions, newCapacity*sizeof(struct avrFunction));
+        if (functions == NULL)
+            return -1;
+        table->functions = functions;
+        *capacity = newCapacity;
+    }
+
+    memset(&table->functions[table->len], 0, sizeof(struct avrFunction));
+    table->functions[table->len].address = address;
+    table->functions[table->len].sources = sources;
+    table->functions[table->len].first = (unsigned int)index;
+    table->len++;
+
+    return 0;
+}
+
+/* Sort and merge duplicate function boundaries, and fill in instruction
+ * extents */
+static void util_functions_merge(struct avrFunctionTable *table, const struct avrProgram *program) {
+    unsigned int i, j;
+
+    qsort(table->functions, table->len, sizeof(struct avrFunction), util_function_compare);
+    for (i = 0, j = 0; i < table->len; i++) {
+        if (j > 0 && table->functions[j-1].address == table->functions[i].address) {
+            table->functions[j-1].sources |= table->functions[i].sources;
+            if (table->functions[j-1].name == NULL)
+                table->functions[j-1].name = table->functions[i].name;
+            continue;
+        }
+        table->functions[j++] = table->functions[i];
+    }
+    table->len = j;
+
+    for (i = 0; i < table->len; i++) {
+        if (i+1 < table->len)
+            table->functions[i].len = table->functions[i+1].first - table->functions[i].first;
+        else
+            table->functions[i].len = program->len - table->functions[i].first;
+    }
+}
+
+int avr_functions_find(struct avrFunctionTable *table, struct avrProgram *program, const struct SymbolTable *symbols) {
+    unsigned int capacity = 0;
+    unsigned int i, numVectors;
+    uint32_t target;
+
+    memset(table, 0, sizeof(struct avrFunctionTable));
+
+    if (program->len == 0)
+        return 0;
+
+    /* Function boundaries are searched by address */
+    avr_program_sort(program);
+
+    /* The interrupt vector table is the leading run of consecutive jumps */
+    for (numVectors = 0; numVectors < program->len; numVectors++) {
+        if (avr_instruction_flow(program->instructions[numVectors].instructionInfo) != AVR_FLOW_JUMP)
+            break;
+        if (numVectors > 0 && program->instructions[numVectors].address != program->instructions[numVectors-1].address + program->instructions[numVectors-1].instructionInfo->width)
+            break;
+    }
+
+    /* Program entry */
+    if (util_functions_add(table, &capacity, program, program->instructions[0].address, AVR_FUNCTION_ENTRY | (numVectors > 0 ? AVR_FUNCTION_VECTORS : 0)) < 0)
+        goto alloc_error;
+
+    for (i = 0; i < program->len; i++) {
+        int flow = avr_instruction_flow(program->instructions[i].instructionInfo);
+
+        /* Vector targets and call targets */
+        if ((i < numVectors || flow == AVR_FLOW_CALL) && avr_instruction_target(&program->instructions[i], &target)) {
+            if (util_functions_add(table, &capacity, program, target, (i < numVectors) ? AVR_FUNCTION_VECTOR_TARGET : AVR_FUNCTION_CALL_TARGET) < 0)
+                goto alloc_error;
+        }
+    }
+
+    /* Symbols */
+    if (symbols != NULL) {
+        for (i = 0; i < symbols->len; i++) {
+            if (util_functions_add(table, &capacity, program, symbols->symbols[i].address, AVR_FUNCTION_SYMBOL) < 0)
+                goto alloc_error;
+        }
+    }
+
+    util_functions_merge(table, program);
+
+    /* Fill in names */
+    if (symbols != NULL) {
+        for (i = 0; i < table->len; i++)
+            table->functions[i].name = symbol_table_lookup(symbols, table->functions[i].address);
+    }
+
+    return 0;
+
+    alloc_error:
+    avr_functions_free(table);
+    return -1;
+}
+
+void avr_functions_free(struct avrFunctionTable *table) {
+    free(table->functions);
+    memset(table, 0, sizeof(struct avrFunctionTable));
+}
+
+int avr_function_name(const struct avrFunction *function, char *name, size_t size) {
+    if (function->name != NULL)
+        return snprintf(name, size, "%s", function->name);
+    else if (function->sources & AVR_FUNCTION_VECTORS)
+        return snprintf(name, size, "__vectors");
+    return snprintf(name, size, "sub_%04x", function->address);
+}
+
+
+/******************************************************************************/
+/* AVR Function Signature Support */
+/******************************************************************************/
+
+/* I/O addresses of SPL, SPH and SREG */
+#define AVR_IO_SPL      0x3d
+#define AVR_IO_SPH      0x3e
+#define AVR_IO_SREG     0x3f
+
+/* Instruction classes of the signatures. A run of push or pop instructions is
+ * one class. */
+enum {
+    SIGNATURE_OTHER,
+    SIGNATURE_PUSH_RUN,         /* push Rr ... */
+    SIGNATURE_POP_RUN,          /* pop Rd ... */
+    SIGNATURE_IN_SPL_Y,         /* in r28, $3d */
+    SIGNATURE_IN_SPH_Y,         /* in r29, $3e */
+    SIGNATURE_IN_SREG,          /* in Rd, $3f */
+    SIGNATURE_CLR_R1,           /* eor r1, r1 */
+    SIGNATURE_LDI_R26,          /* ldi r26, K */
+    SIGNATURE_LDI_R27,          /* ldi r27, K */
+    SIGNATURE_LDI_R30,          /* ldi r30, K */
+    SIGNATURE_LDI_R31,          /* ldi r31, K */
+    SIGNATURE_JUMP,             /* rjmp, jmp */
+    SIGNATURE_RETURN,           /* ret, reti */
+    SIGNATURE_TOTAL_CLASSES,
+};
+
+/* Maximum number of classes in a signature */
+#define SIGNATURE_MAX_LEN       6
+
+/* Structure for a prologue or epilogue signature of avr-gcc code */
+struct avrFunctionSignature {
+    const char *name;
+    /* Instruction classes */
+    int classes[SIGNATURE_MAX_LEN];
+    unsigned int len;
+    /* Prologue, starting a function, or epilogue, ending one */
+    int prologue;
+};
+
+static const struct avrFunctionSignature AVR_Function_Signatures[] = {
+    /* Frame pointer setup, with the call-saved registers pushed first */
+    {"frame", {SIGNATURE_PUSH_RUN, SIGNATURE_IN_SPL_Y, SIGNATURE_IN_SPH_Y}, 3, 1},
+    {"frame", {SIGNATURE_IN_SPL_Y, SIGNATURE_IN_SPH_Y}, 2, 1},
+    /* Interrupt handler: push r1, push r0, in r0, SREG, push r0, clr r1 */
+    {"isr", {SIGNATURE_PUSH_RUN, SIGNATURE_IN_SREG, SIGNATURE_PUSH_RUN, SIGNATURE_CLR_R1}, 4, 1},
+    /* -mcall-prologues: frame size in X, body in Z, jump to __prologue_saves__ */
+    {"prologue_saves", {SIGNATURE_LDI_R26, SIGNATURE_LDI_R27, SIGNATURE_LDI_R30, SIGNATURE_LDI_R31, SIGNATURE_JUMP}, 5, 1},
+    /* Call-saved registers pushed after the end of the previous function */
+    {"push", {SIGNATURE_PUSH_RUN}, 1, 1},
+    /* Call-saved registers restored, and a return */
+    {"pop_ret", {SIGNATURE_POP_RUN, SIGNATURE_RETURN}, 2, 0},
+    {"ret", {SIGNATURE_RETURN}, 1, 0},
+    /* -mcall-prologues: jump to __epilogue_restores__ */
+    {"epilogue_restores", {SIGNATURE_LDI_R30, SIGNATURE_JUMP}, 2, 0},
+};
+#define AVR_TOTAL_FUNCTION_SIGNATURES (sizeof(AVR_Function_Signatures)/sizeof(AVR_Function_Signatures[0]))
+
+/* Shift-And automaton of all signatures, one bit per signature class */
+struct signature_matcher {
+    /* Bits of the signature classes matching each instruction class */
+    uint64_t classMasks[SIGNATURE_TOTAL_CLASSES];
+    /* Bits of the first and last class of each signature */
+    uint64_t firstMask;
+    uint64_t lastMask;
+    /* Signature of each last class bit */
+    unsigned int signatures[64];
+};
+
+static void util_signature_matcher_build(struct signature_matcher *matcher) {
+    unsigned int i, j, bit;
+
+    memset(matcher, 0, sizeof(struct signature_matcher));
+
+    for (i = 0, bit = 0; i < AVR_TOTAL_FUNCTION_SIGNATURES; i++) {
+        for (j = 0; j < AVR_Function_Signatures[i].len; j++, bit++)
+            matcher->classMasks[AVR_Function_Signatures[i].classes[j]] |= (uint64_t)1 << bit;
+        matcher->firstMask |= (uint64_t)1 << (bit - AVR_Function_Signatures[i].len);
+        matcher->lastMask |= (uint64_t)1 << (bit - 1);
+        matcher->signatures[bit - 1] = i;
+    }
+}
+
+static int util_signature_class(const struct avrInstructionDisasm *instrDisasm) {
+    const char *mnemonic = instrDisasm->instructionInfo->mnemonic;
+    int32_t d = instrDisasm->operandDisasms[0], r = instrDisasm->operandDisasms[1];
+
+    switch (mnemonic[0]) {
+        case 'e':
+            if (strcmp(mnemonic, "eor") == 0 && d == 1 && r == 1)
+                return SIGNATURE_CLR_R1;
+            break;
+        case 'i':
+            if (strcmp(mnemonic, "in") == 0) {
+                if (d == 28 && r == AVR_IO_SPL)
+                    return SIGNATURE_IN_SPL_Y;
+                if (d == 29 && r == AVR_IO_SPH)
+                    return SIGNATURE_IN_SPH_Y;
+                if (r == AVR_IO_SREG)
+                    return SIGNATURE_IN_SREG;
+            }
+            break;
+        case 'l':
+            if (strcmp(mnemonic, "ldi") == 0) {
+                switch (d) {
+                    case 26: return SIGNATURE_LDI_R26;
+                    case 27: return SIGNATURE_LDI_R27;
+                    case 30: return SIGNATURE_LDI_R30;
+                    case 31: return SIGNATURE_LDI_R31;
+                    default: break;
+                }
+            }
+            break;
+        case 'p':
+            if (strcmp(mnemonic, "push") == 0)
+                return SIGNATURE_PUSH_RUN;
+            if (strcmp(mnemonic, "pop") == 0)
+                return SIGNATURE_POP_RUN;
+            break;
+        default:
+            break;
+    }
+
+    switch (avr_instruction_flow(instrDisasm->instructionInfo)) {
+        case AVR_FLOW_JUMP:
+            return SIGNATURE_JUMP;
+        case AVR_FLOW_RETURN:
+            return SIGNATURE_RETURN;
+        default:
+            break;
+    }
+
+    return SIGNATURE_OTHER;
+}
+
+/* Whether instruction i follows instruction i - 1 in the address space */
+static int util_functions_contiguous(const struct avrProgram *program, unsigned int i) {
+    return i > 0 && i < program->len && program->instructions[i].address == program->instructions[i-1].address + program->instructions[i-1].instructionInfo->width;
+}
+
+/* Whether a function may start at instruction i: it is code, no branch or
+ * jump lands on it, and the instruction before it doesn't fall through */
+static int util_functions_may_start(const struct avrProgram *program, const uint8_t *targeted, unsigned int i) {
+    int index;
+
+    if (i >= program->len || targeted[i])
+        return 0;
+
+    index = AVR_ISET_INDEX(program->instructions[i].instructionInfo);
+    if (index == AVR_ISET_INDEX_WORD || index == AVR_ISET_INDEX_BYTE)
+        return 0;
+
+    if (!util_functions_contiguous(program, i))
+        return 1;
+
+    switch (avr_instruction_flow(program->instructions[i-1].instructionInfo)) {
+        case AVR_FLOW_JUMP:
+        case AVR_FLOW_INDIRECT_JUMP:
+        case AVR_FLOW_RETURN:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+int avr_functions_detect(struct avrFunctionTable *table, struct avrProgram *program) {
+    const struct avrFunctionSignature *signature;
+    struct signature_matcher matcher;
+    uint8_t *targeted;
+    unsigned int capacity = table->len;
+    unsigned int i, n, bit, start, class;
+    /* Instruction index of the last SIGNATURE_MAX_LEN classes */
+    unsigned int history[SIGNATURE_MAX_LEN];
+    uint64_t state, matches;
+    uint32_t target;
+    int flow, index;
+
+    if (program->len == 0)
+        return 0;
+
+    avr_program_sort(program);
+
+    /* Instructions landed on by a branch or jump */
+    if ((targeted = calloc(program->len, 1)) == NULL)
+        return -1;
+    for (i = 0; i < program->len; i++) {
+        flow = avr_instruction_flow(program->instructions[i].instructionInfo);
+        if ((flow == AVR_FLOW_BRANCH || flow == AVR_FLOW_JUMP) && avr_instruction_target(&program->instructions[i], &target)) {
+            if ((index = avr_program_find(program, target)) >= 0)
+                targeted[index] = 1;
+        }
+    }
+
+    util_signature_matcher_build(&matcher);
+
+    /* Match all signatures in one pass over the instruction classes */
+    state = 0;
+    for (i = 0, n = 0; i < program->len; i++) {
+        class = (unsigned int)util_signature_class(&program->instructions[i]);
+
+        /* A discontinuity breaks every partial match */
+        if (!util_functions_contiguous(program, i))
+            state = 0;
+        /* Collapse push and pop runs into their first instruction */
+        else if ((class == SIGNATURE_PUSH_RUN || class == SIGNATURE_POP_RUN) && util_signature_class(&program->instructions[i-1]) == (int)class)
+            continue;
+
+        history[n % SIGNATURE_MAX_LEN] = i;
+        n++;
+
+        state = ((state << 1) | matcher.firstMask) & matcher.classMasks[class];
+        if ((matches = state & matcher.lastMask) == 0)
+            continue;
+
+        for (bit = 0; bit < 64; bit++) {
+            if (!(matches & ((uint64_t)1 << bit)))
+                continue;
+            signature = &AVR_Function_Signatures[matcher.signatures[bit]];
+
+            if (signature->prologue) {
+                /* Function starts at the first instruction of the prologue */
+                start = history[(n - signature->len) % SIGNATURE_MAX_LEN];
+                if (!util_functions_may_start(program, targeted, start))
+                    continue;
+                if (util_functions_add(table, &capacity, program, program->instructions[start].address, AVR_FUNCTION_PROLOGUE) < 0)
+                    goto alloc_error;
+            } else {
+                /* Next function starts after the epilogue */
+                if (!util_functions_contiguous(program, i+1) || !util_functions_may_start(program, targeted, i+1))
+                    continue;
+                if (util_functions_add(table, &capacity, program, program->instructions[i+1].address, AVR_FUNCTION_EPILOGUE) < 0)
+                    goto alloc_error;
+            }
+        }
+    }
+
+    free(targeted);
+
+    util_functions_merge(table, program);
+
+    return 0;
+
+    alloc_error:
+    free(targeted);
+    avr_functions_free(table);
+    return -1;
+}
@@ -0,0 +1,349 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <byte_stream.h>
+#include <disasm_stream.h>
+#include <instruction.h>
+
+#include "../file/file_support.h"
+
+#include "avr_instruction_set.h"
+#include "avr_support.h"
+#include "avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Program Decoding from Byte Images */
+/******************************************************************************/
+
+/* Setup an AVR Disasm Stream on an image Byte Stream */
+static void util_setup_image_streams(struct DisasmStream *ds, struct ByteStream *bs, const struct ByteImage *image) {
+    memset(bs, 0, sizeof(struct ByteStream));
+    bs->in_image = image;
+    bs->stream_init = byte_stream_image_init;
+    bs->stream_close = byte_stream_image_close;
+    bs->stream_read = byte_stream_image_read;
+
+    memset(ds, 0, sizeof(struct DisasmStream));
+    ds->in = bs;
+    ds->stream_init = disasm_stream_avr_init;
+    ds->stream_close = disasm_stream_avr_close;
+    ds->stream_read = disasm_stream_avr_read;
+}
+
+int avr_program_decode(struct avrProgram *program, const struct ByteImage *image) {
+    struct ByteStream bs;
+    struct DisasmStream ds;
+
+    util_setup_image_streams(&ds, &bs, image);
+
+    return avr_program_read(program, &ds);
+}
+
+/******************************************************************************/
+/* AVR Decode Result Files */
+/******************************************************************************/
+
+/* A decode result file holds a Byte Image and its decoded instructions, in
+ * host byte order:
+ *      struct decode_file_header
+ *      struct ByteImageSegment [numSegments]
+ *      uint8_t data [len]
+ *      struct decode_file_instruction [numInstructions]
+ */
+
+#define DECODE_FILE_MAGIC   "VAVRDEC1"
+
+struct decode_file_header {
+    char magic[8];
+    /* Instruction set size, to reject results of another instruction set */
+    uint32_t numInstructionSet;
+    uint32_t numSegments;
+    uint32_t len;
+    uint32_t numInstructions;
+};
+
+struct decode_file_instruction {
+    uint32_t address;
+    uint8_t opcode[4];
+    int32_t operandDisasms[2];
+    uint32_t index;
+};
+
+int avr_program_save(FILE *out, const struct ByteImage *image, const struct avrProgram *program) {
+    struct decode_file_header header;
+    struct decode_file_instruction record;
+    unsigned int i;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DECODE_FILE_MAGIC, sizeof(header.magic));
+    header.numInstructionSet = (uint32_t)AVR_TOTAL_INSTRUCTIONS;
+    header.numSegments = image->numSegments;
+    header.len = image->len;
+    header.numInstructions = program->len;
+
+    if (fwrite(&header, sizeof(header), 1, out) != 1)
+        return -1;
+    if (image->numSegments > 0 && fwrite(image->segments, sizeof(struct ByteImageSegment), image->numSegments, out) != image->numSegments)
+        return -1;
+    if (image->len > 0 && fwrite(image->data, 1, image->len, out) != image->len)
+        return -1;
+
+    for (i = 0; i < program->len; i++) {
+        memset(&record, 0, sizeof(record));
+        record.address = program->instructions[i].address;
+        memcpy(record.opcode, program->instructions[i].opcode, sizeof(record.opcode));
+        record.operandDisasms[0] = program->instructions[i].operandDisasms[0];
+        record.operandDisasms[1] = program->instructions[i].operandDisasms[1];
+        record.index = (uint32_t)AVR_ISET_INDEX(program->instructions[i].instructionInfo);
+        if (fwrite(&record, sizeof(record), 1, out) != 1)
+            return -1;
+    }
+
+    return 0;
+}
+
+int avr_program_load(FILE *in, struct ByteImage *image, struct avrProgram *program) {
+    struct decode_file_header header;
+    struct decode_file_instruction record;
+    uint64_t totalWidth;
+    unsigned int i;
+
+    memset(image, 0, sizeof(struct ByteImage));
+    memset(program, 0, sizeof(struct avrProgram));
+    program->sorted = 1;
+
+    if (fread(&header, sizeof(header), 1, in) != 1)
+        return -1;
+    if (memcmp(header.magic, DECODE_FILE_MAGIC, sizeof(header.magic)) != 0 || header.numInstructionSet != (uint32_t)AVR_TOTAL_INSTRUCTIONS)
+        return -1;
+
+    /* Byte image */
+    image->segments = malloc((header.numSegments > 0 ? header.numSegments : 1)*sizeof(struct ByteImageSegment));
+    image->data = malloc(header.len > 0 ? header.len : 1);
+    program->instructions = malloc((header.numInstructions > 0 ? header.numInstructions : 1)*sizeof(struct avrInstructionDisasm));
+    if (image->segments == NULL || image->data == NULL || program->instructions == NULL)
+        goto load_error;
+    image->numSegments = image->segmentsCapacity = header.numSegments;
+    image->len = image->capacity = header.len;
+    program->capacity = header.numInstructions;
+
+    if (header.numSegments > 0 && fread(image->segments, sizeof(struct ByteImageSegment), header.numSegments, in) != header.numSegments)
+        goto load_error;
+    if (header.len > 0 && fread(image->data, 1, header.len, in) != header.len)
+        goto load_error;
+
+    /* Segments must tile the image data in order */
+    for (i = 0, totalWidth = 0; i < image->numSegments; i++) {
+        if (image->segments[i].offset != totalWidth || image->segments[i].len == 0)
+            goto load_error;
+        totalWidth += image->segments[i].len;
+    }
+    if (totalWidth != image->len)
+        goto load_error;
+
+    /* Instructions */
+    for (i = 0, totalWidth = 0; i < header.numInstructions; i++) {
+        struct avrInstructionDisasm *instrDisasm = &program->instructions[i];
+
+        if (fread(&record, sizeof(record), 1, in) != 1)
+            goto load_error;
+        if (record.index >= (uint32_t)AVR_TOTAL_INSTRUCTIONS)
+            goto load_error;
+
+        memset(instrDisasm, 0, sizeof(struct avrInstructionDisasm));
+        instrDisasm->address = record.address;
+        memcpy(instrDisasm->opcode, record.opcode, sizeof(record.opcode));
+        instrDisasm->operandDisasms[0] = record.operandDisasms[0];
+        instrDisasm->operandDisasms[1] = record.operandDisasms[1];
+        instrDisasm->instructionInfo = &AVR_Instruction_Set[record.index];
+
+        if (i > 0 && instrDisasm->address < program->instructions[i-1].address)
+            program->sorted = 0;
+        totalWidth += instrDisasm->instructionInfo->width;
+        program->len++;
+    }
+
+    /* Instructions must cover the image exactly */
+    if (totalWidth != image->len)
+        goto load_error;
+
+    return 0;
+
+    load_error:
+    byte_image_free(image);
+    avr_program_free(program);
+    return -1;
+}
+
+/******************************************************************************/
+/* AVR Incremental Disassembly */
+/******************************************************************************/
+
+/* Bytes compared per step when searching for changes */
+#define DIFF_WORD   sizeof(uint64_t)
+
+/* First offset in [start, len) where a and b differ, or len */
+static uint32_t util_diff_first(const uint8_t *a, const uint8_t *b, uint32_t start, uint32_t len) {
+    uint64_t wa, wb;
+    uint32_t i = start;
+
+    /* Compare a word at a time, then narrow down to the byte */
+    while (i + DIFF_WORD <= len) {
+        memcpy(&wa, a + i, DIFF_WORD);
+        memcpy(&wb, b + i, DIFF_WORD);
+        if (wa != wb)
+            break;
+        i += DIFF_WORD;
+    }
+    while (i < len && a[i] == b[i])
+        i++;
+
+    return i;
+}
+
+/* End of the changed run starting at start: the first offset after start that
+ * begins a whole unchanged word, or len */
+static uint32_t util_diff_end(const uint8_t *a, const uint8_t *b, uint32_t start, uint32_t len) {
+    uint32_t i = start + 1;
+
+    while (i + DIFF_WORD <= len && memcmp(a + i, b + i, DIFF_WORD) != 0)
+        i++;
+
+    return (i + DIFF_WORD <= len) ? i : len;
+}
+
+/* Decode a segment from offset start, appending instructions to the program,
+ * until the decoding resynchronizes with an old instruction boundary at or
+ * after offset end, or the segment ends. Advances *oldIndex past old
+ * instructions before the resynchronized offset, and returns that offset, or
+ * a negative stream error. */
+static int64_t util_redecode(struct avrProgram *program, const struct ByteImage *image, const struct ByteImageSegment *segment, uint32_t start, uint32_t end, const struct avrProgram *oldProgram, unsigned int *oldIndex, unsigned int oldEnd) {
+    struct ByteImageSegment view_segment;
+    struct ByteImage view;
+    struct ByteStream bs;
+    struct DisasmStream ds;
+    struct instruction instr;
+    uint32_t offset = start;
+    int ret;
+
+    /* View of the segment from the start offset */
+    memset(&view, 0, sizeof(view));
+    view_segment.address = segment->address + start;
+    view_segment.offset = segment->offset + start;
+    view_segment.len = segment->len - start;
+    view.data = image->data;
+    view.len = image->len;
+    view.segments = &view_segment;
+    view.numSegments = 1;
+
+    util_setup_image_streams(&ds, &bs, &view);
+    if ((ret = ds.stream_init(&ds)) < 0)
+        return ret;
+
+    while (offset < segment->len) {
+        if ((ret = ds.stream_read(&ds, &instr)) < 0) {
+            ds.stream_close(&ds);
+            return (ret == STREAM_EOF) ? STREAM_ERROR_FAILURE : ret;
+        }
+        if (avr_program_append(program, (struct avrInstructionDisasm *)instr.instructionDisasm) < 0) {
+            ds.stream_close(&ds);
+            return STREAM_ERROR_ALLOC;
+        }
+        offset += instr.width;
+
+        /* Skip old instructions before the new offset */
+        while (*oldIndex < oldEnd && oldProgram->instructions[*oldIndex].address - segment->address < offset)
+            (*oldIndex)++;
+
+        /* Resynchronized with an old instruction boundary */
+        if (offset >= end && *oldIndex < oldEnd && oldProgram->instructions[*oldIndex].address - segment->address == offset)
+            break;
+    }
+
+    if ((ret = ds.stream_close(&ds)) < 0)
+        return ret;
+
+    return offset;
+}
+
+int avr_program_update(struct avrProgram *program, const struct ByteImage *image, const struct ByteImage *oldImage, const struct avrProgram *oldProgram, uint32_t *redecoded) {
+    unsigned int i, oldIndex, oldEnd;
+    uint32_t offset, changeStart, changeEnd, width;
+    int64_t ret;
+
+    memset(program, 0, sizeof(struct avrProgram));
+    program->sorted = 1;
+
+    /* Changes are searched segment by segment, so the address layout of both
+     * images must match. Otherwise, decode the whole image. */
+    if (image->numSegments != oldImage->numSegments || image->len != oldImage->len)
+        goto full_decode;
+    for (i = 0; i < image->numSegments; i++) {
+        if (image->segments[i].address != oldImage->segments[i].address ||
+            image->segments[i].offset != oldImage->segments[i].offset ||
+            image->segments[i].len != oldImage->segments[i].len)
+            goto full_decode;
+    }
+
+    *redecoded = 0;
+    oldIndex = 0;
+    for (i = 0; i < image->numSegments; i++) {
+        const struct ByteImageSegment *segment = &image->segments[i];
+        const uint8_t *data = image->data + segment->offset;
+        const uint8_t *oldData = oldImage->data + segment->offset;
+
+        /* Old instructions of this segment, in stream order */
+        for (oldEnd = oldIndex, width = 0; oldEnd < oldProgram->len && width < segment->len; oldEnd++)
+            width += oldProgram->instructions[oldEnd].instructionInfo->width;
+        if (width != segment->len)
+            goto full_decode_free;
+
+        offset = 0;
+        while (1) {
+            /* Next changed byte run */
+            changeStart = util_diff_first(data, oldData, offset, segment->len);
+            if (changeStart == segment->len)
+                break;
+            changeEnd = util_diff_end(data, oldData, changeStart, segment->len);
+
+            /* Keep old instructions that end before the change */
+            while (oldIndex < oldEnd && oldProgram->instructions[oldIndex].address - segment->address + oldProgram->instructions[oldIndex].instructionInfo->width <= changeStart) {
+                if (avr_program_append(program, &oldProgram->instructions[oldIndex]) < 0)
+                    goto alloc_error;
+                oldIndex++;
+            }
+
+            /* Redecode from the old instruction containing the change */
+            offset = oldProgram->instructions[oldIndex].address - segment->address;
+            ret = util_redecode(program, image, segment, offset, changeEnd, oldProgram, &oldIndex, oldEnd);
+            if (ret < 0) {
+                avr_program_free(program);
+                return (int)ret;
+            }
+            *redecoded += (uint32_t)ret - offset;
+            offset = (uint32_t)ret;
+        }
+
+        /* Keep the remaining old instructions */
+        for (; oldIndex < oldEnd; oldIndex++) {
+            if (avr_program_append(program, &oldProgram->instructions[oldIndex]) < 0)
+                goto alloc_error;
+        }
+    }
+
+    return 0;
+
+    alloc_error:
+    avr_program_free(program);
+    return STREAM_ERROR_ALLOC;
+
+    full_decode_free:
+    avr_program_free(program);
+    program->sorted = 1;
+    full_decode:
+    *redecoded = image->len;
+    return avr_program_decode(program, image);
+}
+
@@ -167,3 +167,156 @@ struct avrInstructionInfo AVR_Instruction_Set[] = {
 /* Total number of AVR instructions */
 int AVR_TOTAL_INSTRUCTIONS = (sizeof(AVR_Instruction_Set)/sizeof(AVR_Instruction_Set[0]));
 
+/* Compile-time check that the instruction set fits fixed size tables */
+typedef char AVR_Instruction_Set_Size_Check[((sizeof(AVR_Instruction_Set)/sizeof(AVR_Instruction_Set[0])) <= AVR_ISET_MAX_INSTRUCTIONS) ? 1 : -1];
+
+/* Register and SREG effects of each instruction, in instruction set order:
+ * {operand accesses}, implicit uses, implicit defs, SREG uses, SREG sets,
+ * flags. Calls and returns are left to the analysis. */
+struct avrInstructionEffects AVR_Instruction_Effects[] = {
+    /* break         */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* clc           */ {{0, 0}, 0, 0, 0, AVR_SREG_C, AVR_EFFECT_PURE},
+    /* clh           */ {{0, 0}, 0, 0, 0, AVR_SREG_H, AVR_EFFECT_PURE},
+    /* cli           */ {{0, 0}, 0, 0, 0, AVR_SREG_I, 0},
+    /* cln           */ {{0, 0}, 0, 0, 0, AVR_SREG_N, AVR_EFFECT_PURE},
+    /* cls           */ {{0, 0}, 0, 0, 0, AVR_SREG_S, AVR_EFFECT_PURE},
+    /* clt           */ {{0, 0}, 0, 0, 0, AVR_SREG_T, AVR_EFFECT_PURE},
+    /* clv           */ {{0, 0}, 0, 0, 0, AVR_SREG_V, AVR_EFFECT_PURE},
+    /* clz           */ {{0, 0}, 0, 0, 0, AVR_SREG_Z, AVR_EFFECT_PURE},
+    /* eicall        */ {{0, 0}, AVR_REG_Z, 0, 0, 0, 0},
+    /* eijmp         */ {{0, 0}, AVR_REG_Z, 0, 0, 0, 0},
+    /* elpm          */ {{0, 0}, AVR_REG_Z, AVR_REG(0), 0, 0, AVR_EFFECT_PURE},
+    /* icall         */ {{0, 0}, AVR_REG_Z, 0, 0, 0, 0},
+    /* ijmp          */ {{0, 0}, AVR_REG_Z, 0, 0, 0, 0},
+    /* lpm           */ {{0, 0}, AVR_REG_Z, AVR_REG(0), 0, 0, AVR_EFFECT_PURE},
+    /* nop           */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* ret           */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* reti          */ {{0, 0}, 0, 0, 0, AVR_SREG_I, 0},
+    /* sec           */ {{0, 0}, 0, 0, 0, AVR_SREG_C, AVR_EFFECT_PURE},
+    /* seh           */ {{0, 0}, 0, 0, 0, AVR_SREG_H, AVR_EFFECT_PURE},
+    /* sei           */ {{0, 0}, 0, 0, 0, AVR_SREG_I, 0},
+    /* sen           */ {{0, 0}, 0, 0, 0, AVR_SREG_N, AVR_EFFECT_PURE},
+    /* ses           */ {{0, 0}, 0, 0, 0, AVR_SREG_S, AVR_EFFECT_PURE},
+    /* set           */ {{0, 0}, 0, 0, 0, AVR_SREG_T, AVR_EFFECT_PURE},
+    /* sev           */ {{0, 0}, 0, 0, 0, AVR_SREG_V, AVR_EFFECT_PURE},
+    /* sez           */ {{0, 0}, 0, 0, 0, AVR_SREG_Z, AVR_EFFECT_PURE},
+    /* sleep         */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* spm           */ {{0, 0}, AVR_REG_R0_R1 | AVR_REG_Z, 0, 0, 0, 0},
+    /* spm Z+        */ {{0, 0}, AVR_REG_R0_R1 | AVR_REG_Z, AVR_REG_Z, 0, 0, 0},
+    /* wdr           */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* des K         */ {{0, 0}, 0x0000ffff, 0x0000ffff, AVR_SREG_H, 0, 0},
+    /* asr Rd        */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, 0, AVR_SREG_LOGIC | AVR_SREG_C, AVR_EFFECT_PURE},
+    /* bclr b        */ {{AVR_ACCESS_SREG_SET, 0}, 0, 0, 0, 0, 0},
+    /* brcc k        */ {{0, 0}, 0, 0, AVR_SREG_C, 0, 0},
+    /* brcs k        */ {{0, 0}, 0, 0, AVR_SREG_C, 0, 0},
+    /* breq k        */ {{0, 0}, 0, 0, AVR_SREG_Z, 0, 0},
+    /* brge k        */ {{0, 0}, 0, 0, AVR_SREG_S, 0, 0},
+    /* brhc k        */ {{0, 0}, 0, 0, AVR_SREG_H, 0, 0},
+    /* brhs k        */ {{0, 0}, 0, 0, AVR_SREG_H, 0, 0},
+    /* brid k        */ {{0, 0}, 0, 0, AVR_SREG_I, 0, 0},
+    /* brie k        */ {{0, 0}, 0, 0, AVR_SREG_I, 0, 0},
+    /* brlo k        */ {{0, 0}, 0, 0, AVR_SREG_C, 0, 0},
+    /* brlt k        */ {{0, 0}, 0, 0, AVR_SREG_S, 0, 0},
+    /* brmi k        */ {{0, 0}, 0, 0, AVR_SREG_N, 0, 0},
+    /* brne k        */ {{0, 0}, 0, 0, AVR_SREG_Z, 0, 0},
+    /* brpl k        */ {{0, 0}, 0, 0, AVR_SREG_N, 0, 0},
+    /* brsh k        */ {{0, 0}, 0, 0, AVR_SREG_C, 0, 0},
+    /* brtc k        */ {{0, 0}, 0, 0, AVR_SREG_T, 0, 0},
+    /* brts k        */ {{0, 0}, 0, 0, AVR_SREG_T, 0, 0},
+    /* brvc k        */ {{0, 0}, 0, 0, AVR_SREG_V, 0, 0},
+    /* brvs k        */ {{0, 0}, 0, 0, AVR_SREG_V, 0, 0},
+    /* bset b        */ {{AVR_ACCESS_SREG_SET, 0}, 0, 0, 0, 0, 0},
+    /* call k        */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* com Rd        */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, 0, AVR_SREG_LOGIC | AVR_SREG_C, AVR_EFFECT_PURE},
+    /* dec Rd        */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, 0, AVR_SREG_LOGIC, AVR_EFFECT_PURE},
+    /* inc Rd        */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, 0, AVR_SREG_LOGIC, AVR_EFFECT_PURE},
+    /* jmp k         */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* lpm Rd, Z     */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_Z, 0, 0, 0, AVR_EFFECT_PURE},
+    /* lpm Rd, Z+    */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_Z, AVR_REG_Z, 0, 0, AVR_EFFECT_PURE},
+    /* lsr Rd        */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, 0, AVR_SREG_LOGIC | AVR_SREG_C, AVR_EFFECT_PURE},
+    /* neg Rd        */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, 0, AVR_SREG_ARITH, AVR_EFFECT_PURE},
+    /* pop Rd        */ {{AVR_ACCESS_WRITE, 0}, 0, 0, 0, 0, 0},
+    /* xch Z, Rr     */ {{0, AVR_ACCESS_READ | AVR_ACCESS_WRITE}, AVR_REG_Z, 0, 0, 0, 0},
+    /* las Z, Rr     */ {{0, AVR_ACCESS_READ | AVR_ACCESS_WRITE}, AVR_REG_Z, 0, 0, 0, 0},
+    /* lac Z, Rr     */ {{0, AVR_ACCESS_READ | AVR_ACCESS_WRITE}, AVR_REG_Z, 0, 0, 0, 0},
+    /* lat Z, Rr     */ {{0, AVR_ACCESS_READ | AVR_ACCESS_WRITE}, AVR_REG_Z, 0, 0, 0, 0},
+    /* push Rd       */ {{AVR_ACCESS_READ, 0}, 0, 0, 0, 0, 0},
+    /* rcall k       */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* rjmp k        */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* ror Rd        */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, AVR_SREG_C, AVR_SREG_LOGIC | AVR_SREG_C, AVR_EFFECT_PURE},
+    /* ser Rd        */ {{AVR_ACCESS_WRITE, 0}, 0, 0, 0, 0, AVR_EFFECT_PURE},
+    /* swap Rd       */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, 0, 0, AVR_EFFECT_PURE},
+    /* adc Rd, Rr    */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, AVR_ACCESS_READ}, 0, 0, AVR_SREG_C, AVR_SREG_ARITH, AVR_EFFECT_PURE},
+    /* add Rd, Rr    */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, AVR_ACCESS_READ}, 0, 0, 0, AVR_SREG_ARITH, AVR_EFFECT_PURE},
+    /* adiw Rd, K    */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE | AVR_ACCESS_PAIR, 0}, 0, 0, 0, AVR_SREG_LOGIC | AVR_SREG_C, AVR_EFFECT_PURE},
+    /* and Rd, Rr    */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, AVR_ACCESS_READ}, 0, 0, 0, AVR_SREG_LOGIC, AVR_EFFECT_PURE},
+    /* andi Rd, K    */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, 0, AVR_SREG_LOGIC, AVR_EFFECT_PURE},
+    /* bld Rd, b     */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, AVR_SREG_T, 0, AVR_EFFECT_PURE},
+    /* brbc b, k     */ {{AVR_ACCESS_SREG_USE, 0}, 0, 0, 0, 0, 0},
+    /* brbs b, k     */ {{AVR_ACCESS_SREG_USE, 0}, 0, 0, 0, 0, 0},
+    /* bst Rd, b     */ {{AVR_ACCESS_READ, 0}, 0, 0, 0, AVR_SREG_T, AVR_EFFECT_PURE},
+    /* cbi A, b      */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* cp Rd, Rr     */ {{AVR_ACCESS_READ, AVR_ACCESS_READ}, 0, 0, 0, AVR_SREG_ARITH, AVR_EFFECT_PURE},
+    /* cpc Rd, Rr    */ {{AVR_ACCESS_READ, AVR_ACCESS_READ}, 0, 0, AVR_SREG_C | AVR_SREG_Z, AVR_SREG_ARITH, AVR_EFFECT_PURE},
+    /* cpi Rd, K     */ {{AVR_ACCESS_READ, 0}, 0, 0, 0, AVR_SREG_ARITH, AVR_EFFECT_PURE},
+    /* cpse Rd, Rr   */ {{AVR_ACCESS_READ, AVR_ACCESS_READ}, 0, 0, 0, 0, 0},
+    /* elpm Rd, Z    */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_Z, 0, 0, 0, AVR_EFFECT_PURE},
+    /* elpm Rd, Z+   */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_Z, AVR_REG_Z, 0, 0, AVR_EFFECT_PURE},
+    /* eor Rd, Rr    */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, AVR_ACCESS_READ}, 0, 0, 0, AVR_SREG_LOGIC, AVR_EFFECT_PURE | AVR_EFFECT_SAME_CLEARS},
+    /* fmul Rd, Rr   */ {{AVR_ACCESS_READ, AVR_ACCESS_READ}, 0, AVR_REG_R0_R1, 0, AVR_SREG_C | AVR_SREG_Z, AVR_EFFECT_PURE},
+    /* fmuls Rd, Rr  */ {{AVR_ACCESS_READ, AVR_ACCESS_READ}, 0, AVR_REG_R0_R1, 0, AVR_SREG_C | AVR_SREG_Z, AVR_EFFECT_PURE},
+    /* fmulsu Rd, Rr */ {{AVR_ACCESS_READ, AVR_ACCESS_READ}, 0, AVR_REG_R0_R1, 0, AVR_SREG_C | AVR_SREG_Z, AVR_EFFECT_PURE},
+    /* in Rd, A      */ {{AVR_ACCESS_WRITE, 0}, 0, 0, 0, 0, AVR_EFFECT_IO},
+    /* ld Rd, X      */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_X, 0, 0, 0, 0},
+    /* ld Rd, X+     */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_X, AVR_REG_X, 0, 0, 0},
+    /* ld Rd, -X     */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_X, AVR_REG_X, 0, 0, 0},
+    /* ld Rd, Y      */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_Y, 0, 0, 0, 0},
+    /* ld Rd, Y+     */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_Y, AVR_REG_Y, 0, 0, 0},
+    /* ld Rd, -Y     */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_Y, AVR_REG_Y, 0, 0, 0},
+    /* ld Rd, Z      */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_Z, 0, 0, 0, 0},
+    /* ld Rd, Z+     */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_Z, AVR_REG_Z, 0, 0, 0},
+    /* ld Rd, -Z     */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_Z, AVR_REG_Z, 0, 0, 0},
+    /* ldd Rd, Y+q   */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_Y, 0, 0, 0, 0},
+    /* ldd Rd, Z+q   */ {{AVR_ACCESS_WRITE, 0}, AVR_REG_Z, 0, 0, 0, 0},
+    /* ldi Rd, K     */ {{AVR_ACCESS_WRITE, 0}, 0, 0, 0, 0, AVR_EFFECT_PURE},
+    /* lds Rd, k     */ {{AVR_ACCESS_WRITE, 0}, 0, 0, 0, 0, 0},
+    /* lds Rd, K     */ {{AVR_ACCESS_WRITE, 0}, 0, 0, 0, 0, 0},
+    /* mov Rd, Rr    */ {{AVR_ACCESS_WRITE, AVR_ACCESS_READ}, 0, 0, 0, 0, AVR_EFFECT_PURE},
+    /* movw Rd, Rr   */ {{AVR_ACCESS_WRITE | AVR_ACCESS_PAIR, AVR_ACCESS_READ | AVR_ACCESS_PAIR}, 0, 0, 0, 0, AVR_EFFECT_PURE},
+    /* mul Rd, Rr    */ {{AVR_ACCESS_READ, AVR_ACCESS_READ}, 0, AVR_REG_R0_R1, 0, AVR_SREG_C | AVR_SREG_Z, AVR_EFFECT_PURE},
+    /* muls Rd, Rr   */ {{AVR_ACCESS_READ, AVR_ACCESS_READ}, 0, AVR_REG_R0_R1, 0, AVR_SREG_C | AVR_SREG_Z, AVR_EFFECT_PURE},
+    /* mulsu Rd, Rr  */ {{AVR_ACCESS_READ, AVR_ACCESS_READ}, 0, AVR_REG_R0_R1, 0, AVR_SREG_C | AVR_SREG_Z, AVR_EFFECT_PURE},
+    /* or Rd, Rr     */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, AVR_ACCESS_READ}, 0, 0, 0, AVR_SREG_LOGIC, AVR_EFFECT_PURE},
+    /* ori Rd, K     */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, 0, AVR_SREG_LOGIC, AVR_EFFECT_PURE},
+    /* out A, Rr     */ {{0, AVR_ACCESS_READ}, 0, 0, 0, 0, AVR_EFFECT_IO},
+    /* sbc Rd, Rr    */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, AVR_ACCESS_READ}, 0, 0, AVR_SREG_C | AVR_SREG_Z, AVR_SREG_ARITH, AVR_EFFECT_PURE},
+    /* sbci Rd, K    */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, AVR_SREG_C | AVR_SREG_Z, AVR_SREG_ARITH, AVR_EFFECT_PURE},
+    /* sbi A, b      */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* sbic A, b     */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* sbis A, b     */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* sbiw Rd, K    */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE | AVR_ACCESS_PAIR, 0}, 0, 0, 0, AVR_SREG_LOGIC | AVR_SREG_C, AVR_EFFECT_PURE},
+    /* sbr Rd, K     */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, 0, AVR_SREG_LOGIC, AVR_EFFECT_PURE},
+    /* sbrc Rd, b    */ {{AVR_ACCESS_READ, 0}, 0, 0, 0, 0, 0},
+    /* sbrs Rd, b    */ {{AVR_ACCESS_READ, 0}, 0, 0, 0, 0, 0},
+    /* st X, Rr      */ {{0, AVR_ACCESS_READ}, AVR_REG_X, 0, 0, 0, 0},
+    /* st X+, Rr     */ {{0, AVR_ACCESS_READ}, AVR_REG_X, AVR_REG_X, 0, 0, 0},
+    /* st -X, Rr     */ {{0, AVR_ACCESS_READ}, AVR_REG_X, AVR_REG_X, 0, 0, 0},
+    /* st Y, Rr      */ {{0, AVR_ACCESS_READ}, AVR_REG_Y, 0, 0, 0, 0},
+    /* st Y+, Rr     */ {{0, AVR_ACCESS_READ}, AVR_REG_Y, AVR_REG_Y, 0, 0, 0},
+    /* st -Y, Rr     */ {{0, AVR_ACCESS_READ}, AVR_REG_Y, AVR_REG_Y, 0, 0, 0},
+    /* st Z, Rr      */ {{0, AVR_ACCESS_READ}, AVR_REG_Z, 0, 0, 0, 0},
+    /* st Z+, Rr     */ {{0, AVR_ACCESS_READ}, AVR_REG_Z, AVR_REG_Z, 0, 0, 0},
+    /* st -Z, Rr     */ {{0, AVR_ACCESS_READ}, AVR_REG_Z, AVR_REG_Z, 0, 0, 0},
+    /* std Y+q, Rr   */ {{0, AVR_ACCESS_READ}, AVR_REG_Y, 0, 0, 0, 0},
+    /* std Z+q, Rr   */ {{0, AVR_ACCESS_READ}, AVR_REG_Z, 0, 0, 0, 0},
+    /* sts k, Rr     */ {{0, AVR_ACCESS_READ}, 0, 0, 0, 0, 0},
+    /* sts Rd, K     */ {{AVR_ACCESS_READ, 0}, 0, 0, 0, 0, 0},
+    /* sub Rd, Rr    */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, AVR_ACCESS_READ}, 0, 0, 0, AVR_SREG_ARITH, AVR_EFFECT_PURE | AVR_EFFECT_SAME_CLEARS},
+    /* subi Rd, K    */ {{AVR_ACCESS_READ | AVR_ACCESS_WRITE, 0}, 0, 0, 0, AVR_SREG_ARITH, AVR_EFFECT_PURE},
+    /* .dw           */ {{0, 0}, 0, 0, 0, 0, 0},
+    /* .db           */ {{0, 0}, 0, 0, 0, 0, 0},
+};
+
+/* Compile-time check that every instruction has its effects */
+typedef char AVR_Instruction_Effects_Size_Check[((sizeof(AVR_Instruction_Effects)/sizeof(AVR_Instruction_Effects[0])) == (sizeof(AVR_Instruction_Set)/sizeof(AVR_Instruction_Set[0]))) ? 1 : -1];
+
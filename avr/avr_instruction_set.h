@@ -7,6 +7,13 @@
 #define AVR_ISET_INDEX_WORD     (AVR_TOTAL_INSTRUCTIONS-2)
 #define AVR_ISET_INDEX_BYTE     (AVR_TOTAL_INSTRUCTIONS-1)
 
+/* Upper bound on the number of instruction set entries, for fixed size tables
+ * indexed by instruction set index */
+#define AVR_ISET_MAX_INSTRUCTIONS   256
+
+/* Index of an instruction set entry in the instruction set */
+#define AVR_ISET_INDEX(info)    ((int)((info) - AVR_Instruction_Set))
+
 /* Enumeration for all types of AVR Operands */
 enum {
     OPERAND_NONE,
@@ -20,6 +27,9 @@ enum {
     OPERAND_RAW_WORD, OPERAND_RAW_BYTE,
 };
 
+/* Number of AVR Operand types */
+#define AVR_TOTAL_OPERAND_TYPES (OPERAND_RAW_BYTE+1)
+
 /* Structure for each entry in the instruction set */
 struct avrInstructionInfo {
     char mnemonic[7];
@@ -38,8 +48,59 @@ struct avrInstructionDisasm {
     int32_t operandDisasms[2];
 };
 
+/* Register bits of register bitmasks, bit n for Rn */
+#define AVR_REG(n)              ((uint32_t)1 << (n))
+#define AVR_REG_R0_R1           (AVR_REG(0) | AVR_REG(1))
+#define AVR_REG_X               (AVR_REG(26) | AVR_REG(27))
+#define AVR_REG_Y               (AVR_REG(28) | AVR_REG(29))
+#define AVR_REG_Z               (AVR_REG(30) | AVR_REG(31))
+
+/* SREG flag bits */
+enum {
+    AVR_SREG_C = (1<<0), AVR_SREG_Z = (1<<1), AVR_SREG_N = (1<<2), AVR_SREG_V = (1<<3),
+    AVR_SREG_S = (1<<4), AVR_SREG_H = (1<<5), AVR_SREG_T = (1<<6), AVR_SREG_I = (1<<7),
+};
+#define AVR_SREG_LOGIC          (AVR_SREG_S | AVR_SREG_V | AVR_SREG_N | AVR_SREG_Z)
+#define AVR_SREG_ARITH          (AVR_SREG_H | AVR_SREG_LOGIC | AVR_SREG_C)
+
+/* Access of an instruction operand */
+enum {
+    AVR_ACCESS_READ             = (1<<0),   /* Register read */
+    AVR_ACCESS_WRITE            = (1<<1),   /* Register written */
+    AVR_ACCESS_PAIR             = (1<<2),   /* Register and the next one */
+    AVR_ACCESS_SREG_USE         = (1<<3),   /* SREG bit number used */
+    AVR_ACCESS_SREG_SET         = (1<<4),   /* SREG bit number set */
+};
+
+/* Instruction effect flags */
+enum {
+    /* No effects besides its register and SREG writes */
+    AVR_EFFECT_PURE             = (1<<0),
+    /* Result independent of the operands when both are the same register */
+    AVR_EFFECT_SAME_CLEARS      = (1<<1),
+    /* I/O address operand, which reaches SREG at 0x3f */
+    AVR_EFFECT_IO               = (1<<2),
+};
+
+/* Structure for the register and SREG effects of an instruction set entry */
+struct avrInstructionEffects {
+    /* Access of each operand */
+    uint8_t operandAccess[2];
+    /* Implicitly read and written registers */
+    uint32_t implicitUses;
+    uint32_t implicitDefs;
+    /* SREG flags used and set */
+    uint8_t sregUses;
+    uint8_t sregDefs;
+    /* Effect flags */
+    uint8_t flags;
+};
+
 extern struct avrInstructionInfo AVR_Instruction_Set[];
 extern int AVR_TOTAL_INSTRUCTIONS;
 
+/* Effects of each instruction set entry, indexed by instruction set index */
+extern struct avrInstructionEffects AVR_Instruction_Effects[];
+
 #endif
 
@@ -0,0 +1,307 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "avr_instruction_set.h"
+#include "avr_support.h"
+#include "avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Register Effects Support */
+/******************************************************************************/
+
+/* I/O address of SREG */
+#define AVR_IO_SREG     0x3f
+
+void avr_instruction_effects(const struct avrInstructionDisasm *instrDisasm, struct avrRegisterEffects *effects) {
+    const struct avrInstructionInfo *instructionInfo = instrDisasm->instructionInfo;
+    const struct avrInstructionEffects *instructionEffects = &AVR_Instruction_Effects[AVR_ISET_INDEX(instructionInfo)];
+    uint32_t mask, operandMasks[2] = {0, 0};
+    unsigned int access;
+    int i, io = -1;
+
+    effects->uses = instructionEffects->implicitUses;
+    effects->defs = instructionEffects->implicitDefs;
+    effects->sregUses = instructionEffects->sregUses;
+    effects->sregDefs = instructionEffects->sregDefs;
+    effects->pure = (instructionEffects->flags & AVR_EFFECT_PURE) != 0;
+
+    for (i = 0; i < instructionInfo->numOperands; i++) {
+        access = instructionEffects->operandAccess[i];
+
+        if (access & (AVR_ACCESS_READ | AVR_ACCESS_WRITE)) {
+            mask = AVR_REG(instrDisasm->operandDisasms[i] & 0x1f);
+            if (access & AVR_ACCESS_PAIR)
+                mask |= AVR_REG((instrDisasm->operandDisasms[i] + 1) & 0x1f);
+            operandMasks[i] = mask;
+
+            if (access & AVR_ACCESS_READ)
+                effects->uses |= mask;
+            if (access & AVR_ACCESS_WRITE)
+                effects->defs |= mask;
+        } else if (access & AVR_ACCESS_SREG_USE) {
+            effects->sregUses |= (uint8_t)(1 << (instrDisasm->operandDisasms[i] & 0x7));
+        } else if (access & AVR_ACCESS_SREG_SET) {
+            effects->sregDefs |= (uint8_t)(1 << (instrDisasm->operandDisasms[i] & 0x7));
+        } else {
+            io = i;
+        }
+    }
+
+    /* eor Rd, Rd and sub Rd, Rd don't depend on Rd */
+    if ((instructionEffects->flags & AVR_EFFECT_SAME_CLEARS) && instrDisasm->operandDisasms[0] == instrDisasm->operandDisasms[1])
+        effects->uses &= ~operandMasks[0];
+
+    /* in Rd, SREG reads every flag and out SREG, Rr writes every flag */
+    if ((instructionEffects->flags & AVR_EFFECT_IO) && io >= 0 && instrDisasm->operandDisasms[io] == AVR_IO_SREG) {
+        if (instructionEffects->operandAccess[1-io] & AVR_ACCESS_WRITE)
+            effects->sregUses = 0xff;
+        else
+            effects->sregDefs = 0xff;
+    }
+}
+
+/******************************************************************************/
+/* AVR Register Liveness Support */
+/******************************************************************************/
+
+/* No successor block */
+#define LIVENESS_NONE   0xffffffff
+
+/* Basic block of the liveness analysis */
+struct liveness_block {
+    /* Index of first instruction and number of instructions */
+    uint32_t first;
+    uint32_t len;
+    /* Successor blocks, or LIVENESS_NONE */
+    uint32_t successors[2];
+    /* Control flow leaves the program or is unknown */
+    int exits;
+    /* Registers read before written in the block, and written in the block */
+    uint64_t uses;
+    uint64_t defs;
+    /* Registers live on entry */
+    uint64_t liveIn;
+};
+
+/* Registers and SREG flags read and written by an instruction, with calls
+ * treated as reading every register */
+static void util_liveness_effects(const struct avrInstructionDisasm *instrDisasm, uint64_t *uses, uint64_t *defs, int *pure) {
+    struct avrRegisterEffects effects;
+    int flow;
+
+    avr_instruction_effects(instrDisasm, &effects);
+    *uses = AVR_LIVE_REG(effects.uses) | AVR_LIVE_SREG(effects.sregUses);
+    *defs = AVR_LIVE_REG(effects.defs) | AVR_LIVE_SREG(effects.sregDefs);
+    *pure = effects.pure;
+
+    flow = avr_instruction_flow(instrDisasm->instructionInfo);
+    if (flow == AVR_FLOW_CALL || flow == AVR_FLOW_INDIRECT_CALL)
+        *uses = AVR_LIVE_ALL;
+}
+
+/* Whether instruction i + 1 follows instruction i in the address space */
+static int util_liveness_contiguous(const struct avrProgram *program, uint32_t i) {
+    return i + 1 < program->len && program->instructions[i+1].address == program->instructions[i].address + program->instructions[i].instructionInfo->width;
+}
+
+/* Successors of the block ending at instruction last */
+static void util_liveness_successors(struct liveness_block *block, const struct avrProgram *program, const uint32_t *blockOf, uint32_t last) {
+    const struct avrInstructionDisasm *instrDisasm = &program->instructions[last];
+    uint32_t next, target;
+    int index, flow;
+
+    block->successors[0] = block->successors[1] = LIVENESS_NONE;
+    block->exits = 0;
+
+    next = util_liveness_contiguous(program, last) ? blockOf[last+1] : LIVENESS_NONE;
+    flow = avr_instruction_flow(instrDisasm->instructionInfo);
+
+    switch (flow) {
+        case AVR_FLOW_SKIP:
+            /* The next instruction, or the one after it */
+            block->successors[0] = next;
+            if (next != LIVENESS_NONE && util_liveness_contiguous(program, last+1))
+                block->successors[1] = blockOf[last+2];
+            block->exits = (block->successors[0] == LIVENESS_NONE || block->successors[1] == LIVENESS_NONE);
+            break;
+        case AVR_FLOW_BRANCH:
+        case AVR_FLOW_JUMP:
+            /* The branch or jump target, and the next instruction of a branch */
+            if (flow == AVR_FLOW_BRANCH) {
+                block->successors[0] = next;
+                block->exits = (next == LIVENESS_NONE);
+            }
+            if (avr_instruction_target(instrDisasm, &target) && (index = avr_program_find(program, target)) >= 0)
+                block->successors[1] = blockOf[index];
+            else
+                block->exits = 1;
+            break;
+        case AVR_FLOW_INDIRECT_JUMP:
+        case AVR_FLOW_RETURN:
+            block->exits = 1;
+            break;
+        default:
+            block->successors[0] = next;
+            block->exits = (next == LIVENESS_NONE);
+            break;
+    }
+}
+
+int avr_liveness_analyze(struct avrLiveness *liveness, const struct avrProgram *program, const struct avrFunctionTable *table) {
+    struct liveness_block *blocks = NULL;
+    uint64_t *uses = NULL, *defs = NULL;
+    uint64_t live, liveIn;
+    uint32_t *blockOf = NULL;
+    uint8_t *leaders = NULL, *pure = NULL;
+    uint32_t i, b, numBlocks;
+    int changed, p;
+
+    memset(liveness, 0, sizeof(struct avrLiveness));
+
+    liveness->liveOut = malloc((program->len > 0 ? program->len : 1)*sizeof(uint64_t));
+    liveness->dead = calloc(program->len + 1, 1);
+    uses = malloc((program->len > 0 ? program->len : 1)*sizeof(uint64_t));
+    defs = malloc((program->len > 0 ? program->len : 1)*sizeof(uint64_t));
+    pure = calloc(program->len + 1, 1);
+    blockOf = malloc((program->len + 2)*sizeof(uint32_t));
+    leaders = calloc(program->len + 2, 1);
+    if (liveness->liveOut == NULL || liveness->dead == NULL || uses == NULL || defs == NULL || pure == NULL || blockOf == NULL || leaders == NULL)
+        goto alloc_error;
+
+    /* Split the program into basic blocks */
+    avr_block_leaders(program, table, leaders);
+    for (i = 0, numBlocks = 0; i < program->len; i++) {
+        numBlocks += leaders[i];
+        blockOf[i] = numBlocks - 1;
+    }
+    blockOf[program->len] = blockOf[program->len+1] = LIVENESS_NONE;
+
+    if ((blocks = calloc(numBlocks > 0 ? numBlocks : 1, sizeof(struct liveness_block))) == NULL)
+        goto alloc_error;
+
+    for (i = 0; i < program->len; i++) {
+        util_liveness_effects(&program->instructions[i], &uses[i], &defs[i], &p);
+        pure[i] = (uint8_t)p;
+
+        if (leaders[i])
+            blocks[blockOf[i]].first = i;
+        blocks[blockOf[i]].len++;
+    }
+
+    /* Successors and summary uses and defs of each block */
+    for (b = 0; b < numBlocks; b++) {
+        util_liveness_successors(&blocks[b], program, blockOf, blocks[b].first + blocks[b].len - 1);
+
+        for (i = blocks[b].first + blocks[b].len; i-- > blocks[b].first; ) {
+            blocks[b].uses = (blocks[b].uses & ~defs[i]) | uses[i];
+            blocks[b].defs |= defs[i];
+        }
+    }
+
+    /* Solve backward to a fixed point, visiting blocks in reverse order */
+    do {
+        changed = 0;
+        for (b = numBlocks; b-- > 0; ) {
+            live = blocks[b].exits ? AVR_LIVE_ALL : 0;
+            if (blocks[b].successors[0] != LIVENESS_NONE)
+                live |= blocks[blocks[b].successors[0]].liveIn;
+            if (blocks[b].successors[1] != LIVENESS_NONE)
+                live |= blocks[blocks[b].successors[1]].liveIn;
+
+            liveIn = blocks[b].uses | (live & ~blocks[b].defs);
+            if (liveIn != blocks[b].liveIn) {
+                blocks[b].liveIn = liveIn;
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    /* Registers live after each instruction, and dead stores */
+    for (b = 0; b < numBlocks; b++) {
+        live = blocks[b].exits ? AVR_LIVE_ALL : 0;
+        if (blocks[b].successors[0] != LIVENESS_NONE)
+            live |= blocks[blocks[b].successors[0]].liveIn;
+        if (blocks[b].successors[1] != LIVENESS_NONE)
+            live |= blocks[blocks[b].successors[1]].liveIn;
+
+        for (i = blocks[b].first + blocks[b].len; i-- > blocks[b].first; ) {
+            liveness->liveOut[i] = live;
+            if (pure[i] && defs[i] != 0 && (defs[i] & live) == 0) {
+                liveness->dead[i] = 1;
+                liveness->numDead++;
+            }
+            live = (live & ~defs[i]) | uses[i];
+        }
+    }
+
+    free(blocks);
+    free(uses);
+    free(defs);
+    free(pure);
+    free(blockOf);
+    free(leaders);
+
+    return 0;
+
+    alloc_error:
+    free(blocks);
+    free(uses);
+    free(defs);
+    free(pure);
+    free(blockOf);
+    free(leaders);
+    avr_liveness_free(liveness);
+    return -1;
+}
+
+void avr_liveness_free(struct avrLiveness *liveness) {
+    free(liveness->liveOut);
+    free(liveness->dead);
+    memset(liveness, 0, sizeof(struct avrLiveness));
+}
+
+/******************************************************************************/
+/* AVR Liveness Report */
+/******************************************************************************/
+
+int avr_report_liveness(FILE *out, const struct avrProgram *program, const struct avrLiveness *liveness, int flags) {
+    const struct avrInstructionDisasm *instrDisasm;
+    struct avrRegisterEffects effects;
+    char line[128];
+    uint32_t i, r;
+    int n;
+
+    for (i = 0; i < program->len; i++) {
+        instrDisasm = &program->instructions[i];
+
+        /* Origin at the start and at address discontinuities */
+        if (i == 0 || !util_liveness_contiguous(program, i-1)) {
+            if (avr_instruction_format_origin(instrDisasm->address, line, sizeof(line), flags) < 0)
+                return -1;
+            fputs(line, out);
+        }
+
+        if (avr_instruction_format(instrDisasm, line, sizeof(line), flags) < 0)
+            return -1;
+        fputs(line, out);
+
+        /* Annotate dead stores with their dead registers */
+        if (liveness->dead[i]) {
+            avr_instruction_effects(instrDisasm, &effects);
+            fprintf(out, "\t; dead store");
+            for (r = 0, n = 0; r < 32; r++) {
+                if (effects.defs & AVR_REG(r))
+                    fprintf(out, "%s R%u", (n++ == 0) ? ":" : ",", r);
+            }
+            if (n == 0)
+                fprintf(out, ": SREG");
+        }
+        fputc('\n', out);
+    }
+
+    fprintf(out, "\n; %u dead stores in %u instructions\n", liveness->numDead, program->len);
+
+    return ferror(out) ? -1 : 0;
+}
@@ -1,10 +1,13 @@
 #include <stdint.h>
+#include <stdarg.h>
 #include <stdio.h>
 
 #include <print_stream.h>
 #include <instruction.h>
+#include <symbol_table.h>
 
 #include "avr_instruction_set.h"
+#include "avr_support.h"
 
 /* AVRASM format prefixes */
 #define AVR_PREFIX_REGISTER             "R"  /* mov R0, R2 */
@@ -23,150 +26,188 @@
 /* Address filed width, e.g. 4 -> 0x0004 */
 #define AVR_ADDRESS_WIDTH               4
 
-int avr_instruction_print_origin(struct instruction *instr, FILE *out, int flags) {
-    /* Print an origin directive if we're outputting assembly */
+/* Maximum formatted length of an origin or instruction line */
+#define AVR_FORMAT_MAX_LEN              128
+
+/* Caller buffer being formatted into */
+struct format_buffer {
+    char *buf;
+    size_t size;
+    size_t len;
+};
+
+static int util_format_append(struct format_buffer *fb, const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    /* Append at the current length, or count only once the buffer is full */
+    va_start(ap, fmt);
+    if (fb->len < fb->size)
+        n = vsnprintf(fb->buf + fb->len, fb->size - fb->len, fmt, ap);
+    else
+        n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+        return -1;
+
+    fb->len += n;
+    return 0;
+}
+
+int avr_instruction_format_origin(uint32_t address, char *buf, size_t size, int flags) {
+    struct format_buffer fb = {buf, size, 0};
+
+    if (size > 0)
+        buf[0] = '\0';
+
+    /* Format an origin directive if we're outputting assembly */
     if (flags & PRINT_FLAG_ASSEMBLY) {
-        if (fprintf(out, ".org %s%0*x\n", AVR_PREFIX_ABSOLUTE_ADDRESS, AVR_ADDRESS_WIDTH, instr->address) < 0)
+        if (util_format_append(&fb, ".org %s%0*x\n", AVR_PREFIX_ABSOLUTE_ADDRESS, AVR_ADDRESS_WIDTH, address) < 0)
             return -1;
     }
-    return 0;
+
+    return fb.len;
 }
 
-int avr_instruction_print(struct instruction *instr, FILE *out, int flags) {
-    struct avrInstructionDisasm *instrDisasm = (struct avrInstructionDisasm *)instr->instructionDisasm;
+int avr_instruction_format(const struct avrInstructionDisasm *instrDisasm, char *buf, size_t size, int flags) {
+    struct format_buffer fb = {buf, size, 0};
     int i;
 
-    /* Print an address label if we're outputting assembly */
+    if (size > 0)
+        buf[0] = '\0';
+
+    /* Format an address label if we're outputting assembly */
     if (flags & PRINT_FLAG_ASSEMBLY) {
-        if (fprintf(out, "%s%0*x:\t", AVR_PREFIX_ADDRESS_LABEL, AVR_ADDRESS_WIDTH, instr->address) < 0)
+        if (util_format_append(&fb, "%s%0*x:\t", AVR_PREFIX_ADDRESS_LABEL, AVR_ADDRESS_WIDTH, instrDisasm->address) < 0)
             return -1;
 
-    /* Print address */
+    /* Format address */
     } else if (flags & PRINT_FLAG_ADDRESSES) {
-        if (fprintf(out, "%*x:\t", AVR_ADDRESS_WIDTH, instr->address) < 0)
+        if (util_format_append(&fb, "%*x:\t", AVR_ADDRESS_WIDTH, instrDisasm->address) < 0)
             return -1;
     }
 
-    /* Print original opcodes */
+    /* Format original opcodes */
     if (flags & PRINT_FLAG_OPCODES) {
         if (instrDisasm->instructionInfo->width == 1) {
-            if (fprintf(out, "%02x         \t", instrDisasm->opcode[0]) < 0)
+            if (util_format_append(&fb, "%02x         \t", instrDisasm->opcode[0]) < 0)
                 return -1;
         } else if (instrDisasm->instructionInfo->width == 2) {
             if (flags & PRINT_FLAG_OBJDUMP_COMP) {
-                if (fprintf(out, "%02x %02x      \t", instrDisasm->opcode[0], instrDisasm->opcode[1]) < 0)
+                if (util_format_append(&fb, "%02x %02x      \t", instrDisasm->opcode[0], instrDisasm->opcode[1]) < 0)
                     return -1;
             } else {
-                if (fprintf(out, "%02x %02x      \t", instrDisasm->opcode[1], instrDisasm->opcode[0]) < 0)
+                if (util_format_append(&fb, "%02x %02x      \t", instrDisasm->opcode[1], instrDisasm->opcode[0]) < 0)
                     return -1;
             }
         } else if (instrDisasm->instructionInfo->width == 4) {
             if (flags & PRINT_FLAG_OBJDUMP_COMP) {
-                if (fprintf(out, "%02x %02x %02x %02x\t", instrDisasm->opcode[0], instrDisasm->opcode[1], instrDisasm->opcode[2], instrDisasm->opcode[3]) < 0)
+                if (util_format_append(&fb, "%02x %02x %02x %02x\t", instrDisasm->opcode[0], instrDisasm->opcode[1], instrDisasm->opcode[2], instrDisasm->opcode[3]) < 0)
                     return -1;
             } else {
-                if (fprintf(out, "%02x %02x %02x %02x\t", instrDisasm->opcode[3], instrDisasm->opcode[2], instrDisasm->opcode[1], instrDisasm->opcode[0]) < 0)
+                if (util_format_append(&fb, "%02x %02x %02x %02x\t", instrDisasm->opcode[3], instrDisasm->opcode[2], instrDisasm->opcode[1], instrDisasm->opcode[0]) < 0)
                     return -1;
             }
         }
     }
 
-    /* Print mnemonic */
-    if (fprintf(out, "%s\t", instrDisasm->instructionInfo->mnemonic) < 0)
+    /* Format mnemonic */
+    if (util_format_append(&fb, "%s\t", instrDisasm->instructionInfo->mnemonic) < 0)
         return -1;
 
-    /* Print operands */
+    /* Format operands */
     for (i = 0; i < instrDisasm->instructionInfo->numOperands; i++) {
-        /* Print dat comma, yea */
+        /* Format dat comma, yea */
         if (i > 0 && i < instrDisasm->instructionInfo->numOperands) {
-            if (fprintf(out, ", ") < 0)
+            if (util_format_append(&fb, ", ") < 0)
                 return -1;
         }
 
-        /* Print the operand */
+        /* Format the operand */
         switch (instrDisasm->instructionInfo->operandTypes[i]) {
             case OPERAND_REGISTER:
             case OPERAND_REGISTER_STARTR16:
             case OPERAND_REGISTER_EVEN_PAIR:
             case OPERAND_REGISTER_EVEN_PAIR_STARTR24:
-                if (fprintf(out, "%s%d", AVR_PREFIX_REGISTER, instrDisasm->operandDisasms[i]) < 0) return -1;
+                if (util_format_append(&fb, "%s%d", AVR_PREFIX_REGISTER, instrDisasm->operandDisasms[i]) < 0) return -1;
                 break;
             case OPERAND_IO_REGISTER:
-                if (fprintf(out, "%s%02x", AVR_PREFIX_IO_REGISTER, instrDisasm->operandDisasms[i]) < 0) return -1;
+                if (util_format_append(&fb, "%s%02x", AVR_PREFIX_IO_REGISTER, instrDisasm->operandDisasms[i]) < 0) return -1;
                 break;
             case OPERAND_BIT:
-                if (fprintf(out, "%s%d", AVR_PREFIX_BIT, instrDisasm->operandDisasms[i]) < 0) return -1;
+                if (util_format_append(&fb, "%s%d", AVR_PREFIX_BIT, instrDisasm->operandDisasms[i]) < 0) return -1;
                 break;
             case OPERAND_DES_ROUND:
-                if (fprintf(out, "%s%d", AVR_PREFIX_DES_ROUND, instrDisasm->operandDisasms[i]) < 0) return -1;
+                if (util_format_append(&fb, "%s%d", AVR_PREFIX_DES_ROUND, instrDisasm->operandDisasms[i]) < 0) return -1;
                 break;
             case OPERAND_RAW_WORD:
-                if (fprintf(out, "%s%04x", AVR_PREFIX_RAW_WORD, instrDisasm->operandDisasms[i]) < 0) return -1;
+                if (util_format_append(&fb, "%s%04x", AVR_PREFIX_RAW_WORD, instrDisasm->operandDisasms[i]) < 0) return -1;
                 break;
             case OPERAND_RAW_BYTE:
-                if (fprintf(out, "%s%02x", AVR_PREFIX_RAW_BYTE, instrDisasm->operandDisasms[i]) < 0) return -1;
+                if (util_format_append(&fb, "%s%02x", AVR_PREFIX_RAW_BYTE, instrDisasm->operandDisasms[i]) < 0) return -1;
                 break;
             case OPERAND_X:
-                if (fprintf(out, "X") < 0) return -1;
+                if (util_format_append(&fb, "X") < 0) return -1;
                 break;
             case OPERAND_XP:
-                if (fprintf(out, "X+") < 0) return -1;
+                if (util_format_append(&fb, "X+") < 0) return -1;
                 break;
             case OPERAND_MX:
-                if (fprintf(out, "-X") < 0) return -1;
+                if (util_format_append(&fb, "-X") < 0) return -1;
                 break;
             case OPERAND_Y:
-                if (fprintf(out, "Y") < 0) return -1;
+                if (util_format_append(&fb, "Y") < 0) return -1;
                 break;
             case OPERAND_YP:
-                if (fprintf(out, "Y+") < 0) return -1;
+                if (util_format_append(&fb, "Y+") < 0) return -1;
                 break;
             case OPERAND_MY:
-                if (fprintf(out, "-Y") < 0) return -1;
+                if (util_format_append(&fb, "-Y") < 0) return -1;
                 break;
             case OPERAND_Z:
-                if (fprintf(out, "Z") < 0) return -1;
+                if (util_format_append(&fb, "Z") < 0) return -1;
                 break;
             case OPERAND_ZP:
-                if (fprintf(out, "Z+") < 0) return -1;
+                if (util_format_append(&fb, "Z+") < 0) return -1;
                 break;
             case OPERAND_MZ:
-                if (fprintf(out, "-Z") < 0) return -1;
+                if (util_format_append(&fb, "-Z") < 0) return -1;
                 break;
             case OPERAND_YPQ:
-                if (fprintf(out, "Y+%d", instrDisasm->operandDisasms[i]) < 0) return -1;
+                if (util_format_append(&fb, "Y+%d", instrDisasm->operandDisasms[i]) < 0) return -1;
                 break;
             case OPERAND_ZPQ:
-                if (fprintf(out, "Z+%d", instrDisasm->operandDisasms[i]) < 0) return -1;
+                if (util_format_append(&fb, "Z+%d", instrDisasm->operandDisasms[i]) < 0) return -1;
                 break;
             case OPERAND_DATA:
                 if (flags & PRINT_FLAG_DATA_BIN) {
                     /* Data representation binary */
                     char binary[9];
-                    int i;
-                    for (i = 0; i < 8; i++) {
-                        if (instrDisasm->operandDisasms[i] & (1 << i))
-                            binary[7-i] = '1';
+                    int j;
+                    for (j = 0; j < 8; j++) {
+                        if (instrDisasm->operandDisasms[i] & (1 << j))
+                            binary[7-j] = '1';
                         else
-                            binary[7-i] = '0';
+                            binary[7-j] = '0';
                     }
                     binary[8] = '\0';
-                    if (fprintf(out, "%s%s", AVR_PREFIX_DATA_BIN, binary) < 0) return -1;
+                    if (util_format_append(&fb, "%s%s", AVR_PREFIX_DATA_BIN, binary) < 0) return -1;
                 } else if (flags & PRINT_FLAG_DATA_DEC) {
                     /* Data representation decimal */
-                    if (fprintf(out, "%s%d", AVR_PREFIX_DATA_DEC, instrDisasm->operandDisasms[i]) < 0) return -1;
+                    if (util_format_append(&fb, "%s%d", AVR_PREFIX_DATA_DEC, instrDisasm->operandDisasms[i]) < 0) return -1;
                 } else {
                     /* Default to data representation hex */
-                    if (fprintf(out, "%s%02x", AVR_PREFIX_DATA_HEX, instrDisasm->operandDisasms[i]) < 0) return -1;
+                    if (util_format_append(&fb, "%s%02x", AVR_PREFIX_DATA_HEX, instrDisasm->operandDisasms[i]) < 0) return -1;
                 }
                 break;
             case OPERAND_LONG_ABSOLUTE_ADDRESS:
                 if (flags & PRINT_FLAG_OBJDUMP_COMP) {
                     /* Render a byte address like avr-objdump */
-                    if (fprintf(out, "%s%0*x", AVR_PREFIX_ABSOLUTE_ADDRESS, AVR_ADDRESS_WIDTH, instrDisasm->operandDisasms[i]) < 0) return -1;
+                    if (util_format_append(&fb, "%s%0*x", AVR_PREFIX_ABSOLUTE_ADDRESS, AVR_ADDRESS_WIDTH, instrDisasm->operandDisasms[i]) < 0) return -1;
                 } else {
                     /* Divide the address by two to render a word address */
-                    if (fprintf(out, "%s%0*x", AVR_PREFIX_ABSOLUTE_ADDRESS, AVR_ADDRESS_WIDTH, instrDisasm->operandDisasms[i] / 2) < 0) return -1;
+                    if (util_format_append(&fb, "%s%0*x", AVR_PREFIX_ABSOLUTE_ADDRESS, AVR_ADDRESS_WIDTH, instrDisasm->operandDisasms[i] / 2) < 0) return -1;
                 }
                 break;
             case OPERAND_BRANCH_ADDRESS:
@@ -174,14 +215,14 @@ int avr_instruction_print(struct instruction *instr, FILE *out, int flags) {
                 /* If we have address labels turned on, replace the relative
                  * address with the appropriate address label */
                 if (flags & PRINT_FLAG_ASSEMBLY) {
-                    if (fprintf(out, "%s%0*x", AVR_PREFIX_ADDRESS_LABEL, AVR_ADDRESS_WIDTH, instrDisasm->operandDisasms[i] + instrDisasm->address + 2) < 0) return -1;
+                    if (util_format_append(&fb, "%s%0*x", AVR_PREFIX_ADDRESS_LABEL, AVR_ADDRESS_WIDTH, instrDisasm->operandDisasms[i] + instrDisasm->address + 2) < 0) return -1;
                 } else {
                     /* Print a plus sign for positive relative addresses, printf
                      * will insert a minus sign for negative relative addresses. */
                     if (instrDisasm->operandDisasms[i] >= 0) {
-                        if (fprintf(out, "%s+%d", AVR_PREFIX_RELATIVE_ADDRESS, instrDisasm->operandDisasms[i]) < 0) return -1;
+                        if (util_format_append(&fb, "%s+%d", AVR_PREFIX_RELATIVE_ADDRESS, instrDisasm->operandDisasms[i]) < 0) return -1;
                     } else {
-                        if (fprintf(out, "%s%d", AVR_PREFIX_RELATIVE_ADDRESS, instrDisasm->operandDisasms[i]) < 0) return -1;
+                        if (util_format_append(&fb, "%s%d", AVR_PREFIX_RELATIVE_ADDRESS, instrDisasm->operandDisasms[i]) < 0) return -1;
                     }
                 }
                 break;
@@ -190,17 +231,73 @@ int avr_instruction_print(struct instruction *instr, FILE *out, int flags) {
         }
     }
 
-    /* Print destination address comment */
+    /* Format destination address comment */
     if (flags & PRINT_FLAG_DESTINATION_COMMENT) {
         for (i = 0; i < instrDisasm->instructionInfo->numOperands; i++) {
             if ( instrDisasm->instructionInfo->operandTypes[i] == OPERAND_BRANCH_ADDRESS ||
                  instrDisasm->instructionInfo->operandTypes[i] == OPERAND_RELATIVE_ADDRESS) {
-                if (fprintf(out, "\t; %s%x", AVR_PREFIX_ABSOLUTE_ADDRESS, instrDisasm->operandDisasms[i] + instrDisasm->address + 2) < 0)
+                if (util_format_append(&fb, "\t; %s%x", AVR_PREFIX_ABSOLUTE_ADDRESS, instrDisasm->operandDisasms[i] + instrDisasm->address + 2) < 0)
                     return -1;
             }
         }
     }
 
+    return fb.len;
+}
+
+int avr_instruction_print_origin(struct instruction *instr, FILE *out, int flags) {
+    char line[AVR_FORMAT_MAX_LEN];
+    int len;
+
+    len = avr_instruction_format_origin(instr->address, line, sizeof(line), flags);
+    if (len < 0 || len >= (int)sizeof(line))
+        return -1;
+
+    if (fputs(line, out) < 0)
+        return -1;
+
+    return len;
+}
+
+/* Print the symbol name of a branch, jump or call destination, after its
+ * destination address comment. Returns the printed length, or -1 on error. */
+static int util_print_destination_symbol(const struct avrInstructionDisasm *instrDisasm, const struct SymbolTable *symbols, FILE *out) {
+    const struct avrInstructionInfo *instructionInfo = instrDisasm->instructionInfo;
+    const char *name;
+    int i;
+
+    for (i = 0; i < instructionInfo->numOperands; i++) {
+        if (instructionInfo->operandTypes[i] == OPERAND_BRANCH_ADDRESS || instructionInfo->operandTypes[i] == OPERAND_RELATIVE_ADDRESS) {
+            /* Relative destinations already have an address comment */
+            if ((name = symbol_table_lookup(symbols, instrDisasm->operandDisasms[i] + instrDisasm->address + 2)) != NULL)
+                return fprintf(out, " <%s>", name);
+        } else if (instructionInfo->operandTypes[i] == OPERAND_LONG_ABSOLUTE_ADDRESS && instructionInfo->numOperands == 1) {
+            /* call / jmp, but not the data address of lds / sts */
+            if ((name = symbol_table_lookup(symbols, instrDisasm->operandDisasms[i])) != NULL)
+                return fprintf(out, "\t; <%s>", name);
+        }
+    }
+
     return 0;
 }
 
+int avr_instruction_print(struct instruction *instr, FILE *out, int flags) {
+    char line[AVR_FORMAT_MAX_LEN];
+    int len, symbolLen;
+
+    len = avr_instruction_format((struct avrInstructionDisasm *)instr->instructionDisasm, line, sizeof(line), flags);
+    if (len < 0 || len >= (int)sizeof(line))
+        return -1;
+
+    if (fputs(line, out) < 0)
+        return -1;
+
+    /* Name the destination with its symbol */
+    if (instr->symbols != NULL && (flags & PRINT_FLAG_DESTINATION_COMMENT)) {
+        if ((symbolLen = util_print_destination_symbol((struct avrInstructionDisasm *)instr->instructionDisasm, instr->symbols, out)) < 0)
+            return -1;
+        len += symbolLen;
+    }
+
+    return len;
+}
@@ -0,0 +1,183 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <disasm_stream.h>
+#include <instruction.h>
+#include <profile.h>
+#include <trace.h>
+
+#include "avr_instruction_set.h"
+#include "avr_support.h"
+#include "avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Program Support */
+/******************************************************************************/
+
+int avr_program_append(struct avrProgram *program, const struct avrInstructionDisasm *instrDisasm) {
+    /* Grow the instruction array if needed */
+    if (program->len == program->capacity) {
+        unsigned int capacity = (program->capacity == 0) ? 4096 : program->capacity*2;
+        struct avrInstructionDisasm *instructions = realloc(program->instructions, capacity*sizeof(struct avrInstructionDisasm));
+        if (instructions == NULL)
+            return -1;
+        program->instructions = instructions;
+        program->capacity = capacity;
+    }
+
+    /* Keep track of whether we're still sorted */
+    if (program->len > 0 && program->instructions[program->len-1].address > instrDisasm->address)
+        program->sorted = 0;
+
+    program->instructions[program->len++] = *instrDisasm;
+
+    return 0;
+}
+
+int avr_program_read(struct avrProgram *program, struct DisasmStream *ds) {
+    struct instruction instr;
+    uint64_t start;
+    int ret;
+
+    memset(program, 0, sizeof(struct avrProgram));
+    program->sorted = 1;
+    start = PROFILE_NOW();
+
+    /* Initialize the disasm stream */
+    if ((ret = ds->stream_init(ds)) < 0)
+        return ret;
+    TRACE_BEGIN("decode", NULL);
+
+    /* Read disassembled instructions until EOF */
+    while ( (ret = ds->stream_read(ds, &instr)) != STREAM_EOF ) {
+        if (ret < 0)
+            goto read_error;
+
+        if (avr_program_append(program, (struct avrInstructionDisasm *)instr.instructionDisasm) < 0) {
+            ret = STREAM_ERROR_ALLOC;
+            goto read_error;
+        }
+    }
+
+    /* Close the disasm stream */
+    TRACE_END("decode");
+    if ((ret = ds->stream_close(ds)) < 0) {
+        avr_program_free(program);
+        return ret;
+    }
+
+    PROFILE_TIME(PROFILE_TIMER_DISASM, start);
+
+    return 0;
+
+    read_error:
+    TRACE_END("decode");
+    ds->stream_close(ds);
+    avr_program_free(program);
+    return ret;
+}
+
+void avr_program_free(struct avrProgram *program) {
+    free(program->instructions);
+    memset(program, 0, sizeof(struct avrProgram));
+}
+
+static int util_instruction_compare(const void *a, const void *b) {
+    const struct avrInstructionDisasm *ia = (const struct avrInstructionDisasm *)a;
+    const struct avrInstructionDisasm *ib = (const struct avrInstructionDisasm *)b;
+
+    if (ia->address < ib->address)
+        return -1;
+    else if (ia->address > ib->address)
+        return 1;
+    return 0;
+}
+
+void avr_program_sort(struct avrProgram *program) {
+    if (program->sorted)
+        return;
+
+    qsort(program->instructions, program->len, sizeof(struct avrInstructionDisasm), util_instruction_compare);
+    program->sorted = 1;
+}
+
+int avr_program_find(const struct avrProgram *program, uint32_t address) {
+    unsigned int lo, hi, mid;
+
+    /* Binary search for the instruction at address in a sorted program */
+    lo = 0;
+    hi = program->len;
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if (program->instructions[mid].address < address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < program->len && program->instructions[lo].address == address)
+        return (int)lo;
+
+    return -1;
+}
+
+/******************************************************************************/
+/* AVR Program Disasm Stream Support */
+/******************************************************************************/
+
+struct disasm_stream_avr_program_state {
+    /* Index of next instruction */
+    unsigned int index;
+};
+
+int disasm_stream_avr_program_init(struct DisasmStream *self) {
+    /* Allocate stream state */
+    self->state = malloc(sizeof(struct disasm_stream_avr_program_state));
+    if (self->state == NULL) {
+        self->error = "Error allocating disasm stream state!";
+        return STREAM_ERROR_ALLOC;
+    }
+    /* Initialize stream state */
+    memset(self->state, 0, sizeof(struct disasm_stream_avr_program_state));
+
+    /* Reset the error to NULL */
+    self->error = NULL;
+
+    /* Initialize the input program */
+    /* const void *in_program; assumed to have been read */
+
+    return 0;
+}
+
+int disasm_stream_avr_program_close(struct DisasmStream *self) {
+    /* Free stream state memory */
+    free(self->state);
+
+    /* Input program is owned by the caller */
+
+    return 0;
+}
+
+int disasm_stream_avr_program_read(struct DisasmStream *self, struct instruction *instr) {
+    struct disasm_stream_avr_program_state *state = (struct disasm_stream_avr_program_state *)self->state;
+    const struct avrProgram *program = (const struct avrProgram *)self->in_program;
+    struct avrInstructionDisasm *instrDisasm;
+
+    if (state->index == program->len)
+        return STREAM_EOF;
+
+    instrDisasm = &program->instructions[state->index++];
+
+    /* Fill the instruction structure */
+    instr->address = instrDisasm->address;
+    instr->width = instrDisasm->instructionInfo->width;
+    instr->instructionDisasm = (void *)instrDisasm;
+    instr->symbols = NULL;
+    instr->print_origin = avr_instruction_print_origin;
+    instr->print = avr_instruction_print;
+
+    return 0;
+}
+
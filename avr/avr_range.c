@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <byte_stream.h>
+
+#include "avr_instruction_set.h"
+#include "avr_support.h"
+#include "avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Range Disassembly */
+/******************************************************************************/
+
+int avr_boundary_index_build(struct avrBoundaryIndex *index, const struct ByteImage *image) {
+    uint32_t i;
+
+    memset(index, 0, sizeof(struct avrBoundaryIndex));
+
+    index->bitmap = calloc((image->len + 7)/8 + 1, 1);
+    if (index->bitmap == NULL)
+        return -1;
+    index->len = image->len;
+
+    /* Build the opcode lookup table, if it hasn't been built already */
+    avr_iset_lookup_init();
+
+    /* Each segment is decoded on its own, from its first byte */
+    for (i = 0; i < image->numSegments; i++)
+        avr_disasm_boundaries(image->data + image->segments[i].offset, image->segments[i].len, index->bitmap, image->segments[i].offset);
+
+    return 0;
+}
+
+void avr_boundary_index_free(struct avrBoundaryIndex *index) {
+    free(index->bitmap);
+    memset(index, 0, sizeof(struct avrBoundaryIndex));
+}
+
+int avr_boundary_index_first(const struct avrBoundaryIndex *index, uint32_t offset, uint32_t len) {
+    uint32_t i;
+
+    for (i = 0; i < len && offset + i < index->len; i++) {
+        if (index->bitmap[(offset + i)/8] & (1 << ((offset + i) % 8)))
+            return (int)i;
+    }
+
+    return -1;
+}
+
+/* Offset of the instruction start at or before an image data offset */
+static uint32_t util_boundary_seek(const struct avrBoundaryIndex *index, uint32_t offset) {
+    /* Instructions are at most 4 bytes, so this looks back at most 3 */
+    while (!(index->bitmap[offset/8] & (1 << (offset % 8))))
+        offset--;
+
+    return offset;
+}
+
+int avr_program_decode_range(struct avrProgram *program, const struct ByteImage *image, const struct avrBoundaryIndex *index, uint32_t start, uint32_t end) {
+    const struct ByteImageSegment *segment;
+    struct avrInstructionDisasm instrDisasm;
+    uint32_t i, offset, segmentEnd, avail;
+
+    memset(program, 0, sizeof(struct avrProgram));
+    program->sorted = 1;
+
+    if (start >= end)
+        return 0;
+
+    /* Build the opcode lookup table, if it hasn't been built already */
+    avr_iset_lookup_init();
+
+    for (i = 0; i < image->numSegments; i++) {
+        segment = &image->segments[i];
+
+        /* Skip segments outside of [start, end) */
+        if (segment->len == 0 || segment->address >= end || segment->address + (segment->len - 1) < start)
+            continue;
+
+        /* Seek to the instruction containing start, including a 32-bit
+         * instruction straddling it */
+        offset = segment->offset;
+        if (start > segment->address)
+            offset = util_boundary_seek(index, segment->offset + (start - segment->address));
+
+        /* Decode the window */
+        segmentEnd = segment->offset + segment->len;
+        while (offset < segmentEnd && segment->address + (offset - segment->offset) < end) {
+            avail = (segmentEnd - offset > 4) ? 4 : segmentEnd - offset;
+            offset += avr_disasm_decode(image->data + offset, avail, segment->address + (offset - segment->offset), &instrDisasm);
+            if (avr_program_append(program, &instrDisasm) < 0) {
+                avr_program_free(program);
+                return STREAM_ERROR_ALLOC;
+            }
+        }
+    }
+
+    return 0;
+}
+
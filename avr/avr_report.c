@@ -0,0 +1,182 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "avr_instruction_set.h"
+#include "avr_support.h"
+#include "avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Size Report */
+/******************************************************************************/
+
+/* Size profile of a function */
+struct size_report_function {
+    const struct avrFunction *function;
+    unsigned int bytes;
+    unsigned int numInstructions;
+    unsigned int numLongInstructions;
+    unsigned int dataBytes;
+};
+
+/* Size profile of a mnemonic */
+struct size_report_mnemonic {
+    const char *mnemonic;
+    unsigned int bytes;
+    unsigned int count;
+};
+
+static int util_size_function_compare(const void *a, const void *b) {
+    const struct size_report_function *fa = (const struct size_report_function *)a;
+    const struct size_report_function *fb = (const struct size_report_function *)b;
+
+    /* Descending size, then ascending address */
+    if (fa->bytes != fb->bytes)
+        return (fa->bytes > fb->bytes) ? -1 : 1;
+    if (fa->function->address != fb->function->address)
+        return (fa->function->address < fb->function->address) ? -1 : 1;
+    return 0;
+}
+
+static int util_size_mnemonic_compare(const void *a, const void *b) {
+    const struct size_report_mnemonic *ma = (const struct size_report_mnemonic *)a;
+    const struct size_report_mnemonic *mb = (const struct size_report_mnemonic *)b;
+
+    /* Descending size, then mnemonic */
+    if (ma->bytes != mb->bytes)
+        return (ma->bytes > mb->bytes) ? -1 : 1;
+    return strcmp(ma->mnemonic, mb->mnemonic);
+}
+
+int avr_report_size(FILE *out, const struct avrProgram *program, const struct avrFunctionTable *table) {
+    struct size_report_function *functions;
+    struct size_report_mnemonic *mnemonics;
+    unsigned int *indexBytes, *indexCounts;
+    unsigned int totalBytes, numMnemonics;
+    unsigned int i, j;
+    char name[64];
+    int ret = -1;
+
+    functions = calloc(table->len > 0 ? table->len : 1, sizeof(struct size_report_function));
+    mnemonics = calloc(AVR_TOTAL_INSTRUCTIONS, sizeof(struct size_report_mnemonic));
+    indexBytes = calloc(AVR_TOTAL_INSTRUCTIONS, sizeof(unsigned int));
+    indexCounts = calloc(AVR_TOTAL_INSTRUCTIONS, sizeof(unsigned int));
+    if (functions == NULL || mnemonics == NULL || indexBytes == NULL || indexCounts == NULL)
+        goto cleanup;
+
+    /* Tally each function's instructions, and each instruction set entry */
+    totalBytes = 0;
+    for (i = 0; i < table->len; i++) {
+        functions[i].function = &table->functions[i];
+
+        for (j = table->functions[i].first; j < table->functions[i].first + table->functions[i].len; j++) {
+            const struct avrInstructionDisasm *instrDisasm = &program->instructions[j];
+            unsigned int width = instrDisasm->instructionInfo->width;
+            int index = AVR_ISET_INDEX(instrDisasm->instructionInfo);
+
+            functions[i].bytes += width;
+            if (index == AVR_ISET_INDEX_WORD || index == AVR_ISET_INDEX_BYTE) {
+                functions[i].dataBytes += width;
+            } else {
+                functions[i].numInstructions++;
+                if (width == 4)
+                    functions[i].numLongInstructions++;
+            }
+
+            indexBytes[index] += width;
+            indexCounts[index]++;
+        }
+
+        totalBytes += functions[i].bytes;
+    }
+
+    /* Merge instruction set entries by mnemonic */
+    numMnemonics = 0;
+    for (i = 0; i < AVR_TOTAL_INSTRUCTIONS; i++) {
+        if (indexCounts[i] == 0)
+            continue;
+        for (j = 0; j < numMnemonics; j++) {
+            if (strcmp(mnemonics[j].mnemonic, AVR_Instruction_Set[i].mnemonic) == 0)
+                break;
+        }
+        if (j == numMnemonics) {
+            mnemonics[j].mnemonic = AVR_Instruction_Set[i].mnemonic;
+            numMnemonics++;
+        }
+        mnemonics[j].bytes += indexBytes[i];
+        mnemonics[j].count += indexCounts[i];
+    }
+
+    qsort(functions, table->len, sizeof(struct size_report_function), util_size_function_compare);
+    qsort(mnemonics, numMnemonics, sizeof(struct size_report_mnemonic), util_size_mnemonic_compare);
+
+    /* Print function table */
+    if (fprintf(out, "%-32s %10s %8s %8s %8s %10s\n", "Function", "Address", "Bytes", "Instrs", "32-bit", ".dw bytes") < 0)
+        goto cleanup;
+    for (i = 0; i < table->len; i++) {
+        avr_function_name(functions[i].function, name, sizeof(name));
+        if (fprintf(out, "%-32s 0x%08x %8u %8u %8u %10u\n", name, functions[i].function->address, functions[i].bytes, functions[i].numInstructions, functions[i].numLongInstructions, functions[i].dataBytes) < 0)
+            goto cleanup;
+    }
+    if (fprintf(out, "%-32s %10s %8u\n\n", "Total", "", totalBytes) < 0)
+        goto cleanup;
+
+    /* Print mnemonic histogram */
+    if (fprintf(out, "%-8s %8s %8s %7s\n", "Mnemonic", "Count", "Bytes", "Share") < 0)
+        goto cleanup;
+    for (i = 0; i < numMnemonics; i++) {
+        if (fprintf(out, "%-8s %8u %8u %6.2f%%\n", mnemonics[i].mnemonic, mnemonics[i].count, mnemonics[i].bytes, (totalBytes > 0) ? (100.0*mnemonics[i].bytes)/totalBytes : 0.0) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+    cleanup:
+    free(functions);
+    free(mnemonics);
+    free(indexBytes);
+    free(indexCounts);
+    return ret;
+}
+
+
+/******************************************************************************/
+/* AVR Function Listing */
+/******************************************************************************/
+
+int avr_report_functions(FILE *out, const struct avrProgram *program, const struct avrFunctionTable *table, int flags) {
+    const struct avrInstructionDisasm *instrDisasm;
+    unsigned int i, f, numFingerprints;
+    char line[128], name[64];
+
+    numFingerprints = 0;
+    for (i = 0, f = 0; i < program->len; i++) {
+        instrDisasm = &program->instructions[i];
+
+        /* Origin at the start and at address discontinuities */
+        if (i == 0 || instrDisasm->address != program->instructions[i-1].address + program->instructions[i-1].instructionInfo->width) {
+            if (avr_instruction_format_origin(instrDisasm->address, line, sizeof(line), flags) < 0)
+                return -1;
+            fputs(line, out);
+        }
+
+        /* Function name ahead of its first instruction */
+        if (f < table->len && table->functions[f].first == i) {
+            avr_function_name(&table->functions[f], name, sizeof(name));
+            fprintf(out, "\n; %s%s\n", name, (table->functions[f].sources & AVR_FUNCTION_FINGERPRINT) ? " (fingerprint)" : "");
+            if (table->functions[f].sources & AVR_FUNCTION_FINGERPRINT)
+                numFingerprints++;
+            f++;
+        }
+
+        if (avr_instruction_format(instrDisasm, line, sizeof(line), flags) < 0)
+            return -1;
+        fputs(line, out);
+        fputc('\n', out);
+    }
+
+    fprintf(out, "\n; %u of %u functions named by fingerprint\n", numFingerprints, table->len);
+
+    return ferror(out) ? -1 : 0;
+}
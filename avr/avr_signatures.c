@@ -0,0 +1,540 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include <byte_stream.h>
+
+#include "avr_instruction_set.h"
+#include "avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Signature Parsing */
+/******************************************************************************/
+
+/* Maximum length of a signature file line */
+#define SIGNATURE_MAX_LINE          4096
+/* Maximum number of encodings of a signature word */
+#define SIGNATURE_MAX_ALTERNATIVES  16
+/* Maximum number of automaton transitions */
+#define SIGNATURE_MAX_TRANSITIONS   (1UL << 26)
+
+/* Signature word, matching an opcode word if any of its value / mask pairs
+ * does */
+struct signature_word {
+    uint16_t values[SIGNATURE_MAX_ALTERNATIVES];
+    uint16_t masks[SIGNATURE_MAX_ALTERNATIVES];
+    unsigned int numAlternatives;
+};
+
+/* Signatures being parsed */
+struct signature_parse {
+    /* Words of all signatures */
+    struct signature_word *words;
+    unsigned int numWords;
+    unsigned int capacityWords;
+    /* Index of the first word and line number of each signature */
+    unsigned int *firsts;
+    unsigned int *lines;
+    unsigned int capacitySignatures;
+};
+
+static int util_signature_word_match(const struct signature_word *word, uint16_t opcode) {
+    unsigned int i;
+
+    for (i = 0; i < word->numAlternatives; i++) {
+        if ((opcode & word->masks[i]) == word->values[i])
+            return 1;
+    }
+
+    return 0;
+}
+
+static int util_hex_nibble(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c = (char)tolower((unsigned char)c);
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/* Parse four hex digits, with ? for a don't care nibble unless value only */
+static int util_hex_word(const char *token, size_t len, uint16_t *value, uint16_t *mask, int valueOnly) {
+    size_t i;
+    int nibble;
+
+    if (len != 4)
+        return -1;
+
+    *value = *mask = 0;
+    for (i = 0; i < 4; i++) {
+        *value <<= 4;
+        *mask <<= 4;
+        if (token[i] == '?' && !valueOnly)
+            continue;
+        if ((nibble = util_hex_nibble(token[i])) < 0)
+            return -1;
+        *value |= (uint16_t)nibble;
+        *mask |= 0xf;
+    }
+
+    return 0;
+}
+
+/* Case insensitive compare of a mnemonic and a token */
+static int util_mnemonic_equal(const char *mnemonic, const char *token, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (mnemonic[i] == '\0' || mnemonic[i] != tolower((unsigned char)token[i]))
+            return 0;
+    }
+
+    return mnemonic[len] == '\0';
+}
+
+static int util_signature_word_parse(struct signature_word *word, const char *token, size_t len) {
+    const char *slash;
+    uint16_t mask;
+    int i;
+
+    memset(word, 0, sizeof(struct signature_word));
+
+    /* Any word */
+    if (len == 1 && token[0] == '*') {
+        word->numAlternatives = 1;
+        return 0;
+    }
+
+    /* <value>/<mask> */
+    if ((slash = memchr(token, '/', len)) != NULL) {
+        if (util_hex_word(token, (size_t)(slash - token), &word->values[0], &mask, 1) < 0)
+            return -1;
+        if (util_hex_word(slash + 1, len - (size_t)(slash - token) - 1, &word->masks[0], &mask, 1) < 0)
+            return -1;
+        word->values[0] &= word->masks[0];
+        word->numAlternatives = 1;
+        return 0;
+    }
+
+    /* Hex digits with don't care nibbles */
+    if (util_hex_word(token, len, &word->values[0], &word->masks[0], 0) == 0) {
+        word->numAlternatives = 1;
+        return 0;
+    }
+
+    /* Every encoding of a mnemonic, with the operand bits of its first word
+     * don't care */
+    for (i = 0; i < AVR_TOTAL_INSTRUCTIONS; i++) {
+        if (i == AVR_ISET_INDEX_WORD || i == AVR_ISET_INDEX_BYTE)
+            continue;
+        if (!util_mnemonic_equal(AVR_Instruction_Set[i].mnemonic, token, len))
+            continue;
+        if (word->numAlternatives == SIGNATURE_MAX_ALTERNATIVES)
+            return -1;
+        word->masks[word->numAlternatives] = (uint16_t)~(AVR_Instruction_Set[i].operandMasks[0] | AVR_Instruction_Set[i].operandMasks[1]);
+        word->values[word->numAlternatives] = AVR_Instruction_Set[i].instructionMask & word->masks[word->numAlternatives];
+        word->numAlternatives++;
+    }
+
+    return (word->numAlternatives > 0) ? 0 : -1;
+}
+
+/* Parse a signature line into a name and words. Returns 1 for a signature, 0
+ * for a blank or comment line, -1 on error. */
+static int util_signature_line(struct avrSignatureSet *set, struct signature_parse *parse, char *line, unsigned int number) {
+    char *p, *colon, *end, *name;
+    size_t len;
+
+    /* Strip comments and surrounding whitespace */
+    if ((p = strchr(line, '#')) != NULL)
+        *p = '\0';
+    for (p = line; isspace((unsigned char)*p); p++)
+        ;
+    if (*p == '\0')
+        return 0;
+
+    /* Name */
+    if ((colon = strchr(p, ':')) == NULL)
+        return -1;
+    for (end = colon; end > p && isspace((unsigned char)end[-1]); end--)
+        ;
+    if (end == p)
+        return -1;
+
+    /* Grow the signature arrays if needed */
+    if (set->numSignatures == parse->capacitySignatures) {
+        unsigned int capacity = (parse->capacitySignatures == 0) ? 64 : parse->capacitySignatures*2;
+        char **names = realloc(set->names, capacity*sizeof(char *));
+        unsigned int *lengths, *firsts, *lines;
+        if (names == NULL)
+            return -1;
+        set->names = names;
+        if ((lengths = realloc(set->lengths, capacity*sizeof(unsigned int))) == NULL)
+            return -1;
+        set->lengths = lengths;
+        if ((firsts = realloc(parse->firsts, capacity*sizeof(unsigned int))) == NULL)
+            return -1;
+        parse->firsts = firsts;
+        if ((lines = realloc(parse->lines, capacity*sizeof(unsigned int))) == NULL)
+            return -1;
+        parse->lines = lines;
+        parse->capacitySignatures = capacity;
+    }
+
+    if ((name = malloc((size_t)(end - p) + 1)) == NULL)
+        return -1;
+    memcpy(name, p, (size_t)(end - p));
+    name[end - p] = '\0';
+    set->names[set->numSignatures] = name;
+    set->lengths[set->numSignatures] = 0;
+    parse->firsts[set->numSignatures] = parse->numWords;
+    parse->lines[set->numSignatures] = number;
+    set->numSignatures++;
+
+    /* Words */
+    for (p = colon + 1; ; p += len) {
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == '\0')
+            break;
+        for (len = 0; p[len] != '\0' && !isspace((unsigned char)p[len]); len++)
+            ;
+
+        /* Grow the word array if needed */
+        if (parse->numWords == parse->capacityWords) {
+            unsigned int capacity = (parse->capacityWords == 0) ? 256 : parse->capacityWords*2;
+            struct signature_word *words = realloc(parse->words, capacity*sizeof(struct signature_word));
+            if (words == NULL)
+                return -1;
+            parse->words = words;
+            parse->capacityWords = capacity;
+        }
+
+        if (util_signature_word_parse(&parse->words[parse->numWords], p, len) < 0)
+            return -1;
+        parse->numWords++;
+        set->lengths[set->numSignatures-1]++;
+    }
+
+    return (set->lengths[set->numSignatures-1] > 0) ? 1 : -1;
+}
+
+/******************************************************************************/
+/* AVR Signature Automaton */
+/******************************************************************************/
+
+/* Split the opcode words into classes matching the same signature words */
+static int util_signature_classes(struct avrSignatureSet *set, const struct signature_parse *parse) {
+    int32_t *split;
+    unsigned int i, numClasses, key;
+    uint32_t opcode;
+
+    if ((set->classes = calloc(65536, sizeof(uint16_t))) == NULL)
+        return -1;
+    if ((split = malloc(2*65536*sizeof(int32_t))) == NULL)
+        return -1;
+
+    /* Refine the classes by each signature word in turn */
+    set->numClasses = 1;
+    for (i = 0; i < parse->numWords; i++) {
+        for (key = 0; key < 2*set->numClasses; key++)
+            split[key] = -1;
+
+        numClasses = 0;
+        for (opcode = 0; opcode < 65536; opcode++) {
+            key = 2*set->classes[opcode] + (unsigned int)util_signature_word_match(&parse->words[i], (uint16_t)opcode);
+            if (split[key] < 0)
+                split[key] = (int32_t)numClasses++;
+            set->classes[opcode] = (uint16_t)split[key];
+        }
+        set->numClasses = numClasses;
+    }
+
+    free(split);
+
+    return 0;
+}
+
+/* Grow the automaton state arrays for one more state. Returns the new state,
+ * or 0 on error. */
+static uint32_t util_signature_state_add(struct avrSignatureSet *set, uint32_t *capacity) {
+    uint32_t *transitions, *accepts;
+
+    if (set->numStates == *capacity) {
+        uint32_t newCapacity = (*capacity == 0) ? 256 : *capacity*2;
+        if ((uint64_t)newCapacity*set->numClasses > SIGNATURE_MAX_TRANSITIONS)
+            return 0;
+        if ((transitions = realloc(set->transitions, (size_t)newCapacity*set->numClasses*sizeof(uint32_t))) == NULL)
+            return 0;
+        set->transitions = transitions;
+        if ((accepts = realloc(set->accepts, (size_t)newCapacity*sizeof(uint32_t))) == NULL)
+            return 0;
+        set->accepts = accepts;
+        *capacity = newCapacity;
+    }
+
+    memset(&set->transitions[(size_t)set->numStates*set->numClasses], 0, set->numClasses*sizeof(uint32_t));
+    set->accepts[set->numStates] = AVR_SIGNATURE_NONE;
+
+    return set->numStates++;
+}
+
+/* Insert every class string a signature expands to into the trie */
+static int util_signature_insert(struct avrSignatureSet *set, const struct signature_parse *parse, uint16_t *representatives, unsigned int signature, uint32_t *capacity, uint32_t *capacityAccepts) {
+    const struct signature_word *words = &parse->words[parse->firsts[signature]];
+    unsigned int len = set->lengths[signature];
+    unsigned int *position, expansions = 1, count, i, c;
+    uint32_t state, next, *grown;
+
+    /* Expansions are counted first to bound the trie */
+    for (i = 0; i < len; i++) {
+        for (c = 0, count = 0; c < set->numClasses; c++)
+            count += (unsigned int)util_signature_word_match(&words[i], representatives[c]);
+        if (count == 0)
+            return -1;
+        expansions *= count;
+        if (expansions > AVR_SIGNATURE_MAX_EXPANSIONS)
+            return -1;
+    }
+
+    /* Odometer over the classes matching each word */
+    if ((position = calloc(len, sizeof(unsigned int))) == NULL)
+        return -1;
+    for (i = 0; i < len; i++) {
+        while (!util_signature_word_match(&words[i], representatives[position[i]]))
+            position[i]++;
+    }
+
+    while (1) {
+        /* Insert the class string */
+        for (i = 0, state = 0; i < len; i++) {
+            next = set->transitions[(size_t)state*set->numClasses + position[i]];
+            if (next == 0) {
+                if ((next = util_signature_state_add(set, capacity)) == 0)
+                    goto error;
+                set->transitions[(size_t)state*set->numClasses + position[i]] = next;
+            }
+            state = next;
+        }
+
+        /* Chain the signature onto the accepting state */
+        if (set->numAccepts == *capacityAccepts) {
+            *capacityAccepts = (*capacityAccepts == 0) ? 64 : *capacityAccepts*2;
+            if ((grown = realloc(set->acceptSignatures, *capacityAccepts*sizeof(uint32_t))) == NULL)
+                goto error;
+            set->acceptSignatures = grown;
+            if ((grown = realloc(set->acceptNext, *capacityAccepts*sizeof(uint32_t))) == NULL)
+                goto error;
+            set->acceptNext = grown;
+        }
+        set->acceptSignatures[set->numAccepts] = signature;
+        set->acceptNext[set->numAccepts] = set->accepts[state];
+        set->accepts[state] = set->numAccepts++;
+
+        /* Next class string */
+        for (i = len; i-- > 0; ) {
+            for (position[i]++; position[i] < set->numClasses && !util_signature_word_match(&words[i], representatives[position[i]]); position[i]++)
+                ;
+            if (position[i] < set->numClasses)
+                break;
+            position[i] = 0;
+            while (!util_signature_word_match(&words[i], representatives[position[i]]))
+                position[i]++;
+        }
+        if (i == (unsigned int)-1)
+            break;
+    }
+
+    free(position);
+    return 0;
+
+    error:
+    free(position);
+    return -1;
+}
+
+/* Complete the trie into an Aho-Corasick automaton, breadth first */
+static int util_signature_links(struct avrSignatureSet *set) {
+    uint32_t *queue, *fail;
+    uint32_t head = 0, tail = 0, state, next, c;
+
+    queue = malloc(set->numStates*sizeof(uint32_t));
+    fail = calloc(set->numStates, sizeof(uint32_t));
+    if ((set->outputs = calloc(set->numStates, sizeof(uint32_t))) == NULL || queue == NULL || fail == NULL) {
+        free(queue);
+        free(fail);
+        return -1;
+    }
+
+    for (c = 0; c < set->numClasses; c++) {
+        if ((next = set->transitions[c]) != 0)
+            queue[tail++] = next;
+    }
+
+    while (head < tail) {
+        state = queue[head++];
+        for (c = 0; c < set->numClasses; c++) {
+            next = set->transitions[(size_t)state*set->numClasses + c];
+            if (next != 0) {
+                fail[next] = set->transitions[(size_t)fail[state]*set->numClasses + c];
+                set->outputs[next] = (set->accepts[fail[next]] != AVR_SIGNATURE_NONE) ? fail[next] : set->outputs[fail[next]];
+                queue[tail++] = next;
+            } else {
+                set->transitions[(size_t)state*set->numClasses + c] = set->transitions[(size_t)fail[state]*set->numClasses + c];
+            }
+        }
+    }
+
+    free(queue);
+    free(fail);
+
+    return 0;
+}
+
+/******************************************************************************/
+/* AVR Signature Search Support */
+/******************************************************************************/
+
+int avr_signatures_load(struct avrSignatureSet *set, FILE *in, unsigned int *line) {
+    struct signature_parse parse;
+    char buf[SIGNATURE_MAX_LINE];
+    uint16_t *representatives = NULL;
+    uint32_t capacity = 0, capacityAccepts = 0, opcode;
+    unsigned int i;
+
+    memset(set, 0, sizeof(struct avrSignatureSet));
+    memset(&parse, 0, sizeof(parse));
+    *line = 0;
+
+    /* Parse the signatures */
+    while (fgets(buf, sizeof(buf), in) != NULL) {
+        (*line)++;
+        if (strchr(buf, '\n') == NULL && !feof(in))
+            goto error;
+        if (util_signature_line(set, &parse, buf, *line) < 0)
+            goto error;
+    }
+    if (ferror(in))
+        goto error;
+    *line = 0;
+
+    /* Classes of opcode words, with a representative word of each */
+    if (util_signature_classes(set, &parse) < 0)
+        goto error;
+    if ((representatives = malloc(set->numClasses*sizeof(uint16_t))) == NULL)
+        goto error;
+    for (opcode = 65536; opcode-- > 0; )
+        representatives[set->classes[opcode]] = (uint16_t)opcode;
+
+    /* Trie of the class strings, with the root as state 0 */
+    if (util_signature_state_add(set, &capacity) != 0 || set->numStates != 1)
+        goto error;
+    for (i = 0; i < set->numSignatures; i++) {
+        if (util_signature_insert(set, &parse, representatives, i, &capacity, &capacityAccepts) < 0) {
+            /* Report the signature that doesn't fit */
+            *line = parse.lines[i];
+            goto error;
+        }
+    }
+
+    if (util_signature_links(set) < 0)
+        goto error;
+
+    free(representatives);
+    free(parse.words);
+    free(parse.firsts);
+    free(parse.lines);
+
+    return 0;
+
+    error:
+    free(representatives);
+    free(parse.words);
+    free(parse.firsts);
+    free(parse.lines);
+    avr_signatures_free(set);
+    return -1;
+}
+
+void avr_signatures_free(struct avrSignatureSet *set) {
+    unsigned int i;
+
+    for (i = 0; i < set->numSignatures; i++)
+        free(set->names[i]);
+    free(set->names);
+    free(set->lengths);
+    free(set->classes);
+    free(set->transitions);
+    free(set->accepts);
+    free(set->outputs);
+    free(set->acceptSignatures);
+    free(set->acceptNext);
+    memset(set, 0, sizeof(struct avrSignatureSet));
+}
+
+static int util_signature_match_compare(const void *a, const void *b) {
+    const struct avrSignatureMatch *ma = (const struct avrSignatureMatch *)a;
+    const struct avrSignatureMatch *mb = (const struct avrSignatureMatch *)b;
+
+    if (ma->address != mb->address)
+        return (ma->address < mb->address) ? -1 : 1;
+    if (ma->signature != mb->signature)
+        return (ma->signature < mb->signature) ? -1 : 1;
+    return 0;
+}
+
+int avr_signatures_scan(const struct avrSignatureSet *set, const struct ByteImage *image, struct avrSignatureMatches *matches) {
+    const struct ByteImageSegment *segment;
+    const uint8_t *data;
+    uint32_t i, offset, address, state, accepting, entry;
+    struct avrSignatureMatch *grown;
+
+    memset(matches, 0, sizeof(struct avrSignatureMatches));
+
+    if (set->numStates == 0)
+        return 0;
+
+    for (i = 0; i < image->numSegments; i++) {
+        segment = &image->segments[i];
+        data = image->data + segment->offset;
+
+        /* Words start at even addresses, and a segment starts over */
+        state = 0;
+        for (offset = (segment->address & 1); offset + 1 < segment->len; offset += 2) {
+            state = set->transitions[(size_t)state*set->numClasses + set->classes[(uint16_t)(data[offset+1] << 8) | data[offset]]];
+
+            accepting = (set->accepts[state] != AVR_SIGNATURE_NONE) ? state : set->outputs[state];
+            for (; accepting != 0; accepting = set->outputs[accepting]) {
+                for (entry = set->accepts[accepting]; entry != AVR_SIGNATURE_NONE; entry = set->acceptNext[entry]) {
+                    /* Grow the match array if needed */
+                    if (matches->len == matches->capacity) {
+                        unsigned int capacity = (matches->capacity == 0) ? 64 : matches->capacity*2;
+                        if ((grown = realloc(matches->matches, capacity*sizeof(struct avrSignatureMatch))) == NULL) {
+                            avr_signature_matches_free(matches);
+                            return -1;
+                        }
+                        matches->matches = grown;
+                        matches->capacity = capacity;
+                    }
+
+                    address = segment->address + offset + 2 - 2*set->lengths[set->acceptSignatures[entry]];
+                    matches->matches[matches->len].address = address;
+                    matches->matches[matches->len].signature = set->acceptSignatures[entry];
+                    matches->len++;
+                }
+            }
+        }
+    }
+
+    qsort(matches->matches, matches->len, sizeof(struct avrSignatureMatch), util_signature_match_compare);
+
+    return 0;
+}
+
+void avr_signature_matches_free(struct avrSignatureMatches *matches) {
+    free(matches->matches);
+    memset(matches, 0, sizeof(struct avrSignatureMatches));
+}
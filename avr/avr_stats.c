@@ -0,0 +1,169 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <disasm_stream.h>
+#include <instruction.h>
+
+#include "avr_instruction_set.h"
+#include "avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Instruction Statistics */
+/******************************************************************************/
+
+/* Short names of operand types, indexed by operand type */
+static const char *AVR_Operand_Type_Names[AVR_TOTAL_OPERAND_TYPES] = {
+    "none",
+    "reg", "reg16",
+    "pair", "pair24",
+    "branch", "rel", "abs",
+    "io", "data", "round", "bit",
+    "X", "X+", "-X",
+    "Y", "Y+", "-Y", "Y+q",
+    "Z", "Z+", "-Z", "Z+q",
+    "word", "byte",
+};
+
+void avr_stats_init(struct avrStats *stats) {
+    memset(stats, 0, sizeof(struct avrStats));
+}
+
+int avr_stats_read(struct avrStats *stats, struct DisasmStream *ds) {
+    struct instruction instr;
+    struct avrInstructionDisasm *instrDisasm;
+    int i, ret;
+
+    /* Initialize the disasm stream */
+    if ((ret = ds->stream_init(ds)) < 0)
+        return ret;
+
+    /* Tally disassembled instructions until EOF */
+    while ( (ret = ds->stream_read(ds, &instr)) != STREAM_EOF ) {
+        if (ret < 0) {
+            ds->stream_close(ds);
+            return ret;
+        }
+
+        instrDisasm = (struct avrInstructionDisasm *)instr.instructionDisasm;
+
+        stats->instructions++;
+        stats->bytes += instr.width;
+        stats->instructionCounts[AVR_ISET_INDEX(instrDisasm->instructionInfo)]++;
+        for (i = 0; i < instrDisasm->instructionInfo->numOperands; i++)
+            stats->operandCounts[instrDisasm->instructionInfo->operandTypes[i]]++;
+    }
+
+    /* Close the disasm stream */
+    if ((ret = ds->stream_close(ds)) < 0)
+        return ret;
+
+    stats->files++;
+
+    return 0;
+}
+
+void avr_stats_merge(struct avrStats *stats, const struct avrStats *other) {
+    int i;
+
+    stats->files += other->files;
+    stats->bytes += other->bytes;
+    stats->instructions += other->instructions;
+    for (i = 0; i < AVR_ISET_MAX_INSTRUCTIONS; i++)
+        stats->instructionCounts[i] += other->instructionCounts[i];
+    for (i = 0; i < AVR_TOTAL_OPERAND_TYPES; i++)
+        stats->operandCounts[i] += other->operandCounts[i];
+}
+
+/* Sort entry for instruction or operand counts */
+struct stats_entry {
+    int index;
+    uint64_t count;
+};
+
+static int util_stats_entry_compare(const void *a, const void *b) {
+    const struct stats_entry *ea = (const struct stats_entry *)a;
+    const struct stats_entry *eb = (const struct stats_entry *)b;
+
+    /* Descending count, then ascending index */
+    if (ea->count != eb->count)
+        return (ea->count > eb->count) ? -1 : 1;
+    return ea->index - eb->index;
+}
+
+static void util_stats_instruction_name(int index, char *name, size_t size) {
+    const struct avrInstructionInfo *instructionInfo = &AVR_Instruction_Set[index];
+    int i, n;
+
+    /* Mnemonic followed by operand types, e.g. "ld reg, X+" */
+    n = snprintf(name, size, "%s", instructionInfo->mnemonic);
+    for (i = 0; i < instructionInfo->numOperands && n > 0 && (size_t)n < size; i++)
+        n += snprintf(name + n, size - n, "%s%s", (i == 0) ? " " : ", ", AVR_Operand_Type_Names[instructionInfo->operandTypes[i]]);
+}
+
+int avr_stats_print(FILE *out, const struct avrStats *stats, int json) {
+    struct stats_entry instructions[AVR_ISET_MAX_INSTRUCTIONS];
+    struct stats_entry operands[AVR_TOTAL_OPERAND_TYPES];
+    int numInstructions, numOperands, i;
+    uint64_t totalOperands;
+    char name[64];
+
+    /* Collect and sort non-zero counts */
+    for (i = 0, numInstructions = 0; i < AVR_TOTAL_INSTRUCTIONS; i++) {
+        if (stats->instructionCounts[i] == 0)
+            continue;
+        instructions[numInstructions].index = i;
+        instructions[numInstructions++].count = stats->instructionCounts[i];
+    }
+    for (i = 0, numOperands = 0, totalOperands = 0; i < AVR_TOTAL_OPERAND_TYPES; i++) {
+        if (stats->operandCounts[i] == 0)
+            continue;
+        operands[numOperands].index = i;
+        operands[numOperands++].count = stats->operandCounts[i];
+        totalOperands += stats->operandCounts[i];
+    }
+    qsort(instructions, numInstructions, sizeof(struct stats_entry), util_stats_entry_compare);
+    qsort(operands, numOperands, sizeof(struct stats_entry), util_stats_entry_compare);
+
+    if (json) {
+        if (fprintf(out, "{\n  \"files\": %llu,\n  \"bytes\": %llu,\n  \"instructions\": %llu,\n  \"instruction_counts\": [", (unsigned long long)stats->files, (unsigned long long)stats->bytes, (unsigned long long)stats->instructions) < 0)
+            return -1;
+        for (i = 0; i < numInstructions; i++) {
+            util_stats_instruction_name(instructions[i].index, name, sizeof(name));
+            if (fprintf(out, "%s\n    {\"index\": %d, \"instruction\": \"%s\", \"count\": %llu}", (i == 0) ? "" : ",", instructions[i].index, name, (unsigned long long)instructions[i].count) < 0)
+                return -1;
+        }
+        if (fprintf(out, "\n  ],\n  \"operand_counts\": [") < 0)
+            return -1;
+        for (i = 0; i < numOperands; i++) {
+            if (fprintf(out, "%s\n    {\"type\": \"%s\", \"count\": %llu}", (i == 0) ? "" : ",", AVR_Operand_Type_Names[operands[i].index], (unsigned long long)operands[i].count) < 0)
+                return -1;
+        }
+        if (fprintf(out, "\n  ]\n}\n") < 0)
+            return -1;
+
+        return 0;
+    }
+
+    if (fprintf(out, "Files: %llu, Bytes: %llu, Instructions: %llu\n\n", (unsigned long long)stats->files, (unsigned long long)stats->bytes, (unsigned long long)stats->instructions) < 0)
+        return -1;
+
+    if (fprintf(out, "%-5s %-24s %12s %7s\n", "Index", "Instruction", "Count", "Share") < 0)
+        return -1;
+    for (i = 0; i < numInstructions; i++) {
+        util_stats_instruction_name(instructions[i].index, name, sizeof(name));
+        if (fprintf(out, "%-5d %-24s %12llu %6.2f%%\n", instructions[i].index, name, (unsigned long long)instructions[i].count, (100.0*instructions[i].count)/stats->instructions) < 0)
+            return -1;
+    }
+
+    if (fprintf(out, "\n%-30s %12s %7s\n", "Operand Type", "Count", "Share") < 0)
+        return -1;
+    for (i = 0; i < numOperands; i++) {
+        if (fprintf(out, "%-30s %12llu %6.2f%%\n", AVR_Operand_Type_Names[operands[i].index], (unsigned long long)operands[i].count, (100.0*operands[i].count)/totalOperands) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
@@ -4,11 +4,44 @@
 #include <disasm_stream.h>
 #include <instruction.h>
 
+#include "avr_instruction_set.h"
+
 /* AVR Disassembly Stream Support */
 int disasm_stream_avr_init(struct DisasmStream *self);
 int disasm_stream_avr_close(struct DisasmStream *self);
 int disasm_stream_avr_read(struct DisasmStream *self, struct instruction *instr);
 
+/* AVR Program Disasm Stream Support. Replays the instructions of a decoded
+ * struct avrProgram in in_program. */
+int disasm_stream_avr_program_init(struct DisasmStream *self);
+int disasm_stream_avr_program_close(struct DisasmStream *self);
+int disasm_stream_avr_program_read(struct DisasmStream *self, struct instruction *instr);
+
+/* AVR Instruction Set Lookup Support. Builds the shared opcode lookup table
+ * once, safe to call from multiple threads. */
+void avr_iset_lookup_init(void);
+
+/* AVR Instruction Decode Support. Decodes one instruction from len
+ * consecutive bytes at address, where len < 4 marks the end of the run.
+ * Returns the number of bytes consumed, which avr_disasm_width() returns
+ * without decoding. */
+int avr_disasm_decode(const uint8_t *data, unsigned int len, uint32_t address, struct avrInstructionDisasm *instrDisasm);
+int avr_disasm_width(const uint8_t *data, unsigned int len);
+
+/* AVR Instruction Boundary Support. Sets the bits of the instruction starts of
+ * len consecutive bytes in bitmap, where bit first is data[0]. */
+void avr_disasm_boundaries(const uint8_t *data, uint32_t len, uint8_t *bitmap, uint32_t first);
+
+/* AVR Instruction Format Support. Formats into a caller buffer like snprintf,
+ * returning the untruncated length or -1 on error. */
+int avr_instruction_format_origin(uint32_t address, char *buf, size_t size, int flags);
+int avr_instruction_format(const struct avrInstructionDisasm *instrDisasm, char *buf, size_t size, int flags);
+
+/* AVR File Mapping Support. Maps a whole file read-only, or reads it into
+ * memory where there is no mmap(). Returns NULL on error or an empty file. */
+void *avr_file_map(const char *path, size_t *size);
+void avr_file_unmap(void *base, size_t size);
+
 /* AVR Instruction Print Support */
 int avr_instruction_print_origin(struct instruction *instr, FILE *out, int flags);
 int avr_instruction_print(struct instruction *instr, FILE *out, int flags);
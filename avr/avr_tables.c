@@ -0,0 +1,795 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "avr_instruction_set.h"
+#include "avr_support.h"
+#include "avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Z Pointer Constant Propagation */
+/******************************************************************************/
+
+/* I/O address of RAMPZ */
+#define AVR_IO_RAMPZ    0x3b
+
+/* Instructions of the propagation */
+enum {
+    TABLES_OP_NONE,
+    TABLES_OP_LDI,
+    TABLES_OP_SER,
+    TABLES_OP_MOV,
+    TABLES_OP_MOVW,
+    TABLES_OP_ADIW,
+    TABLES_OP_SBIW,
+    TABLES_OP_SUBI,
+    TABLES_OP_SBCI,
+    TABLES_OP_ADD,
+    TABLES_OP_ADC,
+    TABLES_OP_OUT,
+    TABLES_OP_LPM,
+    TABLES_OP_ELPM,
+    TABLES_OP_IJMP,
+    TABLES_OP_ICALL,
+};
+
+/* Kinds of a resolved address, before it is applied to the map */
+enum {
+    TABLES_DATA,
+    TABLES_ROOT,
+    TABLES_JUMP_TABLE,
+};
+
+/* Resolved address of an lpm, elpm, ijmp or icall */
+struct tables_candidate {
+    uint32_t address;
+    uint32_t source;
+    int kind;
+};
+
+/* Resolved addresses pending application to the map */
+struct tables_candidates {
+    struct tables_candidate *candidates;
+    unsigned int len;
+    unsigned int capacity;
+};
+
+/* Known register values within a basic block */
+struct tables_state {
+    uint8_t values[32];
+    /* Registers with a known value */
+    uint32_t known;
+    /* Carry flag after subi / sbci / add / adc, or -1 if unknown */
+    int carry;
+    /* RAMPZ, or -1 if unknown */
+    int rampz;
+    /* Z holds an unknown index plus offset */
+    int indexed;
+    uint16_t offset;
+    /* Low byte subtracted from an unknown R30 by the previous instruction */
+    int pending;
+    uint8_t pendingLow;
+};
+
+static int util_tables_op(const struct avrInstructionInfo *instructionInfo) {
+    const char *mnemonic = instructionInfo->mnemonic;
+
+    switch (mnemonic[0]) {
+        case 'a':
+            if (strcmp(mnemonic, "adiw") == 0)
+                return TABLES_OP_ADIW;
+            if (strcmp(mnemonic, "add") == 0)
+                return TABLES_OP_ADD;
+            if (strcmp(mnemonic, "adc") == 0)
+                return TABLES_OP_ADC;
+            break;
+        case 'e':
+            if (strcmp(mnemonic, "elpm") == 0)
+                return TABLES_OP_ELPM;
+            break;
+        case 'i':
+            if (strcmp(mnemonic, "ijmp") == 0)
+                return TABLES_OP_IJMP;
+            if (strcmp(mnemonic, "icall") == 0)
+                return TABLES_OP_ICALL;
+            break;
+        case 'l':
+            if (strcmp(mnemonic, "ldi") == 0)
+                return TABLES_OP_LDI;
+            if (strcmp(mnemonic, "lpm") == 0)
+                return TABLES_OP_LPM;
+            break;
+        case 'm':
+            if (strcmp(mnemonic, "mov") == 0)
+                return TABLES_OP_MOV;
+            if (strcmp(mnemonic, "movw") == 0)
+                return TABLES_OP_MOVW;
+            break;
+        case 'o':
+            if (strcmp(mnemonic, "out") == 0)
+                return TABLES_OP_OUT;
+            break;
+        case 's':
+            if (strcmp(mnemonic, "ser") == 0)
+                return TABLES_OP_SER;
+            if (strcmp(mnemonic, "sbiw") == 0)
+                return TABLES_OP_SBIW;
+            if (strcmp(mnemonic, "subi") == 0)
+                return TABLES_OP_SUBI;
+            if (strcmp(mnemonic, "sbci") == 0)
+                return TABLES_OP_SBCI;
+            break;
+        default:
+            break;
+    }
+
+    return TABLES_OP_NONE;
+}
+
+static void util_tables_reset(struct tables_state *state) {
+    memset(state, 0, sizeof(struct tables_state));
+    state->carry = -1;
+    state->rampz = -1;
+}
+
+static void util_tables_set(struct tables_state *state, int reg, unsigned int value) {
+    state->values[reg] = (uint8_t)value;
+    state->known |= AVR_REG(reg);
+}
+
+static int util_tables_known(const struct tables_state *state, int reg) {
+    return (state->known & AVR_REG(reg)) != 0;
+}
+
+static int util_tables_candidate_add(struct tables_candidates *pending, uint32_t address, uint32_t source, int kind) {
+    /* Grow the candidate array if needed */
+    if (pending->len == pending->capacity) {
+        unsigned int capacity = (pending->capacity == 0) ? 64 : pending->capacity*2;
+        struct tables_candidate *candidates = realloc(pending->candidates, capacity*sizeof(struct tables_candidate));
+        if (candidates == NULL)
+            return -1;
+        pending->candidates = candidates;
+        pending->capacity = capacity;
+    }
+
+    pending->candidates[pending->len].address = address;
+    pending->candidates[pending->len].source = source;
+    pending->candidates[pending->len].kind = kind;
+    pending->len++;
+
+    return 0;
+}
+
+/* Flash address read by an lpm / elpm or jumped to by an ijmp / icall, from
+ * the current Z */
+static int util_tables_resolve_z(struct tables_candidates *pending, const struct tables_state *state, const struct avrInstructionDisasm *instrDisasm, int op) {
+    uint32_t z;
+    int indexed;
+
+    if (util_tables_known(state, 30) && util_tables_known(state, 31)) {
+        z = (uint32_t)(state->values[31] << 8) | state->values[30];
+        indexed = 0;
+    } else if (state->indexed) {
+        z = state->offset;
+        indexed = 1;
+    } else {
+        return 0;
+    }
+
+    switch (op) {
+        case TABLES_OP_ELPM:
+            if (state->rampz < 0)
+                return 0;
+            z |= (uint32_t)state->rampz << 16;
+            /* Fall through */
+        case TABLES_OP_LPM:
+            return util_tables_candidate_add(pending, z, instrDisasm->address, TABLES_DATA);
+        default:
+            /* Z is a word address */
+            return util_tables_candidate_add(pending, 2*z, instrDisasm->address, indexed ? TABLES_JUMP_TABLE : TABLES_ROOT);
+    }
+}
+
+/* Whether instruction i starts a basic block, by the block leaders if known,
+ * otherwise by the previous instruction */
+static int util_tables_block_start(const struct avrProgram *program, unsigned int i, const uint8_t *leaders) {
+    const struct avrInstructionDisasm *previous = &program->instructions[i-1];
+
+    if (leaders != NULL)
+        return leaders[i];
+
+    if (program->instructions[i].address != previous->address + previous->instructionInfo->width)
+        return 1;
+
+    switch (avr_instruction_flow(previous->instructionInfo)) {
+        case AVR_FLOW_BRANCH:
+        case AVR_FLOW_SKIP:
+        case AVR_FLOW_JUMP:
+        case AVR_FLOW_INDIRECT_JUMP:
+        case AVR_FLOW_RETURN:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Propagate constants through instructions first up to the end of their basic
+ * block or last, adding the resolved addresses to pending */
+static int util_tables_scan(struct tables_candidates *pending, const struct avrProgram *program, unsigned int first, unsigned int last, const uint8_t *leaders) {
+    const struct avrInstructionDisasm *instrDisasm;
+    struct avrRegisterEffects effects;
+    struct tables_state state;
+    unsigned int i, value, result;
+    int op, flow, d, r, pendingLow, increment;
+
+    util_tables_reset(&state);
+
+    for (i = first; i < last; i++) {
+        instrDisasm = &program->instructions[i];
+
+        /* Stop at the next block */
+        if (i > first && util_tables_block_start(program, i, leaders))
+            break;
+
+        op = util_tables_op(instrDisasm->instructionInfo);
+        d = instrDisasm->operandDisasms[0];
+        r = instrDisasm->operandDisasms[1];
+
+        /* A subtraction from an unknown R30 only pairs with the next sbci */
+        pendingLow = state.pending ? state.pendingLow : -1;
+        state.pending = 0;
+
+        switch (op) {
+            case TABLES_OP_LDI:
+                util_tables_set(&state, d, (unsigned int)r);
+                continue;
+            case TABLES_OP_SER:
+                util_tables_set(&state, d, 0xff);
+                continue;
+            case TABLES_OP_MOV:
+                if (util_tables_known(&state, r))
+                    util_tables_set(&state, d, state.values[r]);
+                else
+                    state.known &= ~AVR_REG(d);
+                if (d == 30 || d == 31)
+                    state.indexed = 0;
+                continue;
+            case TABLES_OP_MOVW:
+                if (util_tables_known(&state, r) && util_tables_known(&state, r+1)) {
+                    util_tables_set(&state, d, state.values[r]);
+                    util_tables_set(&state, d+1, state.values[r+1]);
+                } else {
+                    state.known &= ~(AVR_REG(d) | AVR_REG(d+1));
+                }
+                if (d == 30)
+                    state.indexed = 0;
+                continue;
+            case TABLES_OP_ADIW:
+            case TABLES_OP_SBIW:
+                state.carry = -1;
+                if (util_tables_known(&state, d) && util_tables_known(&state, d+1)) {
+                    value = (unsigned int)(state.values[d+1] << 8) | state.values[d];
+                    value = (op == TABLES_OP_ADIW) ? value + (unsigned int)r : value - (unsigned int)r;
+                    util_tables_set(&state, d, value & 0xff);
+                    util_tables_set(&state, d+1, (value >> 8) & 0xff);
+                } else if (d == 30 && state.indexed) {
+                    state.offset = (uint16_t)((op == TABLES_OP_ADIW) ? state.offset + r : state.offset - r);
+                } else {
+                    state.known &= ~(AVR_REG(d) | AVR_REG(d+1));
+                    if (d == 30)
+                        state.indexed = 0;
+                }
+                continue;
+            case TABLES_OP_SUBI:
+                if (util_tables_known(&state, d)) {
+                    state.carry = state.values[d] < (unsigned int)r;
+                    util_tables_set(&state, d, (unsigned int)(state.values[d] - r) & 0xff);
+                } else {
+                    state.carry = -1;
+                    if (d == 30) {
+                        state.pending = 1;
+                        state.pendingLow = (uint8_t)r;
+                    }
+                }
+                continue;
+            case TABLES_OP_SBCI:
+                if (util_tables_known(&state, d) && state.carry >= 0) {
+                    value = (unsigned int)r + (unsigned int)state.carry;
+                    state.carry = state.values[d] < value;
+                    util_tables_set(&state, d, (unsigned int)(state.values[d] - value) & 0xff);
+                } else if (d == 31 && pendingLow >= 0) {
+                    /* subi r30, lo8(-(table)) ; sbci r31, hi8(-(table)) adds
+                     * the table address to an unknown index in Z */
+                    if (!state.indexed) {
+                        state.indexed = 1;
+                        state.offset = 0;
+                    }
+                    state.offset = (uint16_t)(state.offset - (((unsigned int)r << 8) | (unsigned int)pendingLow));
+                    state.known &= ~AVR_REG_Z;
+                    state.carry = -1;
+                } else {
+                    state.known &= ~AVR_REG(d);
+                    state.carry = -1;
+                    if (d == 30 || d == 31)
+                        state.indexed = 0;
+                }
+                continue;
+            case TABLES_OP_ADD:
+            case TABLES_OP_ADC:
+                if (util_tables_known(&state, d) && util_tables_known(&state, r) && (op == TABLES_OP_ADD || state.carry >= 0)) {
+                    result = (unsigned int)state.values[d] + state.values[r] + ((op == TABLES_OP_ADC) ? (unsigned int)state.carry : 0);
+                    state.carry = result > 0xff;
+                    util_tables_set(&state, d, result & 0xff);
+                } else if (op == TABLES_OP_ADD && d == 30 && util_tables_known(&state, 30) && util_tables_known(&state, 31)) {
+                    /* add r30, Rr ; adc r31, Rr+1 adds an unknown index to
+                     * the table address in Z */
+                    state.indexed = 1;
+                    state.offset = (uint16_t)((state.values[31] << 8) | state.values[30]);
+                    state.known &= ~AVR_REG_Z;
+                    state.carry = -1;
+                } else if (op == TABLES_OP_ADC && d == 31 && state.indexed) {
+                    state.carry = -1;
+                } else {
+                    state.known &= ~AVR_REG(d);
+                    state.carry = -1;
+                    if (d == 30 || d == 31)
+                        state.indexed = 0;
+                }
+                continue;
+            case TABLES_OP_OUT:
+                if (d == AVR_IO_RAMPZ)
+                    state.rampz = util_tables_known(&state, r) ? state.values[r] : -1;
+                continue;
+            case TABLES_OP_LPM:
+            case TABLES_OP_ELPM:
+            case TABLES_OP_IJMP:
+            case TABLES_OP_ICALL:
+                if (util_tables_resolve_z(pending, &state, instrDisasm, op) < 0)
+                    return -1;
+                break;
+            default:
+                break;
+        }
+
+        flow = avr_instruction_flow(instrDisasm->instructionInfo);
+        if (flow == AVR_FLOW_CALL || flow == AVR_FLOW_INDIRECT_CALL) {
+            /* The callee may write any register */
+            util_tables_reset(&state);
+            continue;
+        }
+
+        /* Forget the registers and carry written by anything else, keeping
+         * the post-increment of lpm / elpm Z+ */
+        avr_instruction_effects(instrDisasm, &effects);
+        increment = (op == TABLES_OP_LPM || op == TABLES_OP_ELPM) && instrDisasm->instructionInfo->operandTypes[1] == OPERAND_ZP && d != 30 && d != 31;
+        if (increment && util_tables_known(&state, 30) && util_tables_known(&state, 31)) {
+            value = (((unsigned int)(state.values[31] << 8) | state.values[30]) + 1) & 0xffff;
+            util_tables_set(&state, 30, value & 0xff);
+            util_tables_set(&state, 31, value >> 8);
+            state.known &= ~AVR_REG(d);
+        } else if (increment && state.indexed) {
+            state.offset++;
+            state.known &= ~AVR_REG(d);
+        } else {
+            state.known &= ~effects.defs;
+            if (effects.defs & AVR_REG_Z)
+                state.indexed = 0;
+        }
+        if (effects.sregDefs & AVR_SREG_C)
+            state.carry = -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/* AVR Code/Data Map Support */
+/******************************************************************************/
+
+/* Index of the first region starting after address */
+static unsigned int util_map_upper(const struct avrCodeMap *map, uint32_t address) {
+    unsigned int lo, hi, mid;
+
+    lo = 0;
+    hi = map->len;
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if (map->regions[mid].address <= address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* Index of the data region containing address, or -1 */
+static int util_map_data(const struct avrCodeMap *map, uint32_t address) {
+    unsigned int i = util_map_upper(map, address);
+
+    if (i > 0 && map->regions[i-1].kind == AVR_REGION_DATA && address < map->regions[i-1].address + map->regions[i-1].len)
+        return (int)(i-1);
+
+    return -1;
+}
+
+static int util_map_insert(struct avrCodeMap *map, uint32_t address, uint32_t len, unsigned int kind, uint32_t source) {
+    unsigned int i;
+
+    /* Grow the region array if needed */
+    if (map->len == map->capacity) {
+        unsigned int capacity = (map->capacity == 0) ? 64 : map->capacity*2;
+        struct avrCodeRegion *regions = realloc(map->regions, capacity*sizeof(struct avrCodeRegion));
+        if (regions == NULL)
+            return -1;
+        map->regions = regions;
+        map->capacity = capacity;
+    }
+
+    i = util_map_upper(map, address);
+    memmove(&map->regions[i+1], &map->regions[i], (map->len - i)*sizeof(struct avrCodeRegion));
+    map->regions[i].address = address;
+    map->regions[i].len = len;
+    map->regions[i].kind = kind;
+    map->regions[i].source = source;
+    map->len++;
+
+    return 0;
+}
+
+void avr_code_map_free(struct avrCodeMap *map) {
+    free(map->regions);
+    memset(map, 0, sizeof(struct avrCodeMap));
+}
+
+/******************************************************************************/
+/* AVR Program Redecoding */
+/******************************************************************************/
+
+/* Index of the instruction containing address in a sorted program, or -1 */
+static int util_program_containing(const struct avrProgram *program, uint32_t address) {
+    unsigned int lo, hi, mid;
+
+    lo = 0;
+    hi = program->len;
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if (program->instructions[mid].address <= address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo > 0 && address < program->instructions[lo-1].address + program->instructions[lo-1].instructionInfo->width)
+        return (int)(lo-1);
+
+    return -1;
+}
+
+/* Index of the first function starting at or after address */
+static unsigned int util_function_lower(const struct avrFunctionTable *table, uint32_t address) {
+    unsigned int lo, hi, mid;
+
+    lo = 0;
+    hi = table->len;
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if (table->functions[mid].address < address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* Address of the first function start after address, or UINT32_MAX */
+static uint32_t util_function_next(const struct avrFunctionTable *table, uint32_t address) {
+    unsigned int i = util_function_lower(table, address);
+
+    if (i < table->len && table->functions[i].address == address)
+        i++;
+
+    return (i < table->len) ? table->functions[i].address : UINT32_MAX;
+}
+
+/* Replace count instructions at first with num new instructions */
+static int util_program_splice(struct avrProgram *program, unsigned int first, unsigned int count, const struct avrInstructionDisasm *instructions, unsigned int num) {
+    if (program->len - count + num > program->capacity) {
+        unsigned int capacity = program->capacity*2 + num;
+        struct avrInstructionDisasm *grown = realloc(program->instructions, capacity*sizeof(struct avrInstructionDisasm));
+        if (grown == NULL)
+            return -1;
+        program->instructions = grown;
+        program->capacity = capacity;
+    }
+
+    memmove(&program->instructions[first + num], &program->instructions[first + count], (program->len - first - count)*sizeof(struct avrInstructionDisasm));
+    memcpy(&program->instructions[first], instructions, num*sizeof(struct avrInstructionDisasm));
+    program->len = program->len - count + num;
+
+    return 0;
+}
+
+/* Redecode the instructions from first, honoring the data regions of the map
+ * and the code roots and function starts as instruction boundaries, up to the
+ * first old instruction boundary at or after end */
+static int util_program_redecode(struct avrProgram *program, const struct avrCodeMap *map, const struct avrFunctionTable *table, unsigned int first, uint32_t end) {
+    const struct avrInstructionDisasm *old;
+    struct avrInstructionDisasm *decoded = NULL, *grown;
+    unsigned int numDecoded = 0, capacityDecoded = 0;
+    uint8_t *bytes = NULL, *grownBytes;
+    uint32_t start, address, bufLen = 0, bufCapacity = 0, avail, limit, next;
+    unsigned int k, nextOld;
+    int region, width, ret = -1;
+
+    start = address = program->instructions[first].address;
+    k = nextOld = first;
+
+    while (1) {
+        /* Resynchronized with an old instruction boundary past end */
+        while (k < nextOld && program->instructions[k].address < address)
+            k++;
+        if (address >= end && ((k < nextOld && program->instructions[k].address == address) || (k == nextOld && address == start + bufLen)))
+            break;
+
+        /* Buffer the bytes of the old instructions, at least 4 past address
+         * within the run */
+        while (start + bufLen < address + 4 && nextOld < program->len && program->instructions[nextOld].address == start + bufLen) {
+            old = &program->instructions[nextOld];
+            if (bufLen + 4 > bufCapacity) {
+                bufCapacity = (bufCapacity == 0) ? 64 : bufCapacity*2;
+                if ((grownBytes = realloc(bytes, bufCapacity)) == NULL)
+                    goto cleanup;
+                bytes = grownBytes;
+            }
+            memcpy(bytes + bufLen, old->opcode, old->instructionInfo->width);
+            bufLen += old->instructionInfo->width;
+            nextOld++;
+        }
+        if (address >= start + bufLen)
+            break;
+
+        /* Grow the decoded instruction array if needed */
+        if (numDecoded == capacityDecoded) {
+            capacityDecoded = (capacityDecoded == 0) ? 16 : capacityDecoded*2;
+            if ((grown = realloc(decoded, capacityDecoded*sizeof(struct avrInstructionDisasm))) == NULL)
+                goto cleanup;
+            decoded = grown;
+        }
+
+        avail = start + bufLen - address;
+        if (avail > 4)
+            avail = 4;
+
+        if ((region = util_map_data(map, address)) >= 0) {
+            /* Data words, and a lone byte at the end of a region */
+            limit = map->regions[region].address + map->regions[region].len;
+            memset(&decoded[numDecoded], 0, sizeof(struct avrInstructionDisasm));
+            decoded[numDecoded].address = address;
+            decoded[numDecoded].opcode[0] = bytes[address - start];
+            if (avail >= 2 && limit - address >= 2) {
+                decoded[numDecoded].opcode[1] = bytes[address - start + 1];
+                decoded[numDecoded].instructionInfo = &AVR_Instruction_Set[AVR_ISET_INDEX_WORD];
+                decoded[numDecoded].operandDisasms[0] = (int32_t)((bytes[address - start + 1] << 8) | bytes[address - start]);
+                width = 2;
+            } else {
+                decoded[numDecoded].instructionInfo = &AVR_Instruction_Set[AVR_ISET_INDEX_BYTE];
+                decoded[numDecoded].operandDisasms[0] = (int32_t)bytes[address - start];
+                width = 1;
+            }
+        } else {
+            /* Code up to the next data region, code root or function */
+            region = (int)util_map_upper(map, address);
+            limit = ((unsigned int)region < map->len) ? map->regions[region].address : UINT32_MAX;
+            if ((next = util_function_next(table, address)) < limit)
+                limit = next;
+            if (limit - address < avail)
+                avail = limit - address;
+            width = avr_disasm_decode(bytes + (address - start), avail, address, &decoded[numDecoded]);
+        }
+
+        numDecoded++;
+        address += (uint32_t)width;
+    }
+
+    ret = util_program_splice(program, first, k - first, decoded, numDecoded);
+
+    cleanup:
+    free(decoded);
+    free(bytes);
+    return ret;
+}
+
+/******************************************************************************/
+/* AVR Flash Table Support */
+/******************************************************************************/
+
+/* Mark a data table at address as data, up to the next function start, code
+ * root or data region, the resolving instruction, or the end of the run */
+static int util_tables_apply_data(struct avrCodeMap *map, struct avrProgram *program, const struct avrFunctionTable *table, const struct tables_candidate *candidate) {
+    uint32_t address, end, next;
+    unsigned int i, upper;
+    int index;
+
+    address = candidate->address & ~(uint32_t)1;
+    if ((index = util_program_containing(program, address)) < 0)
+        return 0;
+
+    /* Already a known code start, or mapped */
+    upper = util_function_lower(table, address);
+    if (upper < table->len && table->functions[upper].address == address)
+        return 0;
+    upper = util_map_upper(map, address);
+    if (upper > 0 && (map->regions[upper-1].address == address || util_map_data(map, address) >= 0))
+        return 0;
+
+    end = (upper < map->len) ? map->regions[upper].address : UINT32_MAX;
+    if ((next = util_function_next(table, address)) < end)
+        end = next;
+    if (candidate->source >= address && candidate->source < end)
+        end = candidate->source;
+    for (i = (unsigned int)index; i+1 < program->len && program->instructions[i+1].address < end; i++) {
+        if (program->instructions[i+1].address != program->instructions[i].address + program->instructions[i].instructionInfo->width)
+            break;
+    }
+    next = program->instructions[i].address + program->instructions[i].instructionInfo->width;
+    if (next < end)
+        end = next;
+    if (end <= address)
+        return 0;
+
+    if (util_map_insert(map, address, end - address, AVR_REGION_DATA, candidate->source) < 0)
+        return -1;
+
+    return util_program_redecode(program, map, table, (unsigned int)index, end);
+}
+
+/* Mark a code root at address, truncating a data region containing it.
+ * Returns 1 if instructions were redecoded. */
+static int util_tables_apply_root(struct avrCodeMap *map, struct avrProgram *program, const struct avrFunctionTable *table, uint32_t address, uint32_t source) {
+    unsigned int upper;
+    int index, region, aligned;
+
+    if ((address & 1) || (index = util_program_containing(program, address)) < 0)
+        return 0;
+
+    upper = util_map_upper(map, address);
+    if (upper > 0 && map->regions[upper-1].address == address && map->regions[upper-1].kind == AVR_REGION_CODE_ROOT)
+        return 0;
+
+    /* Code wins over a data table estimate */
+    aligned = (program->instructions[index].address == address);
+    if ((region = util_map_data(map, address)) >= 0) {
+        map->regions[region].len = address - map->regions[region].address;
+        if (map->regions[region].len == 0) {
+            memmove(&map->regions[region], &map->regions[region+1], (map->len - (unsigned int)region - 1)*sizeof(struct avrCodeRegion));
+            map->len--;
+        }
+        aligned = 0;
+    }
+
+    if (util_map_insert(map, address, 0, AVR_REGION_CODE_ROOT, source) < 0)
+        return -1;
+
+    if (aligned)
+        return 0;
+
+    if (util_program_redecode(program, map, table, (unsigned int)index, address + 1) < 0)
+        return -1;
+
+    return 1;
+}
+
+int avr_tables_resolve(struct avrCodeMap *map, struct avrProgram *program, struct avrFunctionTable *table) {
+    struct tables_candidates pending, applying;
+    struct tables_candidate *candidate;
+    uint32_t *rescan = NULL, *grown;
+    unsigned int numRescan = 0, capacityRescan = 0;
+    uint8_t *leaders = NULL;
+    unsigned int i, j, b;
+    int index, ret;
+
+    memset(map, 0, sizeof(struct avrCodeMap));
+    memset(&pending, 0, sizeof(pending));
+    memset(&applying, 0, sizeof(applying));
+
+    if (program->len == 0)
+        return 0;
+
+    avr_program_sort(program);
+
+    /* Scan every basic block of the program */
+    if ((leaders = calloc(program->len + 2, 1)) == NULL)
+        goto alloc_error;
+    avr_block_leaders(program, table, leaders);
+    for (b = 0; b < program->len; b = i) {
+        if (util_tables_scan(&pending, program, b, program->len, leaders) < 0)
+            goto alloc_error;
+        for (i = b + 1; i < program->len && !leaders[i]; i++)
+            ;
+    }
+    free(leaders);
+    leaders = NULL;
+
+    /* Apply the resolved addresses, then scan the code they uncover, until
+     * nothing new is resolved */
+    while (pending.len > 0) {
+        applying = pending;
+        memset(&pending, 0, sizeof(pending));
+        numRescan = 0;
+
+        for (i = 0; i < applying.len; i++) {
+            candidate = &applying.candidates[i];
+
+            if (candidate->kind == TABLES_DATA) {
+                if (util_tables_apply_data(map, program, table, candidate) < 0)
+                    goto alloc_error;
+                continue;
+            }
+
+            if ((ret = util_tables_apply_root(map, program, table, candidate->address, candidate->source)) < 0)
+                goto alloc_error;
+
+            /* Each consecutive jump of a jump table is an entry */
+            if (candidate->kind == TABLES_JUMP_TABLE && (index = avr_program_find(program, candidate->address)) >= 0) {
+                for (j = (unsigned int)index + 1; j < program->len && avr_instruction_flow(program->instructions[j-1].instructionInfo) == AVR_FLOW_JUMP; j++) {
+                    if (program->instructions[j].address != program->instructions[j-1].address + program->instructions[j-1].instructionInfo->width)
+                        break;
+                    if (avr_instruction_flow(program->instructions[j].instructionInfo) != AVR_FLOW_JUMP)
+                        break;
+                    if (util_tables_apply_root(map, program, table, program->instructions[j].address, candidate->source) < 0)
+                        goto alloc_error;
+                }
+            }
+
+            if (ret == 0)
+                continue;
+
+            /* Grow the rescan array if needed */
+            if (numRescan == capacityRescan) {
+                capacityRescan = (capacityRescan == 0) ? 16 : capacityRescan*2;
+                if ((grown = realloc(rescan, capacityRescan*sizeof(uint32_t))) == NULL)
+                    goto alloc_error;
+                rescan = grown;
+            }
+            rescan[numRescan++] = candidate->address;
+        }
+
+        free(applying.candidates);
+        memset(&applying, 0, sizeof(applying));
+
+        /* Scan the newly decoded code from each root */
+        for (i = 0; i < numRescan; i++) {
+            if ((index = avr_program_find(program, rescan[i])) < 0)
+                continue;
+            if (util_tables_scan(&pending, program, (unsigned int)index, program->len, NULL) < 0)
+                goto alloc_error;
+        }
+    }
+
+    free(rescan);
+
+    /* Update the function extents to the redecoded program */
+    for (i = 0; i < table->len; i++) {
+        if ((index = avr_program_find(program, table->functions[i].address)) >= 0)
+            table->functions[i].first = (unsigned int)index;
+    }
+    for (i = 0; i < table->len; i++) {
+        if (i+1 < table->len)
+            table->functions[i].len = table->functions[i+1].first - table->functions[i].first;
+        else
+            table->functions[i].len = program->len - table->functions[i].first;
+    }
+
+    return 0;
+
+    alloc_error:
+    free(leaders);
+    free(rescan);
+    free(pending.candidates);
+    free(applying.candidates);
+    avr_code_map_free(map);
+    return -1;
+}
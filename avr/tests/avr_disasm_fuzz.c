@@ -0,0 +1,364 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <byte_stream.h>
+#include <disasm_stream.h>
+#include <print_stream.h>
+
+/* File Support */
+#include "file/file_support.h"
+
+/* AVR Support */
+#include "avr/avr_support.h"
+#include "avr/avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Disasm Stream Differential Fuzzer */
+/******************************************************************************/
+
+/* Feeds arbitrary byte and address sequences through the debug Byte Stream
+ * into the AVR Disasm Stream, and checks its instructions against a reference
+ * linear instruction set lookup and against the span decode, boundary and
+ * image decode paths.
+ *
+ * Each case is a sequence of (control, data) byte pairs. The control byte
+ * picks the address of the data byte relative to the previous one, so cases
+ * cover consecutive runs, gaps, backward jumps, repeated addresses and runs
+ * ending inside 32-bit instructions.
+ *
+ * Built as a standalone driver of random cases:
+ *      vavrdisasm_fuzz [-n <cases>] [-s <seed>] [<case file> ...]
+ * or with libFuzzer:
+ *      clang -fsanitize=fuzzer,address -DFUZZ_LIBFUZZER -I. ... */
+
+/* Maximum number of data bytes in a case */
+#define FUZZ_MAX_LEN            4096
+/* Default number of random cases of the standalone driver */
+#define FUZZ_CASES              200000
+
+struct byte_stream_debug_state {
+    uint8_t *data;
+    uint32_t *address;
+    unsigned int len;
+    int index;
+};
+
+/* Current case, for failure reports */
+static uint8_t Fuzz_Data[FUZZ_MAX_LEN];
+static uint32_t Fuzz_Address[FUZZ_MAX_LEN];
+static unsigned int Fuzz_Len;
+
+static void util_fuzz_fail(const char *what, unsigned int offset) {
+    unsigned int i;
+
+    fprintf(stderr, "FAILURE %s at byte %u of %u\n", what, offset, Fuzz_Len);
+    for (i = 0; i < Fuzz_Len; i++)
+        fprintf(stderr, "%08x:%02x%s", Fuzz_Address[i], Fuzz_Data[i], (i % 8 == 7) ? "\n" : " ");
+    fprintf(stderr, "\n");
+
+    abort();
+}
+
+/* Reference instruction set lookup, a linear search of the instruction set
+ * independent of the decoder's lookup table. The .dw entry matches any
+ * opcode. */
+static const struct avrInstructionInfo *util_lookup_linear(uint16_t opcode) {
+    uint16_t instructionBits;
+    int i, j;
+
+    for (i = 0; i < AVR_TOTAL_INSTRUCTIONS; i++) {
+        instructionBits = opcode;
+        for (j = 0; j < AVR_Instruction_Set[i].numOperands; j++)
+            instructionBits &= ~(AVR_Instruction_Set[i].operandMasks[j]);
+        if (instructionBits == AVR_Instruction_Set[i].instructionMask)
+            return &AVR_Instruction_Set[i];
+    }
+
+    return NULL;
+}
+
+/* Reference lookup of every opcode, built once with the linear search */
+static const struct avrInstructionInfo *Reference_Lookup[65536];
+
+static void util_reference_init(void) {
+    uint32_t opcode;
+
+    if (Reference_Lookup[0] != NULL)
+        return;
+    for (opcode = 0; opcode < 65536; opcode++)
+        Reference_Lookup[opcode] = util_lookup_linear((uint16_t)opcode);
+}
+
+/* Number of consecutive addresses of the case from offset, up to 4 */
+static unsigned int util_run_len(unsigned int offset) {
+    unsigned int n;
+
+    for (n = 1; n < 4 && offset + n < Fuzz_Len; n++) {
+        if (Fuzz_Address[offset + n] != Fuzz_Address[offset] + n)
+            break;
+    }
+
+    return n;
+}
+
+static int util_instruction_equal(const struct avrInstructionDisasm *a, const struct avrInstructionDisasm *b) {
+    return a->address == b->address && a->instructionInfo == b->instructionInfo &&
+           memcmp(a->opcode, b->opcode, a->instructionInfo->width) == 0 &&
+           a->operandDisasms[0] == b->operandDisasms[0] && a->operandDisasms[1] == b->operandDisasms[1];
+}
+
+/* Run the current case through every decode path */
+static void fuzz_case(void) {
+    static struct avrInstructionDisasm streamed[FUZZ_MAX_LEN];
+    static uint8_t bitmap[FUZZ_MAX_LEN/8 + 1];
+    const struct avrInstructionInfo *reference;
+    struct avrInstructionDisasm spanDisasm;
+    struct ByteStream bs;
+    struct DisasmStream ds;
+    struct instruction instr;
+    struct byte_stream_debug_state *state;
+    struct ByteImage image;
+    struct avrProgram program;
+    struct avrBoundaryIndex index;
+    unsigned int i, n, offset, run, expectedWidth;
+    char buf[128];
+    int ret, len, flags;
+
+    /* Setup a debug Byte Stream and the AVR Disasm Stream */
+    memset(&bs, 0, sizeof(bs));
+    bs.stream_init = byte_stream_debug_init;
+    bs.stream_close = byte_stream_debug_close;
+    bs.stream_read = byte_stream_debug_read;
+    memset(&ds, 0, sizeof(ds));
+    ds.in = &bs;
+    ds.stream_init = disasm_stream_avr_init;
+    ds.stream_close = disasm_stream_avr_close;
+    ds.stream_read = disasm_stream_avr_read;
+
+    if (ds.stream_init(&ds) < 0)
+        util_fuzz_fail("stream init", 0);
+
+    /* Load the debug Byte Stream with the case */
+    state = (struct byte_stream_debug_state *)bs.state;
+    state->data = Fuzz_Data;
+    state->address = Fuzz_Address;
+    state->len = Fuzz_Len;
+
+    /* Streamed instructions cover the case bytes in order, each decoded as
+     * the reference lookup decodes it */
+    for (n = 0, offset = 0; (ret = ds.stream_read(&ds, &instr)) != STREAM_EOF; n++) {
+        if (ret < 0)
+            util_fuzz_fail(ds.error, offset);
+        if (offset >= Fuzz_Len)
+            util_fuzz_fail("instruction past end of input", offset);
+
+        streamed[n] = *(struct avrInstructionDisasm *)instr.instructionDisasm;
+
+        run = util_run_len(offset);
+        reference = Reference_Lookup[(uint16_t)(Fuzz_Data[offset] | (run > 1 ? Fuzz_Data[offset + 1] << 8 : 0))];
+        if (run < 2)
+            reference = &AVR_Instruction_Set[AVR_ISET_INDEX_BYTE];
+        else if (reference->width == 4 && run < 4)
+            reference = &AVR_Instruction_Set[AVR_ISET_INDEX_WORD];
+        expectedWidth = reference->width;
+
+        if (streamed[n].instructionInfo != reference)
+            util_fuzz_fail("instruction differs from reference lookup", offset);
+        if (streamed[n].address != Fuzz_Address[offset] || instr.address != Fuzz_Address[offset])
+            util_fuzz_fail("instruction address", offset);
+        if (instr.width != expectedWidth)
+            util_fuzz_fail("instruction width", offset);
+        if (memcmp(streamed[n].opcode, &Fuzz_Data[offset], expectedWidth) != 0)
+            util_fuzz_fail("instruction opcode bytes", offset);
+        if (avr_disasm_width(&Fuzz_Data[offset], run) != (int)expectedWidth)
+            util_fuzz_fail("avr_disasm_width()", offset);
+
+        /* Span decode of the same bytes */
+        if (avr_disasm_decode(&Fuzz_Data[offset], run, Fuzz_Address[offset], &spanDisasm) != (int)expectedWidth || !util_instruction_equal(&spanDisasm, &streamed[n]))
+            util_fuzz_fail("span decode differs from stream", offset);
+
+        /* Formatting stays within the buffer and reports its length */
+        flags = PRINT_FLAG_ADDRESSES | PRINT_FLAG_OPCODES | ((n % 3 == 0) ? PRINT_FLAG_DATA_HEX : (n % 3 == 1) ? PRINT_FLAG_DATA_BIN : PRINT_FLAG_DATA_DEC);
+        flags |= (n & 4) ? PRINT_FLAG_ASSEMBLY : PRINT_FLAG_DESTINATION_COMMENT;
+        len = avr_instruction_format(&streamed[n], buf, sizeof(buf), flags);
+        if (len < 0 || len >= (int)sizeof(buf) || (size_t)len != strlen(buf))
+            util_fuzz_fail("avr_instruction_format()", offset);
+
+        offset += expectedWidth;
+    }
+    if (offset != Fuzz_Len)
+        util_fuzz_fail("instructions don't cover input", offset);
+
+    if (ds.stream_close(&ds) < 0)
+        util_fuzz_fail("stream close", offset);
+
+    /* Image decode and instruction-boundary index of the same bytes */
+    memset(&image, 0, sizeof(image));
+    for (i = 0; i < Fuzz_Len; i += run) {
+        for (run = 1; i + run < Fuzz_Len && Fuzz_Address[i + run] == Fuzz_Address[i] + run; run++)
+            ;
+        if (byte_image_append(&image, &Fuzz_Data[i], run, Fuzz_Address[i]) < 0)
+            util_fuzz_fail("byte_image_append()", i);
+    }
+
+    if (avr_program_decode(&program, &image) < 0)
+        util_fuzz_fail("avr_program_decode()", 0);
+    if (program.len != n)
+        util_fuzz_fail("image decode instruction count", 0);
+    for (i = 0; i < n; i++) {
+        if (!util_instruction_equal(&program.instructions[i], &streamed[i]))
+            util_fuzz_fail("image decode differs from stream", i);
+    }
+    avr_program_free(&program);
+
+    if (avr_boundary_index_build(&index, &image) < 0)
+        util_fuzz_fail("avr_boundary_index_build()", 0);
+    memset(bitmap, 0, (Fuzz_Len + 7)/8);
+    for (i = 0, offset = 0; i < n; offset += streamed[i].instructionInfo->width, i++)
+        bitmap[offset/8] |= (uint8_t)(1 << (offset % 8));
+    if (memcmp(index.bitmap, bitmap, (Fuzz_Len + 7)/8) != 0)
+        util_fuzz_fail("boundary index differs from stream", 0);
+    avr_boundary_index_free(&index);
+
+    byte_image_free(&image);
+}
+
+/* Decode a case from (control, data) byte pairs */
+static void util_case_load(const uint8_t *input, size_t size) {
+    uint32_t address = 0;
+    size_t i;
+
+    Fuzz_Len = 0;
+    for (i = 0; i + 1 < size && Fuzz_Len < FUZZ_MAX_LEN; i += 2) {
+        if (Fuzz_Len > 0) {
+            if (input[i] < 0xe0)
+                address += 1;                                   /* Consecutive */
+            else if (input[i] < 0xf0)
+                address += 2 + (input[i] & 0x0f);               /* Gap */
+            else if (input[i] < 0xf8)
+                address -= 1 + (input[i] & 0x07);               /* Backward */
+            else if (input[i] < 0xff)
+                address += (uint32_t)(input[i] & 0x07) << 16;   /* Far jump */
+            /* 0xff repeats the address */
+        }
+        Fuzz_Address[Fuzz_Len] = address;
+        Fuzz_Data[Fuzz_Len] = input[i + 1];
+        Fuzz_Len++;
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    avr_iset_lookup_init();
+    util_reference_init();
+
+    util_case_load(data, size);
+    fuzz_case();
+
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+/******************************************************************************/
+/* Standalone Driver */
+/******************************************************************************/
+
+/* Deterministic xorshift32 generator */
+static uint32_t util_random(uint32_t *state) {
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return x;
+}
+
+/* Generate a random case input, mostly consecutive bytes with occasional
+ * address changes, seeded with 32-bit instruction opcodes so runs and the
+ * input end often split them */
+static size_t util_case_generate(uint8_t *input, uint32_t *seed) {
+    size_t len, i;
+    uint32_t r;
+
+    len = 2*(util_random(seed) % 128);
+    for (i = 0; i < len; i += 2) {
+        r = util_random(seed);
+        input[i] = ((r & 0x1f) == 0) ? (uint8_t)(0xe0 | (r >> 8)) : 0x00;
+        input[i + 1] = (uint8_t)(r >> 16);
+
+        /* First word of a lds, sts, jmp or call */
+        if ((r >> 28) == 0 && i + 3 < len) {
+            input[i + 1] = (uint8_t)((r >> 16) & 0xf0) | (((r >> 24) & 1) ? 0x00 : 0x0c | ((r >> 16) & 0x03));
+            input[i + 2] = 0x00;
+            input[i + 3] = (uint8_t)(0x90 + ((r >> 24) & 0x01)*4 + ((r >> 25) & 0x03));
+            i += 2;
+        }
+    }
+
+    return len;
+}
+
+static int util_file_run(const char *path) {
+    static uint8_t input[2*FUZZ_MAX_LEN];
+    FILE *in;
+    size_t len;
+
+    if ((in = fopen(path, "rb")) == NULL) {
+        fprintf(stderr, "Error opening case file %s: ", path);
+        perror(NULL);
+        return -1;
+    }
+    len = fread(input, 1, sizeof(input), in);
+    fclose(in);
+
+    LLVMFuzzerTestOneInput(input, len);
+    printf("%s: OK\n", path);
+
+    return 0;
+}
+
+int main(int argc, const char *argv[]) {
+    static uint8_t input[2*FUZZ_MAX_LEN];
+    unsigned long cases = FUZZ_CASES, c;
+    uint32_t seed = 0x2545f491;
+    uint64_t bytes = 0;
+    clock_t start;
+    double seconds;
+    int i, files = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            cases = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else {
+            if (util_file_run(argv[i]) < 0)
+                return EXIT_FAILURE;
+            files++;
+        }
+    }
+    if (files > 0)
+        return EXIT_SUCCESS;
+
+    if (seed == 0)
+        seed = 1;
+
+    start = clock();
+    for (c = 0; c < cases; c++) {
+        size_t len = util_case_generate(input, &seed);
+        LLVMFuzzerTestOneInput(input, len);
+        bytes += Fuzz_Len;
+    }
+    seconds = (double)(clock() - start)/CLOCKS_PER_SEC;
+
+    printf("%lu cases, %llu bytes, %.1f s, %.0f cases/s: OK\n", cases, (unsigned long long)bytes, seconds, (seconds > 0.0) ? (double)cases/seconds : 0.0);
+
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,237 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <byte_stream.h>
+#include <disasm_stream.h>
+#include <print_stream.h>
+#include <profile.h>
+
+/* File Support */
+#include "file/file_support.h"
+
+/* AVR Support */
+#include "avr/avr_support.h"
+#include "avr/avr_analysis.h"
+
+/******************************************************************************/
+/* AVR Exhaustive Opcode Test */
+/******************************************************************************/
+
+/* Decodes every 16-bit opcode word, and every 32-bit instruction with
+ * representative second words, and compares the mnemonic and operands
+ * against a golden table, one line per decode:
+ *      <word>: <mnemonic>\t<operands>
+ *      <word> <second word>: <mnemonic>\t<operands>
+ * Then reports the decode throughput over the opcode space.
+ *
+ * Usage: vavrdisasm_opcodes <golden table>
+ *        vavrdisasm_opcodes -g <golden table>    (write the golden table) */
+
+/* Address of every decode, clear of zero so relative targets stay positive */
+#define OPCODE_TEST_ADDRESS     0x8000
+/* Format flags of the golden table, with destination comments to cover the
+ * relative target arithmetic */
+#define OPCODE_TEST_FLAGS       (PRINT_FLAG_DATA_HEX | PRINT_FLAG_DESTINATION_COMMENT)
+/* Repetitions of the opcode space in the throughput test */
+#define OPCODE_TEST_REPETITIONS 64
+/* Maximum number of mismatches printed */
+#define OPCODE_TEST_MAX_REPORTS 16
+
+/* Second words of 32-bit instructions. The first is used in the 16-bit
+ * opcode space pass. */
+static const uint16_t Opcode_Test_Second_Words[] = {0x0000, 0x0001, 0x1234, 0x7fff, 0x8000, 0xffff};
+#define OPCODE_TEST_NUM_SECOND_WORDS (sizeof(Opcode_Test_Second_Words)/sizeof(Opcode_Test_Second_Words[0]))
+
+/* Format a golden table line for an opcode word and second word */
+static int util_opcode_line(char *line, size_t size, uint16_t word, uint16_t second, int showSecond, struct avrInstructionDisasm *instrDisasm) {
+    uint8_t data[4];
+    int n, len;
+
+    data[0] = (uint8_t)(word & 0xff); data[1] = (uint8_t)(word >> 8);
+    data[2] = (uint8_t)(second & 0xff); data[3] = (uint8_t)(second >> 8);
+
+    if (avr_disasm_decode(data, 4, OPCODE_TEST_ADDRESS, instrDisasm) <= 0)
+        return -1;
+
+    if (showSecond)
+        n = snprintf(line, size, "%04x %04x: ", word, second);
+    else
+        n = snprintf(line, size, "%04x: ", word);
+
+    len = avr_instruction_format(instrDisasm, line + n, size - (size_t)n, OPCODE_TEST_FLAGS);
+    if (len < 0 || (size_t)(n + len) >= size)
+        return -1;
+    len += n;
+
+    /* Strip the trailing separator of instructions without operands */
+    while (len > 0 && (line[len-1] == '\t' || line[len-1] == ' '))
+        line[--len] = '\0';
+
+    return len;
+}
+
+/* Generate or check the golden table. Returns the number of mismatches, or
+ * -1 on error. */
+static int opcode_table(FILE *golden, int generate) {
+    struct avrInstructionDisasm instrDisasm;
+    char line[128], expected[256];
+    unsigned int word, i, lines = 0, mismatches = 0, pass;
+    size_t len;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (word = 0; word < 65536; word++) {
+            for (i = 0; i < ((pass == 0) ? 1 : OPCODE_TEST_NUM_SECOND_WORDS); i++) {
+                /* Second pass only covers the 32-bit instructions */
+                if (pass == 1 && i == 0)
+                    continue;
+
+                if (util_opcode_line(line, sizeof(line), (uint16_t)word, Opcode_Test_Second_Words[i], pass == 1, &instrDisasm) < 0) {
+                    fprintf(stderr, "Error decoding opcode %04x!\n", word);
+                    return -1;
+                }
+                if (pass == 1 && instrDisasm.instructionInfo->width != 4)
+                    break;
+                lines++;
+
+                if (generate) {
+                    fprintf(golden, "%s\n", line);
+                    continue;
+                }
+
+                if (fgets(expected, sizeof(expected), golden) == NULL) {
+                    fprintf(stderr, "FAILURE golden table ends at line %u\n", lines);
+                    return (int)mismatches + 1;
+                }
+                len = strlen(expected);
+                if (len > 0 && expected[len-1] == '\n')
+                    expected[--len] = '\0';
+
+                if (strcmp(line, expected) != 0) {
+                    if (mismatches < OPCODE_TEST_MAX_REPORTS)
+                        fprintf(stderr, "FAILURE line %u: got \"%s\", expected \"%s\"\n", lines, line, expected);
+                    mismatches++;
+                }
+            }
+        }
+    }
+
+    if (!generate && fgets(expected, sizeof(expected), golden) != NULL) {
+        fprintf(stderr, "FAILURE golden table has lines past %u\n", lines);
+        mismatches++;
+    }
+
+    printf("%u opcode lines %s\n", lines, generate ? "written" : (mismatches == 0) ? "match" : "checked");
+
+    return (int)mismatches;
+}
+
+/* Time the decoding of the opcode space, directly and through the
+ * disassembly stream */
+static int opcode_throughput(void) {
+    struct avrInstructionDisasm instrDisasm;
+    struct ByteStream bs;
+    struct DisasmStream ds;
+    struct instruction instr;
+    uint8_t *data;
+    uint64_t start, elapsed, decoded = 0;
+    uint32_t word, sum = 0;
+    unsigned int r;
+    int ret;
+
+    /* All opcode words in order, with a spare word for 32-bit decodes */
+    if ((data = malloc(2*65536 + 2)) == NULL) {
+        fprintf(stderr, "Error allocating opcode space!\n");
+        return -1;
+    }
+    for (word = 0; word < 65536; word++) {
+        data[2*word] = (uint8_t)(word & 0xff);
+        data[2*word+1] = (uint8_t)(word >> 8);
+    }
+    data[2*65536] = data[2*65536+1] = 0;
+
+    /* Direct decode of every word */
+    start = profile_now();
+    for (r = 0; r < OPCODE_TEST_REPETITIONS; r++) {
+        for (word = 0; word < 65536; word++) {
+            avr_disasm_decode(data + 2*word, 4, 2*word, &instrDisasm);
+            sum += (uint32_t)instrDisasm.operandDisasms[0];
+        }
+    }
+    elapsed = profile_now() - start;
+    printf("avr_disasm_decode():   %8.2f M opcodes/s (checksum %08x)\n", (double)OPCODE_TEST_REPETITIONS*65536.0/((double)elapsed*1e-3), sum);
+
+    /* Disassembly stream over the opcode space as a binary program */
+    start = profile_now();
+    for (r = 0; r < OPCODE_TEST_REPETITIONS; r++) {
+        memset(&bs, 0, sizeof(bs));
+        bs.in_buf = data;
+        bs.in_len = 2*65536;
+        bs.stream_init = byte_stream_binary_memory_init;
+        bs.stream_close = byte_stream_binary_memory_close;
+        bs.stream_read = byte_stream_binary_memory_read;
+        memset(&ds, 0, sizeof(ds));
+        ds.in = &bs;
+        ds.stream_init = disasm_stream_avr_init;
+        ds.stream_close = disasm_stream_avr_close;
+        ds.stream_read = disasm_stream_avr_read;
+
+        if (ds.stream_init(&ds) < 0) {
+            fprintf(stderr, "Error initializing streams!\n");
+            free(data);
+            return -1;
+        }
+        while ( (ret = ds.stream_read(&ds, &instr)) != STREAM_EOF ) {
+            if (ret < 0) {
+                fprintf(stderr, "Error in disassembly stream: %s\n", ds.error);
+                ds.stream_close(&ds);
+                free(data);
+                return -1;
+            }
+            decoded++;
+        }
+        ds.stream_close(&ds);
+    }
+    elapsed = profile_now() - start;
+    printf("disasm_stream_avr_read(): %5.2f M instructions/s, %.2f MB/s\n", (double)decoded/((double)elapsed*1e-3), (double)OPCODE_TEST_REPETITIONS*2*65536/((double)elapsed*1e-3));
+
+    free(data);
+
+    return 0;
+}
+
+int main(int argc, const char *argv[]) {
+    FILE *golden;
+    int generate, ret;
+
+    generate = (argc == 3 && strcmp(argv[1], "-g") == 0);
+    if (argc != 2 && !generate) {
+        fprintf(stderr, "Usage: %s [-g] <golden table>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if ((golden = fopen(argv[argc-1], generate ? "w" : "r")) == NULL) {
+        fprintf(stderr, "Error opening golden table %s: ", argv[argc-1]);
+        perror(NULL);
+        return EXIT_FAILURE;
+    }
+
+    avr_iset_lookup_init();
+
+    ret = opcode_table(golden, generate);
+    if (fclose(golden) != 0 && generate) {
+        fprintf(stderr, "Error writing golden table %s!\n", argv[argc-1]);
+        return EXIT_FAILURE;
+    }
+    if (ret != 0) {
+        if (ret > 0)
+            fprintf(stderr, "%d opcode lines differ from the golden table\n", ret);
+        return EXIT_FAILURE;
+    }
+
+    if (!generate && opcode_throughput() < 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
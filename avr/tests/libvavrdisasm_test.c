@@ -0,0 +1,100 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <vavrdisasm.h>
+
+/******************************************************************************/
+/* libvavrdisasm Public API Test */
+/******************************************************************************/
+
+/* Disassembles a binary program file through the public header alone, with
+ * the default format flags of vavrdisasm, so that its output can be compared
+ * against vavrdisasm -t binary of the same file. With a range, decodes only
+ * the instructions overlapping addresses [start, end) through the
+ * instruction-boundary bitmap, to compare against vavrdisasm --start / --end.
+ *
+ * Usage: vavrdisasm_libtest <binary file> [<start> <end>] */
+
+/* Default format flags of vavrdisasm */
+#define LIBTEST_FLAGS   (VAVRDISASM_FLAG_ADDRESSES | VAVRDISASM_FLAG_DESTINATION_COMMENT | VAVRDISASM_FLAG_OPCODES | VAVRDISASM_FLAG_DATA_HEX)
+
+/* Read a whole file. Returns the data, or NULL on error. */
+static uint8_t *util_read_file(const char *path, size_t *len) {
+    uint8_t *data = NULL, *newData;
+    size_t capacity = 0, n;
+    FILE *in;
+
+    if ((in = fopen(path, "rb")) == NULL)
+        return NULL;
+
+    *len = 0;
+    do {
+        if (*len == capacity) {
+            capacity = (capacity == 0) ? 4096 : capacity*2;
+            if ((newData = realloc(data, capacity)) == NULL) {
+                free(data);
+                fclose(in);
+                return NULL;
+            }
+            data = newData;
+        }
+        n = fread(data + *len, 1, capacity - *len, in);
+        *len += n;
+    } while (n > 0);
+
+    if (ferror(in)) {
+        free(data);
+        data = NULL;
+    }
+    fclose(in);
+
+    return data;
+}
+
+int main(int argc, const char *argv[]) {
+    struct vavrdisasm_instruction *instructions;
+    uint8_t *data, *bitmap = NULL;
+    size_t len, count, i;
+    char line[256];
+    int ret = EXIT_FAILURE;
+
+    if (argc != 2 && argc != 4) {
+        fprintf(stderr, "Usage: %s <binary file> [<start> <end>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if ((data = util_read_file(argv[1], &len)) == NULL) {
+        fprintf(stderr, "Error reading %s!\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    /* At most one instruction per 2 bytes, plus a trailing odd byte */
+    if ((instructions = malloc((len/2 + 1)*sizeof(struct vavrdisasm_instruction))) == NULL)
+        goto cleanup;
+
+    if (argc == 4) {
+        if ((bitmap = malloc(vavrdisasm_index_size(len))) == NULL)
+            goto cleanup;
+        vavrdisasm_index_build(data, len, bitmap);
+        count = vavrdisasm_decode_range(data, len, 0, bitmap, (uint32_t)strtoul(argv[2], NULL, 0), (uint32_t)strtoul(argv[3], NULL, 0), instructions, len/2 + 1);
+    } else {
+        count = vavrdisasm_decode(data, len, 0, instructions, len/2 + 1, NULL);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (vavrdisasm_format(&instructions[i], line, sizeof(line), LIBTEST_FLAGS) < 0) {
+            fprintf(stderr, "Error formatting instruction at 0x%04x!\n", instructions[i].address);
+            goto cleanup;
+        }
+        printf("%s\n", line);
+    }
+
+    ret = EXIT_SUCCESS;
+
+    cleanup:
+    free(bitmap);
+    free(instructions);
+    free(data);
+    return ret;
+}
@@ -0,0 +1,541 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <byte_stream.h>
+#include <disasm_stream.h>
+#include <print_stream.h>
+
+/* File Support */
+#include "file/file_support.h"
+#include "file/libGIS-1.0.5/atmel_generic.h"
+#include "file/libGIS-1.0.5/ihex.h"
+#include "file/libGIS-1.0.5/srecord.h"
+
+/* AVR Support */
+#include "avr/avr_support.h"
+#include "avr/avr_analysis.h"
+
+/******************************************************************************/
+/* vAVRdisasm Benchmark */
+/******************************************************************************/
+
+/* Generates deterministic synthetic programs, encodes them in every supported
+ * file format, and times the parse, decode, format and end-to-end stages
+ * in-process. Throughput is in MB/s of program bytes and in instructions/s,
+ * as the minimum and median over repetitions.
+ *
+ * Usage: vavrdisasm_bench [repetitions] */
+
+/* Program address space, bounded by the 16-bit Intel HEX8 addresses */
+#define BENCH_IMAGE_LEN         65536
+/* Default number of repetitions of each stage */
+#define BENCH_REPETITIONS       5
+/* Program bytes processed per repetition, as iterations over the program */
+#define BENCH_MIN_BYTES         (256*1024)
+
+/* Output flags of the format and end-to-end stages, the command line defaults */
+#define BENCH_PRINT_FLAGS       (PRINT_FLAG_ADDRESSES | PRINT_FLAG_DESTINATION_COMMENT | PRINT_FLAG_OPCODES | PRINT_FLAG_DATA_HEX)
+
+/******************************************************************************/
+/* Synthetic Program Generators */
+/******************************************************************************/
+
+/* Deterministic xorshift32 generator */
+static uint32_t util_random(uint32_t *state) {
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return x;
+}
+
+/* Weighted mnemonic of an instruction mix */
+struct bench_mix_entry {
+    const char *mnemonic;
+    unsigned int weight;
+};
+
+/* Instruction mix of compiled C code */
+static const struct bench_mix_entry Bench_Mix_Compiler[] = {
+    {"ldi", 14}, {"mov", 6}, {"movw", 5}, {"ld", 4}, {"st", 4}, {"ldd", 5},
+    {"std", 4}, {"push", 4}, {"pop", 4}, {"add", 3}, {"adc", 3}, {"sub", 2},
+    {"sbc", 2}, {"subi", 3}, {"sbci", 3}, {"cpi", 3}, {"cp", 3}, {"cpc", 3},
+    {"and", 2}, {"or", 2}, {"eor", 3}, {"brne", 4}, {"breq", 3}, {"rjmp", 4},
+    {"rcall", 4}, {"ret", 2}, {"in", 2}, {"out", 2}, {"adiw", 2}, {"sbiw", 2},
+    {"lds", 2}, {"sts", 2}, {"call", 2}, {"jmp", 1},
+    {NULL, 0},
+};
+
+/* Instruction mix dominated by 32-bit instructions */
+static const struct bench_mix_entry Bench_Mix_Long[] = {
+    {"lds", 25}, {"sts", 25}, {"call", 20}, {"jmp", 10}, {"ldi", 10}, {"mov", 10},
+    {NULL, 0},
+};
+
+/* Append one instruction of a mix, picking among the instruction set entries
+ * of the mnemonic, with random operands */
+static uint32_t util_mix_instruction(const struct bench_mix_entry *mix, unsigned int totalWeight, uint32_t *state, uint8_t *data) {
+    const struct avrInstructionInfo *info, *matches[16];
+    unsigned int i, pick, numMatches;
+    uint16_t word, second;
+
+    /* Pick a mnemonic */
+    pick = util_random(state) % totalWeight;
+    for (i = 0; pick >= mix[i].weight; i++)
+        pick -= mix[i].weight;
+
+    /* Pick an instruction set entry, excluding .dw and .db */
+    for (numMatches = 0, pick = 0; pick < (unsigned int)AVR_ISET_INDEX_WORD && numMatches < 16; pick++) {
+        if (strcmp(AVR_Instruction_Set[pick].mnemonic, mix[i].mnemonic) == 0)
+            matches[numMatches++] = &AVR_Instruction_Set[pick];
+    }
+    if (numMatches == 0)
+        return 0;
+    info = matches[util_random(state) % numMatches];
+
+    /* Encode with random operands */
+    word = info->instructionMask | ((uint16_t)util_random(state) & (info->operandMasks[0] | info->operandMasks[1]));
+    data[0] = (uint8_t)(word & 0xff);
+    data[1] = (uint8_t)(word >> 8);
+    if (info->width == 4) {
+        second = (uint16_t)util_random(state);
+        data[2] = (uint8_t)(second & 0xff);
+        data[3] = (uint8_t)(second >> 8);
+    }
+
+    return info->width;
+}
+
+/* Fill len bytes with random words, or with instructions of a mix */
+static void util_generate(uint8_t *data, uint32_t len, const struct bench_mix_entry *mix, uint32_t *state) {
+    unsigned int totalWeight, i;
+    uint8_t instruction[4];
+    uint32_t offset, width;
+
+    if (mix == NULL) {
+        for (offset = 0; offset < len; offset++)
+            data[offset] = (uint8_t)util_random(state);
+        return;
+    }
+
+    for (i = 0, totalWeight = 0; mix[i].mnemonic != NULL; i++)
+        totalWeight += mix[i].weight;
+
+    for (offset = 0; offset < len; offset += width) {
+        if ((width = util_mix_instruction(mix, totalWeight, state, instruction)) == 0)
+            width = 2, instruction[0] = instruction[1] = 0;
+        memcpy(data + offset, instruction, (len - offset < width) ? len - offset : width);
+    }
+}
+
+/* Structure for a synthetic program */
+struct bench_program {
+    const char *name;
+    struct ByteImage image;
+    /* Address discontinuities flag, which binary and ASCII hex can't hold */
+    int sparse;
+};
+
+static int util_program_generate(struct bench_program *program, const char *name, const struct bench_mix_entry *mix, int sparse, uint32_t seed) {
+    uint8_t *data;
+    uint32_t state, address, len;
+
+    memset(program, 0, sizeof(struct bench_program));
+    program->name = name;
+    program->sparse = sparse;
+    state = seed;
+
+    if ((data = malloc(BENCH_IMAGE_LEN)) == NULL)
+        return -1;
+    util_generate(data, BENCH_IMAGE_LEN, mix, &state);
+
+    if (!sparse) {
+        if (byte_image_append(&program->image, data, BENCH_IMAGE_LEN, 0) < 0)
+            goto generate_error;
+    } else {
+        /* Even-sized runs of 256 bytes to 4 KB, separated by gaps of the same */
+        for (address = 0; address < BENCH_IMAGE_LEN; address += len + 256*(1 + util_random(&state) % 16)) {
+            len = 256*(1 + util_random(&state) % 16);
+            if (len > BENCH_IMAGE_LEN - address)
+                len = BENCH_IMAGE_LEN - address;
+            if (byte_image_append(&program->image, data + address, len, address) < 0)
+                goto generate_error;
+        }
+    }
+
+    free(data);
+    return 0;
+
+    generate_error:
+    free(data);
+    byte_image_free(&program->image);
+    return -1;
+}
+
+/******************************************************************************/
+/* File Format Encoders */
+/******************************************************************************/
+
+/* Structure for a supported file format */
+struct bench_format {
+    const char *name;
+    /* Encoder of a program image, or NULL for raw binary */
+    int (*encode)(FILE *out, const struct ByteImage *image);
+    /* Memory Byte Stream functions */
+    int (*stream_init)(struct ByteStream *self);
+    int (*stream_close)(struct ByteStream *self);
+    int (*stream_read)(struct ByteStream *self, uint8_t *data, uint32_t *address);
+    int (*stream_span)(struct ByteStream *self, const uint8_t **data, uint32_t *len, uint32_t *address);
+    /* Holds address discontinuities flag */
+    int sparse;
+};
+
+static int util_encode_generic(FILE *out, const struct ByteImage *image) {
+    AtmelGenericRecord record;
+    uint32_t i, j;
+
+    for (i = 0; i < image->numSegments; i++) {
+        const struct ByteImageSegment *segment = &image->segments[i];
+        for (j = 0; j + 1 < segment->len; j += 2) {
+            uint16_t word = (uint16_t)(image->data[segment->offset + j] | (image->data[segment->offset + j + 1] << 8));
+            if (New_AtmelGenericRecord((segment->address + j)/2, word, &record) != ATMEL_GENERIC_OK || Write_AtmelGenericRecord(&record, out) != ATMEL_GENERIC_OK)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int util_encode_ihex(FILE *out, const struct ByteImage *image) {
+    IHexRecord record;
+    uint32_t i, j, len;
+
+    for (i = 0; i < image->numSegments; i++) {
+        const struct ByteImageSegment *segment = &image->segments[i];
+        for (j = 0; j < segment->len; j += len) {
+            len = (segment->len - j > 16) ? 16 : segment->len - j;
+            if (New_IHexRecord(IHEX_TYPE_00, (uint16_t)(segment->address + j), image->data + segment->offset + j, (int)len, &record) != IHEX_OK || Write_IHexRecord(&record, out) != IHEX_OK)
+                return -1;
+        }
+    }
+    if (New_IHexRecord(IHEX_TYPE_01, 0, NULL, 0, &record) != IHEX_OK || Write_IHexRecord(&record, out) != IHEX_OK)
+        return -1;
+
+    return 0;
+}
+
+static int util_encode_srecord(FILE *out, const struct ByteImage *image) {
+    SRecord record;
+    uint32_t i, j, len;
+
+    for (i = 0; i < image->numSegments; i++) {
+        const struct ByteImageSegment *segment = &image->segments[i];
+        for (j = 0; j < segment->len; j += len) {
+            len = (segment->len - j > 32) ? 32 : segment->len - j;
+            if (New_SRecord(SRECORD_TYPE_S1, segment->address + j, image->data + segment->offset + j, (int)len, &record) != SRECORD_OK || Write_SRecord(&record, out) != SRECORD_OK)
+                return -1;
+        }
+    }
+    if (New_SRecord(SRECORD_TYPE_S9, 0, NULL, 0, &record) != SRECORD_OK || Write_SRecord(&record, out) != SRECORD_OK)
+        return -1;
+
+    return 0;
+}
+
+static int util_encode_asciihex(FILE *out, const struct ByteImage *image) {
+    uint32_t i;
+
+    for (i = 0; i < image->len; i++) {
+        if (fprintf(out, "%02x%c", image->data[i], ((i+1) % 16 == 0) ? '\n' : ' ') < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static const struct bench_format Bench_Formats[] = {
+    {"generic", util_encode_generic, byte_stream_generic_memory_init, byte_stream_generic_close, byte_stream_generic_read, NULL, 1},
+    {"ihex", util_encode_ihex, byte_stream_ihex_memory_init, byte_stream_ihex_close, byte_stream_ihex_read, NULL, 1},
+    {"srec", util_encode_srecord, byte_stream_srecord_memory_init, byte_stream_srecord_close, byte_stream_srecord_read, NULL, 1},
+    {"ascii", util_encode_asciihex, byte_stream_asciihex_memory_init, byte_stream_asciihex_close, byte_stream_asciihex_read, NULL, 0},
+    {"binary", NULL, byte_stream_binary_memory_init, byte_stream_binary_memory_close, byte_stream_binary_memory_read, byte_stream_binary_memory_span, 0},
+};
+
+#define BENCH_NUM_FORMATS   (sizeof(Bench_Formats)/sizeof(Bench_Formats[0]))
+
+/* Encode a program image in a file format, into an allocated buffer */
+static int util_format_encode(const struct bench_format *format, const struct ByteImage *image, uint8_t **buf, size_t *len) {
+    FILE *out;
+    char *text;
+
+    if (format->encode == NULL) {
+        if ((*buf = malloc(image->len > 0 ? image->len : 1)) == NULL)
+            return -1;
+        memcpy(*buf, image->data, image->len);
+        *len = image->len;
+        return 0;
+    }
+
+    if ((out = open_memstream(&text, len)) == NULL)
+        return -1;
+    if (format->encode(out, image) < 0) {
+        fclose(out);
+        free(text);
+        return -1;
+    }
+    if (fclose(out) != 0)
+        return -1;
+
+    *buf = (uint8_t *)text;
+    return 0;
+}
+
+/******************************************************************************/
+/* Benchmark Stages */
+/******************************************************************************/
+
+/* Structure for the input of a stage */
+struct bench_case {
+    const struct bench_program *program;
+    const struct bench_format *format;
+    /* Encoded file */
+    const uint8_t *buf;
+    size_t len;
+    /* Decoded program, for the format stage */
+    const struct avrProgram *decoded;
+    /* Output sink, for the end-to-end stage */
+    FILE *null;
+};
+
+static void util_setup_byte_stream(struct ByteStream *bs, const struct bench_case *c) {
+    memset(bs, 0, sizeof(struct ByteStream));
+    bs->in_buf = c->buf;
+    bs->in_len = c->len;
+    bs->stream_init = c->format->stream_init;
+    bs->stream_close = c->format->stream_close;
+    bs->stream_read = c->format->stream_read;
+    bs->stream_span = c->format->stream_span;
+}
+
+/* Parse a file into a Byte Image */
+static int bench_parse(const struct bench_case *c, uint64_t *instructions) {
+    struct ByteStream bs;
+    struct ByteImage image;
+
+    util_setup_byte_stream(&bs, c);
+    if (byte_image_read(&image, &bs) < 0)
+        return -1;
+    byte_image_free(&image);
+
+    *instructions = 0;
+    return 0;
+}
+
+/* Decode a Byte Image into instructions */
+static int bench_decode(const struct bench_case *c, uint64_t *instructions) {
+    struct avrProgram program;
+
+    if (avr_program_decode(&program, &c->program->image) < 0)
+        return -1;
+    *instructions = program.len;
+    avr_program_free(&program);
+
+    return 0;
+}
+
+/* Format decoded instructions into text */
+static int bench_format(const struct bench_case *c, uint64_t *instructions) {
+    char buf[128];
+    unsigned int i;
+
+    for (i = 0; i < c->decoded->len; i++) {
+        if (avr_instruction_format(&c->decoded->instructions[i], buf, sizeof(buf), BENCH_PRINT_FLAGS) < 0)
+            return -1;
+    }
+    *instructions = c->decoded->len;
+
+    return 0;
+}
+
+/* Disassemble a file through the stream pipeline */
+static int bench_end_to_end(const struct bench_case *c, uint64_t *instructions) {
+    struct ByteStream bs;
+    struct DisasmStream ds;
+    struct PrintStream ps;
+    int ret;
+
+    util_setup_byte_stream(&bs, c);
+
+    memset(&ds, 0, sizeof(struct DisasmStream));
+    ds.in = &bs;
+    ds.stream_init = disasm_stream_avr_init;
+    ds.stream_close = disasm_stream_avr_close;
+    ds.stream_read = disasm_stream_avr_read;
+
+    memset(&ps, 0, sizeof(struct PrintStream));
+    ps.in = &ds;
+    ps.stream_init = print_stream_init;
+    ps.stream_close = print_stream_close;
+    ps.stream_read = print_stream_read;
+
+    if (ps.stream_init(&ps, BENCH_PRINT_FLAGS) < 0)
+        return -1;
+    while ( (ret = ps.stream_read(&ps, c->null)) != STREAM_EOF ) {
+        if (ret < 0) {
+            ps.stream_close(&ps);
+            return -1;
+        }
+    }
+    if (ps.stream_close(&ps) < 0)
+        return -1;
+
+    *instructions = c->decoded->len;
+    return 0;
+}
+
+/******************************************************************************/
+/* Benchmark Driver */
+/******************************************************************************/
+
+static double util_time_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+
+static int util_double_compare(const void *a, const void *b) {
+    double da = *(const double *)a, db = *(const double *)b;
+
+    return (da < db) ? -1 : (da > db) ? 1 : 0;
+}
+
+/* Time repetitions of a stage, and print its throughput */
+static int bench_run(const char *stage, const struct bench_case *c, int (*run)(const struct bench_case *c, uint64_t *instructions), unsigned int repetitions) {
+    double *mbps, *ips, start, elapsed;
+    uint64_t instructions, totalInstructions;
+    unsigned int iterations, r, i;
+
+    mbps = malloc(repetitions*sizeof(double));
+    ips = malloc(repetitions*sizeof(double));
+    if (mbps == NULL || ips == NULL) {
+        free(mbps);
+        free(ips);
+        return -1;
+    }
+
+    iterations = BENCH_MIN_BYTES / c->program->image.len;
+    if (iterations == 0)
+        iterations = 1;
+
+    for (r = 0; r < repetitions; r++) {
+        totalInstructions = 0;
+        start = util_time_now();
+        for (i = 0; i < iterations; i++) {
+            if (run(c, &instructions) < 0) {
+                fprintf(stderr, "Error running %s stage on %s / %s!\n", stage, c->program->name, (c->format != NULL) ? c->format->name : "-");
+                free(mbps);
+                free(ips);
+                return -1;
+            }
+            totalInstructions += instructions;
+        }
+        elapsed = util_time_now() - start;
+        mbps[r] = ((double)c->program->image.len*iterations/1e6) / elapsed;
+        ips[r] = ((double)totalInstructions/1e6) / elapsed;
+    }
+
+    qsort(mbps, repetitions, sizeof(double), util_double_compare);
+    qsort(ips, repetitions, sizeof(double), util_double_compare);
+
+    printf("%-10s %-8s %-11s %10.1f %10.1f", c->program->name, (c->format != NULL) ? c->format->name : "-", stage, mbps[0], mbps[repetitions/2]);
+    if (ips[repetitions-1] > 0)
+        printf(" %10.2f %10.2f\n", ips[0], ips[repetitions/2]);
+    else
+        printf(" %10s %10s\n", "-", "-");
+
+    free(mbps);
+    free(ips);
+
+    return 0;
+}
+
+int main(int argc, const char *argv[]) {
+    struct bench_program programs[4];
+    struct bench_case c;
+    struct avrProgram decoded;
+    unsigned int repetitions, p, f;
+    uint8_t *buf;
+    size_t len;
+    FILE *null;
+
+    repetitions = (argc > 1) ? (unsigned int)strtoul(argv[1], NULL, 10) : BENCH_REPETITIONS;
+    if (repetitions == 0)
+        repetitions = 1;
+
+    if ((null = fopen("/dev/null", "w")) == NULL) {
+        perror("Error opening /dev/null");
+        return EXIT_FAILURE;
+    }
+
+    /* Build the opcode lookup table before any timing */
+    avr_iset_lookup_init();
+
+    if (util_program_generate(&programs[0], "random", NULL, 0, 0x12345678) < 0 ||
+        util_program_generate(&programs[1], "compiler", Bench_Mix_Compiler, 0, 0x9e3779b9) < 0 ||
+        util_program_generate(&programs[2], "long", Bench_Mix_Long, 0, 0x2545f491) < 0 ||
+        util_program_generate(&programs[3], "sparse", Bench_Mix_Compiler, 1, 0x6c078965) < 0) {
+        fprintf(stderr, "Error generating synthetic programs!\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%d repetitions, MB/s of program bytes, M instructions/s\n\n", repetitions);
+    printf("%-10s %-8s %-11s %10s %10s %10s %10s\n", "program", "format", "stage", "MB/s min", "MB/s med", "Mi/s min", "Mi/s med");
+
+    for (p = 0; p < sizeof(programs)/sizeof(programs[0]); p++) {
+        memset(&c, 0, sizeof(c));
+        c.program = &programs[p];
+        c.null = null;
+
+        /* Decode and format stages run on the program image */
+        if (avr_program_decode(&decoded, &programs[p].image) < 0) {
+            fprintf(stderr, "Error decoding %s!\n", programs[p].name);
+            return EXIT_FAILURE;
+        }
+        c.decoded = &decoded;
+        if (bench_run("decode", &c, bench_decode, repetitions) < 0 || bench_run("format", &c, bench_format, repetitions) < 0)
+            return EXIT_FAILURE;
+
+        /* Parse and end-to-end stages run on each file format */
+        for (f = 0; f < BENCH_NUM_FORMATS; f++) {
+            if (programs[p].sparse && !Bench_Formats[f].sparse)
+                continue;
+
+            if (util_format_encode(&Bench_Formats[f], &programs[p].image, &buf, &len) < 0) {
+                fprintf(stderr, "Error encoding %s in %s format!\n", programs[p].name, Bench_Formats[f].name);
+                return EXIT_FAILURE;
+            }
+            c.format = &Bench_Formats[f];
+            c.buf = buf;
+            c.len = len;
+            if (bench_run("parse", &c, bench_parse, repetitions) < 0 || bench_run("end-to-end", &c, bench_end_to_end, repetitions) < 0)
+                return EXIT_FAILURE;
+            free(buf);
+        }
+
+        avr_program_free(&decoded);
+        byte_image_free(&programs[p].image);
+        printf("\n");
+    }
+
+    fclose(null);
+
+    return EXIT_SUCCESS;
+}
@@ -2,12 +2,40 @@
 #define BYTE_STREAM_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stream_error.h>
 
+/* Run of consecutive addresses in a Byte Image */
+struct ByteImageSegment {
+    /* Start address */
+    uint32_t address;
+    /* Offset of the first byte in the image data */
+    uint32_t offset;
+    /* Number of bytes */
+    uint32_t len;
+};
+
+/* Structure for the bytes of a fully read Byte Stream, in stream order */
+struct ByteImage {
+    /* Bytes */
+    uint8_t *data;
+    uint32_t len;
+    uint32_t capacity;
+    /* Address runs */
+    struct ByteImageSegment *segments;
+    uint32_t numSegments;
+    uint32_t segmentsCapacity;
+};
+
 struct ByteStream {
     /* Input stream */
     FILE *in;
+    /* Input image, for image Byte Streams */
+    const struct ByteImage *in_image;
+    /* Input buffer and length, for memory Byte Streams */
+    const uint8_t *in_buf;
+    size_t in_len;
     /* Stream state */
     void *state;
     /* Error string */
@@ -19,6 +47,9 @@ struct ByteStream {
     int (*stream_close)(struct ByteStream *self);
     /* Output function */
     int (*stream_read)(struct ByteStream *self, uint8_t *data, uint32_t *address);
+    /* Span output function, or NULL if unsupported. Returns the next run of
+     * consecutive bytes in place, without copying. */
+    int (*stream_span)(struct ByteStream *self, const uint8_t **data, uint32_t *len, uint32_t *address);
 };
 
 
@@ -0,0 +1,316 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _MSC_VER
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#else
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#endif
+
+#include <cache.h>
+
+/******************************************************************************/
+/* Cache Support */
+/******************************************************************************/
+
+/* Cached files are named <16 hex digit key>.dis */
+#define CACHE_SUFFIX        ".dis"
+#define CACHE_NAME_LEN      (16 + sizeof(CACHE_SUFFIX) - 1)
+
+/* Temporary files of entries being stored are named <16 hex digit
+ * key>.<pid>.<counter>.tmp, and are orphaned if their writer crashed */
+#define CACHE_TMP_SUFFIX    ".tmp"
+
+/* Age in seconds past which a temporary file is taken to be orphaned */
+#define CACHE_TMP_STALE_SECONDS     3600
+
+/* Eviction removes files until the cache is down to this fraction of its size
+ * bound, so that it runs once per many stores */
+#define CACHE_EVICT_TARGET(max_size)    ((max_size) - (max_size)/4)
+
+/* Nanoseconds of a file's modification time */
+#if defined(__APPLE__)
+#define CACHE_MTIME_NSEC(st)    ((st).st_mtimespec.tv_nsec)
+#else
+#define CACHE_MTIME_NSEC(st)    ((st).st_mtim.tv_nsec)
+#endif
+
+/* Counter for unique temporary file names within the process */
+static volatile unsigned int cache_tmp_counter = 0;
+
+static int util_cache_path(const struct Cache *cache, uint64_t key, char *path, size_t size) {
+    if (snprintf(path, size, "%s/%016llx%s", cache->dir, (unsigned long long)key, CACHE_SUFFIX) >= (int)size)
+        return -1;
+    return 0;
+}
+
+int cache_init(struct Cache *cache, const char *dir, uint64_t max_size) {
+    memset(cache, 0, sizeof(struct Cache));
+
+    if ((cache->dir = strdup(dir)) == NULL)
+        return -1;
+    cache->max_size = max_size;
+
+    /* Create the cache directory if it doesn't exist */
+#ifdef _MSC_VER
+    if (_mkdir(dir) < 0 && errno != EEXIST) {
+#else
+    if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+#endif
+        cache_free(cache);
+        return -1;
+    }
+
+    /* Start the running total from the files already cached, evicting them
+     * if they're over the bound */
+    if (cache_evict(cache) < 0) {
+        cache_free(cache);
+        return -1;
+    }
+
+    return 0;
+}
+
+void cache_free(struct Cache *cache) {
+    free(cache->dir);
+    memset(cache, 0, sizeof(struct Cache));
+}
+
+FILE *cache_lookup(const struct Cache *cache, uint64_t key) {
+    char path[4096];
+    FILE *in;
+
+    if (util_cache_path(cache, key, path, sizeof(path)) < 0)
+        return NULL;
+
+    if ((in = fopen(path, "r")) == NULL)
+        return NULL;
+
+#ifndef _MSC_VER
+    /* Mark the entry as recently used for eviction */
+    utime(path, NULL);
+#endif
+
+    return in;
+}
+
+int cache_store_begin(const struct Cache *cache, uint64_t key, struct cache_entry *entry) {
+    unsigned int counter;
+
+    memset(entry, 0, sizeof(struct cache_entry));
+    entry->key = key;
+
+#ifndef _MSC_VER
+    counter = __sync_fetch_and_add(&cache_tmp_counter, 1);
+#else
+    counter = cache_tmp_counter++;
+#endif
+
+    /* Temporary file unique to this process and entry */
+    if (snprintf(entry->tmp_path, sizeof(entry->tmp_path), "%s/%016llx.%d.%u%s", cache->dir, (unsigned long long)key, (int)getpid(), counter, CACHE_TMP_SUFFIX) >= (int)sizeof(entry->tmp_path))
+        return -1;
+
+    if ((entry->out = fopen(entry->tmp_path, "w+")) == NULL)
+        return -1;
+
+    return 0;
+}
+
+int cache_store_commit(struct Cache *cache, struct cache_entry *entry) {
+    char path[4096];
+    uint64_t size;
+    long len;
+    int ret;
+
+    /* Size of the entry, for the running total */
+    if (fseek(entry->out, 0, SEEK_END) != 0 || (len = ftell(entry->out)) < 0)
+        len = 0;
+
+    ret = fclose(entry->out);
+    entry->out = NULL;
+    if (ret != 0 || util_cache_path(cache, entry->key, path, sizeof(path)) < 0) {
+        remove(entry->tmp_path);
+        return -1;
+    }
+
+    /* Atomically move the complete file into place */
+#ifdef _MSC_VER
+    remove(path);
+#endif
+    if (rename(entry->tmp_path, path) < 0) {
+        remove(entry->tmp_path);
+        return -1;
+    }
+
+    /* Only scan the cache directory once the running total crosses the
+     * bound */
+#ifndef _MSC_VER
+    size = __sync_add_and_fetch(&cache->size, (uint64_t)len);
+#else
+    size = (cache->size += (uint64_t)len);
+#endif
+    if (size <= cache->max_size)
+        return 0;
+
+    return cache_evict(cache);
+}
+
+void cache_store_abort(struct cache_entry *entry) {
+    if (entry->out != NULL)
+        fclose(entry->out);
+    entry->out = NULL;
+    remove(entry->tmp_path);
+}
+
+#ifndef _MSC_VER
+
+/* Cached file, for eviction */
+struct cache_file {
+    char name[CACHE_NAME_LEN + 1];
+    time_t mtime;
+    long mtime_nsec;
+    uint64_t size;
+};
+
+static int util_cache_file_compare(const void *a, const void *b) {
+    const struct cache_file *fa = (const struct cache_file *)a;
+    const struct cache_file *fb = (const struct cache_file *)b;
+
+    /* Least recently used first, then by name for files used within the
+     * same timestamp */
+    if (fa->mtime != fb->mtime)
+        return (fa->mtime < fb->mtime) ? -1 : 1;
+    if (fa->mtime_nsec != fb->mtime_nsec)
+        return (fa->mtime_nsec < fb->mtime_nsec) ? -1 : 1;
+    return strcmp(fa->name, fb->name);
+}
+
+/* Temporary file of an entry being stored */
+static int util_cache_is_tmp(const char *name, size_t len) {
+    return len > 16 + sizeof(CACHE_TMP_SUFFIX) && name[16] == '.' && strcmp(name + len - (sizeof(CACHE_TMP_SUFFIX) - 1), CACHE_TMP_SUFFIX) == 0;
+}
+
+int cache_evict(struct Cache *cache) {
+    struct cache_file *files = NULL;
+    unsigned int numFiles = 0, capacity = 0, i;
+    uint64_t total = 0, before;
+    time_t now = time(NULL);
+    struct dirent *dirent;
+    struct stat st;
+    char path[4096];
+    size_t len;
+    DIR *dir;
+
+    /* One thread scans the cache directory while the others keep storing */
+    if (__sync_lock_test_and_set(&cache->evicting, 1))
+        return 0;
+
+    /* Running total the scan replaces, so that stores made during the scan
+     * stay counted */
+    before = __sync_add_and_fetch(&cache->size, 0);
+
+    if ((dir = opendir(cache->dir)) == NULL) {
+        __sync_lock_release(&cache->evicting);
+        return -1;
+    }
+
+    /* Collect cached files and their total size */
+    while ((dirent = readdir(dir)) != NULL) {
+        len = strlen(dirent->d_name);
+
+        /* Temporary files count towards the total, and are removed once
+         * stale, as left behind by a crashed writer */
+        if (util_cache_is_tmp(dirent->d_name, len)) {
+            if (snprintf(path, sizeof(path), "%s/%s", cache->dir, dirent->d_name) >= (int)sizeof(path) || stat(path, &st) < 0)
+                continue;
+            if (now - st.st_mtime > CACHE_TMP_STALE_SECONDS && (remove(path) == 0 || errno == ENOENT))
+                continue;
+            total += (uint64_t)st.st_size;
+            continue;
+        }
+
+        if (len != CACHE_NAME_LEN || strcmp(dirent->d_name + 16, CACHE_SUFFIX) != 0)
+            continue;
+        if (snprintf(path, sizeof(path), "%s/%s", cache->dir, dirent->d_name) >= (int)sizeof(path))
+            continue;
+        if (stat(path, &st) < 0)
+            continue;
+
+        if (numFiles == capacity) {
+            unsigned int newCapacity = (capacity == 0) ? 256 : capacity*2;
+            struct cache_file *newFiles = realloc(files, newCapacity*sizeof(struct cache_file));
+            if (newFiles == NULL) {
+                free(files);
+                closedir(dir);
+                __sync_lock_release(&cache->evicting);
+                return -1;
+            }
+            files = newFiles;
+            capacity = newCapacity;
+        }
+        strcpy(files[numFiles].name, dirent->d_name);
+        files[numFiles].mtime = st.st_mtime;
+        files[numFiles].mtime_nsec = (long)CACHE_MTIME_NSEC(st);
+        files[numFiles].size = (uint64_t)st.st_size;
+        total += files[numFiles].size;
+        numFiles++;
+    }
+    closedir(dir);
+
+    /* Remove least recently used files until under the eviction target */
+    if (total > cache->max_size) {
+        qsort(files, numFiles, sizeof(struct cache_file), util_cache_file_compare);
+        for (i = 0; i < numFiles && total > CACHE_EVICT_TARGET(cache->max_size); i++) {
+            snprintf(path, sizeof(path), "%s/%s", cache->dir, files[i].name);
+            /* Another process may have evicted it already */
+            if (remove(path) == 0 || errno == ENOENT)
+                total -= files[i].size;
+        }
+    }
+
+    free(files);
+
+    /* Replace the running total from before the scan with the scanned
+     * total, keeping what other threads added meanwhile */
+    if (total < before)
+        __sync_sub_and_fetch(&cache->size, before - total);
+    else
+        __sync_add_and_fetch(&cache->size, total - before);
+    __sync_lock_release(&cache->evicting);
+
+    return 0;
+}
+
+#else
+
+int cache_evict(struct Cache *cache) {
+    /* No eviction support */
+    return 0;
+}
+
+#endif
+
+int cache_copy(FILE *in, FILE *out) {
+    char buf[65536];
+    size_t n;
+
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n)
+            return -1;
+    }
+    if (ferror(in))
+        return -1;
+
+    return 0;
+}
+
@@ -0,0 +1,39 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* On-disk cache of output files, keyed by a 64-bit content hash */
+struct Cache {
+    /* Cache directory */
+    char *dir;
+    /* Size bound of all cached files, in bytes */
+    uint64_t max_size;
+    /* Running total size of cached files, from the last directory scan and
+     * the files stored since */
+    volatile uint64_t size;
+    /* Eviction in progress flag */
+    volatile int evicting;
+};
+
+/* Entry being stored into the cache */
+struct cache_entry {
+    /* Output file, written to a temporary path until committed */
+    FILE *out;
+    uint64_t key;
+    char tmp_path[4096];
+};
+
+/* Cache Support */
+int cache_init(struct Cache *cache, const char *dir, uint64_t max_size);
+void cache_free(struct Cache *cache);
+FILE *cache_lookup(const struct Cache *cache, uint64_t key);
+int cache_store_begin(const struct Cache *cache, uint64_t key, struct cache_entry *entry);
+int cache_store_commit(struct Cache *cache, struct cache_entry *entry);
+void cache_store_abort(struct cache_entry *entry);
+int cache_evict(struct Cache *cache);
+int cache_copy(FILE *in, FILE *out);
+
+#endif
+
@@ -9,6 +9,8 @@
 struct DisasmStream {
     /* Input stream */
     struct ByteStream *in;
+    /* Input program, for program Disasm Streams */
+    const void *in_program;
     /* Stream state */
     void *state;
     /* Error */
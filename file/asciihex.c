@@ -5,6 +5,7 @@
 #include <ctype.h>
 
 #include <byte_stream.h>
+#include <profile.h>
 
 /******************************************************************************/
 /* ASCII Hex Stream Support */
@@ -67,6 +68,7 @@ int byte_stream_asciihex_read(struct ByteStream *self, uint8_t *data, uint32_t *
             *data = util_hex2num(hexstr[0])*16 + util_hex2num(hexstr[1]);
             *address = state->address;
             state->address++;
+            PROFILE_COUNT(PROFILE_BYTES_READ, 1);
             return 0;
         } else {
             self->error = "Error reading file!";
@@ -77,6 +79,7 @@ int byte_stream_asciihex_read(struct ByteStream *self, uint8_t *data, uint32_t *
             *data = util_hex2num(hexstr[0])*16 + util_hex2num(hexstr[1]);
             *address = state->address;
             state->address++;
+            PROFILE_COUNT(PROFILE_BYTES_READ, 1);
             return 0;
         } else {
             self->error = "Error reading file!";
@@ -6,6 +6,7 @@
 #include "libGIS-1.0.5/atmel_generic.h"
 
 #include <byte_stream.h>
+#include <profile.h>
 
 /******************************************************************************/
 /* Atmel Generic file support */
@@ -76,6 +77,8 @@ int byte_stream_generic_read(struct ByteStream *self, uint8_t *data, uint32_t *a
 
             /* Update our available byte counter */
             state->availBytes = 2;
+            PROFILE_COUNT(PROFILE_RECORDS, 1);
+            PROFILE_COUNT(PROFILE_BYTES_READ, 2);
     }
 
     if (state->availBytes == 2) {
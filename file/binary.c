@@ -4,6 +4,7 @@
 #include <string.h>
 
 #include <byte_stream.h>
+#include <profile.h>
 
 /******************************************************************************/
 /* Binary Byte Stream Support */
@@ -51,6 +52,7 @@ int byte_stream_binary_read(struct ByteStream *self, uint8_t *data, uint32_t *ad
     if (bytes_read == 1) {
         *address = state->address;
         state->address++;
+        PROFILE_COUNT(PROFILE_BYTES_READ, 1);
     } else {
     /* Check for short-count, indicating EOF or error */
         if (feof(self->in))
@@ -0,0 +1,965 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <byte_stream.h>
+#include <symbol_table.h>
+#include <line_table.h>
+#include <profile.h>
+
+#include "file_support.h"
+
+/******************************************************************************/
+/* ELF Byte Stream Support */
+/******************************************************************************/
+
+/* ELF32 constants, without depending on the system's elf.h */
+#define ELF_HEADER_SIZE         52
+#define ELF_PHDR_SIZE           32
+#define ELF_SHDR_SIZE           40
+#define ELF_SYM_SIZE            16
+
+#define ELF_CLASS_32            1
+#define ELF_DATA_LSB            1
+#define ELF_TYPE_REL            1
+#define ELF_MACHINE_AVR         83
+
+#define ELF_PT_LOAD             1
+#define ELF_SHT_PROGBITS        1
+#define ELF_SHT_SYMTAB          2
+#define ELF_SHF_ALLOC           0x2
+#define ELF_SHF_EXECINSTR       0x4
+#define ELF_SHN_LORESERVE       0xff00
+
+#define ELF_STT_NOTYPE          0
+#define ELF_STT_FUNC            2
+
+/* avr-gcc places RAM, EEPROM and fuses above this address in the ELF address
+ * space, program memory starts at 0 */
+#define ELF_AVR_FLASH_END       0x800000
+
+/* Loaded run of program memory */
+struct elf_segment {
+    /* Program memory address */
+    uint32_t address;
+    /* File offset */
+    uint32_t offset;
+    /* Number of bytes */
+    uint32_t len;
+};
+
+/* Mapped or read ELF file */
+struct elf_file {
+    const uint8_t *base;
+    size_t size;
+    int mapped;
+};
+
+struct byte_stream_elf_state {
+    struct elf_file file;
+    /* Program memory segments, sorted by address */
+    struct elf_segment *segments;
+    uint32_t numSegments;
+    /* Current segment and offset into it */
+    uint32_t segment;
+    uint32_t offset;
+};
+
+static uint16_t util_elf_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t util_elf_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Check that a table of an ELF file lies within the file */
+static int util_elf_table_valid(const struct elf_file *file, uint32_t offset, uint32_t num, uint32_t entrySize) {
+    return offset <= file->size && num <= (file->size - offset)/entrySize;
+}
+
+/* Map an ELF file into memory, falling back to reading it whole if it can't
+ * be mapped. Returns -1 on error. */
+static int util_elf_open(struct elf_file *file, FILE *in) {
+    uint8_t *buf;
+    size_t capacity, n;
+
+    memset(file, 0, sizeof(struct elf_file));
+
+#ifndef _MSC_VER
+    {
+        struct stat st;
+        void *base;
+
+        if (fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fileno(in), 0);
+            if (base != MAP_FAILED) {
+                file->base = (const uint8_t *)base;
+                file->size = (size_t)st.st_size;
+                file->mapped = 1;
+                return 0;
+            }
+        }
+    }
+#endif
+
+    /* Read the input until EOF, e.g. from a pipe */
+    buf = NULL;
+    capacity = 0;
+    for (;;) {
+        if (file->size == capacity) {
+            uint8_t *grown;
+            capacity = (capacity == 0) ? 65536 : capacity*2;
+            if ((grown = realloc(buf, capacity)) == NULL) {
+                free(buf);
+                return -1;
+            }
+            buf = grown;
+        }
+        n = fread(buf + file->size, 1, capacity - file->size, in);
+        file->size += n;
+        if (n == 0)
+            break;
+    }
+    if (ferror(in)) {
+        free(buf);
+        return -1;
+    }
+
+    file->base = buf;
+    return 0;
+}
+
+static void util_elf_close(struct elf_file *file) {
+#ifndef _MSC_VER
+    if (file->mapped) {
+        munmap((void *)file->base, file->size);
+        return;
+    }
+#endif
+    free((void *)file->base);
+}
+
+/* Validate the ELF header of an AVR executable or object. Returns -1 if it
+ * isn't one. */
+static int util_elf_header_valid(const struct elf_file *file) {
+    const uint8_t *h = file->base;
+
+    if (file->size < ELF_HEADER_SIZE || memcmp(h, "\x7f" "ELF", 4) != 0)
+        return -1;
+    if (h[4] != ELF_CLASS_32 || h[5] != ELF_DATA_LSB || util_elf_u16(h + 18) != ELF_MACHINE_AVR)
+        return -1;
+    /* Program and section header tables */
+    if (util_elf_u16(h + 44) > 0 && (util_elf_u16(h + 42) < ELF_PHDR_SIZE || !util_elf_table_valid(file, util_elf_u32(h + 28), util_elf_u16(h + 44), util_elf_u16(h + 42))))
+        return -1;
+    if (util_elf_u16(h + 48) > 0 && (util_elf_u16(h + 46) < ELF_SHDR_SIZE || !util_elf_table_valid(file, util_elf_u32(h + 32), util_elf_u16(h + 48), util_elf_u16(h + 46))))
+        return -1;
+
+    return 0;
+}
+
+/* Section header i of a validated ELF file */
+static const uint8_t *util_elf_section(const struct elf_file *file, unsigned int i) {
+    return file->base + util_elf_u32(file->base + 32) + i*util_elf_u16(file->base + 46);
+}
+
+static int util_elf_segment_compare(const void *a, const void *b) {
+    const struct elf_segment *sa = (const struct elf_segment *)a;
+    const struct elf_segment *sb = (const struct elf_segment *)b;
+
+    if (sa->address < sb->address)
+        return -1;
+    else if (sa->address > sb->address)
+        return 1;
+    return 0;
+}
+
+static int util_elf_segment_add(struct byte_stream_elf_state *state, uint32_t address, uint32_t offset, uint32_t len) {
+    struct elf_segment *segments;
+
+    if (len == 0 || address >= ELF_AVR_FLASH_END)
+        return 0;
+
+    segments = realloc(state->segments, (state->numSegments + 1)*sizeof(struct elf_segment));
+    if (segments == NULL)
+        return -1;
+    state->segments = segments;
+    state->segments[state->numSegments].address = address;
+    state->segments[state->numSegments].offset = offset;
+    state->segments[state->numSegments].len = len;
+    state->numSegments++;
+
+    return 0;
+}
+
+/* Collect the program memory segments of an ELF file. These are the loadable
+ * segments at their physical (load) address, so the initializers of .data
+ * follow .text as they would in flash, or the allocated program sections of
+ * an object without program headers. Returns -1 on allocation error, or 1 on
+ * invalid segments. */
+static int util_elf_segments(struct byte_stream_elf_state *state) {
+    const struct elf_file *file = &state->file;
+    const uint8_t *p;
+    uint32_t offset, len;
+    unsigned int i, num;
+
+    /* Loadable segments */
+    num = util_elf_u16(file->base + 44);
+    for (i = 0; i < num; i++) {
+        p = file->base + util_elf_u32(file->base + 28) + i*util_elf_u16(file->base + 42);
+        if (util_elf_u32(p) != ELF_PT_LOAD)
+            continue;
+        offset = util_elf_u32(p + 4);
+        len = util_elf_u32(p + 16);
+        if (!util_elf_table_valid(file, offset, len, 1))
+            return 1;
+        if (util_elf_segment_add(state, util_elf_u32(p + 12), offset, len) < 0)
+            return -1;
+    }
+
+    /* Allocated program sections of an object */
+    if (num == 0) {
+        num = util_elf_u16(file->base + 48);
+        for (i = 0; i < num; i++) {
+            p = util_elf_section(file, i);
+            if (util_elf_u32(p + 4) != ELF_SHT_PROGBITS || (util_elf_u32(p + 8) & ELF_SHF_ALLOC) == 0)
+                continue;
+            offset = util_elf_u32(p + 16);
+            len = util_elf_u32(p + 20);
+            if (!util_elf_table_valid(file, offset, len, 1))
+                return 1;
+            if (util_elf_segment_add(state, util_elf_u32(p + 12), offset, len) < 0)
+                return -1;
+        }
+    }
+
+    /* Sort by address, and reject overlapping segments */
+    if (state->numSegments > 0)
+        qsort(state->segments, state->numSegments, sizeof(struct elf_segment), util_elf_segment_compare);
+    for (i = 1; i < state->numSegments; i++) {
+        if (state->segments[i].address - state->segments[i-1].address < state->segments[i-1].len)
+            return 1;
+    }
+
+    return 0;
+}
+
+int byte_stream_elf_init(struct ByteStream *self) {
+    struct byte_stream_elf_state *state;
+    int ret;
+
+    /* Allocate stream state */
+    self->state = malloc(sizeof(struct byte_stream_elf_state));
+    if (self->state == NULL) {
+        self->error = "Error allocating opcode stream state!";
+        return STREAM_ERROR_ALLOC;
+    }
+    /* Initialize stream state */
+    memset(self->state, 0, sizeof(struct byte_stream_elf_state));
+    state = (struct byte_stream_elf_state *)self->state;
+
+    /* Reset error string to NULL */
+    self->error = NULL;
+
+    /* Initialize the input stream */
+    /* FILE *in; assumed to have been opened */
+    if (util_elf_open(&state->file, self->in) < 0) {
+        free(self->state);
+        self->error = "Error reading file!";
+        return STREAM_ERROR_INPUT;
+    }
+
+    if (util_elf_header_valid(&state->file) < 0) {
+        util_elf_close(&state->file);
+        free(self->state);
+        self->error = "Invalid ELF file! Not a 32-bit little-endian AVR ELF file.";
+        return STREAM_ERROR_INPUT;
+    }
+
+    if ((ret = util_elf_segments(state)) != 0) {
+        util_elf_close(&state->file);
+        free(state->segments);
+        free(self->state);
+        if (ret < 0) {
+            self->error = "Error allocating ELF segments!";
+            return STREAM_ERROR_ALLOC;
+        }
+        self->error = "Invalid ELF file! Invalid loadable segments.";
+        return STREAM_ERROR_INPUT;
+    }
+
+    return 0;
+}
+
+int byte_stream_elf_close(struct ByteStream *self) {
+    struct byte_stream_elf_state *state = (struct byte_stream_elf_state *)self->state;
+
+    /* Unmap the file */
+    util_elf_close(&state->file);
+
+    /* Free stream state memory */
+    free(state->segments);
+    free(self->state);
+
+    /* Close input stream */
+    fclose(self->in);
+
+    return 0;
+}
+
+int byte_stream_elf_read(struct ByteStream *self, uint8_t *data, uint32_t *address) {
+    struct byte_stream_elf_state *state = (struct byte_stream_elf_state *)self->state;
+    const struct elf_segment *segment;
+
+    if (state->segment == state->numSegments)
+        return STREAM_EOF;
+
+    segment = &state->segments[state->segment];
+    *data = state->file.base[segment->offset + state->offset];
+    *address = segment->address + state->offset;
+    PROFILE_COUNT(PROFILE_BYTES_READ, 1);
+
+    /* Advance to the next segment */
+    if (++state->offset == segment->len) {
+        state->segment++;
+        state->offset = 0;
+    }
+
+    return 0;
+}
+
+int byte_stream_elf_span(struct ByteStream *self, const uint8_t **data, uint32_t *len, uint32_t *address) {
+    struct byte_stream_elf_state *state = (struct byte_stream_elf_state *)self->state;
+    const struct elf_segment *segment;
+
+    if (state->segment == state->numSegments)
+        return STREAM_EOF;
+
+    /* The rest of the segment is one run of consecutive addresses, in place
+     * in the mapped file */
+    segment = &state->segments[state->segment];
+    *data = state->file.base + segment->offset + state->offset;
+    *len = segment->len - state->offset;
+    *address = segment->address + state->offset;
+    PROFILE_COUNT(PROFILE_BYTES_READ, *len);
+
+    state->segment++;
+    state->offset = 0;
+
+    return 0;
+}
+
+/******************************************************************************/
+/* ELF Symbol Support */
+/******************************************************************************/
+
+/* Import the code symbols of a symbol table section */
+static int util_elf_symbols_section(struct SymbolTable *table, const struct elf_file *file, const uint8_t *symtab) {
+    const uint8_t *strtab, *sym, *section;
+    uint32_t i, num, strOffset, strLen, name, shndx, address;
+    unsigned int numSections = util_elf_u16(file->base + 48);
+    int relocatable = util_elf_u16(file->base + 16) == ELF_TYPE_REL;
+    int type;
+
+    /* Linked string table */
+    if (util_elf_u32(symtab + 24) >= numSections)
+        return 1;
+    strtab = util_elf_section(file, util_elf_u32(symtab + 24));
+    strOffset = util_elf_u32(strtab + 16);
+    strLen = util_elf_u32(strtab + 20);
+    if (!util_elf_table_valid(file, strOffset, strLen, 1) || !util_elf_table_valid(file, util_elf_u32(symtab + 16), util_elf_u32(symtab + 20), 1))
+        return 1;
+
+    num = util_elf_u32(symtab + 20) / ELF_SYM_SIZE;
+    for (i = 0; i < num; i++) {
+        sym = file->base + util_elf_u32(symtab + 16) + i*ELF_SYM_SIZE;
+        name = util_elf_u32(sym);
+        type = sym[12] & 0xf;
+        shndx = util_elf_u16(sym + 14);
+
+        /* Only import named functions and labels of program sections */
+        if (type != ELF_STT_FUNC && type != ELF_STT_NOTYPE)
+            continue;
+        if (shndx == 0 || shndx >= ELF_SHN_LORESERVE || shndx >= numSections)
+            continue;
+        section = util_elf_section(file, shndx);
+        if ((util_elf_u32(section + 8) & ELF_SHF_EXECINSTR) == 0)
+            continue;
+        if (name == 0 || name >= strLen || memchr(file->base + strOffset + name, '\0', strLen - name) == NULL)
+            continue;
+
+        /* Symbol values of an object are relative to their section */
+        address = util_elf_u32(sym + 4);
+        if (relocatable)
+            address += util_elf_u32(section + 12);
+
+        if (symbol_table_add(table, address, (const char *)file->base + strOffset + name) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int elf_symbols_load(struct SymbolTable *table, FILE *in) {
+    struct elf_file file;
+    unsigned int i, num;
+    int ret = 0;
+
+    if (util_elf_open(&file, in) < 0)
+        return -1;
+    /* The Byte Stream reads the file again */
+    if (!file.mapped)
+        rewind(in);
+
+    /* Leave an invalid file to be reported by the Byte Stream */
+    if (util_elf_header_valid(&file) < 0) {
+        util_elf_close(&file);
+        return 0;
+    }
+
+    num = util_elf_u16(file.base + 48);
+    for (i = 0; ret == 0 && i < num; i++) {
+        if (util_elf_u32(util_elf_section(&file, i) + 4) == ELF_SHT_SYMTAB)
+            ret = util_elf_symbols_section(table, &file, util_elf_section(&file, i));
+    }
+
+    util_elf_close(&file);
+
+    if (ret != 0)
+        return -1;
+
+    symbol_table_sort(table);
+
+    return 0;
+}
+
+/******************************************************************************/
+/* DWARF Line Table Support */
+/******************************************************************************/
+
+/* DWARF constants */
+#define DWARF_LNS_COPY                  1
+#define DWARF_LNS_ADVANCE_PC            2
+#define DWARF_LNS_ADVANCE_LINE          3
+#define DWARF_LNS_SET_FILE              4
+#define DWARF_LNS_CONST_ADD_PC          8
+#define DWARF_LNS_FIXED_ADVANCE_PC      9
+
+#define DWARF_LNE_END_SEQUENCE          1
+#define DWARF_LNE_SET_ADDRESS           2
+#define DWARF_LNE_DEFINE_FILE           3
+
+#define DWARF_LNCT_PATH                 1
+#define DWARF_LNCT_DIRECTORY_INDEX      2
+
+#define DWARF_FORM_DATA2                0x05
+#define DWARF_FORM_DATA4                0x06
+#define DWARF_FORM_DATA8                0x07
+#define DWARF_FORM_STRING               0x08
+#define DWARF_FORM_BLOCK                0x09
+#define DWARF_FORM_DATA1                0x0b
+#define DWARF_FORM_STRP                 0x0e
+#define DWARF_FORM_UDATA                0x0f
+#define DWARF_FORM_DATA16               0x1e
+#define DWARF_FORM_LINE_STRP            0x1f
+
+/* Bounds checked reader of DWARF data */
+struct dwarf_reader {
+    const uint8_t *p;
+    const uint8_t *end;
+    int error;
+};
+
+/* String sections referenced by DWARF 5 line tables */
+struct dwarf_strings {
+    const uint8_t *str;
+    uint32_t strLen;
+    const uint8_t *lineStr;
+    uint32_t lineStrLen;
+};
+
+/* Directories and files of a line table unit */
+struct dwarf_unit_files {
+    const char **dirs;
+    uint32_t numDirs;
+    /* Line Table file indices */
+    int *files;
+    uint32_t numFiles;
+    uint32_t capacity;
+};
+
+static uint64_t util_dwarf_fixed(struct dwarf_reader *r, unsigned int size) {
+    uint64_t value = 0;
+    unsigned int i;
+
+    if (r->error || (size_t)(r->end - r->p) < size) {
+        r->error = 1;
+        return 0;
+    }
+    for (i = 0; i < size; i++)
+        value |= (uint64_t)r->p[i] << (8*i);
+    r->p += size;
+
+    return value;
+}
+
+static uint64_t util_dwarf_uleb(struct dwarf_reader *r) {
+    uint64_t value = 0;
+    unsigned int shift = 0;
+
+    while (!r->error) {
+        if (r->p == r->end) {
+            r->error = 1;
+            break;
+        }
+        if (shift < 64)
+            value |= (uint64_t)(*r->p & 0x7f) << shift;
+        shift += 7;
+        if ((*r->p++ & 0x80) == 0)
+            break;
+    }
+
+    return value;
+}
+
+static int64_t util_dwarf_sleb(struct dwarf_reader *r) {
+    uint64_t value = 0;
+    unsigned int shift = 0;
+    uint8_t byte = 0;
+
+    while (!r->error) {
+        if (r->p == r->end) {
+            r->error = 1;
+            break;
+        }
+        byte = *r->p++;
+        if (shift < 64)
+            value |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+        if ((byte & 0x80) == 0)
+            break;
+    }
+    /* Sign extend */
+    if (shift < 64 && (byte & 0x40))
+        value |= ~(uint64_t)0 << shift;
+
+    return (int64_t)value;
+}
+
+static const char *util_dwarf_string(struct dwarf_reader *r) {
+    const uint8_t *s = r->p;
+
+    if (r->error || (r->p = memchr(s, '\0', r->end - s)) == NULL) {
+        r->p = r->end;
+        r->error = 1;
+        return NULL;
+    }
+    r->p++;
+
+    return (const char *)s;
+}
+
+/* String at an offset of a string section, or NULL */
+static const char *util_dwarf_string_at(const uint8_t *section, uint32_t len, uint64_t offset) {
+    if (section == NULL || offset >= len || memchr(section + offset, '\0', len - offset) == NULL)
+        return NULL;
+    return (const char *)section + offset;
+}
+
+/* Read an attribute of a DWARF 5 directory or file entry, as a string or a
+ * value. Returns -1 on an unsupported form. */
+static int util_dwarf_form(struct dwarf_reader *r, uint64_t form, unsigned int offsetSize, const struct dwarf_strings *strings, const char **str, uint64_t *value) {
+    *str = NULL;
+    *value = 0;
+
+    switch (form) {
+        case DWARF_FORM_STRING:
+            *str = util_dwarf_string(r);
+            break;
+        case DWARF_FORM_LINE_STRP:
+            *str = util_dwarf_string_at(strings->lineStr, strings->lineStrLen, util_dwarf_fixed(r, offsetSize));
+            break;
+        case DWARF_FORM_STRP:
+            *str = util_dwarf_string_at(strings->str, strings->strLen, util_dwarf_fixed(r, offsetSize));
+            break;
+        case DWARF_FORM_UDATA:
+            *value = util_dwarf_uleb(r);
+            break;
+        case DWARF_FORM_DATA1:
+            *value = util_dwarf_fixed(r, 1);
+            break;
+        case DWARF_FORM_DATA2:
+            *value = util_dwarf_fixed(r, 2);
+            break;
+        case DWARF_FORM_DATA4:
+            *value = util_dwarf_fixed(r, 4);
+            break;
+        case DWARF_FORM_DATA8:
+            *value = util_dwarf_fixed(r, 8);
+            break;
+        case DWARF_FORM_DATA16:
+            util_dwarf_fixed(r, 8);
+            util_dwarf_fixed(r, 8);
+            break;
+        case DWARF_FORM_BLOCK:
+            *value = util_dwarf_uleb(r);
+            if (!r->error && *value > (uint64_t)(r->end - r->p))
+                r->error = 1;
+            else if (!r->error)
+                r->p += *value;
+            *value = 0;
+            break;
+        default:
+            return -1;
+    }
+
+    return r->error ? -1 : 0;
+}
+
+/* Add a source file of a unit to the Line Table, joining its directory */
+static int util_dwarf_add_file(struct LineTable *table, struct dwarf_unit_files *unit, const char *name, uint64_t dir) {
+    char path[4096];
+    int index;
+
+    if (unit->numFiles == unit->capacity) {
+        uint32_t capacity = (unit->capacity == 0) ? 16 : unit->capacity*2;
+        int *files = realloc(unit->files, capacity*sizeof(int));
+        if (files == NULL)
+            return -1;
+        unit->files = files;
+        unit->capacity = capacity;
+    }
+
+    if (name == NULL)
+        name = "?";
+    if (name[0] != '/' && dir < unit->numDirs && unit->dirs[dir] != NULL && unit->dirs[dir][0] != '\0')
+        snprintf(path, sizeof(path), "%s/%s", unit->dirs[dir], name);
+    else
+        snprintf(path, sizeof(path), "%s", name);
+
+    if ((index = line_table_add_file(table, path)) < 0)
+        return -1;
+    unit->files[unit->numFiles++] = index;
+
+    return 0;
+}
+
+/* Read the DWARF 5 directory or file entries of a line table header.
+ * Returns -1 on allocation error, or 1 on invalid entries. */
+static int util_dwarf_entries(struct dwarf_reader *r, struct LineTable *table, struct dwarf_unit_files *unit, int directories, unsigned int offsetSize, const struct dwarf_strings *strings) {
+    uint64_t formats[16][2];
+    uint64_t count, i, value, dir;
+    const char *str, *path;
+    unsigned int numFormats, j;
+
+    numFormats = (unsigned int)util_dwarf_fixed(r, 1);
+    if (numFormats > 16)
+        return 1;
+    for (j = 0; j < numFormats; j++) {
+        formats[j][0] = util_dwarf_uleb(r);
+        formats[j][1] = util_dwarf_uleb(r);
+    }
+
+    count = util_dwarf_uleb(r);
+    if (r->error || count > (uint64_t)(r->end - r->p))
+        return 1;
+
+    if (directories) {
+        if ((unit->dirs = calloc((size_t)count + 1, sizeof(const char *))) == NULL)
+            return -1;
+        unit->numDirs = (uint32_t)count;
+    }
+
+    for (i = 0; i < count; i++) {
+        path = NULL;
+        dir = 0;
+        for (j = 0; j < numFormats; j++) {
+            if (util_dwarf_form(r, formats[j][1], offsetSize, strings, &str, &value) < 0)
+                return 1;
+            if (formats[j][0] == DWARF_LNCT_PATH)
+                path = str;
+            else if (formats[j][0] == DWARF_LNCT_DIRECTORY_INDEX)
+                dir = value;
+        }
+
+        if (directories)
+            unit->dirs[i] = path;
+        else if (util_dwarf_add_file(table, unit, path, dir) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Decode the line number program of one unit of .debug_line into the Line
+ * Table. Returns -1 on allocation error, or 1 on an invalid or unsupported
+ * unit. */
+static int util_dwarf_line_unit(struct dwarf_reader *r, struct LineTable *table, unsigned int offsetSize, const struct dwarf_strings *strings) {
+    struct dwarf_unit_files unit;
+    struct dwarf_reader header;
+    const uint8_t *standardLengths;
+    unsigned int version, minLength, lineRange, opcodeBase, i;
+    int lineBase, fileBase;
+    uint64_t headerLength, len, n;
+    uint32_t address, file, line;
+    int valid, opcode, ret;
+    const char *str;
+
+    memset(&unit, 0, sizeof(struct dwarf_unit_files));
+
+    /* Header */
+    version = (unsigned int)util_dwarf_fixed(r, 2);
+    if (version < 2 || version > 5)
+        return 1;
+    if (version >= 5)
+        util_dwarf_fixed(r, 2);     /* address_size, segment_selector_size */
+    headerLength = util_dwarf_fixed(r, offsetSize);
+    if (r->error || headerLength > (uint64_t)(r->end - r->p))
+        return 1;
+    header.p = r->p;
+    header.end = r->p + headerLength;
+    header.error = 0;
+    r->p = header.end;
+
+    minLength = (unsigned int)util_dwarf_fixed(&header, 1);
+    if (version >= 4)
+        util_dwarf_fixed(&header, 1);   /* maximum_operations_per_instruction */
+    util_dwarf_fixed(&header, 1);       /* default_is_stmt */
+    lineBase = (int8_t)util_dwarf_fixed(&header, 1);
+    lineRange = (unsigned int)util_dwarf_fixed(&header, 1);
+    opcodeBase = (unsigned int)util_dwarf_fixed(&header, 1);
+    if (header.error || lineRange == 0 || opcodeBase == 0 || (size_t)(header.end - header.p) < opcodeBase - 1)
+        return 1;
+    standardLengths = header.p;
+    header.p += opcodeBase - 1;
+
+    /* Directories and files */
+    if (version >= 5) {
+        fileBase = 0;
+        if ((ret = util_dwarf_entries(&header, table, &unit, 1, offsetSize, strings)) != 0 ||
+            (ret = util_dwarf_entries(&header, table, &unit, 0, offsetSize, strings)) != 0)
+            goto unit_done;
+    } else {
+        fileBase = 1;
+        /* Directory 0 is the compilation directory, not listed */
+        for (n = 0; (str = util_dwarf_string(&header)) != NULL && str[0] != '\0'; n++) {
+            const char **dirs = realloc(unit.dirs, (n + 2)*sizeof(const char *));
+            if (dirs == NULL) {
+                ret = -1;
+                goto unit_done;
+            }
+            unit.dirs = dirs;
+            unit.dirs[0] = NULL;
+            unit.dirs[n + 1] = str;
+            unit.numDirs = (uint32_t)n + 2;
+        }
+        while ((str = util_dwarf_string(&header)) != NULL && str[0] != '\0') {
+            n = util_dwarf_uleb(&header);
+            util_dwarf_uleb(&header);   /* modification time */
+            util_dwarf_uleb(&header);   /* length */
+            if ((ret = util_dwarf_add_file(table, &unit, str, n)) < 0)
+                goto unit_done;
+        }
+    }
+    if (header.error) {
+        ret = 1;
+        goto unit_done;
+    }
+
+    /* Run the line number program state machine */
+    address = 0;
+    file = 1;
+    line = 1;
+    valid = 1;
+    ret = 0;
+    while (r->p < r->end && !r->error && ret == 0) {
+        opcode = *r->p++;
+
+        if (opcode >= (int)opcodeBase) {
+            /* Special opcode: advance address and line, and append a row */
+            opcode -= opcodeBase;
+            address += (opcode / lineRange)*minLength;
+            line += lineBase + (int)(opcode % lineRange);
+        } else if (opcode == 0) {
+            /* Extended opcode */
+            len = util_dwarf_uleb(r);
+            if (r->error || len == 0 || len > (uint64_t)(r->end - r->p)) {
+                ret = 1;
+                break;
+            }
+            opcode = *r->p;
+            if (opcode == DWARF_LNE_END_SEQUENCE) {
+                /* End the sequence, and reset the registers */
+                if (valid)
+                    ret = line_table_add(table, address, 0, 0);
+                address = 0;
+                file = 1;
+                line = 1;
+                valid = 1;
+            } else if (opcode == DWARF_LNE_SET_ADDRESS) {
+                struct dwarf_reader operand = {r->p + 1, r->p + len, 0};
+                uint64_t value = util_dwarf_fixed(&operand, (len - 1 > 8) ? 8 : (unsigned int)(len - 1));
+                /* Sequences of discarded code have tombstone addresses
+                 * outside of program memory */
+                valid = value < ELF_AVR_FLASH_END;
+                address = (uint32_t)value;
+            } else if (opcode == DWARF_LNE_DEFINE_FILE && version < 5) {
+                struct dwarf_reader operand = {r->p + 1, r->p + len, 0};
+                str = util_dwarf_string(&operand);
+                n = util_dwarf_uleb(&operand);
+                if (str != NULL)
+                    ret = util_dwarf_add_file(table, &unit, str, n);
+            }
+            r->p += len;
+            continue;
+        } else if (opcode == DWARF_LNS_COPY) {
+            /* Append a row */
+        } else {
+            switch (opcode) {
+                case DWARF_LNS_ADVANCE_PC:
+                    address += (uint32_t)util_dwarf_uleb(r)*minLength;
+                    break;
+                case DWARF_LNS_ADVANCE_LINE:
+                    line += (uint32_t)util_dwarf_sleb(r);
+                    break;
+                case DWARF_LNS_SET_FILE:
+                    file = (uint32_t)util_dwarf_uleb(r);
+                    break;
+                case DWARF_LNS_CONST_ADD_PC:
+                    address += ((255 - opcodeBase) / lineRange)*minLength;
+                    break;
+                case DWARF_LNS_FIXED_ADVANCE_PC:
+                    address += (uint32_t)util_dwarf_fixed(r, 2);
+                    break;
+                default:
+                    /* Skip the operands of other standard opcodes */
+                    for (i = 0; i < standardLengths[opcode-1]; i++)
+                        util_dwarf_uleb(r);
+                    break;
+            }
+            continue;
+        }
+
+        /* Append a row, without source for an unknown file */
+        if (valid) {
+            if (file - fileBase < unit.numFiles && line != 0)
+                ret = line_table_add(table, address, unit.files[file - fileBase], line);
+            else
+                ret = line_table_add(table, address, 0, 0);
+        }
+    }
+    if (r->error && ret == 0)
+        ret = 1;
+
+    unit_done:
+    free(unit.dirs);
+    free(unit.files);
+
+    return ret;
+}
+
+/* Section header of an ELF file by name, or NULL */
+static const uint8_t *util_elf_section_named(const struct elf_file *file, const char *name) {
+    const uint8_t *shstrtab, *section;
+    uint32_t strOffset, strLen, offset;
+    unsigned int i, num = util_elf_u16(file->base + 48);
+
+    if (util_elf_u16(file->base + 50) >= num)
+        return NULL;
+    shstrtab = util_elf_section(file, util_elf_u16(file->base + 50));
+    strOffset = util_elf_u32(shstrtab + 16);
+    strLen = util_elf_u32(shstrtab + 20);
+    if (!util_elf_table_valid(file, strOffset, strLen, 1))
+        return NULL;
+
+    for (i = 0; i < num; i++) {
+        section = util_elf_section(file, i);
+        offset = util_elf_u32(section);
+        if (offset < strLen && strncmp((const char *)file->base + strOffset + offset, name, strLen - offset) == 0 && memchr(file->base + strOffset + offset, '\0', strLen - offset) != NULL)
+            return section;
+    }
+
+    return NULL;
+}
+
+/* Contents of an ELF section by name. Returns -1 if missing or invalid. */
+static int util_elf_section_data(const struct elf_file *file, const char *name, const uint8_t **data, uint32_t *len) {
+    const uint8_t *section;
+
+    if ((section = util_elf_section_named(file, name)) == NULL)
+        return -1;
+    if (!util_elf_table_valid(file, util_elf_u32(section + 16), util_elf_u32(section + 20), 1))
+        return -1;
+
+    *data = file->base + util_elf_u32(section + 16);
+    *len = util_elf_u32(section + 20);
+    return 0;
+}
+
+int elf_lines_load(struct LineTable *table, FILE *in) {
+    struct elf_file file;
+    struct dwarf_strings strings;
+    struct dwarf_reader r, unit;
+    const uint8_t *data;
+    unsigned int offsetSize;
+    uint64_t len;
+    uint32_t size;
+    int ret = 0;
+
+    if (util_elf_open(&file, in) < 0)
+        return -1;
+    /* The Byte Stream reads the file again */
+    if (!file.mapped)
+        rewind(in);
+
+    /* Leave an invalid file to be reported by the Byte Stream, and programs
+     * without line information unannotated */
+    if (util_elf_header_valid(&file) < 0 || util_elf_section_data(&file, ".debug_line", &data, &size) < 0) {
+        util_elf_close(&file);
+        return 0;
+    }
+
+    memset(&strings, 0, sizeof(struct dwarf_strings));
+    if (util_elf_section_data(&file, ".debug_str", &strings.str, &strings.strLen) < 0)
+        strings.str = NULL;
+    if (util_elf_section_data(&file, ".debug_line_str", &strings.lineStr, &strings.lineStrLen) < 0)
+        strings.lineStr = NULL;
+
+    /* Decode each unit, skipping invalid or unsupported ones */
+    r.p = data;
+    r.end = data + size;
+    r.error = 0;
+    while (r.p < r.end && ret >= 0) {
+        offsetSize = 4;
+        len = util_dwarf_fixed(&r, 4);
+        if (len == 0xffffffff) {
+            /* 64-bit DWARF */
+            offsetSize = 8;
+            len = util_dwarf_fixed(&r, 8);
+        }
+        if (r.error || len > (uint64_t)(r.end - r.p))
+            break;
+
+        unit.p = r.p;
+        unit.end = r.p + len;
+        unit.error = 0;
+        r.p = unit.end;
+
+        ret = util_dwarf_line_unit(&unit, table, offsetSize, &strings);
+    }
+
+    util_elf_close(&file);
+
+    if (ret < 0)
+        return -1;
+
+    line_table_sort(table);
+
+    return 0;
+}
@@ -20,6 +20,98 @@ int byte_stream_binary_init(struct ByteStream *self);
 int byte_stream_binary_close(struct ByteStream *self);
 int byte_stream_binary_read(struct ByteStream *self, uint8_t *data, uint32_t *address);
 
+/* Memory Byte Stream Support. Text formats parse the in_buf / in_len input
+ * buffer, and are read and closed with their file Byte Stream functions. */
+int byte_stream_generic_memory_init(struct ByteStream *self);
+int byte_stream_ihex_memory_init(struct ByteStream *self);
+int byte_stream_srecord_memory_init(struct ByteStream *self);
+int byte_stream_asciihex_memory_init(struct ByteStream *self);
+
+/* Binary Memory Byte Stream Support. Reads in place from the in_buf / in_len
+ * input buffer, with zero-copy spans. */
+int byte_stream_binary_memory_init(struct ByteStream *self);
+int byte_stream_binary_memory_close(struct ByteStream *self);
+int byte_stream_binary_memory_read(struct ByteStream *self, uint8_t *data, uint32_t *address);
+int byte_stream_binary_memory_span(struct ByteStream *self, const uint8_t **data, uint32_t *len, uint32_t *address);
+
+/* ELF Byte Stream Support. Maps the file and reads the program memory load
+ * segments of an AVR ELF file by physical address, with zero-copy spans. */
+int byte_stream_elf_init(struct ByteStream *self);
+int byte_stream_elf_close(struct ByteStream *self);
+int byte_stream_elf_read(struct ByteStream *self, uint8_t *data, uint32_t *address);
+int byte_stream_elf_span(struct ByteStream *self, const uint8_t **data, uint32_t *len, uint32_t *address);
+
+/* ELF Symbol Support. Imports the code symbols of the .symtab of an AVR ELF
+ * file into a symbol table. */
+struct SymbolTable;
+int elf_symbols_load(struct SymbolTable *table, FILE *in);
+
+/* ELF Line Table Support. Decodes the DWARF .debug_line line number programs
+ * of an AVR ELF file into a line table. */
+struct LineTable;
+int elf_lines_load(struct LineTable *table, FILE *in);
+
+/* Image Byte Stream Support */
+int byte_stream_image_init(struct ByteStream *self);
+int byte_stream_image_close(struct ByteStream *self);
+int byte_stream_image_read(struct ByteStream *self, uint8_t *data, uint32_t *address);
+
+/* Byte Image Support */
+#define BYTE_HASH_INIT  0xcbf29ce484222325ULL
+int byte_image_read(struct ByteImage *image, struct ByteStream *bs);
+int byte_image_append(struct ByteImage *image, const uint8_t *data, uint32_t len, uint32_t address);
+void byte_image_free(struct ByteImage *image);
+uint64_t byte_image_hash(const struct ByteImage *image, uint64_t hash);
+uint64_t byte_hash(uint64_t hash, const void *data, size_t len);
+
+/* Record Offset Index of an Intel HEX or Motorola S-Record file. The data
+ * records are indexed in blocks of about RECORD_INDEX_BLOCK_LEN bytes, each
+ * within one address segment, so a range of addresses can be read by seeking
+ * to the records covering it. */
+#define RECORD_INDEX_BLOCK_LEN      1024
+#define RECORD_INDEX_NO_SYNC        0xff
+
+enum {
+    RECORD_INDEX_IHEX,
+    RECORD_INDEX_SREC,
+};
+
+struct RecordIndexBlock {
+    /* File offset of the first record */
+    uint64_t offset;
+    /* Address of the first data byte, and number of data bytes */
+    uint32_t address;
+    uint32_t len;
+    /* Offset of the first data byte in the Byte Image of the file */
+    uint32_t imageOffset;
+    /* Offset of the first decode sync point (instruction start) in the
+     * block, or RECORD_INDEX_NO_SYNC */
+    uint8_t sync;
+    /* Starts a new address segment flag */
+    uint8_t segment;
+    uint8_t reserved[2];
+};
+
+struct RecordIndex {
+    /* Record format */
+    uint32_t format;
+    /* Caller's tag of the sync points, e.g. an instruction set version */
+    uint32_t tag;
+    /* Indexed file size and modification time, for invalidation */
+    uint64_t fileSize;
+    int64_t fileMtime;
+    /* Blocks, in file order */
+    struct RecordIndexBlock *blocks;
+    uint32_t numBlocks;
+};
+
+/* Record Offset Index Support */
+int record_index_build(struct RecordIndex *index, struct ByteImage *image, FILE *in, int format);
+int record_index_read_range(const struct RecordIndex *index, FILE *in, uint32_t *block, uint32_t start, uint32_t end, struct ByteImage *image);
+int record_index_save(FILE *out, const struct RecordIndex *index);
+int record_index_load(FILE *in, struct RecordIndex *index);
+void record_index_free(struct RecordIndex *index);
+
 /* ASCII Hex Stream Support */
 int byte_stream_asciihex_init(struct ByteStream *self);
 int byte_stream_asciihex_close(struct ByteStream *self);
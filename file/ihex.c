@@ -6,6 +6,7 @@
 #include "libGIS-1.0.5/ihex.h"
 
 #include <byte_stream.h>
+#include <profile.h>
 
 /******************************************************************************/
 /* Intel HEX file support */
@@ -50,7 +51,7 @@ int byte_stream_ihex_read(struct ByteStream *self, uint8_t *data, uint32_t *addr
     int ret;
 
     if (state->availBytes == 0) {
-        do {
+        while (1) {
             /* Read the next record */
             ret = Read_IHexRecord(&(state->iRec), self->in);
             switch (ret) {
@@ -71,11 +72,15 @@ int byte_stream_ihex_read(struct ByteStream *self, uint8_t *data, uint32_t *addr
                     return STREAM_ERROR_INPUT;
             }
 
-        /* Continue reading until we get a data record */
-        } while(state->iRec.type != IHEX_TYPE_00);
+            /* Continue reading until we get a non-empty data record */
+            if (state->iRec.type == IHEX_TYPE_00 && state->iRec.dataLen > 0)
+                break;
+        }
 
         /* Update our available bytes counter */
         state->availBytes = state->iRec.dataLen;
+        PROFILE_COUNT(PROFILE_RECORDS, 1);
+        PROFILE_COUNT(PROFILE_BYTES_READ, (uint64_t)state->iRec.dataLen);
     }
 
     if (state->availBytes) {
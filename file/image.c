@@ -0,0 +1,201 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <byte_stream.h>
+#include <profile.h>
+#include <trace.h>
+
+#include "file_support.h"
+
+/******************************************************************************/
+/* Byte Image Support */
+/******************************************************************************/
+
+int byte_image_append(struct ByteImage *image, const uint8_t *data, uint32_t len, uint32_t address) {
+    struct ByteImageSegment *segment;
+
+    /* Grow the data array if needed */
+    if (image->capacity - image->len < len) {
+        uint32_t capacity = (image->capacity == 0) ? 4096 : image->capacity;
+        uint8_t *newData;
+        while (capacity - image->len < len)
+            capacity *= 2;
+        newData = realloc(image->data, capacity);
+        if (newData == NULL)
+            return -1;
+        image->data = newData;
+        image->capacity = capacity;
+    }
+
+    /* Start a new segment on an address discontinuity */
+    segment = (image->numSegments > 0) ? &image->segments[image->numSegments-1] : NULL;
+    if (segment == NULL || address != segment->address + segment->len) {
+        if (image->numSegments == image->segmentsCapacity) {
+            uint32_t capacity = (image->segmentsCapacity == 0) ? 16 : image->segmentsCapacity*2;
+            struct ByteImageSegment *newSegments = realloc(image->segments, capacity*sizeof(struct ByteImageSegment));
+            if (newSegments == NULL)
+                return -1;
+            image->segments = newSegments;
+            image->segmentsCapacity = capacity;
+        }
+        segment = &image->segments[image->numSegments++];
+        segment->address = address;
+        segment->offset = image->len;
+        segment->len = 0;
+    }
+
+    if (len == 1)
+        image->data[image->len] = data[0];
+    else
+        memcpy(image->data + image->len, data, len);
+    image->len += len;
+    segment->len += len;
+
+    return 0;
+}
+
+int byte_image_read(struct ByteImage *image, struct ByteStream *bs) {
+    const uint8_t *span;
+    uint8_t data;
+    uint32_t address, len;
+    uint64_t start;
+    int ret;
+
+    memset(image, 0, sizeof(struct ByteImage));
+    start = PROFILE_NOW();
+
+    /* Initialize the byte stream */
+    if ((ret = bs->stream_init(bs)) < 0)
+        return ret;
+    TRACE_BEGIN("parse", NULL);
+
+    /* Copy whole runs of bytes until EOF, if the stream supports spans */
+    while ( bs->stream_span != NULL && (ret = bs->stream_span(bs, &span, &len, &address)) != STREAM_EOF ) {
+        if (ret < 0)
+            goto read_error;
+        if (byte_image_append(image, span, len, address) < 0) {
+            bs->error = "Error allocating byte image!";
+            ret = STREAM_ERROR_ALLOC;
+            goto read_error;
+        }
+    }
+
+    /* Read bytes until EOF */
+    while ( bs->stream_span == NULL && (ret = bs->stream_read(bs, &data, &address)) != STREAM_EOF ) {
+        if (ret < 0)
+            goto read_error;
+        if (byte_image_append(image, &data, 1, address) < 0) {
+            bs->error = "Error allocating byte image!";
+            ret = STREAM_ERROR_ALLOC;
+            goto read_error;
+        }
+    }
+
+    /* Close the byte stream */
+    TRACE_END("parse");
+    if ((ret = bs->stream_close(bs)) < 0) {
+        byte_image_free(image);
+        return ret;
+    }
+
+    PROFILE_TIME(PROFILE_TIMER_READ, start);
+
+    return 0;
+
+    read_error:
+    TRACE_END("parse");
+    bs->stream_close(bs);
+    byte_image_free(image);
+    return ret;
+}
+
+void byte_image_free(struct ByteImage *image) {
+    free(image->data);
+    free(image->segments);
+    memset(image, 0, sizeof(struct ByteImage));
+}
+
+uint64_t byte_image_hash(const struct ByteImage *image, uint64_t hash) {
+    uint32_t i;
+
+    /* FNV-1a over the address runs and the data */
+    for (i = 0; i < image->numSegments; i++) {
+        hash = byte_hash(hash, &image->segments[i].address, sizeof(uint32_t));
+        hash = byte_hash(hash, &image->segments[i].len, sizeof(uint32_t));
+    }
+    return byte_hash(hash, image->data, image->len);
+}
+
+uint64_t byte_hash(uint64_t hash, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+/******************************************************************************/
+/* Image Byte Stream Support */
+/******************************************************************************/
+
+struct byte_stream_image_state {
+    /* Current segment, and offset into it */
+    uint32_t segment;
+    uint32_t offset;
+};
+
+int byte_stream_image_init(struct ByteStream *self) {
+    /* Allocate stream state */
+    self->state = malloc(sizeof(struct byte_stream_image_state));
+    if (self->state == NULL) {
+        self->error = "Error allocating opcode stream state!";
+        return STREAM_ERROR_ALLOC;
+    }
+    /* Initialize stream state */
+    memset(self->state, 0, sizeof(struct byte_stream_image_state));
+
+    /* Reset error string to NULL */
+    self->error = NULL;
+
+    /* Initialize the input stream */
+    /* const struct ByteImage *in_image; assumed to have been read */
+
+    return 0;
+}
+
+int byte_stream_image_close(struct ByteStream *self) {
+    /* Free stream state memory */
+    free(self->state);
+
+    /* Input image is owned by the caller */
+
+    return 0;
+}
+
+int byte_stream_image_read(struct ByteStream *self, uint8_t *data, uint32_t *address) {
+    struct byte_stream_image_state *state = (struct byte_stream_image_state *)self->state;
+    const struct ByteImage *image = self->in_image;
+    const struct ByteImageSegment *segment;
+
+    /* Skip to the next segment at the end of the current one */
+    while (state->segment < image->numSegments && state->offset == image->segments[state->segment].len) {
+        state->segment++;
+        state->offset = 0;
+    }
+    if (state->segment == image->numSegments)
+        return STREAM_EOF;
+
+    segment = &image->segments[state->segment];
+    *data = image->data[segment->offset + state->offset];
+    *address = segment->address + state->offset;
+    state->offset++;
+
+    return 0;
+}
+
@@ -0,0 +1,279 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libGIS-1.0.5/ihex.h"
+#include "libGIS-1.0.5/srecord.h"
+
+#include <byte_stream.h>
+
+#include "file_support.h"
+
+/******************************************************************************/
+/* Record Offset Index Support */
+/******************************************************************************/
+
+/* Index file layout, in host byte order:
+ *      struct index_file_header
+ *      struct RecordIndexBlock [numBlocks]
+ */
+
+#define INDEX_FILE_MAGIC    "VAVRIDX1"
+
+struct index_file_header {
+    char magic[8];
+    uint32_t format;
+    uint32_t tag;
+    uint64_t fileSize;
+    int64_t fileMtime;
+    uint32_t numBlocks;
+    uint32_t reserved;
+};
+
+/* Structure for the data of one record */
+struct index_record {
+    uint8_t data[256];
+    uint32_t len;
+    uint32_t address;
+};
+
+/* Read the next non-empty data record */
+static int util_record_read(FILE *in, int format, struct index_record *record) {
+    IHexRecord iRec;
+    SRecord sRec;
+    int ret;
+
+    while (1) {
+        if (format == RECORD_INDEX_IHEX) {
+            ret = Read_IHexRecord(&iRec, in);
+            if (ret == IHEX_ERROR_NEWLINE)
+                continue;
+            else if (ret == IHEX_ERROR_EOF)
+                return STREAM_EOF;
+            else if (ret != IHEX_OK)
+                return STREAM_ERROR_INPUT;
+
+            if (iRec.type == IHEX_TYPE_00 && iRec.dataLen > 0) {
+                memcpy(record->data, iRec.data, iRec.dataLen);
+                record->len = iRec.dataLen;
+                record->address = iRec.address;
+                return 0;
+            }
+        } else {
+            ret = Read_SRecord(&sRec, in);
+            if (ret == SRECORD_ERROR_NEWLINE)
+                continue;
+            else if (ret == SRECORD_ERROR_EOF)
+                return STREAM_EOF;
+            else if (ret != SRECORD_OK)
+                return STREAM_ERROR_INPUT;
+
+            if ((sRec.type == SRECORD_TYPE_S1 || sRec.type == SRECORD_TYPE_S2 || sRec.type == SRECORD_TYPE_S3) && sRec.dataLen > 0) {
+                memcpy(record->data, sRec.data, sRec.dataLen);
+                record->len = sRec.dataLen;
+                record->address = sRec.address;
+                return 0;
+            }
+        }
+    }
+}
+
+int record_index_build(struct RecordIndex *index, struct ByteImage *image, FILE *in, int format) {
+    struct index_record record;
+    struct RecordIndexBlock *block;
+    uint32_t capacity;
+    long offset;
+    int ret;
+
+    memset(index, 0, sizeof(struct RecordIndex));
+    memset(image, 0, sizeof(struct ByteImage));
+    index->format = format;
+    capacity = 0;
+    block = NULL;
+
+    if (fseek(in, 0, SEEK_SET) != 0)
+        return STREAM_ERROR_INPUT;
+
+    while (1) {
+        if ((offset = ftell(in)) < 0) {
+            ret = STREAM_ERROR_INPUT;
+            goto build_error;
+        }
+        if ((ret = util_record_read(in, format, &record)) == STREAM_EOF)
+            break;
+        else if (ret < 0)
+            goto build_error;
+
+        /* Start a new block on an address discontinuity, or when the current
+         * block is full */
+        if (block == NULL || record.address != block->address + block->len || block->len >= RECORD_INDEX_BLOCK_LEN) {
+            if (index->numBlocks == capacity) {
+                struct RecordIndexBlock *newBlocks;
+                capacity = (capacity == 0) ? 64 : capacity*2;
+                newBlocks = realloc(index->blocks, capacity*sizeof(struct RecordIndexBlock));
+                if (newBlocks == NULL) {
+                    ret = STREAM_ERROR_ALLOC;
+                    goto build_error;
+                }
+                index->blocks = newBlocks;
+            }
+            block = &index->blocks[index->numBlocks++];
+            memset(block, 0, sizeof(struct RecordIndexBlock));
+            block->segment = (block == index->blocks || record.address != block[-1].address + block[-1].len);
+            block->offset = (uint64_t)offset;
+            block->address = record.address;
+            block->imageOffset = image->len;
+            block->sync = RECORD_INDEX_NO_SYNC;
+        }
+
+        if (byte_image_append(image, record.data, record.len, record.address) < 0) {
+            ret = STREAM_ERROR_ALLOC;
+            goto build_error;
+        }
+        block->len += record.len;
+    }
+
+    return 0;
+
+    build_error:
+    record_index_free(index);
+    byte_image_free(image);
+    return ret;
+}
+
+/* Index of the block of a segment containing an address */
+static uint32_t util_block_find(const struct RecordIndex *index, uint32_t first, uint32_t last, uint32_t address) {
+    uint32_t mid;
+
+    /* Last block in [first, last] starting at or before the address */
+    while (first < last) {
+        mid = first + (last - first + 1)/2;
+        if (index->blocks[mid].address <= address)
+            first = mid;
+        else
+            last = mid - 1;
+    }
+
+    return first;
+}
+
+int record_index_read_range(const struct RecordIndex *index, FILE *in, uint32_t *block, uint32_t start, uint32_t end, struct ByteImage *image) {
+    struct index_record record;
+    uint32_t first, last, k, m, s, e, skip, remaining;
+    uint64_t segmentEnd;
+    int ret;
+
+    memset(image, 0, sizeof(struct ByteImage));
+
+    /* Find the next segment overlapping [start, end) */
+    for (first = *block; first < index->numBlocks; first = last + 1) {
+        for (last = first; last+1 < index->numBlocks && !index->blocks[last+1].segment; last++)
+            ;
+        segmentEnd = (uint64_t)index->blocks[last].address + index->blocks[last].len;
+        if (start < end && index->blocks[first].address < end && segmentEnd > start)
+            break;
+    }
+    if (first >= index->numBlocks) {
+        *block = index->numBlocks;
+        return STREAM_EOF;
+    }
+    *block = last + 1;
+
+    /* Clip the range to the segment */
+    s = (start > index->blocks[first].address) ? start : index->blocks[first].address;
+    e = ((uint64_t)end < segmentEnd) ? end - 1 : (uint32_t)(segmentEnd - 1);
+
+    /* First block containing s, backed up to a decode sync point at or before
+     * s */
+    k = util_block_find(index, first, last, s);
+    while (k > first && (index->blocks[k].sync == RECORD_INDEX_NO_SYNC || index->blocks[k].address + index->blocks[k].sync > s))
+        k--;
+    skip = (index->blocks[k].sync == RECORD_INDEX_NO_SYNC) ? 0 : index->blocks[k].sync;
+
+    /* Last block containing e, plus the next one for an instruction
+     * straddling the end */
+    m = util_block_find(index, first, last, e);
+    if (m < last)
+        m++;
+
+    /* Read the records of blocks k..m */
+    if (fseek(in, (long)index->blocks[k].offset, SEEK_SET) != 0)
+        return STREAM_ERROR_INPUT;
+    remaining = index->blocks[m].imageOffset + index->blocks[m].len - index->blocks[k].imageOffset;
+    while (remaining > 0) {
+        if ((ret = util_record_read(in, index->format, &record)) < 0) {
+            byte_image_free(image);
+            return (ret == STREAM_EOF) ? STREAM_ERROR_INPUT : ret;
+        }
+        if (record.len > remaining)
+            record.len = remaining;
+        remaining -= record.len;
+
+        /* Skip up to the sync point */
+        if (skip >= record.len) {
+            skip -= record.len;
+            continue;
+        }
+        if (byte_image_append(image, record.data + skip, record.len - skip, record.address + skip) < 0) {
+            byte_image_free(image);
+            return STREAM_ERROR_ALLOC;
+        }
+        skip = 0;
+    }
+
+    return 0;
+}
+
+int record_index_save(FILE *out, const struct RecordIndex *index) {
+    struct index_file_header header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+    header.format = index->format;
+    header.tag = index->tag;
+    header.fileSize = index->fileSize;
+    header.fileMtime = index->fileMtime;
+    header.numBlocks = index->numBlocks;
+
+    if (fwrite(&header, sizeof(header), 1, out) != 1)
+        return -1;
+    if (index->numBlocks > 0 && fwrite(index->blocks, sizeof(struct RecordIndexBlock), index->numBlocks, out) != index->numBlocks)
+        return -1;
+
+    return 0;
+}
+
+int record_index_load(FILE *in, struct RecordIndex *index) {
+    struct index_file_header header;
+
+    memset(index, 0, sizeof(struct RecordIndex));
+
+    if (fread(&header, sizeof(header), 1, in) != 1)
+        return -1;
+    if (memcmp(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic)) != 0)
+        return -1;
+
+    index->format = header.format;
+    index->tag = header.tag;
+    index->fileSize = header.fileSize;
+    index->fileMtime = header.fileMtime;
+
+    if (header.numBlocks > 0) {
+        if ((index->blocks = malloc(header.numBlocks*sizeof(struct RecordIndexBlock))) == NULL)
+            return -1;
+        if (fread(index->blocks, sizeof(struct RecordIndexBlock), header.numBlocks, in) != header.numBlocks) {
+            record_index_free(index);
+            return -1;
+        }
+    }
+    index->numBlocks = header.numBlocks;
+
+    return 0;
+}
+
+void record_index_free(struct RecordIndex *index) {
+    free(index->blocks);
+    index->blocks = NULL;
+    index->numBlocks = 0;
+}
@@ -0,0 +1,142 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <byte_stream.h>
+#include <profile.h>
+
+#include "file_support.h"
+
+/******************************************************************************/
+/* Memory Byte Stream Support */
+/******************************************************************************/
+
+/* Open the input buffer as the input FILE of a text format Byte Stream */
+static int util_memory_open(struct ByteStream *self) {
+#ifndef _MSC_VER
+    /* fmemopen() allocates its own buffer for a NULL one */
+    self->in = fmemopen((self->in_buf != NULL) ? (void *)self->in_buf : (void *)"", self->in_len, "r");
+#else
+    /* No fmemopen(), fall back to a temporary file */
+    if ((self->in = tmpfile()) != NULL) {
+        if (fwrite(self->in_buf, 1, self->in_len, self->in) != self->in_len) {
+            fclose(self->in);
+            self->in = NULL;
+        } else {
+            rewind(self->in);
+        }
+    }
+#endif
+
+    if (self->in == NULL) {
+        self->error = "Error opening input buffer!";
+        return STREAM_ERROR_INPUT;
+    }
+
+    return 0;
+}
+
+/* Initialize a text format Byte Stream on the input buffer */
+static int util_memory_init(struct ByteStream *self, int (*stream_init)(struct ByteStream *self)) {
+    int ret;
+
+    if ((ret = util_memory_open(self)) < 0)
+        return ret;
+
+    if ((ret = stream_init(self)) < 0) {
+        fclose(self->in);
+        self->in = NULL;
+        return ret;
+    }
+
+    return 0;
+}
+
+int byte_stream_generic_memory_init(struct ByteStream *self) {
+    return util_memory_init(self, byte_stream_generic_init);
+}
+
+int byte_stream_ihex_memory_init(struct ByteStream *self) {
+    return util_memory_init(self, byte_stream_ihex_init);
+}
+
+int byte_stream_srecord_memory_init(struct ByteStream *self) {
+    return util_memory_init(self, byte_stream_srecord_init);
+}
+
+int byte_stream_asciihex_memory_init(struct ByteStream *self) {
+    return util_memory_init(self, byte_stream_asciihex_init);
+}
+
+/******************************************************************************/
+/* Binary Memory Byte Stream Support */
+/******************************************************************************/
+
+struct byte_stream_binary_memory_state {
+    uint32_t offset;
+};
+
+int byte_stream_binary_memory_init(struct ByteStream *self) {
+    /* Allocate stream state */
+    self->state = malloc(sizeof(struct byte_stream_binary_memory_state));
+    if (self->state == NULL) {
+        self->error = "Error allocating opcode stream state!";
+        return STREAM_ERROR_ALLOC;
+    }
+    /* Initialize stream state */
+    memset(self->state, 0, sizeof(struct byte_stream_binary_memory_state));
+
+    /* Reset error string to NULL */
+    self->error = NULL;
+
+    /* Initialize the input stream */
+    /* const uint8_t *in_buf; assumed to be valid until close */
+    if (self->in_len > UINT32_MAX) {
+        free(self->state);
+        self->error = "Input buffer too large!";
+        return STREAM_ERROR_INPUT;
+    }
+
+    return 0;
+}
+
+int byte_stream_binary_memory_close(struct ByteStream *self) {
+    /* Free stream state memory */
+    free(self->state);
+
+    /* Input buffer is owned by the caller */
+
+    return 0;
+}
+
+int byte_stream_binary_memory_read(struct ByteStream *self, uint8_t *data, uint32_t *address) {
+    struct byte_stream_binary_memory_state *state = (struct byte_stream_binary_memory_state *)self->state;
+
+    if (state->offset == self->in_len)
+        return STREAM_EOF;
+
+    *data = self->in_buf[state->offset];
+    *address = state->offset;
+    state->offset++;
+    PROFILE_COUNT(PROFILE_BYTES_READ, 1);
+
+    return 0;
+}
+
+int byte_stream_binary_memory_span(struct ByteStream *self, const uint8_t **data, uint32_t *len, uint32_t *address) {
+    struct byte_stream_binary_memory_state *state = (struct byte_stream_binary_memory_state *)self->state;
+
+    if (state->offset == self->in_len)
+        return STREAM_EOF;
+
+    /* The rest of the buffer is one run of consecutive addresses */
+    *data = self->in_buf + state->offset;
+    *len = (uint32_t)self->in_len - state->offset;
+    *address = state->offset;
+    state->offset = (uint32_t)self->in_len;
+    PROFILE_COUNT(PROFILE_BYTES_READ, *len);
+
+    return 0;
+}
+
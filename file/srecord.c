@@ -6,6 +6,7 @@
 #include "libGIS-1.0.5/srecord.h"
 
 #include <byte_stream.h>
+#include <profile.h>
 
 /******************************************************************************/
 /* Motorola S-Record file support */
@@ -50,7 +51,7 @@ int byte_stream_srecord_read(struct ByteStream *self, uint8_t *data, uint32_t *a
     int ret;
 
     if (state->availBytes == 0) {
-        do {
+        while (1) {
             /* Read the next record */
             ret = Read_SRecord(&(state->sRec), self->in);
             switch (ret) {
@@ -71,11 +72,15 @@ int byte_stream_srecord_read(struct ByteStream *self, uint8_t *data, uint32_t *a
                     return STREAM_ERROR_INPUT;
             }
 
-        /* Continue reading until we get a data record */
-        } while (state->sRec.type != SRECORD_TYPE_S1 && state->sRec.type != SRECORD_TYPE_S2 && state->sRec.type != SRECORD_TYPE_S3);
+            /* Continue reading until we get a non-empty data record */
+            if ((state->sRec.type == SRECORD_TYPE_S1 || state->sRec.type == SRECORD_TYPE_S2 || state->sRec.type == SRECORD_TYPE_S3) && state->sRec.dataLen > 0)
+                break;
+        }
 
         /* Update our available bytes counter */
         state->availBytes = state->sRec.dataLen;
+        PROFILE_COUNT(PROFILE_RECORDS, 1);
+        PROFILE_COUNT(PROFILE_BYTES_READ, (uint64_t)state->sRec.dataLen);
     }
 
     if (state->availBytes) {
@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <byte_stream.h>
 
@@ -15,6 +16,7 @@ int test_byte_stream(FILE *in, int (*stream_init)(struct ByteStream *self), int
     int i, ret;
 
     /* Setup the Byte Stream */
+    memset(&os, 0, sizeof(struct ByteStream));
     os.in = in;
     os.stream_init = stream_init;
     os.stream_close = stream_close;
@@ -0,0 +1,169 @@
+#!/bin/sh
+# Run vavrdisasm over the input files of file/tests, checking that malformed
+# inputs fail cleanly in every mode, that the sample.elf fixture (see
+# make_elf.py) disassembles to its expected output, and that cached,
+# incremental and range output, and the output of the library test program if
+# given, match a plain disassembly.
+#
+#   input_test.sh [<vavrdisasm>] [<vavrdisasm_libtest>]
+
+VAVRDISASM=${1:-./vavrdisasm}
+LIBTEST=${2:-}
+FAILED=0
+
+# Run from the top of the tree, which the fixture's source paths are
+# relative to
+case $VAVRDISASM in
+    /*) ;;
+    *) VAVRDISASM=$(pwd)/$VAVRDISASM ;;
+esac
+case $LIBTEST in
+    /*|"") ;;
+    *) LIBTEST=$(pwd)/$LIBTEST ;;
+esac
+cd "$(dirname "$0")/../.." || exit 1
+DIR=file/tests
+
+# Scratch directory for outputs and caches
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+# Expect a clean failure (exit status 1) on a malformed input
+check_fails() {
+    "$VAVRDISASM" "$@" > /dev/null 2>&1
+    status=$?
+    if [ $status -ne 1 ]; then
+        echo "FAIL: vavrdisasm $* exited with status $status, expected 1"
+        FAILED=1
+    else
+        echo "PASS: vavrdisasm $*"
+    fi
+}
+
+# Expect the output of an input to match an expected output file
+check_output() {
+    expected=$1
+    shift
+    if "$VAVRDISASM" "$@" 2>&1 | diff -u "$expected" - > /dev/null; then
+        echo "PASS: vavrdisasm $*"
+    else
+        echo "FAIL: vavrdisasm $* differs from $expected"
+        "$VAVRDISASM" "$@" 2>&1 | diff -u "$expected" -
+        FAILED=1
+    fi
+}
+
+# Expect the output of an input to be byte-identical to a reference output
+# file
+check_same() {
+    reference=$1
+    shift
+    "$VAVRDISASM" "$@" > "$TMP/out" 2>&1
+    if cmp -s "$reference" "$TMP/out"; then
+        echo "PASS: vavrdisasm $*"
+    else
+        echo "FAIL: vavrdisasm $* differs from a plain disassembly"
+        cmp "$reference" "$TMP/out"
+        FAILED=1
+    fi
+}
+
+# Expect the output of the library test program to be byte-identical to a
+# reference output file
+check_library() {
+    reference=$1
+    shift
+    "$LIBTEST" "$@" > "$TMP/out" 2>&1
+    if cmp -s "$reference" "$TMP/out"; then
+        echo "PASS: vavrdisasm_libtest $*"
+    else
+        echo "FAIL: vavrdisasm_libtest $* differs from vavrdisasm"
+        cmp "$reference" "$TMP/out"
+        FAILED=1
+    fi
+}
+
+check_fails --size-report "$DIR/malformed.hex"
+check_fails --dead-stores "$DIR/malformed.hex"
+check_fails --tables "$DIR/malformed.hex"
+check_fails --stats --size-report "$DIR/sample.elf"
+check_fails --fingerprints "$DIR/none.fpdb" --dead-stores "$DIR/sample.elf"
+check_fails --tables --start 0x10 "$DIR/sample.elf"
+check_fails -j 0 "$DIR/sample.elf"
+check_fails -j 4x "$DIR/sample.elf"
+check_fails --cache-dir "$TMP/cache" --cache-size 12M "$DIR/sample.elf"
+check_fails --start 0x1g "$DIR/sample.elf"
+check_fails --end 0x100000000 "$DIR/sample.elf"
+check_fails --start 0x20 --end 0x10 "$DIR/sample.elf"
+check_fails --database "$TMP/sample.db" --xrefs delay "$DIR/sample.elf"
+
+check_output "$DIR/sample.elf.dis" "$DIR/sample.elf"
+check_output "$DIR/sample.elf.source.dis" --source "$DIR/sample.elf"
+
+# Hand-assembled fixtures of the analysis modes
+# dead.hex: ldi r24, 0x01 overwritten by ldi r24, 0x02 before out 0x05, r24
+check_output "$DIR/dead.hex.dead-stores.dis" --dead-stores "$DIR/dead.hex"
+# table.hex: lpm r24, Z+ of a Z loaded with 0x000a, where the table words
+# would otherwise decode as a call
+check_output "$DIR/table.hex.tables.dis" --tables "$DIR/table.hex"
+# sample.sig: a signature of the delay() loop of sample.c, found once, and one
+# found nowhere
+check_output "$DIR/sample.sig.find-signature.dis" --find-signature "$DIR/sample.sig" "$DIR/sample.hex"
+# clone.hex: two rcalled copies of a 9 instruction function, one clone group
+check_output "$DIR/clone.hex.clones.dis" --clones "$DIR/clone.hex"
+check_fails --clones=8x "$DIR/clone.hex"
+
+# Cached output, stored then looked up, matches a plain disassembly, and
+# temporary files of crashed writers are removed once stale
+"$VAVRDISASM" "$DIR/sample.elf" > "$TMP/sample.dis"
+mkdir "$TMP/cache"
+: > "$TMP/cache/0123456789abcdef.1.0.tmp"
+touch -t 200001010000 "$TMP/cache/0123456789abcdef.1.0.tmp"
+check_same "$TMP/sample.dis" --cache-dir "$TMP/cache" "$DIR/sample.elf"
+if ! ls "$TMP/cache"/*.dis > /dev/null 2>&1; then
+    echo "FAIL: disassembly was not stored in the cache"
+    FAILED=1
+fi
+check_same "$TMP/sample.dis" --cache-dir "$TMP/cache" "$DIR/sample.elf"
+if [ -e "$TMP/cache/0123456789abcdef.1.0.tmp" ]; then
+    echo "FAIL: stale cache temporary file was not removed"
+    FAILED=1
+fi
+
+# Incremental output against a saved decode matches a full disassembly of the
+# new release. sample2.hex is sample.hex with the ldi at 0x02 changed, and the
+# lds at 0x0e changed to a mov, which leaves its address word to decode alone.
+"$VAVRDISASM" "$DIR/sample2.hex" > "$TMP/sample2.dis"
+"$VAVRDISASM" --save-decode "$TMP/sample.dec" "$DIR/sample.hex" > /dev/null
+check_same "$TMP/sample2.dis" --incremental "$TMP/sample.dec" "$DIR/sample2.hex"
+
+# Range output matches the window of a full disassembly. [0x10, 0x1c) starts
+# inside the lds at 0x0e.
+"$VAVRDISASM" -t binary "$DIR/sample.bin" | sed -n 8,12p > "$TMP/sample.range.dis"
+check_same "$TMP/sample.range.dis" -t binary --start 0x10 --end 0x1c "$DIR/sample.bin"
+
+# So does range output of an Intel HEX file, read in full while writing its
+# record index sidecar, then read through the sidecar, where the range spans
+# two records
+cp "$DIR/sample.hex" "$TMP/sample.hex"
+check_same "$TMP/sample.range.dis" --start 0x10 --end 0x1c "$TMP/sample.hex"
+if [ ! -e "$TMP/sample.hex.vidx" ]; then
+    echo "FAIL: record index sidecar was not written"
+    FAILED=1
+fi
+check_same "$TMP/sample.range.dis" --start 0x10 --end 0x1c "$TMP/sample.hex"
+
+# The library decodes and formats like vavrdisasm, in whole and over a range
+# starting inside a 32-bit instruction
+if [ -n "$LIBTEST" ]; then
+    "$VAVRDISASM" -t binary "$DIR/sample.bin" > "$TMP/sample.bin.dis"
+    "$VAVRDISASM" -t binary --start 0x10 --end 0x1c "$DIR/sample.bin" > "$TMP/sample.bin.range.dis"
+    check_library "$TMP/sample.bin.dis" "$DIR/sample.bin"
+    check_library "$TMP/sample.bin.range.dis" "$DIR/sample.bin" 0x10 0x1c
+fi
+
+if [ $FAILED -ne 0 ]; then
+    echo "Input tests failed!"
+    exit 1
+fi
+echo "Input tests passed."
@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+# Generate the sample.elf test fixture: an avr-gcc style ELF32 executable of
+# sample.c, with .text and .data load segments, function and label symbols,
+# and a DWARF 4 and a DWARF 5 unit of .debug_line, and optionally its .text
+# as the sample.bin binary fixture.
+#
+#   python3 file/tests/make_elf.py file/tests/sample.elf [file/tests/sample.bin]
+
+import struct
+import sys
+
+# Instruction words of main() and delay()
+TEXT_WORDS = [
+    # main
+    0x2411,             # 0x00  eor r1, r1
+    0xe280,             # 0x02  ldi r24, 0x20
+    0xb984,             # 0x04  out 0x04, r24
+    # loop
+    0x9a2d,             # 0x06  sbi 0x05, 5
+    0xd008,             # 0x08  rcall delay
+    0x982d,             # 0x0a  cbi 0x05, 5
+    0xd006,             # 0x0c  rcall delay
+    0x9180, 0x0100,     # 0x0e  lds r24, 0x0100
+    0x9583,             # 0x12  inc r24
+    0x9380, 0x0100,     # 0x14  sts 0x0100, r24
+    0xcff6,             # 0x18  rjmp loop
+    # delay
+    0xef8f,             # 0x1a  ldi r24, 0xff
+    0xef9f,             # 0x1c  ldi r25, 0xff
+    0x9701,             # 0x1e  sbiw r24, 1
+    0xf7f1,             # 0x20  brne .-4
+    0x9508,             # 0x22  ret
+]
+
+# Initializer of count, loaded after .text
+DATA = bytes([0x01])
+DATA_ADDRESS = 0x800100
+
+# Symbols, locals first: name, value, info (binding << 4 | type), section
+# index
+SYMBOLS = [
+    ("loop", 0x06, 0x00, 1),
+    ("main", 0x00, 0x12, 1),
+    ("delay", 0x1a, 0x12, 1),
+    ("count", DATA_ADDRESS, 0x11, 2),
+]
+
+# Line rows of each unit: (address, line), ending at the end address
+MAIN_ROWS = [(0x00, 9), (0x02, 10), (0x06, 12), (0x08, 13), (0x0a, 14), (0x0c, 15), (0x0e, 16), (0x18, 11)]
+MAIN_END = 0x1a
+DELAY_ROWS = [(0x1a, 22), (0x1e, 23), (0x22, 25)]
+DELAY_END = 0x24
+
+SOURCE_DIR = b"file/tests"
+SOURCE_FILE = b"sample.c"
+
+LINE_BASE = -5
+LINE_RANGE = 14
+OPCODE_BASE = 13
+MIN_INSTRUCTION_LENGTH = 2
+STANDARD_OPCODE_LENGTHS = bytes([0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1])
+
+
+def uleb(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7f
+        value >>= 7
+        out.append(byte | (0x80 if value else 0))
+        if not value:
+            return bytes(out)
+
+
+def sleb(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7f
+        value >>= 7
+        done = (value == 0 and not byte & 0x40) or (value == -1 and byte & 0x40)
+        out.append(byte | (0 if done else 0x80))
+        if done:
+            return bytes(out)
+
+
+def line_program(rows, end):
+    # DW_LNE_set_address
+    program = bytearray(b"\x00\x05\x02" + struct.pack("<I", rows[0][0]))
+    address, line = rows[0][0], 1
+    for row_address, row_line in rows:
+        address_advance = (row_address - address) // MIN_INSTRUCTION_LENGTH
+        line_advance = row_line - line
+        opcode = (line_advance - LINE_BASE) + LINE_RANGE*address_advance + OPCODE_BASE
+        if 0 <= line_advance - LINE_BASE < LINE_RANGE and opcode <= 255:
+            # Special opcode
+            program.append(opcode)
+        else:
+            # DW_LNS_advance_pc, DW_LNS_advance_line, DW_LNS_copy
+            if address_advance:
+                program += b"\x02" + uleb(address_advance)
+            program += b"\x03" + sleb(line_advance) + b"\x01"
+        address, line = row_address, row_line
+    # DW_LNS_advance_pc, DW_LNE_end_sequence
+    program += b"\x02" + uleb((end - address) // MIN_INSTRUCTION_LENGTH) + b"\x00\x01\x01"
+    return bytes(program)
+
+
+def line_unit_v4(rows, end):
+    header = bytes([MIN_INSTRUCTION_LENGTH, 1, 1, LINE_BASE & 0xff, LINE_RANGE, OPCODE_BASE]) + STANDARD_OPCODE_LENGTHS
+    header += SOURCE_DIR + b"\x00\x00"
+    header += SOURCE_FILE + b"\x00" + uleb(1) + uleb(0) + uleb(0) + b"\x00"
+    body = struct.pack("<HI", 4, len(header)) + header + line_program(rows, end)
+    return struct.pack("<I", len(body)) + body
+
+
+def line_unit_v5(rows, end, line_str_offset):
+    header = bytes([MIN_INSTRUCTION_LENGTH, 1, 1, LINE_BASE & 0xff, LINE_RANGE, OPCODE_BASE]) + STANDARD_OPCODE_LENGTHS
+    # Directories: DW_LNCT_path as DW_FORM_line_strp
+    header += b"\x01" + uleb(1) + uleb(0x1f) + uleb(1) + struct.pack("<I", line_str_offset)
+    # Files 0 and 1: DW_LNCT_path as DW_FORM_string, DW_LNCT_directory_index
+    # as DW_FORM_udata
+    header += b"\x02" + uleb(1) + uleb(0x08) + uleb(2) + uleb(0x0f) + uleb(2)
+    header += (SOURCE_FILE + b"\x00" + uleb(0))*2
+    body = struct.pack("<HBBI", 5, 4, 0, len(header)) + header + line_program(rows, end)
+    return struct.pack("<I", len(body)) + body
+
+
+def main():
+    text = b"".join(struct.pack("<H", word) for word in TEXT_WORDS)
+
+    debug_line_str = SOURCE_DIR + b"\x00"
+    debug_line = line_unit_v4(MAIN_ROWS, MAIN_END) + line_unit_v5(DELAY_ROWS, DELAY_END, 0)
+
+    strtab = bytearray(b"\x00")
+    symtab = bytearray(16)
+    for name, value, info, shndx in SYMBOLS:
+        symtab += struct.pack("<IIIBBH", len(strtab), value, 0, info, 0, shndx)
+        strtab += name.encode() + b"\x00"
+
+    # Sections: name, type, flags, address, data, link, entry size
+    sections = [
+        (".text", 1, 0x6, 0, text, 0, 0),
+        (".data", 1, 0x3, DATA_ADDRESS, DATA, 0, 0),
+        (".debug_line", 1, 0, 0, debug_line, 0, 0),
+        (".debug_line_str", 1, 0x30, 0, debug_line_str, 0, 1),
+        (".symtab", 2, 0, 0, bytes(symtab), 6, 16),
+        (".strtab", 3, 0, 0, bytes(strtab), 0, 0),
+    ]
+    shstrtab = bytearray(b"\x00")
+    names = []
+    for section in sections + [(".shstrtab",)]:
+        names.append(len(shstrtab))
+        shstrtab += section[0].encode() + b"\x00"
+    sections.append((".shstrtab", 3, 0, 0, bytes(shstrtab), 0, 0))
+
+    # ELF header, two program headers, section contents, section headers
+    phoff = 52
+    offset = phoff + 2*32
+    contents = bytearray()
+    offsets = []
+    for section in sections:
+        while (offset + len(contents)) % 4:
+            contents.append(0)
+        offsets.append(offset + len(contents))
+        contents += section[4]
+    while (offset + len(contents)) % 4:
+        contents.append(0)
+    shoff = offset + len(contents)
+
+    ehdr = b"\x7fELF" + bytes([1, 1, 1]) + bytes(9)
+    ehdr += struct.pack("<HHIIIIIHHHHHH", 2, 83, 1, 0, phoff, shoff, 0x85, 52, 32, 2, 40, len(sections) + 1, len(sections))
+
+    phdrs = struct.pack("<8I", 1, offsets[0], 0, 0, len(text), len(text), 5, 2)
+    phdrs += struct.pack("<8I", 1, offsets[1], DATA_ADDRESS, len(text), len(DATA), len(DATA), 6, 1)
+
+    shdrs = bytes(40)
+    for i, (name, type_, flags, address, data, link, entsize) in enumerate(sections):
+        shdrs += struct.pack("<10I", names[i], type_, flags, address, offsets[i], len(data), link, 2 if type_ == 2 else 0, 1, entsize)
+
+    with open(sys.argv[1], "wb") as f:
+        f.write(ehdr + phdrs + bytes(contents) + shdrs)
+
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], "wb") as f:
+            f.write(text)
+
+
+if __name__ == "__main__":
+    main()
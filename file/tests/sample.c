@@ -0,0 +1,25 @@
+/* Source of the sample.elf test fixture */
+#include <avr/io.h>
+
+volatile uint8_t count = 1;
+
+void delay(void);
+
+int main(void)
+{
+    DDRB = 0x20;
+    for (;;) {
+        PORTB |= 0x20;
+        delay();
+        PORTB &= ~0x20;
+        delay();
+        count++;
+    }
+}
+
+void delay(void)
+{
+    uint16_t n = 0xffff;
+    while (--n)
+        ;
+}
@@ -1,10 +1,14 @@
 #ifndef INSTRUCTION_H
 #define INSTRUCTION_H
 
+struct SymbolTable;
+
 struct instruction {
     uint32_t address;
     unsigned int width;
     void *instructionDisasm;
+    /* Symbols to name destinations with, or NULL */
+    const struct SymbolTable *symbols;
     int (*print_origin)(struct instruction *, FILE *, int flags);
     int (*print)(struct instruction *, FILE *, int flags);
 };
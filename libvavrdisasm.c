@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <vavrdisasm.h>
+#include <print_stream.h>
+
+#include "avr/avr_instruction_set.h"
+#include "avr/avr_support.h"
+
+/******************************************************************************/
+/* libvavrdisasm API */
+/******************************************************************************/
+
+/* Format flags are passed through as print flags */
+typedef char VAVRDISASM_Flags_Check[(VAVRDISASM_FLAG_ASSEMBLY == (int)PRINT_FLAG_ASSEMBLY && VAVRDISASM_FLAG_ADDRESSES == (int)PRINT_FLAG_ADDRESSES &&
+                                     VAVRDISASM_FLAG_DESTINATION_COMMENT == (int)PRINT_FLAG_DESTINATION_COMMENT && VAVRDISASM_FLAG_DATA_HEX == (int)PRINT_FLAG_DATA_HEX &&
+                                     VAVRDISASM_FLAG_DATA_BIN == (int)PRINT_FLAG_DATA_BIN && VAVRDISASM_FLAG_DATA_DEC == (int)PRINT_FLAG_DATA_DEC &&
+                                     VAVRDISASM_FLAG_OPCODES == (int)PRINT_FLAG_OPCODES && VAVRDISASM_FLAG_OBJDUMP_COMP == (int)PRINT_FLAG_OBJDUMP_COMP) ? 1 : -1];
+
+/* Decode an instruction into its public form. Returns the instruction
+ * width. */
+static int util_decode(const uint8_t *data, unsigned int len, uint32_t address, struct vavrdisasm_instruction *instruction) {
+    struct avrInstructionDisasm instrDisasm;
+    int width;
+
+    width = avr_disasm_decode(data, len, address, &instrDisasm);
+
+    instruction->address = instrDisasm.address;
+    memcpy(instruction->opcode, instrDisasm.opcode, sizeof(instruction->opcode));
+    instruction->width = (unsigned int)width;
+    instruction->info = instrDisasm.instructionInfo;
+    instruction->operands[0] = instrDisasm.operandDisasms[0];
+    instruction->operands[1] = instrDisasm.operandDisasms[1];
+
+    return width;
+}
+
+size_t vavrdisasm_decode(const uint8_t *data, size_t len, uint32_t address, struct vavrdisasm_instruction *instructions, size_t max, size_t *consumed) {
+    size_t offset, count;
+    unsigned int avail;
+    int width;
+
+    /* Build the opcode lookup table, if it hasn't been built already */
+    avr_iset_lookup_init();
+
+    for (offset = 0, count = 0; offset < len && count < max; count++) {
+        /* At most one 32-bit instruction's worth of bytes */
+        avail = (len - offset > 4) ? 4 : (unsigned int)(len - offset);
+
+        width = util_decode(data + offset, avail, address + (uint32_t)offset, &instructions[count]);
+        offset += width;
+    }
+
+    if (consumed != NULL)
+        *consumed = offset;
+
+    return count;
+}
+
+size_t vavrdisasm_index_size(size_t len) {
+    return (len + 7)/8;
+}
+
+void vavrdisasm_index_build(const uint8_t *data, size_t len, uint8_t *bitmap) {
+    /* Build the opcode lookup table, if it hasn't been built already */
+    avr_iset_lookup_init();
+
+    memset(bitmap, 0, vavrdisasm_index_size(len));
+    avr_disasm_boundaries(data, (uint32_t)len, bitmap, 0);
+}
+
+size_t vavrdisasm_decode_range(const uint8_t *data, size_t len, uint32_t address, const uint8_t *bitmap, uint32_t start, uint32_t end, struct vavrdisasm_instruction *instructions, size_t max) {
+    size_t offset, count;
+    unsigned int back;
+
+    if (len == 0 || start >= end || start > address + (uint32_t)(len - 1) || end <= address)
+        return 0;
+
+    /* Build the opcode lookup table, if it hasn't been built already */
+    avr_iset_lookup_init();
+
+    /* Seek to the instruction containing start, looking back at most 3 bytes
+     * for its first byte, and no further than the start of data */
+    offset = (start > address) ? (size_t)(start - address) : 0;
+    for (back = 0; back < 3 && offset > 0 && !(bitmap[offset/8] & (1 << (offset % 8))); back++)
+        offset--;
+
+    /* Decode the window */
+    for (count = 0; offset < len && count < max && address + (uint32_t)offset < end; count++)
+        offset += util_decode(data + offset, (len - offset > 4) ? 4 : (unsigned int)(len - offset), address + (uint32_t)offset, &instructions[count]);
+
+    return count;
+}
+
+int vavrdisasm_format(const struct vavrdisasm_instruction *instruction, char *buf, size_t size, int flags) {
+    struct avrInstructionDisasm instrDisasm;
+
+    if (instruction->info == NULL)
+        return -1;
+
+    instrDisasm.address = instruction->address;
+    memcpy(instrDisasm.opcode, instruction->opcode, sizeof(instrDisasm.opcode));
+    instrDisasm.instructionInfo = (struct avrInstructionInfo *)instruction->info;
+    instrDisasm.operandDisasms[0] = instruction->operands[0];
+    instrDisasm.operandDisasms[1] = instruction->operands[1];
+
+    return avr_instruction_format(&instrDisasm, buf, size, flags);
+}
+
+int vavrdisasm_format_origin(uint32_t address, char *buf, size_t size, int flags) {
+    return avr_instruction_format_origin(address, buf, size, flags);
+}
+
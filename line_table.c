@@ -0,0 +1,250 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <line_table.h>
+
+/******************************************************************************/
+/* Line Table Support */
+/******************************************************************************/
+
+void line_table_init(struct LineTable *table) {
+    memset(table, 0, sizeof(struct LineTable));
+    table->sorted = 1;
+}
+
+void line_table_free(struct LineTable *table) {
+    unsigned int i;
+
+    for (i = 0; i < table->numFiles; i++) {
+        free(table->files[i].path);
+        free(table->files[i].lineOffsets);
+#ifndef _MSC_VER
+        if (table->files[i].mapped)
+            munmap((void *)table->files[i].text, table->files[i].size);
+        else
+#endif
+            free((void *)table->files[i].text);
+    }
+    free(table->files);
+    free(table->lines);
+
+    line_table_init(table);
+}
+
+int line_table_add_file(struct LineTable *table, const char *path) {
+    unsigned int i;
+
+    /* Share the files of several compilation units */
+    for (i = 0; i < table->numFiles; i++) {
+        if (strcmp(table->files[i].path, path) == 0)
+            return i;
+    }
+
+    /* Grow the file array if needed */
+    if (table->numFiles == table->filesCapacity) {
+        unsigned int capacity = (table->filesCapacity == 0) ? 16 : table->filesCapacity*2;
+        struct line_file *files = realloc(table->files, capacity*sizeof(struct line_file));
+        if (files == NULL)
+            return -1;
+        table->files = files;
+        table->filesCapacity = capacity;
+    }
+
+    memset(&table->files[table->numFiles], 0, sizeof(struct line_file));
+    table->files[table->numFiles].path = strdup(path);
+    if (table->files[table->numFiles].path == NULL)
+        return -1;
+
+    return table->numFiles++;
+}
+
+int line_table_add(struct LineTable *table, uint32_t address, uint32_t file, uint32_t line) {
+    /* A later line of a sequence at the same address replaces the previous
+     * one, e.g. a function's opening line by its first statement */
+    if (table->len > 0 && table->lines[table->len-1].address == address && table->lines[table->len-1].line != 0) {
+        table->lines[table->len-1].file = file;
+        table->lines[table->len-1].line = line;
+        return 0;
+    }
+
+    /* Grow the line array if needed */
+    if (table->len == table->capacity) {
+        unsigned int capacity = (table->capacity == 0) ? 256 : table->capacity*2;
+        struct line *lines = realloc(table->lines, capacity*sizeof(struct line));
+        if (lines == NULL)
+            return -1;
+        table->lines = lines;
+        table->capacity = capacity;
+    }
+
+    table->lines[table->len].address = address;
+    table->lines[table->len].file = file;
+    table->lines[table->len].line = line;
+
+    /* Keep track of whether we're still sorted */
+    if (table->len > 0 && table->lines[table->len-1].address > address)
+        table->sorted = 0;
+    table->len++;
+
+    return 0;
+}
+
+static int util_line_compare(const void *a, const void *b) {
+    const struct line *la = (const struct line *)a;
+    const struct line *lb = (const struct line *)b;
+
+    if (la->address < lb->address)
+        return -1;
+    else if (la->address > lb->address)
+        return 1;
+    /* Order the end of a sequence before a sequence starting at the same
+     * address, then deterministically by file and line */
+    if ((la->line == 0) != (lb->line == 0))
+        return (la->line == 0) ? -1 : 1;
+    if (la->file != lb->file)
+        return (la->file < lb->file) ? -1 : 1;
+    if (la->line != lb->line)
+        return (la->line < lb->line) ? -1 : 1;
+    return 0;
+}
+
+void line_table_sort(struct LineTable *table) {
+    if (table->sorted)
+        return;
+
+    qsort(table->lines, table->len, sizeof(struct line), util_line_compare);
+    table->sorted = 1;
+}
+
+const struct line *line_table_seek(const struct LineTable *table, uint32_t address, unsigned int *cursor) {
+    unsigned int i = *cursor, lo, hi, mid;
+
+    if (i < table->len && table->lines[i].address <= address) {
+        /* Walk forward from the last line, for addresses in order */
+        while (i + 1 < table->len && table->lines[i+1].address <= address)
+            i++;
+    } else {
+        /* Binary search for the last line at or before address */
+        lo = 0;
+        hi = table->len;
+        while (lo < hi) {
+            mid = lo + (hi - lo)/2;
+            if (table->lines[mid].address <= address)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == 0)
+            return NULL;
+        i = lo - 1;
+    }
+
+    *cursor = i;
+
+    if (table->lines[i].line == 0)
+        return NULL;
+
+    return &table->lines[i];
+}
+
+/* Map the text of a source file and index its lines. Returns -1 on error. */
+static int util_line_file_load(struct line_file *file) {
+    uint32_t offset, n;
+
+#ifndef _MSC_VER
+    struct stat st;
+    void *base;
+    int fd;
+
+    if ((fd = open(file->path, O_RDONLY)) < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || st.st_size == 0 || st.st_size > UINT32_MAX) {
+        close(fd);
+        return -1;
+    }
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+
+    file->text = (const uint8_t *)base;
+    file->size = (size_t)st.st_size;
+    file->mapped = 1;
+#else
+    /* No mmap(), fall back to reading the whole file */
+    FILE *in;
+    uint8_t *base;
+    long len;
+
+    if ((in = fopen(file->path, "rb")) == NULL)
+        return -1;
+    if (fseek(in, 0, SEEK_END) != 0 || (len = ftell(in)) <= 0 || fseek(in, 0, SEEK_SET) != 0 || (base = malloc((size_t)len)) == NULL) {
+        fclose(in);
+        return -1;
+    }
+    if (fread(base, 1, (size_t)len, in) != (size_t)len) {
+        free(base);
+        fclose(in);
+        return -1;
+    }
+    fclose(in);
+
+    file->text = base;
+    file->size = (size_t)len;
+#endif
+
+    /* Count the lines, then record their offsets */
+    file->numLines = 1;
+    for (offset = 0; offset < file->size; offset++) {
+        if (file->text[offset] == '\n' && offset + 1 < file->size)
+            file->numLines++;
+    }
+    if ((file->lineOffsets = malloc(file->numLines*sizeof(uint32_t))) == NULL) {
+        file->numLines = 0;
+        return -1;
+    }
+    file->lineOffsets[0] = 0;
+    for (offset = 0, n = 1; offset < file->size; offset++) {
+        if (file->text[offset] == '\n' && offset + 1 < file->size)
+            file->lineOffsets[n++] = offset + 1;
+    }
+
+    return 0;
+}
+
+const char *line_table_source(struct LineTable *table, uint32_t file, uint32_t line, size_t *len) {
+    struct line_file *f;
+    uint32_t start, end;
+
+    if (file >= table->numFiles)
+        return NULL;
+    f = &table->files[file];
+
+    /* Map the source file on first use only */
+    if (!f->loaded) {
+        f->loaded = 1;
+        util_line_file_load(f);
+    }
+
+    if (line == 0 || line > f->numLines)
+        return NULL;
+
+    /* Line text without its line ending */
+    start = f->lineOffsets[line-1];
+    end = (line < f->numLines) ? f->lineOffsets[line] : (uint32_t)f->size;
+    while (end > start && (f->text[end-1] == '\n' || f->text[end-1] == '\r'))
+        end--;
+
+    *len = end - start;
+    return (const char *)f->text + start;
+}
+
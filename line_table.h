@@ -0,0 +1,58 @@
+#ifndef LINE_TABLE_H
+#define LINE_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Source line of the addresses from address up to the next line */
+struct line {
+    /* Start address */
+    uint32_t address;
+    /* Source file index */
+    uint32_t file;
+    /* Line number, or 0 for addresses without source */
+    uint32_t line;
+};
+
+/* Source file */
+struct line_file {
+    /* Path */
+    char *path;
+    /* Source text, mapped on first use, or NULL */
+    const uint8_t *text;
+    size_t size;
+    int mapped;
+    /* Offsets of the start of each line of the text */
+    uint32_t *lineOffsets;
+    uint32_t numLines;
+    /* Text load attempted flag */
+    int loaded;
+};
+
+/* Address sorted source line table */
+struct LineTable {
+    /* Lines */
+    struct line *lines;
+    /* Number of lines */
+    unsigned int len;
+    /* Allocated number of lines */
+    unsigned int capacity;
+    /* Source files */
+    struct line_file *files;
+    unsigned int numFiles;
+    unsigned int filesCapacity;
+    /* Sorted flag */
+    int sorted;
+};
+
+/* Line Table Support */
+void line_table_init(struct LineTable *table);
+void line_table_free(struct LineTable *table);
+int line_table_add_file(struct LineTable *table, const char *path);
+int line_table_add(struct LineTable *table, uint32_t address, uint32_t file, uint32_t line);
+void line_table_sort(struct LineTable *table);
+const struct line *line_table_seek(const struct LineTable *table, uint32_t address, unsigned int *cursor);
+const char *line_table_source(struct LineTable *table, uint32_t file, uint32_t line, size_t *len);
+
+#endif
+
@@ -1,22 +1,46 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <getopt.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _MSC_VER
+#include <direct.h>
+#endif
 
 #include <byte_stream.h>
 #include <disasm_stream.h>
 #include <print_stream.h>
+#include <symbol_table.h>
+#include <line_table.h>
+#include <thread_pool.h>
+#include <cache.h>
+#include <server.h>
+#include <profile.h>
+#include <trace.h>
 
 /* File Support */
 #include "file/file_support.h"
 
 /* AVR Support */
 #include "avr/avr_support.h"
+#include "avr/avr_analysis.h"
 
 #ifdef _MSC_VER
 #define strcasecmp _strcmpi
 #endif
 
+#define VERSION_STRING  "vAVRdisasm version 3.1 - 09/18/2014."
+
+/* Default and maximum size bound of the output cache, in megabytes */
+#define DEFAULT_CACHE_SIZE_MB   256
+#define MAX_CACHE_SIZE_MB       (1UL << 24)
+
+/* Maximum number of worker threads */
+#define MAX_JOBS                1024
+
 /* Supported file types */
 enum {
     FILE_TYPE_ATMEL_GENERIC,
@@ -24,6 +48,7 @@ enum {
     FILE_TYPE_MOTOROLA_SRECORD,
     FILE_TYPE_BINARY,
     FILE_TYPE_ASCII_HEX,
+    FILE_TYPE_ELF,
 };
 
 /* Supported architectures */
@@ -39,6 +64,20 @@ static int no_opcodes = 0;              /* Flag for --no-opcodes */
 static int assembly = 0;                /* Flag for --assembly */
 static int data_base = 0;               /* Base of data constants (hexadecimal, binary, decimal) */
 static int objdump_compatible = 0;      /* Flag for --objdump */
+static int source = 0;                  /* Flag for --source */
+static int size_report = 0;             /* Flag for --size-report */
+static int dead_stores = 0;             /* Flag for --dead-stores */
+static int tables = 0;                  /* Flag for --tables */
+static int detect_functions = 0;        /* Flag for --detect-functions */
+static const struct SymbolTable *listing_symbols = NULL; /* Symbols to label the disassembly with */
+static struct LineTable *listing_lines = NULL;  /* Source lines to annotate the disassembly with */
+static int stats = 0;                   /* Flag for --stats */
+static int stats_json = 0;              /* Flag for --stats=json */
+static int clones = 0;                  /* Flag for --clones */
+static int profile = 0;                 /* Flag for --profile */
+static int profile_json = 0;            /* Flag for --profile=json */
+static char trace_str[4096] = {0};      /* Trace file path for --trace */
+static int diff = 0;                    /* Flag for --diff */
 
 /* Supported data constant bases */
 enum {
@@ -58,6 +97,32 @@ static struct option long_options[] = {
     {"no-addresses", no_argument, &no_addresses, 1},
     {"no-destination-comments", no_argument, &no_destination_comments, 1},
     {"objdump", no_argument, &objdump_compatible, 1},
+    {"source", no_argument, &source, 1},
+    {"symbols", required_argument, NULL, 's'},
+    {"size-report", no_argument, &size_report, 1},
+    {"dead-stores", no_argument, &dead_stores, 1},
+    {"tables", no_argument, &tables, 1},
+    {"detect-functions", no_argument, &detect_functions, 1},
+    {"find-signature", required_argument, NULL, 'G'},
+    {"fingerprints", required_argument, NULL, 'N'},
+    {"make-fingerprints", required_argument, NULL, 'M'},
+    {"diff", no_argument, &diff, 1},
+    {"stats", optional_argument, NULL, 'S'},
+    {"clones", optional_argument, NULL, 'K'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"batch", required_argument, NULL, 'B'},
+    {"out-dir", required_argument, NULL, 'O'},
+    {"cache-dir", required_argument, NULL, 'C'},
+    {"incremental", required_argument, NULL, 'I'},
+    {"save-decode", required_argument, NULL, 'D'},
+    {"cache-size", required_argument, NULL, 'Z'},
+    {"serve", required_argument, NULL, 'E'},
+    {"start", required_argument, NULL, 'F'},
+    {"end", required_argument, NULL, 'T'},
+    {"database", required_argument, NULL, 'A'},
+    {"xrefs", required_argument, NULL, 'X'},
+    {"profile", optional_argument, NULL, 'P'},
+    {"trace", required_argument, NULL, 'R'},
     {"help", no_argument, NULL, 'h'},
     {"version", no_argument, NULL, 'v'},
     {NULL, 0, NULL, 0}
@@ -65,8 +130,14 @@ static struct option long_options[] = {
 
 static void printUsage(const char *programName) {
     printf("Usage: %s [options] <file>\n", programName);
+    printf("       %s --diff [options] <old file> <new file>\n", programName);
+    printf("       %s --stats[=json] [options] <file> [<file> ...]\n", programName);
+    printf("       %s --out-dir <dir> [--batch <list>] [options] [<file> ...]\n", programName);
+    printf("       %s --find-signature <file> [--batch <list>] [options] [<file> ...]\n", programName);
+    printf("       %s --clones[=<n>] [--batch <list>] [options] [<file> ...]\n", programName);
+    printf("       %s --serve <socket> [options]\n", programName);
     printf("Disassembles program file <file>. Use - for standard input.\n\n");
-    printf("vAVRdisasm version 3.1 - 09/18/2014.\n");
+    printf("%s\n", VERSION_STRING);
     printf("Vanya A. Sergeev - <vsergeev@gmail.com>\n");
     printf("https://github.com/vsergeev/vavrdisasm\n\n");
     printf("Options:\n\
@@ -88,6 +159,87 @@ static void printUsage(const char *programName) {
                                   of relative branch/jump/call instructions.\n\
   --objdump                     Create avr-objdump compatible output.\n\
                                   Affects address display.\n\
+  --source                      Print the source text of the source line\n\
+                                  references of ELF program files with\n\
+                                  DWARF line information.\n\
+\n\
+  -s, --symbols <file>          Read program symbols from nm output <file>.\n\
+                                  Symbols of ELF program files are read\n\
+                                  from the file itself.\n\
+  --detect-functions            Find function boundaries from avr-gcc\n\
+                                  prologues and epilogues too, for the\n\
+                                  reports and analyses below.\n\
+  --size-report                 Report the size of each function and the\n\
+                                  share of each mnemonic, instead of\n\
+                                  disassembly.\n\
+  --dead-stores                 Annotate the disassembly with register and\n\
+                                  SREG flag writes that are never read.\n\
+  --tables                      Disassemble flash tables read by lpm / elpm\n\
+                                  as data, and the targets of ijmp / icall\n\
+                                  and their jump tables as code.\n\
+  --fingerprints <file>         Name the functions whose fingerprints are in\n\
+                                  the fingerprint database <file>, and\n\
+                                  list each function under its name.\n\
+  --make-fingerprints <file>    Add the fingerprints of the functions named\n\
+                                  by -s to the fingerprint database\n\
+                                  <file>, instead of disassembly.\n\
+  --diff                        Compare the programs of <old file> and\n\
+                                  <new file> instruction by instruction,\n\
+                                  and report changed functions.\n\
+\n\
+  --stats[=json]                Count instructions and operand types over all\n\
+                                  program files, instead of disassembly.\n\
+                                  Prints a table, or JSON with =json.\n\
+  --clones[=<n>]                Report instruction sequences of at least <n>\n\
+                                  instructions (default: 8) repeated\n\
+                                  within and across all program files,\n\
+                                  instead of disassembly.\n\
+  --find-signature <file>       Search all program files for the instruction\n\
+                                  signatures in <file>, instead of\n\
+                                  disassembly.\n\
+  --batch <list>                Disassemble each program file listed in\n\
+                                  <list>, one per line, in addition to\n\
+                                  the program files on the command line.\n\
+  --out-dir <dir>               Write the disassembly of each program file\n\
+                                  to <dir>/<file name>.dis.\n\
+  -j, --jobs <n>                Number of worker threads for multiple\n\
+                                  program files (default: number of CPUs).\n\
+\n\
+  --start <address>             Only disassemble the instructions at or after\n\
+                                  <address>, including one straddling it.\n\
+  --end <address>               Only disassemble the instructions before\n\
+                                  <address>.\n\
+\n\
+  --database <file>             Answer from the analysis database <file>,\n\
+                                  analyzing the program into it first if\n\
+                                  it is missing or of another program.\n\
+  --xrefs <address>             List the instructions referencing\n\
+                                  <address>, with --database.\n\
+\n\
+  --save-decode <file>          Save the decode result of the program file\n\
+                                  to <file>, for --incremental.\n\
+  --incremental <file>          Disassemble by redecoding only the changes\n\
+                                  from the program of a saved decode result.\n\
+\n\
+  --cache-dir <dir>             Cache disassembly output in <dir>, keyed by\n\
+                                  program contents and output options.\n\
+  --cache-size <MB>             Size bound of the cache directory, least\n\
+                                  recently used output is evicted first\n\
+                                  (default: 256).\n\
+\n\
+  --serve <socket>              Keep loaded programs resident and serve\n\
+                                  load, disasm and xref requests on the\n\
+                                  UNIX domain socket <socket>, with -j\n\
+                                  worker threads.\n\
+\n\
+  --profile[=json]              Print counters and per-stage times of the\n\
+                                  run to standard error, as a table, or\n\
+                                  JSON with =json.\n\
+\n\
+  --trace <file>                Record begin and end events of the parse,\n\
+                                  decode and format stages per thread, and\n\
+                                  write them to <file> as Chrome trace-event\n\
+                                  JSON.\n\
 \n\
   -h, --help                    Display this usage/help.\n\
   -v, --version                 Display the program's version.\n\n");
@@ -96,277 +248,1988 @@ static void printUsage(const char *programName) {
   Intel HEX8                ihex\n\
   Motorola S-Record         srec\n\
   Raw Binary                binary\n\
-  ASCII Hex                 ascii\n\n");
+  ASCII Hex                 ascii\n\
+  AVR ELF                   elf\n\n");
 }
 
 static void printVersion(void) {
-    printf("vAVRdisasm version 3.1 - 09/18/2014.\n");
+    printf("%s\n", VERSION_STRING);
     printf("Vanya A. Sergeev - <vsergeev@gmail.com>\n");
     printf("https://github.com/vsergeev/vavrdisasm\n");
 }
 
 void print_stream_error_trace(struct PrintStream *ps, struct DisasmStream *ds, struct ByteStream *bs) {
-    if (ps->error == NULL)
-        fprintf(stderr, "\tPrint Stream Error: No error\n");
-    else
-        fprintf(stderr, "\tPrint Stream Error: %s\n", ps->error);
+    if (ps != NULL) {
+        if (ps->error == NULL)
+            fprintf(stderr, "\tPrint Stream Error: No error\n");
+        else
+            fprintf(stderr, "\tPrint Stream Error: %s\n", ps->error);
+    }
 
-    if (ds->error == NULL)
-        fprintf(stderr, "\tDisasm Stream Error: No error\n");
-    else
-        fprintf(stderr, "\tDisasm Stream Error: %s\n", ds->error);
+    if (ds != NULL) {
+        if (ds->error == NULL)
+            fprintf(stderr, "\tDisasm Stream Error: No error\n");
+        else
+            fprintf(stderr, "\tDisasm Stream Error: %s\n", ds->error);
+    }
 
-    if (bs->error == NULL)
-        fprintf(stderr, "\tByte Stream Error: No error\n");
-    else
-        fprintf(stderr, "\tByte Stream Error: %s\n", bs->error);
+    if (bs != NULL) {
+        if (bs->error == NULL)
+            fprintf(stderr, "\tByte Stream Error: No error\n");
+        else
+            fprintf(stderr, "\tByte Stream Error: %s\n", bs->error);
+    }
 
     fprintf(stderr, "\tPlease file an issue at https://github.com/vsergeev/vAVRdisasm/issues\n\tor email the author!\n\n");
 }
 
-int main(int argc, const char *argv[]) {
-    /* User Options */
-    int optc;
-    char arch_str[16] = {0};
-    char file_type_str[8] = {0};
-    char file_out_str[4096] = {0};
+/* Copy an option argument into a fixed size string, exiting on an argument
+ * that doesn't fit */
+static void option_copy(char *str, size_t size, const char *optarg_str) {
+    if (snprintf(str, size, "%s", optarg_str) >= (int)size) {
+        fprintf(stderr, "Error: Option argument is longer than %u characters!\n", (unsigned int)(size - 1));
+        exit(EXIT_FAILURE);
+    }
+}
 
-    /* Input / Output files */
-    FILE *file_in = NULL, *file_out = NULL;
+/* Parse a numeric option argument in base, exiting with an error naming what
+ * the number is on an argument that isn't a number in [min, max] */
+static unsigned long option_number(const char *what, const char *optarg_str, int base, unsigned long min, unsigned long max) {
+    unsigned long value;
+    char *end;
 
-    /* Disassembler Streams */
-    int file_type = 0;
-    int arch = ARCH_AVR8;
-    int flags = 0;
-    struct ByteStream bs;
-    struct DisasmStream ds;
-    struct PrintStream ps;
-    int ret;
+    errno = 0;
+    value = strtoul(optarg_str, &end, base);
+    if (end == optarg_str || *end != '\0' || optarg_str[0] == '-' || errno == ERANGE || value < min || value > max) {
+        fprintf(stderr, "Invalid %s %s.\n", what, optarg_str);
+        exit(EXIT_FAILURE);
+    }
 
-    /* Parse command line options */
-    while (1) {
-        optc = getopt_long(argc, (char * const *)argv, "o:t:l:hv", long_options, NULL);
-        if (optc == -1)
-            break;
-        switch (optc) {
-            /* Long option */
-            case 0:
-                break;
-            case 'a':
-                strncpy(arch_str, optarg, sizeof(arch_str));
-                break;
-            case 't':
-                strncpy(file_type_str, optarg, sizeof(file_type_str));
-                break;
-            case 'o':
-                if (strcmp(optarg, "-") != 0)
-                    strncpy(file_out_str, optarg, sizeof(file_out_str));
-                break;
-            case 'h':
-                printUsage(argv[0]);
-                exit(EXIT_SUCCESS);
-            case 'v':
-                printVersion();
-                exit(EXIT_SUCCESS);
-            default:
-                printUsage(argv[0]);
-                exit(EXIT_SUCCESS);
-        }
+    return value;
+}
+
+/* Open a temporary file next to a file to be replaced, so that the file is
+ * left intact until the replacement is complete. Returns NULL on error. */
+static FILE *replace_open(const char *path, char *tmp_path, size_t size) {
+    if (snprintf(tmp_path, size, "%s.tmp", path) >= (int)size)
+        return NULL;
+    return fopen(tmp_path, "wb");
+}
+
+/* Close a replacement file and move it over the file it replaces, or remove
+ * it if it wasn't written completely. Returns -1 on error. */
+static int replace_close(FILE *out, const char *tmp_path, const char *path, int written) {
+    if (fclose(out) != 0 || !written) {
+        remove(tmp_path);
+        return -1;
     }
 
-    /* If there are no more arguments left */
-    if (optind == argc) {
-        printUsage(argv[0]);
-        goto cleanup_exit_failure;
+#ifdef _MSC_VER
+    remove(path);
+#endif
+    if (rename(tmp_path, path) < 0) {
+        remove(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Parse a file type name, returns -1 on unknown file type */
+static int file_type_parse(const char *file_type_str) {
+    if (strcasecmp(file_type_str, "generic") == 0)
+        return FILE_TYPE_ATMEL_GENERIC;
+    else if (strcasecmp(file_type_str, "ihex") == 0)
+        return FILE_TYPE_INTEL_HEX;
+    else if (strcasecmp(file_type_str, "srec") == 0)
+        return FILE_TYPE_MOTOROLA_SRECORD;
+    else if (strcasecmp(file_type_str, "ascii") == 0)
+        return FILE_TYPE_ASCII_HEX;
+    else if (strcasecmp(file_type_str, "binary") == 0)
+        return FILE_TYPE_BINARY;
+    else if (strcasecmp(file_type_str, "elf") == 0)
+        return FILE_TYPE_ELF;
+
+    fprintf(stderr, "Unknown file type %s.\n", file_type_str);
+    fprintf(stderr, "See program help/usage for supported file types.\n");
+    return -1;
+}
+
+/* Auto-detect the file type of an input file by its first character, returns
+ * -1 if unrecognized */
+static int file_type_detect(FILE *in) {
+    int c, file_type;
+
+    c = fgetc(in);
+    /* Intel HEX8 record statements start with : */
+    if ((char)c == ':')
+        file_type = FILE_TYPE_INTEL_HEX;
+    /* Motorola S-Record record statements start with S */
+    else if ((char)c == 'S')
+        file_type = FILE_TYPE_MOTOROLA_SRECORD;
+    /* ELF files start with the 0x7f "ELF" magic */
+    else if (c == 0x7f)
+        file_type = FILE_TYPE_ELF;
+    /* Atmel Generic record statements start with a ASCII hex digit */
+    else if ( ((char)c >= '0' && (char)c <= '9') || ((char)c >= 'a' && (char)c <= 'f') || ((char)c >= 'A' && (char)c <= 'F') )
+        file_type = FILE_TYPE_ATMEL_GENERIC;
+    else {
+        fprintf(stderr, "Unable to auto-recognize file type by first character.\n");
+        fprintf(stderr, "Please specify file type with -t / --file-type option.\n");
+        return -1;
+    }
+    ungetc(c, in);
+
+    return file_type;
+}
+
+/* Setup a Byte Stream for an opened input file of the specified file type */
+static void setup_byte_stream(struct ByteStream *bs, FILE *in, int file_type) {
+    memset(bs, 0, sizeof(struct ByteStream));
+    bs->in = in;
+    if (file_type == FILE_TYPE_ATMEL_GENERIC) {
+        bs->stream_init = byte_stream_generic_init;
+        bs->stream_close = byte_stream_generic_close;
+        bs->stream_read = byte_stream_generic_read;
+    } else if (file_type == FILE_TYPE_INTEL_HEX) {
+        bs->stream_init = byte_stream_ihex_init;
+        bs->stream_close = byte_stream_ihex_close;
+        bs->stream_read = byte_stream_ihex_read;
+    } else if (file_type == FILE_TYPE_MOTOROLA_SRECORD) {
+        bs->stream_init = byte_stream_srecord_init;
+        bs->stream_close = byte_stream_srecord_close;
+        bs->stream_read = byte_stream_srecord_read;
+    } else if (file_type == FILE_TYPE_ASCII_HEX) {
+        bs->stream_init = byte_stream_asciihex_init;
+        bs->stream_close = byte_stream_asciihex_close;
+        bs->stream_read = byte_stream_asciihex_read;
+    } else if (file_type == FILE_TYPE_ELF) {
+        bs->stream_init = byte_stream_elf_init;
+        bs->stream_close = byte_stream_elf_close;
+        bs->stream_read = byte_stream_elf_read;
+        bs->stream_span = byte_stream_elf_span;
+    } else {
+        bs->stream_init = byte_stream_binary_init;
+        bs->stream_close = byte_stream_binary_close;
+        bs->stream_read = byte_stream_binary_read;
     }
+}
 
-    /*** Open input file ***/
+/* Open an input file, determine its file type if one was not specified, and
+ * setup a Byte Stream for it. Returns the file type, or -1 on error. */
+static int open_byte_stream(struct ByteStream *bs, const char *file_in_str, const char *file_type_str) {
+    FILE *file_in;
+    int file_type;
 
     /* Support reading from stdin with filename "-" */
-    if (strcmp(argv[optind], "-") == 0) {
+    if (strcmp(file_in_str, "-") == 0) {
         file_in = stdin;
     } else {
     /* Otherwise, open the specified input file */
-        file_in = fopen(argv[optind], "r");
+        file_in = fopen(file_in_str, "r");
         if (file_in == NULL) {
-            perror("Error: Cannot open program file for disassembly");
-            goto cleanup_exit_failure;
+            fprintf(stderr, "Error: Cannot open program file %s for disassembly: ", file_in_str);
+            perror(NULL);
+            return -1;
         }
     }
 
-    /*** Determine input file type ***/
-
     /* If a file type was specified */
-    if (file_type_str[0] != '\0') {
-        if (strcasecmp(file_type_str, "generic") == 0)
-            file_type = FILE_TYPE_ATMEL_GENERIC;
-        else if (strcasecmp(file_type_str, "ihex") == 0)
-            file_type = FILE_TYPE_INTEL_HEX;
-        else if (strcasecmp(file_type_str, "srec") == 0)
-            file_type = FILE_TYPE_MOTOROLA_SRECORD;
-        else if (strcasecmp(file_type_str, "ascii") == 0)
-            file_type = FILE_TYPE_ASCII_HEX;
-        else if (strcasecmp(file_type_str, "binary") == 0)
-            file_type = FILE_TYPE_BINARY;
-        else {
-            fprintf(stderr, "Unknown file type %s.\n", file_type_str);
-            fprintf(stderr, "See program help/usage for supported file types.\n");
-            goto cleanup_exit_failure;
-        }
-    } else {
+    if (file_type_str[0] != '\0')
+        file_type = file_type_parse(file_type_str);
     /* Otherwise, attempt to auto-detect file type by first character */
-        int c;
-        c = fgetc(file_in);
-        /* Intel HEX8 record statements start with : */
-        if ((char)c == ':')
-            file_type = FILE_TYPE_INTEL_HEX;
-        /* Motorola S-Record record statements start with S */
-        else if ((char)c == 'S')
-            file_type = FILE_TYPE_MOTOROLA_SRECORD;
-        /* Atmel Generic record statements start with a ASCII hex digit */
-        else if ( ((char)c >= '0' && (char)c <= '9') || ((char)c >= 'a' && (char)c <= 'f') || ((char)c >= 'A' && (char)c <= 'F') )
-            file_type = FILE_TYPE_ATMEL_GENERIC;
-        else {
-            fprintf(stderr, "Unable to auto-recognize file type by first character.\n");
-            fprintf(stderr, "Please specify file type with -t / --file-type option.\n");
-            goto cleanup_exit_failure;
+    else
+        file_type = file_type_detect(file_in);
+
+    if (file_type < 0) {
+        if (file_in != stdin)
+            fclose(file_in);
+        return -1;
+    }
+
+    setup_byte_stream(bs, file_in, file_type);
+
+    return file_type;
+}
+
+/* Setup a Disasm Stream for the specified architecture */
+static void setup_disasm_stream(struct DisasmStream *ds, struct ByteStream *bs, int arch) {
+    memset(ds, 0, sizeof(struct DisasmStream));
+    ds->in = bs;
+    if (arch == ARCH_AVR8) {
+        ds->stream_init = disasm_stream_avr_init;
+        ds->stream_close = disasm_stream_avr_close;
+        ds->stream_read = disasm_stream_avr_read;
+    }
+}
+
+/* Print a program from a Disasm Stream to an output file. The streams are
+ * closed on return. Returns -1 on error. */
+static int print_disasm_stream(struct DisasmStream *ds, int flags, FILE *out, const char *name) {
+    struct ByteStream *bs = ds->in;
+    struct PrintStream ps;
+    /* Streamed batches include their parsing and decoding */
+    const char *batch = (ds->in_program != NULL) ? "format" : "disassemble";
+    unsigned int count = 0;
+    int ret;
+
+    /* Setup the Print Stream */
+    memset(&ps, 0, sizeof(struct PrintStream));
+    ps.in = ds;
+    ps.stream_init = print_stream_init;
+    ps.stream_close = print_stream_close;
+    ps.stream_read = print_stream_read;
+    ps.symbols = listing_symbols;
+    ps.lines = listing_lines;
+
+    /* Initialize streams */
+    if ((ret = ps.stream_init(&ps, flags)) < 0) {
+        fprintf(stderr, "Error initializing streams for %s! Error code: %d\n", name, ret);
+        print_stream_error_trace(&ps, ds, bs);
+        return -1;
+    }
+
+    /* Read from Print Stream until EOF, tracing batches of instructions */
+    TRACE_BEGIN(batch, name);
+    while ( (ret = ps.stream_read(&ps, out)) != STREAM_EOF ) {
+        if (ret < 0) {
+            TRACE_END(batch);
+            fprintf(stderr, "Error occured during disassembly of %s! Error code: %d\n", name, ret);
+            print_stream_error_trace(&ps, ds, bs);
+            ps.stream_close(&ps);
+            return -1;
+        }
+        if (++count == TRACE_BATCH_LEN) {
+            TRACE_END(batch);
+            TRACE_BEGIN(batch, name);
+            count = 0;
         }
-        ungetc(c, file_in);
     }
+    TRACE_END(batch);
 
-    /*** Open output file ***/
+    /* Close streams */
+    if ((ret = ps.stream_close(&ps)) < 0) {
+        fprintf(stderr, "Error closing streams for %s! Error code: %d\n", name, ret);
+        print_stream_error_trace(&ps, ds, bs);
+        return -1;
+    }
 
-    /* If an output file was specified */
-    if (file_out_str[0] != '\0') {
-        file_out = fopen(file_out_str, "w");
-        if (file_out == NULL) {
-            perror("Error opening output file for writing");
-            goto cleanup_exit_failure;
+    return 0;
+}
+
+/* Disassemble a program from an opened Byte Stream to an output file. The
+ * streams are closed on return. Returns -1 on error. */
+static int disassemble(struct ByteStream *bs, int arch, int flags, FILE *out, const char *name) {
+    struct DisasmStream ds;
+
+    /* Setup the Disasm Stream */
+    setup_disasm_stream(&ds, bs, arch);
+
+    return print_disasm_stream(&ds, flags, out, name);
+}
+
+/* Find the functions of a program, including the prologue and epilogue
+ * signatures with --detect-functions. Returns -1 on error. */
+static int find_functions(struct avrFunctionTable *functions, struct avrProgram *program, const struct SymbolTable *symbols) {
+    if (avr_functions_find(functions, program, symbols) < 0)
+        return -1;
+    if (detect_functions && avr_functions_detect(functions, program) < 0)
+        return -1;
+    return 0;
+}
+
+/* Print a decoded program to an output file. Returns -1 on error. */
+static int print_program(const struct avrProgram *program, int flags, FILE *out, const char *name) {
+    struct DisasmStream ds;
+
+    /* Setup a program Disasm Stream */
+    memset(&ds, 0, sizeof(struct DisasmStream));
+    ds.in_program = program;
+    ds.stream_init = disasm_stream_avr_program_init;
+    ds.stream_close = disasm_stream_avr_program_close;
+    ds.stream_read = disasm_stream_avr_program_read;
+
+    return print_disasm_stream(&ds, flags, out, name);
+}
+
+/* Add the fingerprints of the named functions of a program to a fingerprint
+ * database, creating it if it doesn't exist. Returns -1 on error. */
+static int make_fingerprints(const char *fingerprints_str, const struct avrProgram *program, const struct avrFunctionTable *functions) {
+    struct avrFingerprintTable table;
+    struct avrFingerprintDatabase db;
+    char tmp_path[4096];
+    FILE *out;
+    int ret;
+
+    avr_fingerprints_init(&table);
+
+    /* Keep the fingerprints of an existing database */
+    if ((out = fopen(fingerprints_str, "rb")) != NULL) {
+        fclose(out);
+        if (avr_fingerprints_open(&db, fingerprints_str) < 0) {
+            fprintf(stderr, "Error: Invalid fingerprint database %s.\n", fingerprints_str);
+            return -1;
         }
-    } else {
-    /* Otherwise, default the output file to stdout */
-        file_out = stdout;
+        ret = avr_fingerprints_merge(&table, &db);
+        avr_fingerprints_close(&db);
+        if (ret < 0)
+            goto alloc_error;
     }
 
-    /*** Debug Mode ***/
+    if (avr_fingerprints_add(&table, program, functions) < 0)
+        goto alloc_error;
 
-    #if defined (DEBUG_BYTE_STREAM)
-        /* Test opcode stream */
-        if (file_type == FILE_TYPE_ATMEL_GENERIC)
-            test_byte_stream(file_in, byte_stream_generic_init, byte_stream_generic_close, byte_stream_generic_read);
-        else if (file_type == FILE_TYPE_INTEL_HEX)
-            test_byte_stream(file_in, byte_stream_ihex_init, byte_stream_ihex_close, byte_stream_ihex_read);
-        else if (file_type == FILE_TYPE_MOTOROLA_SRECORD)
-            test_byte_stream(file_in, byte_stream_srecord_init, byte_stream_srecord_close, byte_stream_srecord_read);
-        else if (file_type == FILE_TYPE_BINARY)
-            test_byte_stream(file_in, byte_stream_binary_init, byte_stream_binary_close, byte_stream_binary_read);
-        goto cleanup_exit_success;
-    #elif defined (DEBUG_DISASM_STREAM)
-        /* Test Disasm Stream */
-        test_disasm_stream_unit_tests();
-        goto cleanup_exit_success;
-    #elif defined (DEBUG_PRINT_STREAM)
-        /* Test Print Stream */
-        test_print_stream();
-        goto cleanup_exit_success;
-    #endif
+    /* Write the new database beside the existing one, which it replaces
+     * only once complete */
+    out = replace_open(fingerprints_str, tmp_path, sizeof(tmp_path));
+    if (out == NULL) {
+        fprintf(stderr, "Error opening fingerprint database %s for writing: ", fingerprints_str);
+        perror(NULL);
+        avr_fingerprints_free(&table);
+        return -1;
+    }
+    ret = avr_fingerprints_write(out, &table);
+    avr_fingerprints_free(&table);
+    if (replace_close(out, tmp_path, fingerprints_str, ret == 0) < 0) {
+        fprintf(stderr, "Error writing fingerprint database %s!\n", fingerprints_str);
+        return -1;
+    }
 
-    /*** Setup Formatting Flags ***/
-    if (!no_addresses)
-        flags |= PRINT_FLAG_ADDRESSES;
-    if (!no_destination_comments)
-        flags |= PRINT_FLAG_DESTINATION_COMMENT;
-    if (!no_opcodes)
-        flags |= PRINT_FLAG_OPCODES;
+    return 0;
 
-    if (data_base == DATA_BASE_BIN)
-        flags |= PRINT_FLAG_DATA_BIN;
-    else if (data_base == DATA_BASE_DEC)
-        flags |= PRINT_FLAG_DATA_DEC;
-    else
-        flags |= PRINT_FLAG_DATA_HEX;
+    alloc_error:
+    fprintf(stderr, "Error allocating fingerprint table!\n");
+    avr_fingerprints_free(&table);
+    return -1;
+}
 
-    if (assembly)
-        flags |= PRINT_FLAG_ASSEMBLY;
+/* Name the functions of a program from a fingerprint database, and list them.
+ * Returns -1 on error. */
+static int list_fingerprints(const char *fingerprints_str, const struct avrProgram *program, struct avrFunctionTable *functions, int flags, FILE *out) {
+    struct avrFingerprintDatabase db;
+    int ret;
 
-    if (objdump_compatible)
-        flags |= PRINT_FLAG_OBJDUMP_COMP;
+    if (avr_fingerprints_open(&db, fingerprints_str) < 0) {
+        fprintf(stderr, "Error: Cannot open fingerprint database %s.\n", fingerprints_str);
+        return -1;
+    }
 
-    /*** Setup disassembler streams ***/
+    /* Names point into the database, which stays open while listing */
+    avr_fingerprints_identify(&db, program, functions);
+    ret = avr_report_functions(out, program, functions, flags);
+    avr_fingerprints_close(&db);
+    if (ret < 0) {
+        fprintf(stderr, "Error writing function listing!\n");
+        return -1;
+    }
 
-    /* Setup the Byte Stream */
-    bs.in = file_in;
-    if (file_type == FILE_TYPE_ATMEL_GENERIC) {
-        bs.stream_init = byte_stream_generic_init;
-        bs.stream_close = byte_stream_generic_close;
-        bs.stream_read = byte_stream_generic_read;
-    } else if (file_type == FILE_TYPE_INTEL_HEX) {
-        bs.stream_init = byte_stream_ihex_init;
-        bs.stream_close = byte_stream_ihex_close;
-        bs.stream_read = byte_stream_ihex_read;
-    } else if (file_type == FILE_TYPE_MOTOROLA_SRECORD) {
-        bs.stream_init = byte_stream_srecord_init;
-        bs.stream_close = byte_stream_srecord_close;
-        bs.stream_read = byte_stream_srecord_read;
-    } else if (file_type == FILE_TYPE_ASCII_HEX) {
-        bs.stream_init = byte_stream_asciihex_init;
-        bs.stream_close = byte_stream_asciihex_close;
-        bs.stream_read = byte_stream_asciihex_read;
+    return 0;
+}
+
+/* Disassemble a program incrementally against a previous decode result, if
+ * one is specified, and save its decode result, if a file is specified. The
+ * output is identical to a full disassembly. The Byte Stream is closed on
+ * return. Returns -1 on error. */
+static int disassemble_incremental(struct ByteStream *bs, int flags, FILE *out, const char *name, const char *previous_str, const char *save_str) {
+    struct ByteImage image, old_image;
+    struct avrProgram program, old_program;
+    uint32_t redecoded;
+    FILE *decode_file;
+    int ret;
+
+    /* Read the whole program */
+    if ((ret = byte_image_read(&image, bs)) < 0) {
+        fprintf(stderr, "Error occured reading %s! Error code: %d\n", name, ret);
+        print_stream_error_trace(NULL, NULL, bs);
+        return -1;
+    }
+
+    if (previous_str[0] != '\0') {
+        /* Load the previous decode result */
+        decode_file = fopen(previous_str, "rb");
+        if (decode_file == NULL) {
+            fprintf(stderr, "Error: Cannot open decode result %s: ", previous_str);
+            perror(NULL);
+            byte_image_free(&image);
+            return -1;
+        }
+        ret = avr_program_load(decode_file, &old_image, &old_program);
+        fclose(decode_file);
+        if (ret < 0) {
+            fprintf(stderr, "Error: Invalid decode result %s.\n", previous_str);
+            byte_image_free(&image);
+            return -1;
+        }
+
+        /* Redecode the changes */
+        ret = avr_program_update(&program, &image, &old_image, &old_program, &redecoded);
+        byte_image_free(&old_image);
+        avr_program_free(&old_program);
     } else {
-        bs.stream_init = byte_stream_binary_init;
-        bs.stream_close = byte_stream_binary_close;
-        bs.stream_read = byte_stream_binary_read;
+        ret = avr_program_decode(&program, &image);
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Error occured during disassembly of %s! Error code: %d\n", name, ret);
+        byte_image_free(&image);
+        return -1;
     }
 
-    /* Setup the Disasm Stream */
-    ds.in = &bs;
-    if (arch == ARCH_AVR8) {
-        ds.stream_init = disasm_stream_avr_init;
-        ds.stream_close = disasm_stream_avr_close;
-        ds.stream_read = disasm_stream_avr_read;
+    /* Save the decode result */
+    if (save_str[0] != '\0') {
+        decode_file = fopen(save_str, "wb");
+        if (decode_file == NULL || avr_program_save(decode_file, &image, &program) < 0 || fclose(decode_file) != 0) {
+            fprintf(stderr, "Error writing decode result %s!\n", save_str);
+            byte_image_free(&image);
+            avr_program_free(&program);
+            return -1;
+        }
     }
+    byte_image_free(&image);
 
-    /* Setup the Print Stream */
-    ps.in = &ds;
-    ps.stream_init = print_stream_init;
-    ps.stream_close = print_stream_close;
-    ps.stream_read = print_stream_read;
+    /* Print the program */
+    ret = print_program(&program, flags, out, name);
 
-    /* Initialize streams */
-    if ((ret = ps.stream_init(&ps, flags)) < 0) {
-        fprintf(stderr, "Error initializing streams! Error code: %d\n", ret);
-        print_stream_error_trace(&ps, &ds, &bs);
-        goto cleanup_exit_failure;
+    avr_program_free(&program);
+
+    return ret;
+}
+
+/* Disassemble a range of an Intel HEX or Motorola S-Record file through its
+ * record offset index sidecar, <file>.vidx, reading only the records covering
+ * the range. The sidecar is built from a full read of the file if it is
+ * missing or stale. The Byte Stream input is closed on return. Returns -1 on
+ * error. */
+static int disassemble_range_indexed(struct ByteStream *bs, int flags, FILE *out, const char *name, uint32_t start, uint32_t end) {
+    struct RecordIndex index;
+    struct ByteImage image;
+    struct avrBoundaryIndex boundaries;
+    struct avrProgram program, window;
+    struct stat st;
+    char path[1024];
+    FILE *fp;
+    uint32_t i, block;
+    int format, sync, ret;
+
+    format = (bs->stream_read == byte_stream_ihex_read) ? RECORD_INDEX_IHEX : RECORD_INDEX_SREC;
+    snprintf(path, sizeof(path), "%s.vidx", name);
+
+    if (fstat(fileno(bs->in), &st) < 0) {
+        fprintf(stderr, "Error reading %s!\n", name);
+        fclose(bs->in);
+        return -1;
     }
 
-    /* Read from Print Stream until EOF */
-    while ( (ret = ps.stream_read(&ps, file_out)) != STREAM_EOF ) {
-        if (ret < 0) {
-            fprintf(stderr, "Error occured during disassembly! Error code: %d\n", ret);
-            print_stream_error_trace(&ps, &ds, &bs);
-            goto cleanup_exit_failure;
+    /* Load the sidecar, if it is current */
+    ret = -1;
+    if ((fp = fopen(path, "rb")) != NULL) {
+        ret = record_index_load(fp, &index);
+        fclose(fp);
+        if (ret == 0 && (index.format != (uint32_t)format || index.tag != (uint32_t)AVR_TOTAL_INSTRUCTIONS || index.fileSize != (uint64_t)st.st_size || index.fileMtime != (int64_t)st.st_mtime)) {
+            record_index_free(&index);
+            ret = -1;
         }
     }
 
-    /* Close streams */
-    if ((ret = ps.stream_close(&ps)) < 0) {
-        fprintf(stderr, "Error closing streams! Error code: %d\n", ret);
-        print_stream_error_trace(&ps, &ds, &bs);
-        goto cleanup_exit_failure;
+    memset(&program, 0, sizeof(struct avrProgram));
+    program.sorted = 1;
+
+    if (ret < 0) {
+        /* Index the records, reading the whole program */
+        if ((ret = record_index_build(&index, &image, bs->in, format)) < 0) {
+            fprintf(stderr, "Error occured reading %s! Error code: %d\n", name, ret);
+            fclose(bs->in);
+            return -1;
+        }
+        if (avr_boundary_index_build(&boundaries, &image) < 0) {
+            fprintf(stderr, "Error allocating instruction-boundary index!\n");
+            record_index_free(&index);
+            byte_image_free(&image);
+            fclose(bs->in);
+            return -1;
+        }
+
+        /* Record a decode sync point for each block */
+        for (i = 0; i < index.numBlocks; i++) {
+            sync = avr_boundary_index_first(&boundaries, index.blocks[i].imageOffset, index.blocks[i].len);
+            index.blocks[i].sync = (sync >= 0 && sync < RECORD_INDEX_NO_SYNC) ? (uint8_t)sync : RECORD_INDEX_NO_SYNC;
+        }
+        index.tag = AVR_TOTAL_INSTRUCTIONS;
+        index.fileSize = (uint64_t)st.st_size;
+        index.fileMtime = (int64_t)st.st_mtime;
+
+        /* Save the sidecar, best effort */
+        if ((fp = fopen(path, "wb")) != NULL) {
+            ret = record_index_save(fp, &index);
+            if (fclose(fp) != 0 || ret < 0)
+                remove(path);
+        }
+
+        ret = avr_program_decode_range(&program, &image, &boundaries, start, end);
+        avr_boundary_index_free(&boundaries);
+        byte_image_free(&image);
+    } else {
+        /* Read and decode the range of each segment */
+        block = 0;
+        while ((ret = record_index_read_range(&index, bs->in, &block, start, end, &image)) == 0) {
+            if (avr_boundary_index_build(&boundaries, &image) < 0) {
+                byte_image_free(&image);
+                ret = STREAM_ERROR_ALLOC;
+                break;
+            }
+            ret = avr_program_decode_range(&window, &image, &boundaries, start, end);
+            avr_boundary_index_free(&boundaries);
+            byte_image_free(&image);
+            for (i = 0; ret == 0 && i < window.len; i++)
+                ret = (avr_program_append(&program, &window.instructions[i]) < 0) ? STREAM_ERROR_ALLOC : 0;
+            avr_program_free(&window);
+            if (ret < 0)
+                break;
+        }
+        if (ret == STREAM_EOF)
+            ret = 0;
     }
 
-    #if defined (DEBUG_BYTE_STREAM) || defined (DEBUG_DISASM_STREAM) || defined (DEBUG_PRINT_STREAM)
-    cleanup_exit_success:
-    #endif
+    record_index_free(&index);
+    fclose(bs->in);
+
+    if (ret < 0) {
+        fprintf(stderr, "Error occured during disassembly of %s! Error code: %d\n", name, ret);
+        avr_program_free(&program);
+        return -1;
+    }
+
+    /* Print the range */
+    ret = print_program(&program, flags, out, name);
+
+    avr_program_free(&program);
+
+    return ret;
+}
+
+/* Disassemble the instructions of a program overlapping addresses
+ * [start, end), decoding from an instruction-boundary index of the program.
+ * The Byte Stream is closed on return. Returns -1 on error. */
+static int disassemble_range(struct ByteStream *bs, int flags, FILE *out, const char *name, uint32_t start, uint32_t end) {
+    struct ByteImage image;
+    struct avrBoundaryIndex index;
+    struct avrProgram program;
+    int ret;
+
+    /* Seek through the records of Intel HEX and Motorola S-Record files */
+    if (strcmp(name, "-") != 0 && (bs->stream_read == byte_stream_ihex_read || bs->stream_read == byte_stream_srecord_read))
+        return disassemble_range_indexed(bs, flags, out, name, start, end);
+
+    /* Read the whole program */
+    if ((ret = byte_image_read(&image, bs)) < 0) {
+        fprintf(stderr, "Error occured reading %s! Error code: %d\n", name, ret);
+        print_stream_error_trace(NULL, NULL, bs);
+        return -1;
+    }
+
+    /* Index the instruction boundaries, and decode the range */
+    if (avr_boundary_index_build(&index, &image) < 0) {
+        fprintf(stderr, "Error allocating instruction-boundary index!\n");
+        byte_image_free(&image);
+        return -1;
+    }
+    ret = avr_program_decode_range(&program, &image, &index, start, end);
+    avr_boundary_index_free(&index);
+    byte_image_free(&image);
+    if (ret < 0) {
+        fprintf(stderr, "Error occured during disassembly of %s! Error code: %d\n", name, ret);
+        return -1;
+    }
+
+    /* Print the range */
+    ret = print_program(&program, flags, out, name);
+
+    avr_program_free(&program);
+
+    return ret;
+}
+
+/* Hash program symbols into a cache or database key */
+static uint64_t symbols_hash(uint64_t key, const struct SymbolTable *symbols) {
+    unsigned int i;
+
+    for (i = 0; i < symbols->len; i++) {
+        key = byte_hash(key, &symbols->symbols[i].address, sizeof(uint32_t));
+        key = byte_hash(key, symbols->symbols[i].name, strlen(symbols->symbols[i].name) + 1);
+    }
+
+    return key;
+}
+
+/* Hash program source lines into a cache key */
+static uint64_t lines_hash(uint64_t key, const struct LineTable *lines) {
+    unsigned int i;
+
+    key = byte_hash(key, lines->lines, lines->len*sizeof(struct line));
+    for (i = 0; i < lines->numFiles; i++)
+        key = byte_hash(key, lines->files[i].path, strlen(lines->files[i].path) + 1);
+
+    return key;
+}
+
+/* Disassemble a program from an analysis database, analyzing the program into
+ * the database first if it is missing or holds another program. Prints the
+ * instructions overlapping [start, end), or the instructions referencing the
+ * xrefs address, if one is specified. The Byte Stream is closed on return.
+ * Returns -1 on error. */
+static int disassemble_database(struct ByteStream *bs, int flags, FILE *out, const char *name, const char *database_str, const struct SymbolTable *symbols, uint32_t start, uint32_t end, const uint32_t *xrefs) {
+    struct ByteImage image;
+    struct avrProgram program;
+    struct avrFunctionTable functions;
+    struct avrDatabase db;
+    struct avrInstructionDisasm instrDisasm;
+    FILE *database_file;
+    char tmp_path[4096];
+    uint64_t key;
+    uint32_t i, first, count;
+    int ret;
+
+    /* Read the whole program */
+    if ((ret = byte_image_read(&image, bs)) < 0) {
+        fprintf(stderr, "Error occured reading %s! Error code: %d\n", name, ret);
+        print_stream_error_trace(NULL, NULL, bs);
+        return -1;
+    }
+
+    /* Key the program contents and symbols by tool version */
+    key = byte_hash(BYTE_HASH_INIT, VERSION_STRING, strlen(VERSION_STRING));
+    key = byte_image_hash(&image, key);
+    key = symbols_hash(key, symbols);
+    if (detect_functions)
+        key = byte_hash(key, "detect-functions", sizeof("detect-functions"));
+
+    if (avr_database_open(&db, database_str) < 0 || db.key != key) {
+        avr_database_close(&db);
+
+        /* Analyze the program */
+        if ((ret = avr_program_decode(&program, &image)) < 0) {
+            fprintf(stderr, "Error occured during disassembly of %s! Error code: %d\n", name, ret);
+            byte_image_free(&image);
+            return -1;
+        }
+        if (find_functions(&functions, &program, symbols) < 0) {
+            fprintf(stderr, "Error allocating function table!\n");
+            avr_program_free(&program);
+            byte_image_free(&image);
+            return -1;
+        }
+
+        /* Write the database beside the stale one and rename it into place,
+         * so other processes with the stale one mapped keep their copy */
+        if ((database_file = replace_open(database_str, tmp_path, sizeof(tmp_path))) == NULL) {
+            fprintf(stderr, "Error: Cannot open analysis database %s for writing: ", database_str);
+            perror(NULL);
+            ret = -1;
+        } else {
+            ret = avr_database_write(database_file, key, &program, &functions);
+            if (replace_close(database_file, tmp_path, database_str, ret == 0) < 0) {
+                fprintf(stderr, "Error writing analysis database %s!\n", database_str);
+                ret = -1;
+            }
+        }
+        avr_functions_free(&functions);
+        avr_program_free(&program);
+
+        if (ret < 0 || avr_database_open(&db, database_str) < 0) {
+            fprintf(stderr, "Error opening analysis database %s!\n", database_str);
+            byte_image_free(&image);
+            return -1;
+        }
+    }
+
+    byte_image_free(&image);
+
+    /* Collect the queried instructions */
+    memset(&program, 0, sizeof(struct avrProgram));
+    program.sorted = 1;
+    ret = 0;
+    if (xrefs != NULL) {
+        count = avr_database_xrefs(&db, *xrefs, &first);
+        for (i = first; ret == 0 && i < first + count; i++) {
+            if (avr_database_instruction(&db, db.xrefs[i].source, &instrDisasm) < 0 || avr_program_append(&program, &instrDisasm) < 0)
+                ret = -1;
+        }
+    } else if (start < end) {
+        /* Include an instruction straddling start */
+        i = avr_database_seek(&db, start);
+        if (i > 0 && avr_database_instruction(&db, i-1, &instrDisasm) == 0 && instrDisasm.address + instrDisasm.instructionInfo->width > start)
+            i--;
+        for (; ret == 0 && i < db.numInstructions && db.instructions[i].address < end; i++) {
+            if (avr_database_instruction(&db, i, &instrDisasm) < 0 || avr_program_append(&program, &instrDisasm) < 0)
+                ret = -1;
+        }
+    }
+    avr_database_close(&db);
+    if (ret < 0) {
+        fprintf(stderr, "Error reading analysis database %s!\n", database_str);
+        avr_program_free(&program);
+        return -1;
+    }
+
+    /* Print the instructions */
+    ret = print_program(&program, flags, out, name);
+
+    avr_program_free(&program);
+
+    return ret;
+}
+
+/* Disassemble a program through an output cache, serving repeat programs
+ * from the cache. Falls back to uncached disassembly if the cache entry can't
+ * be written. The Byte Stream is closed on return. Returns -1 on error. */
+static int disassemble_cached(struct ByteStream *bs, int arch, int flags, FILE *out, const char *name, struct Cache *cache) {
+    struct ByteImage image;
+    struct ByteStream image_bs;
+    struct cache_entry entry;
+    uint64_t key;
+    FILE *cached;
+    char options[128];
+    int ret;
+
+    /* Source text isn't part of the key */
+    if (cache == NULL || (listing_lines != NULL && (flags & PRINT_FLAG_SOURCE)))
+        return disassemble(bs, arch, flags, out, name);
+
+    /* Read the whole program */
+    if ((ret = byte_image_read(&image, bs)) < 0) {
+        fprintf(stderr, "Error occured reading %s! Error code: %d\n", name, ret);
+        print_stream_error_trace(NULL, NULL, bs);
+        return -1;
+    }
+
+    /* Key the program contents, symbols and source lines by tool version and
+     * output options */
+    snprintf(options, sizeof(options), "%s arch %d flags %d", VERSION_STRING, arch, flags);
+    key = byte_hash(BYTE_HASH_INIT, options, strlen(options));
+    key = byte_image_hash(&image, key);
+    if (listing_symbols != NULL)
+        key = symbols_hash(key, listing_symbols);
+    if (listing_lines != NULL)
+        key = lines_hash(key, listing_lines);
+
+    /* Serve a cached output */
+    if ((cached = cache_lookup(cache, key)) != NULL) {
+        ret = cache_copy(cached, out);
+        fclose(cached);
+        byte_image_free(&image);
+        if (ret < 0) {
+            fprintf(stderr, "Error copying cached disassembly of %s!\n", name);
+            return -1;
+        }
+        return 0;
+    }
+
+    /* Setup an image Byte Stream */
+    memset(&image_bs, 0, sizeof(struct ByteStream));
+    image_bs.in_image = &image;
+    image_bs.stream_init = byte_stream_image_init;
+    image_bs.stream_close = byte_stream_image_close;
+    image_bs.stream_read = byte_stream_image_read;
+
+    /* Disassemble directly to the output if the cache isn't writable */
+    if (cache_store_begin(cache, key, &entry) < 0) {
+        fprintf(stderr, "Warning: Cannot write cache entry for %s.\n", name);
+        ret = disassemble(&image_bs, arch, flags, out, name);
+        byte_image_free(&image);
+        return ret;
+    }
+
+    /* Disassemble into the cache entry, then copy it to the output */
+    ret = disassemble(&image_bs, arch, flags, entry.out, name);
+    byte_image_free(&image);
+    if (ret < 0) {
+        cache_store_abort(&entry);
+        return -1;
+    }
+    rewind(entry.out);
+    if (cache_copy(entry.out, out) < 0) {
+        fprintf(stderr, "Error copying disassembly of %s!\n", name);
+        cache_store_abort(&entry);
+        return -1;
+    }
+    if (cache_store_commit(cache, &entry) < 0)
+        fprintf(stderr, "Warning: Cannot write cache entry for %s.\n", name);
+
+    return 0;
+}
+
+/* Disassemble a whole program file. Returns -1 on error. */
+static int read_program(struct avrProgram *program, const char *file_in_str, const char *file_type_str, int arch) {
+    struct ByteStream bs;
+    struct DisasmStream ds;
+    int ret;
+
+    if (open_byte_stream(&bs, file_in_str, file_type_str) < 0)
+        return -1;
+
+    setup_disasm_stream(&ds, &bs, arch);
+
+    if ((ret = avr_program_read(program, &ds)) < 0) {
+        fprintf(stderr, "Error occured during disassembly of %s! Error code: %d\n", file_in_str, ret);
+        print_stream_error_trace(NULL, &ds, &bs);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Statistics mode state shared between worker threads */
+struct stats_context {
+    const char **files;
+    const char *file_type_str;
+    int arch;
+    /* Per-worker statistics */
+    struct avrStats *stats;
+    /* Failure flag */
+    int failed;
+};
+
+static void stats_job(void *arg, unsigned int worker, unsigned int job) {
+    struct stats_context *ctx = (struct stats_context *)arg;
+    struct ByteStream bs;
+    struct DisasmStream ds;
+    int ret;
+
+    if (open_byte_stream(&bs, ctx->files[job], ctx->file_type_str) < 0) {
+        ctx->failed = 1;
+        return;
+    }
+    setup_disasm_stream(&ds, &bs, ctx->arch);
+
+    TRACE_BEGIN("job", ctx->files[job]);
+    if ((ret = avr_stats_read(&ctx->stats[worker], &ds)) < 0) {
+        fprintf(stderr, "Error occured during disassembly of %s! Error code: %d\n", ctx->files[job], ret);
+        print_stream_error_trace(NULL, &ds, &bs);
+        ctx->failed = 1;
+    }
+    TRACE_END("job");
+}
+
+/* Count instructions over many program files on a pool of worker threads */
+static int stats_files(const char **files, unsigned int num_files, const char *file_type_str, int arch, unsigned int num_workers, FILE *out, int json) {
+    struct stats_context ctx;
+    unsigned int i;
+    int ret;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.files = files;
+    ctx.file_type_str = file_type_str;
+    ctx.arch = arch;
+
+    /* Each worker tallies into its own counters */
+    ctx.stats = calloc(num_workers, sizeof(struct avrStats));
+    if (ctx.stats == NULL) {
+        fprintf(stderr, "Error allocating statistics!\n");
+        return -1;
+    }
+    for (i = 0; i < num_workers; i++)
+        avr_stats_init(&ctx.stats[i]);
+
+    /* Build the shared opcode lookup table before starting workers */
+    avr_iset_lookup_init();
+
+    if (thread_pool_run(num_workers, num_files, stats_job, &ctx) < 0) {
+        fprintf(stderr, "Error starting worker threads!\n");
+        free(ctx.stats);
+        return -1;
+    }
+
+    /* Merge per-worker counters */
+    for (i = 1; i < num_workers; i++)
+        avr_stats_merge(&ctx.stats[0], &ctx.stats[i]);
+
+    ret = avr_stats_print(out, &ctx.stats[0], json);
+    free(ctx.stats);
+    if (ret < 0) {
+        fprintf(stderr, "Error writing statistics!\n");
+        return -1;
+    }
+
+    return ctx.failed ? -1 : 0;
+}
+
+/* Batch mode state shared between worker threads */
+struct batch_context {
+    char **files;
+    /* Output file names, in the output directory */
+    char **out_names;
+    const char *out_dir;
+    const char *file_type_str;
+    int arch;
+    int flags;
+    struct Cache *cache;
+    /* Failure flag */
+    int failed;
+};
+
+static void batch_job(void *arg, unsigned int worker, unsigned int job) {
+    struct batch_context *ctx = (struct batch_context *)arg;
+    const char *file_in_str = ctx->files[job];
+    char file_out_str[4096];
+    struct ByteStream bs;
+    FILE *out;
+
+    if (snprintf(file_out_str, sizeof(file_out_str), "%s/%s.dis", ctx->out_dir, ctx->out_names[job]) >= (int)sizeof(file_out_str)) {
+        fprintf(stderr, "Error: Output file path for %s too long!\n", file_in_str);
+        ctx->failed = 1;
+        return;
+    }
+
+    if (open_byte_stream(&bs, file_in_str, ctx->file_type_str) < 0) {
+        ctx->failed = 1;
+        return;
+    }
+
+    out = fopen(file_out_str, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Error opening output file %s for writing: ", file_out_str);
+        perror(NULL);
+        if (bs.in != stdin)
+            fclose(bs.in);
+        ctx->failed = 1;
+        return;
+    }
+
+    TRACE_BEGIN("job", file_in_str);
+    if (disassemble_cached(&bs, ctx->arch, ctx->flags, out, file_in_str, ctx->cache) < 0)
+        ctx->failed = 1;
+    TRACE_END("job");
+
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Error writing output file %s!\n", file_out_str);
+        ctx->failed = 1;
+    }
+}
+
+static int batch_name_compare(const void *a, const void *b) {
+    const char * const *na = (const char * const *)a;
+    const char * const *nb = (const char * const *)b;
+    int cmp = strcmp(*na, *nb);
+
+    /* Keep list order among equal names */
+    if (cmp == 0)
+        return (na < nb) ? -1 : (na > nb);
+    return cmp;
+}
+
+/* Name the output file of each program file of a batch after its file name.
+ * Program files with the same file name in different directories are told
+ * apart by a -2, -3, ... suffix, in list order. Returns -1 on error. */
+static int batch_output_names(char **files, unsigned int num_files, char ***out_names) {
+    char **names, ***sorted = NULL;
+    char name[4096];
+    const char *base;
+    unsigned int i, j, n;
+    int ret = -1;
+
+    if ((names = calloc(num_files + 1, sizeof(char *))) == NULL)
+        return -1;
+
+    for (i = 0; i < num_files; i++) {
+        base = strrchr(files[i], '/');
+        base = (base == NULL) ? files[i] : base + 1;
+        if ((names[i] = strdup(base)) == NULL)
+            goto cleanup;
+    }
+
+    /* Sort pointers to the names, so equal names are adjacent */
+    if ((sorted = malloc((num_files + 1)*sizeof(char **))) == NULL)
+        goto cleanup;
+    for (i = 0; i < num_files; i++)
+        sorted[i] = &names[i];
+    if (num_files > 0)
+        qsort(sorted, num_files, sizeof(char **), batch_name_compare);
+
+    /* Suffix all but the first of each run of equal names */
+    for (i = 0; i < num_files; i = j) {
+        for (j = i + 1, n = 2; j < num_files && strcmp(*sorted[i], *sorted[j]) == 0; j++, n++) {
+            snprintf(name, sizeof(name), "%s-%u", *sorted[j], n);
+            fprintf(stderr, "Warning: Writing %s to %s.dis, its file name is taken.\n", files[sorted[j] - names], name);
+            free(*sorted[j]);
+            if ((*sorted[j] = strdup(name)) == NULL)
+                goto cleanup;
+        }
+    }
+
+    /* A suffixed name may still collide with another file name */
+    for (i = 0; i < num_files; i++)
+        sorted[i] = &names[i];
+    if (num_files > 0)
+        qsort(sorted, num_files, sizeof(char **), batch_name_compare);
+    for (i = 1; i < num_files; i++) {
+        if (strcmp(*sorted[i-1], *sorted[i]) == 0) {
+            fprintf(stderr, "Error: Output files of %s and %s collide!\n", files[sorted[i-1] - names], files[sorted[i] - names]);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+    cleanup:
+    free(sorted);
+    if (ret < 0) {
+        for (i = 0; i < num_files; i++)
+            free(names[i]);
+        free(names);
+        return -1;
+    }
+    *out_names = names;
+    return 0;
+}
+
+/* Read a batch list of program files, one per line, appending them to a file
+ * list. Blank lines and lines starting with # are skipped. */
+static int batch_list_read(const char *list_str, char ***files, unsigned int *num_files, unsigned int *capacity) {
+    FILE *list;
+    char line[4096];
+    size_t len;
+
+    list = (strcmp(list_str, "-") == 0) ? stdin : fopen(list_str, "r");
+    if (list == NULL) {
+        perror("Error: Cannot open batch list");
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), list) != NULL) {
+        /* Strip trailing newline */
+        len = strlen(line);
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        /* Grow the file list if needed */
+        if (*num_files == *capacity) {
+            unsigned int new_capacity = (*capacity == 0) ? 256 : *capacity*2;
+            char **new_files = realloc(*files, new_capacity*sizeof(char *));
+            if (new_files == NULL)
+                goto alloc_error;
+            *files = new_files;
+            *capacity = new_capacity;
+        }
+        if (((*files)[*num_files] = strdup(line)) == NULL)
+            goto alloc_error;
+        (*num_files)++;
+    }
+
+    if (list != stdin)
+        fclose(list);
+    return 0;
+
+    alloc_error:
+    fprintf(stderr, "Error allocating batch list!\n");
+    if (list != stdin)
+        fclose(list);
+    return -1;
+}
+
+/* Collect the program files of a batch list, if one is specified, and of the
+ * command line into one file list. Returns -1 on error, with the files
+ * collected so far still to be freed. */
+static int batch_list_collect(const char *list_str, const char **args, unsigned int num_args, char ***files, unsigned int *num_files) {
+    unsigned int capacity = 0, i;
+
+    if (list_str[0] != '\0' && batch_list_read(list_str, files, num_files, &capacity) < 0)
+        return -1;
+    if (num_args > 0) {
+        char **new_files = realloc(*files, (*num_files + num_args)*sizeof(char *));
+        if (new_files == NULL) {
+            fprintf(stderr, "Error allocating batch list!\n");
+            return -1;
+        }
+        *files = new_files;
+        for (i = 0; i < num_args; i++) {
+            if (((*files)[*num_files] = strdup(args[i])) == NULL) {
+                fprintf(stderr, "Error allocating batch list!\n");
+                return -1;
+            }
+            (*num_files)++;
+        }
+    }
+
+    return 0;
+}
+
+/* Disassemble a batch of program files, from a batch list and from the
+ * command line, to their own output files on a pool of worker threads */
+static int batch_files(const char *list_str, const char **args, unsigned int num_args, const char *out_dir, const char *file_type_str, int arch, int flags, struct Cache *cache, unsigned int num_workers) {
+    struct batch_context ctx;
+    char **files = NULL, **out_names = NULL;
+    unsigned int num_files = 0, i;
+    int ret = -1;
+
+    if (batch_list_collect(list_str, args, num_args, &files, &num_files) < 0)
+        goto cleanup;
+
+    /* Name the output files before any worker writes one */
+    if (batch_output_names(files, num_files, &out_names) < 0)
+        goto cleanup;
+
+    /* Create the output directory if it doesn't exist */
+#ifdef _MSC_VER
+    _mkdir(out_dir);
+#else
+    mkdir(out_dir, 0777);
+#endif
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.files = files;
+    ctx.out_names = out_names;
+    ctx.out_dir = out_dir;
+    ctx.file_type_str = file_type_str;
+    ctx.arch = arch;
+    ctx.flags = flags;
+    ctx.cache = cache;
+
+    /* Build the shared opcode lookup table before starting workers */
+    avr_iset_lookup_init();
+
+    if (thread_pool_run(num_workers, num_files, batch_job, &ctx) < 0) {
+        fprintf(stderr, "Error starting worker threads!\n");
+        goto cleanup;
+    }
+
+    ret = ctx.failed ? -1 : 0;
+
+    cleanup:
+    for (i = 0; i < num_files; i++) {
+        free(files[i]);
+        if (out_names != NULL)
+            free(out_names[i]);
+    }
+    free(files);
+    free(out_names);
+    return ret;
+}
+
+/* Signature search state shared between worker threads */
+struct signature_context {
+    char **files;
+    const char *file_type_str;
+    const struct avrSignatureSet *set;
+    /* Per-file matches */
+    struct avrSignatureMatches *results;
+    /* Failure flag */
+    int failed;
+};
+
+static void signature_job(void *arg, unsigned int worker, unsigned int job) {
+    struct signature_context *ctx = (struct signature_context *)arg;
+    struct ByteStream bs;
+    struct ByteImage image;
+    int ret;
+
+    (void)worker;
+
+    if (open_byte_stream(&bs, ctx->files[job], ctx->file_type_str) < 0) {
+        ctx->failed = 1;
+        return;
+    }
+
+    TRACE_BEGIN("job", ctx->files[job]);
+    if ((ret = byte_image_read(&image, &bs)) < 0) {
+        fprintf(stderr, "Error occured reading %s! Error code: %d\n", ctx->files[job], ret);
+        print_stream_error_trace(NULL, NULL, &bs);
+        ctx->failed = 1;
+    } else {
+        if (avr_signatures_scan(ctx->set, &image, &ctx->results[job]) < 0) {
+            fprintf(stderr, "Error allocating signature matches of %s!\n", ctx->files[job]);
+            ctx->failed = 1;
+        }
+        byte_image_free(&image);
+    }
+    TRACE_END("job");
+}
+
+/* Search a batch of program files, from a batch list and from the command
+ * line, for the signatures of a signature file on a pool of worker threads,
+ * and print the matches in file and address order */
+static int signature_files(const char *signature_str, const char *list_str, const char **args, unsigned int num_args, const char *file_type_str, unsigned int num_workers, FILE *out) {
+    struct signature_context ctx;
+    struct avrSignatureSet set;
+    struct avrSignatureMatch *match;
+    FILE *signature_in;
+    char **files = NULL;
+    unsigned int num_files = 0, line, i, j;
+    int ret;
+
+    /* Compile the signatures once, shared read-only by the workers */
+    signature_in = fopen(signature_str, "r");
+    if (signature_in == NULL) {
+        perror("Error: Cannot open signature file");
+        return -1;
+    }
+    ret = avr_signatures_load(&set, signature_in, &line);
+    fclose(signature_in);
+    if (ret < 0) {
+        if (line > 0)
+            fprintf(stderr, "Error reading signature file %s at line %u.\n", signature_str, line);
+        else
+            fprintf(stderr, "Error compiling signature file %s!\n", signature_str);
+        return -1;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ret = -1;
+
+    if (batch_list_collect(list_str, args, num_args, &files, &num_files) < 0)
+        goto cleanup;
+
+    ctx.files = files;
+    ctx.file_type_str = file_type_str;
+    ctx.set = &set;
+
+    /* Each file gets its own matches */
+    ctx.results = calloc((num_files > 0) ? num_files : 1, sizeof(struct avrSignatureMatches));
+    if (ctx.results == NULL) {
+        fprintf(stderr, "Error allocating signature matches!\n");
+        goto cleanup;
+    }
+
+    if (thread_pool_run(num_workers, num_files, signature_job, &ctx) < 0) {
+        fprintf(stderr, "Error starting worker threads!\n");
+        goto cleanup;
+    }
+
+    for (i = 0; i < num_files; i++) {
+        for (j = 0; j < ctx.results[i].len; j++) {
+            match = &ctx.results[i].matches[j];
+            if (fprintf(out, "%s:0x%08x\t%s\n", files[i], match->address, set.names[match->signature]) < 0) {
+                fprintf(stderr, "Error writing signature matches!\n");
+                goto cleanup;
+            }
+        }
+    }
+
+    ret = ctx.failed ? -1 : 0;
+
+    cleanup:
+    for (i = 0; i < num_files; i++) {
+        if (ctx.results != NULL)
+            avr_signature_matches_free(&ctx.results[i]);
+        free(files[i]);
+    }
+    free(ctx.results);
+    free(files);
+    avr_signatures_free(&set);
+    return ret;
+}
+
+/* Clone search state shared between worker threads */
+struct clone_context {
+    char **files;
+    const char *file_type_str;
+    int arch;
+    unsigned int window;
+    /* Per-file normalized instructions */
+    struct avrCloneProgram *programs;
+    /* Failure flag */
+    int failed;
+};
+
+static void clone_job(void *arg, unsigned int worker, unsigned int job) {
+    struct clone_context *ctx = (struct clone_context *)arg;
+    struct avrProgram program;
+
+    (void)worker;
+
+    TRACE_BEGIN("job", ctx->files[job]);
+    if (read_program(&program, ctx->files[job], ctx->file_type_str, ctx->arch) < 0) {
+        ctx->failed = 1;
+    } else {
+        if (avr_clones_prepare(&ctx->programs[job], &program, ctx->window) < 0) {
+            fprintf(stderr, "Error allocating clone search of %s!\n", ctx->files[job]);
+            ctx->failed = 1;
+        }
+        avr_program_free(&program);
+    }
+    TRACE_END("job");
+}
+
+/* Search a batch of program files, from a batch list and from the command
+ * line, for repeated instruction sequences, normalizing each program file on
+ * a pool of worker threads, and print the clone groups */
+static int clone_files(const char *list_str, const char **args, unsigned int num_args, const char *file_type_str, int arch, unsigned int window, unsigned int num_workers, FILE *out) {
+    struct clone_context ctx;
+    struct avrClones found;
+    char **files = NULL;
+    unsigned int num_files = 0, i;
+    int ret = -1;
+
+    memset(&ctx, 0, sizeof(ctx));
+
+    if (batch_list_collect(list_str, args, num_args, &files, &num_files) < 0)
+        goto cleanup;
+
+    ctx.files = files;
+    ctx.file_type_str = file_type_str;
+    ctx.arch = arch;
+    ctx.window = window;
+    ctx.programs = calloc((num_files > 0) ? num_files : 1, sizeof(struct avrCloneProgram));
+    if (ctx.programs == NULL) {
+        fprintf(stderr, "Error allocating clone search!\n");
+        goto cleanup;
+    }
+
+    /* Build the shared opcode lookup table before starting workers */
+    avr_iset_lookup_init();
+
+    if (thread_pool_run(num_workers, num_files, clone_job, &ctx) < 0) {
+        fprintf(stderr, "Error starting worker threads!\n");
+        goto cleanup;
+    }
+    if (ctx.failed)
+        goto cleanup;
+
+    /* Bucket the windows of all program files together */
+    if (avr_clones_find(&found, ctx.programs, num_files, window) < 0) {
+        fprintf(stderr, "Error allocating clone search!\n");
+        goto cleanup;
+    }
+    ret = avr_report_clones(out, &found, (const char *const *)files);
+    avr_clones_free(&found);
+    if (ret < 0)
+        fprintf(stderr, "Error writing clone report!\n");
+
+    cleanup:
+    for (i = 0; i < num_files; i++) {
+        if (ctx.programs != NULL)
+            avr_clone_program_free(&ctx.programs[i]);
+        free(files[i]);
+    }
+    free(ctx.programs);
+    free(files);
+    return ret;
+}
+
+/* Write the recorded trace events to a trace file. Returns -1 on error. */
+static int write_trace(const char *trace_str) {
+    FILE *out;
+    int ret;
+
+    out = fopen(trace_str, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Error opening trace file %s for writing: ", trace_str);
+        perror(NULL);
+        return -1;
+    }
+
+    ret = trace_write(out);
+    if (fclose(out) != 0 || ret < 0) {
+        fprintf(stderr, "Error writing trace file %s!\n", trace_str);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, const char *argv[]) {
+    /* User Options */
+    int optc;
+    char arch_str[16] = {0};
+    char file_type_str[8] = {0};
+    char file_out_str[4096] = {0};
+    char symbols_str[4096] = {0};
+    char batch_str[4096] = {0};
+    char out_dir_str[4096] = {0};
+    char cache_dir_str[4096] = {0};
+    char incremental_str[4096] = {0};
+    char save_decode_str[4096] = {0};
+    char serve_str[4096] = {0};
+    char database_str[4096] = {0};
+    char signature_str[4096] = {0};
+    char fingerprints_str[4096] = {0};
+    char make_fingerprints_str[4096] = {0};
+    uint32_t range_start = 0, range_end = UINT32_MAX;
+    int range = 0;
+    uint32_t xrefs_address = 0;
+    int xrefs = 0;
+    unsigned long cache_size_mb = DEFAULT_CACHE_SIZE_MB;
+    unsigned int jobs = 0;
+    unsigned int clone_window = AVR_CLONE_DEFAULT_WINDOW;
+    int num_modes;
+
+    /* Input / Output files */
+    FILE *file_in = NULL, *file_out = NULL;
+
+    /* Disassembler Streams */
+    int arch = ARCH_AVR8;
+    int flags = 0;
+    struct ByteStream bs;
+    struct DisasmStream ds;
+    struct PrintStream ps;
+    int file_type;
+    int ret;
+
+    /* Program symbols */
+    struct SymbolTable symbols;
+    /* Program source lines */
+    struct LineTable lines;
+    /* Output cache */
+    struct Cache cache;
+
+    symbol_table_init(&symbols);
+    line_table_init(&lines);
+    memset(&cache, 0, sizeof(struct Cache));
+
+    /* Parse command line options */
+    while (1) {
+        optc = getopt_long(argc, (char * const *)argv, "o:t:s:j:hv", long_options, NULL);
+        if (optc == -1)
+            break;
+        switch (optc) {
+            /* Long option */
+            case 0:
+                break;
+            case 'a':
+                option_copy(arch_str, sizeof(arch_str), optarg);
+                break;
+            case 't':
+                option_copy(file_type_str, sizeof(file_type_str), optarg);
+                break;
+            case 'o':
+                if (strcmp(optarg, "-") != 0)
+                    option_copy(file_out_str, sizeof(file_out_str), optarg);
+                break;
+            case 's':
+                option_copy(symbols_str, sizeof(symbols_str), optarg);
+                break;
+            case 'S':
+                stats = 1;
+                if (optarg != NULL && strcasecmp(optarg, "json") == 0)
+                    stats_json = 1;
+                else if (optarg != NULL && strcasecmp(optarg, "table") != 0) {
+                    fprintf(stderr, "Unknown statistics format %s.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'K':
+                clones = 1;
+                if (optarg != NULL)
+                    clone_window = (unsigned int)option_number("clone length", optarg, 10, 1, UINT32_MAX);
+                break;
+            case 'P':
+                profile = 1;
+                if (optarg != NULL && strcasecmp(optarg, "json") == 0)
+                    profile_json = 1;
+                else if (optarg != NULL && strcasecmp(optarg, "table") != 0) {
+                    fprintf(stderr, "Unknown profile format %s.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'R':
+                option_copy(trace_str, sizeof(trace_str), optarg);
+                break;
+            case 'j':
+                jobs = (unsigned int)option_number("number of jobs", optarg, 10, 1, MAX_JOBS);
+                break;
+            case 'B':
+                option_copy(batch_str, sizeof(batch_str), optarg);
+                break;
+            case 'O':
+                option_copy(out_dir_str, sizeof(out_dir_str), optarg);
+                break;
+            case 'C':
+                option_copy(cache_dir_str, sizeof(cache_dir_str), optarg);
+                break;
+            case 'Z':
+                cache_size_mb = option_number("cache size", optarg, 10, 1, MAX_CACHE_SIZE_MB);
+                break;
+            case 'I':
+                option_copy(incremental_str, sizeof(incremental_str), optarg);
+                break;
+            case 'D':
+                option_copy(save_decode_str, sizeof(save_decode_str), optarg);
+                break;
+            case 'E':
+                option_copy(serve_str, sizeof(serve_str), optarg);
+                break;
+            case 'F':
+                range_start = (uint32_t)option_number("start address", optarg, 0, 0, UINT32_MAX);
+                range = 1;
+                break;
+            case 'T':
+                range_end = (uint32_t)option_number("end address", optarg, 0, 0, UINT32_MAX);
+                range = 1;
+                break;
+            case 'A':
+                option_copy(database_str, sizeof(database_str), optarg);
+                break;
+            case 'G':
+                option_copy(signature_str, sizeof(signature_str), optarg);
+                break;
+            case 'N':
+                option_copy(fingerprints_str, sizeof(fingerprints_str), optarg);
+                break;
+            case 'M':
+                option_copy(make_fingerprints_str, sizeof(make_fingerprints_str), optarg);
+                break;
+            case 'X':
+                xrefs_address = (uint32_t)option_number("cross reference address", optarg, 0, 0, UINT32_MAX);
+                xrefs = 1;
+                break;
+            case 'h':
+                printUsage(argv[0]);
+                exit(EXIT_SUCCESS);
+            case 'v':
+                printVersion();
+                exit(EXIT_SUCCESS);
+            default:
+                printUsage(argv[0]);
+                exit(EXIT_SUCCESS);
+        }
+    }
+
+    /* If there are no more arguments left */
+    if (optind == argc && batch_str[0] == '\0' && serve_str[0] == '\0') {
+        printUsage(argv[0]);
+        goto cleanup_exit_failure;
+    }
+
+    /* Batch lists need an output directory, a signature search or a clone
+     * search */
+    if (batch_str[0] != '\0' && out_dir_str[0] == '\0' && signature_str[0] == '\0' && !clones) {
+        fprintf(stderr, "Error: --batch requires an output directory with --out-dir, --find-signature, or --clones.\n");
+        goto cleanup_exit_failure;
+    }
+
+    /* Modes replace the disassembly, so only one may be given */
+    num_modes = (serve_str[0] != '\0') + (out_dir_str[0] != '\0') + (diff != 0) + (signature_str[0] != '\0') + (clones != 0) + (stats != 0) + (size_report != 0) + (dead_stores != 0) + (tables != 0) + (fingerprints_str[0] != '\0') + (make_fingerprints_str[0] != '\0') + (database_str[0] != '\0');
+    if (num_modes > 1) {
+        fprintf(stderr, "Error: Only one of --serve, --out-dir, --diff, --find-signature, --clones, --stats, --size-report, --dead-stores, --tables, --fingerprints, --make-fingerprints and --database can be given.\n");
+        goto cleanup_exit_failure;
+    }
+    if ((range || incremental_str[0] != '\0' || save_decode_str[0] != '\0') && num_modes > 0 && database_str[0] == '\0') {
+        fprintf(stderr, "Error: --start / --end, --incremental and --save-decode only apply to the disassembly.\n");
+        goto cleanup_exit_failure;
+    }
+
+    /* Ranges hold at least one address */
+    if (range && range_start >= range_end) {
+        fprintf(stderr, "Error: --start must be below --end.\n");
+        goto cleanup_exit_failure;
+    }
+
+    /* Ranges are decoded from scratch */
+    if (range && (incremental_str[0] != '\0' || save_decode_str[0] != '\0')) {
+        fprintf(stderr, "Error: --start / --end can't be combined with --incremental or --save-decode.\n");
+        goto cleanup_exit_failure;
+    }
+
+    /* Databases are analyzed from scratch, and cross references come from a
+     * database */
+    if (database_str[0] != '\0' && (incremental_str[0] != '\0' || save_decode_str[0] != '\0')) {
+        fprintf(stderr, "Error: --database can't be combined with --incremental or --save-decode.\n");
+        goto cleanup_exit_failure;
+    }
+    if (xrefs && database_str[0] == '\0') {
+        fprintf(stderr, "Error: --xrefs requires an analysis database with --database.\n");
+        goto cleanup_exit_failure;
+    }
+
+    /* Fingerprints of reference programs are named by their symbols */
+    if (make_fingerprints_str[0] != '\0' && symbols_str[0] == '\0') {
+        fprintf(stderr, "Error: --make-fingerprints requires program symbols with -s.\n");
+        goto cleanup_exit_failure;
+    }
+
+    if (jobs == 0)
+        jobs = thread_pool_default_workers();
+
+    if (profile)
+        profile_init();
+    if (trace_str[0] != '\0')
+        trace_init();
+
+    /*** Setup Formatting Flags ***/
+    if (!no_addresses)
+        flags |= PRINT_FLAG_ADDRESSES;
+    if (!no_destination_comments)
+        flags |= PRINT_FLAG_DESTINATION_COMMENT;
+    if (!no_opcodes)
+        flags |= PRINT_FLAG_OPCODES;
+
+    if (data_base == DATA_BASE_BIN)
+        flags |= PRINT_FLAG_DATA_BIN;
+    else if (data_base == DATA_BASE_DEC)
+        flags |= PRINT_FLAG_DATA_DEC;
+    else
+        flags |= PRINT_FLAG_DATA_HEX;
+
+    if (assembly)
+        flags |= PRINT_FLAG_ASSEMBLY;
+
+    if (objdump_compatible)
+        flags |= PRINT_FLAG_OBJDUMP_COMP;
+
+    if (source)
+        flags |= PRINT_FLAG_SOURCE;
+
+    /*** Open output cache ***/
+
+    if (cache_dir_str[0] != '\0') {
+        if (cache_init(&cache, cache_dir_str, (uint64_t)cache_size_mb*1024*1024) < 0) {
+            fprintf(stderr, "Error: Cannot open cache directory %s: ", cache_dir_str);
+            perror(NULL);
+            goto cleanup_exit_failure;
+        }
+    }
+
+    /*** Server Mode ***/
+
+    if (serve_str[0] != '\0') {
+        if (server_run(serve_str, jobs, flags) < 0)
+            goto cleanup_exit_failure;
+        goto cleanup_exit_success;
+    }
+
+    /*** Batch Mode ***/
+
+    if (out_dir_str[0] != '\0') {
+        if (batch_files(batch_str, argv + optind, argc - optind, out_dir_str, file_type_str, arch, flags, (cache_dir_str[0] != '\0') ? &cache : NULL, jobs) < 0)
+            goto cleanup_exit_failure;
+        goto cleanup_exit_success;
+    }
+
+    /*** Open output file ***/
+
+    /* If an output file was specified */
+    if (file_out_str[0] != '\0') {
+        file_out = fopen(file_out_str, "w");
+        if (file_out == NULL) {
+            perror("Error opening output file for writing");
+            goto cleanup_exit_failure;
+        }
+    } else {
+    /* Otherwise, default the output file to stdout */
+        file_out = stdout;
+    }
+
+    /*** Read program symbols ***/
+
+    /* If a symbols file was specified */
+    if (symbols_str[0] != '\0') {
+        FILE *symbols_in = fopen(symbols_str, "r");
+        if (symbols_in == NULL) {
+            perror("Error: Cannot open symbols file");
+            goto cleanup_exit_failure;
+        }
+        if (symbol_table_load_nm(&symbols, symbols_in) < 0) {
+            fprintf(stderr, "Error reading symbols file %s.\n", symbols_str);
+            fclose(symbols_in);
+            goto cleanup_exit_failure;
+        }
+        fclose(symbols_in);
+    }
+
+    /*** Diff Mode ***/
+
+    if (diff) {
+        struct avrProgram old_program, new_program;
+
+        if (argc - optind != 2) {
+            fprintf(stderr, "Error: --diff requires an old and a new program file.\n");
+            goto cleanup_exit_failure;
+        }
+
+        if (read_program(&old_program, argv[optind], file_type_str, arch) < 0)
+            goto cleanup_exit_failure;
+        if (read_program(&new_program, argv[optind+1], file_type_str, arch) < 0) {
+            avr_program_free(&old_program);
+            goto cleanup_exit_failure;
+        }
+
+        ret = avr_report_diff(file_out, &old_program, &new_program, &symbols, detect_functions);
+        avr_program_free(&old_program);
+        avr_program_free(&new_program);
+        if (ret < 0) {
+            fprintf(stderr, "Error writing diff report!\n");
+            goto cleanup_exit_failure;
+        }
+
+        goto cleanup_exit_success;
+    }
+
+    /*** Signature Search Mode ***/
+
+    if (signature_str[0] != '\0') {
+        if (signature_files(signature_str, batch_str, argv + optind, argc - optind, file_type_str, jobs, file_out) < 0)
+            goto cleanup_exit_failure;
+        goto cleanup_exit_success;
+    }
+
+    /*** Clone Search Mode ***/
+
+    if (clones) {
+        if (clone_files(batch_str, argv + optind, argc - optind, file_type_str, arch, clone_window, jobs, file_out) < 0)
+            goto cleanup_exit_failure;
+        goto cleanup_exit_success;
+    }
+
+    /*** Statistics Mode ***/
+
+    if (stats) {
+        if (stats_files(argv + optind, argc - optind, file_type_str, arch, jobs, file_out, stats_json) < 0)
+            goto cleanup_exit_failure;
+        goto cleanup_exit_success;
+    }
+
+    /*** Open input file and determine its file type ***/
+
+    if ((file_type = open_byte_stream(&bs, argv[optind], file_type_str)) < 0)
+        goto cleanup_exit_failure;
+    file_in = bs.in;
+
+    /* Read the symbols of an ELF program file, unless a symbols file was
+     * specified */
+    if (file_type == FILE_TYPE_ELF && symbols_str[0] == '\0' && file_in != stdin) {
+        if (elf_symbols_load(&symbols, file_in) < 0) {
+            fprintf(stderr, "Error reading symbols of %s.\n", argv[optind]);
+            goto cleanup_exit_failure;
+        }
+    }
+
+    /* Read the DWARF source lines of an ELF program file */
+    if (file_type == FILE_TYPE_ELF && file_in != stdin) {
+        if (elf_lines_load(&lines, file_in) < 0) {
+            fprintf(stderr, "Error reading source lines of %s.\n", argv[optind]);
+            goto cleanup_exit_failure;
+        }
+    }
+
+    /* Label the disassembly with the program symbols, and annotate it with
+     * the source lines */
+    if (symbols.len > 0)
+        listing_symbols = &symbols;
+    if (lines.len > 0)
+        listing_lines = &lines;
+
+    /*** Debug Mode ***/
+
+    #if defined (DEBUG_BYTE_STREAM)
+        /* Test opcode stream */
+        test_byte_stream(file_in, bs.stream_init, bs.stream_close, bs.stream_read);
+        goto cleanup_exit_success;
+    #elif defined (DEBUG_DISASM_STREAM)
+        /* Test Disasm Stream */
+        test_disasm_stream_unit_tests();
+        goto cleanup_exit_success;
+    #elif defined (DEBUG_PRINT_STREAM)
+        /* Test Print Stream */
+        test_print_stream();
+        goto cleanup_exit_success;
+    #endif
+
+    /*** Setup disassembler streams ***/
+
+    /* Setup the Disasm Stream */
+    setup_disasm_stream(&ds, &bs, arch);
+
+    /* Setup the Print Stream */
+    ps.in = &ds;
+    ps.stream_init = print_stream_init;
+    ps.stream_close = print_stream_close;
+    ps.stream_read = print_stream_read;
+    ps.symbols = listing_symbols;
+    ps.lines = listing_lines;
+    ps.error = NULL;
+
+    /*** Size Report ***/
+
+    if (size_report) {
+        struct avrProgram program;
+        struct avrFunctionTable functions;
+
+        /* Streams take ownership of the input file */
+        file_in = NULL;
+
+        /* Disassemble the whole program */
+        if ((ret = avr_program_read(&program, &ds)) < 0) {
+            fprintf(stderr, "Error occured during disassembly! Error code: %d\n", ret);
+            print_stream_error_trace(&ps, &ds, &bs);
+            goto cleanup_exit_failure;
+        }
+
+        /* Identify function boundaries */
+        if (find_functions(&functions, &program, &symbols) < 0) {
+            fprintf(stderr, "Error allocating function table!\n");
+            avr_program_free(&program);
+            goto cleanup_exit_failure;
+        }
+
+        ret = avr_report_size(file_out, &program, &functions);
+        avr_functions_free(&functions);
+        avr_program_free(&program);
+        if (ret < 0) {
+            fprintf(stderr, "Error writing size report!\n");
+            goto cleanup_exit_failure;
+        }
+
+        goto cleanup_exit_success;
+    }
+
+    /*** Dead Stores ***/
+
+    if (dead_stores) {
+        struct avrProgram program;
+        struct avrFunctionTable functions;
+        struct avrLiveness liveness;
+
+        /* Streams take ownership of the input file */
+        file_in = NULL;
+
+        /* Disassemble the whole program */
+        if ((ret = avr_program_read(&program, &ds)) < 0) {
+            fprintf(stderr, "Error occured during disassembly! Error code: %d\n", ret);
+            print_stream_error_trace(&ps, &ds, &bs);
+            goto cleanup_exit_failure;
+        }
+
+        /* Identify function boundaries, then solve register liveness */
+        if (find_functions(&functions, &program, &symbols) < 0 || avr_liveness_analyze(&liveness, &program, &functions) < 0) {
+            fprintf(stderr, "Error allocating liveness analysis!\n");
+            avr_functions_free(&functions);
+            avr_program_free(&program);
+            goto cleanup_exit_failure;
+        }
+
+        ret = avr_report_liveness(file_out, &program, &liveness, flags);
+        avr_liveness_free(&liveness);
+        avr_functions_free(&functions);
+        avr_program_free(&program);
+        if (ret < 0) {
+            fprintf(stderr, "Error writing dead store listing!\n");
+            goto cleanup_exit_failure;
+        }
+
+        goto cleanup_exit_success;
+    }
+
+    /*** Flash Tables ***/
+
+    if (tables) {
+        struct avrProgram program;
+        struct avrFunctionTable functions;
+        struct avrCodeMap map;
+
+        /* Streams take ownership of the input file */
+        file_in = NULL;
+
+        /* Disassemble the whole program */
+        if ((ret = avr_program_read(&program, &ds)) < 0) {
+            fprintf(stderr, "Error occured during disassembly! Error code: %d\n", ret);
+            print_stream_error_trace(&ps, &ds, &bs);
+            goto cleanup_exit_failure;
+        }
+
+        /* Identify function boundaries, then resolve the flash tables into
+         * the program */
+        if (find_functions(&functions, &program, &symbols) < 0 || avr_tables_resolve(&map, &program, &functions) < 0) {
+            fprintf(stderr, "Error allocating flash table analysis!\n");
+            avr_functions_free(&functions);
+            avr_program_free(&program);
+            goto cleanup_exit_failure;
+        }
+
+        ret = print_program(&program, flags, file_out, argv[optind]);
+        avr_code_map_free(&map);
+        avr_functions_free(&functions);
+        avr_program_free(&program);
+        if (ret < 0)
+            goto cleanup_exit_failure;
+
+        goto cleanup_exit_success;
+    }
+
+    /*** Function Fingerprints ***/
+
+    if (fingerprints_str[0] != '\0' || make_fingerprints_str[0] != '\0') {
+        struct avrProgram program;
+        struct avrFunctionTable functions;
+
+        /* Streams take ownership of the input file */
+        file_in = NULL;
+
+        /* Disassemble the whole program */
+        if ((ret = avr_program_read(&program, &ds)) < 0) {
+            fprintf(stderr, "Error occured during disassembly! Error code: %d\n", ret);
+            print_stream_error_trace(&ps, &ds, &bs);
+            goto cleanup_exit_failure;
+        }
+
+        /* Identify function boundaries */
+        if (find_functions(&functions, &program, &symbols) < 0) {
+            fprintf(stderr, "Error allocating function table!\n");
+            avr_program_free(&program);
+            goto cleanup_exit_failure;
+        }
+
+        if (make_fingerprints_str[0] != '\0')
+            ret = make_fingerprints(make_fingerprints_str, &program, &functions);
+        else
+            ret = list_fingerprints(fingerprints_str, &program, &functions, flags, file_out);
+        avr_functions_free(&functions);
+        avr_program_free(&program);
+        if (ret < 0)
+            goto cleanup_exit_failure;
+
+        goto cleanup_exit_success;
+    }
+
+    /*** Disassemble ***/
+
+    /* Streams take ownership of the input file */
+    file_in = NULL;
+
+    if (database_str[0] != '\0') {
+        if (disassemble_database(&bs, flags, file_out, argv[optind], database_str, &symbols, range_start, range_end, xrefs ? &xrefs_address : NULL) < 0)
+            goto cleanup_exit_failure;
+        goto cleanup_exit_success;
+    }
+
+    if (range) {
+        if (disassemble_range(&bs, flags, file_out, argv[optind], range_start, range_end) < 0)
+            goto cleanup_exit_failure;
+        goto cleanup_exit_success;
+    }
+
+    if (incremental_str[0] != '\0' || save_decode_str[0] != '\0') {
+        if (disassemble_incremental(&bs, flags, file_out, argv[optind], incremental_str, save_decode_str) < 0)
+            goto cleanup_exit_failure;
+        goto cleanup_exit_success;
+    }
+
+    if (disassemble_cached(&bs, arch, flags, file_out, argv[optind], (cache_dir_str[0] != '\0') ? &cache : NULL) < 0)
+        goto cleanup_exit_failure;
+
+    cleanup_exit_success:
+    symbol_table_free(&symbols);
+    line_table_free(&lines);
+    cache_free(&cache);
     if (file_out != stdout && file_out != NULL)
         fclose(file_out);
+    if (profile)
+        profile_print(stderr, profile_json);
+    if (trace_str[0] != '\0' && write_trace(trace_str) < 0)
+        exit(EXIT_FAILURE);
     exit(EXIT_SUCCESS);
 
     cleanup_exit_failure:
+    symbol_table_free(&symbols);
+    line_table_free(&lines);
+    cache_free(&cache);
     if (file_in != stdin && file_in != NULL)
         fclose(file_in);
     if (file_out != stdout && file_out != NULL)
         fclose(file_out);
+    if (profile)
+        profile_print(stderr, profile_json);
+    if (trace_str[0] != '\0')
+        write_trace(trace_str);
     exit(EXIT_FAILURE);
 }
 
@@ -5,6 +5,7 @@
 
 #include <print_stream.h>
 #include <instruction.h>
+#include <profile.h>
 
 /******************************************************************************/
 /* Print Stream Support */
@@ -50,10 +51,16 @@ int print_stream_close(struct PrintStream *self) {
 int print_stream_read(struct PrintStream *self, FILE *out) {
     struct print_stream_state *state = (struct print_stream_state *)self->state;
     struct instruction instr;
-    int ret;
+    const struct line *line;
+    const char *name, *text;
+    size_t text_len;
+    uint64_t start;
+    int ret, len;
 
     /* Read a disassembled instruction */
+    start = PROFILE_NOW();
     ret = self->in->stream_read(self->in, &instr);
+    PROFILE_TIME(PROFILE_TIMER_DISASM, start);
     switch (ret) {
         case 0:
             break;
@@ -64,26 +71,68 @@ int print_stream_read(struct PrintStream *self, FILE *out) {
             return STREAM_ERROR_INPUT;
     }
 
+    start = PROFILE_NOW();
+
     /* If this is the very first instruction, or there is a discontinuity in
      * the instruction address */
     if (!(state->origin_initialized) || instr.address != state->next_address) {
         /* Print an origin directive if we're outputting assembly */
-        if (instr.print_origin(&instr, out, state->flags) < 0)
+        if ((len = instr.print_origin(&instr, out, state->flags)) < 0)
             goto fprintf_error;
         state->origin_initialized = 1;
+        PROFILE_COUNT(PROFILE_ORIGINS, 1);
+        PROFILE_COUNT(PROFILE_BYTES_WRITTEN, (uint64_t)len);
     }
 
     /* Update next expected address */
     state->next_address = instr.address + instr.width;
 
+    /* Print a label for a symbol at the instruction */
+    instr.symbols = self->symbols;
+    if (self->symbols != NULL && (name = symbol_table_lookup(self->symbols, instr.address)) != NULL) {
+        if ((len = fprintf(out, "%s:\n", name)) < 0)
+            goto fprintf_error;
+        PROFILE_COUNT(PROFILE_BYTES_WRITTEN, (uint64_t)len);
+    }
+
+    /* Print a source reference when the source line changes, with the source
+     * text if requested and available */
+    if (self->lines != NULL && (line = line_table_seek(self->lines, instr.address, &state->line_cursor)) == NULL) {
+        state->line_number = 0;
+    } else if (self->lines != NULL) {
+        if (line->file != state->line_file || line->line != state->line_number) {
+            text = NULL;
+            if (state->flags & PRINT_FLAG_SOURCE)
+                text = line_table_source(self->lines, line->file, line->line, &text_len);
+            if (text != NULL) {
+                /* Trim the indentation */
+                while (text_len > 0 && (*text == ' ' || *text == '\t')) {
+                    text++;
+                    text_len--;
+                }
+                len = fprintf(out, "; %s:%u: %.*s\n", self->lines->files[line->file].path, line->line, (int)text_len, text);
+            } else {
+                len = fprintf(out, "; %s:%u\n", self->lines->files[line->file].path, line->line);
+            }
+            if (len < 0)
+                goto fprintf_error;
+            state->line_file = line->file;
+            state->line_number = line->line;
+            PROFILE_COUNT(PROFILE_BYTES_WRITTEN, (uint64_t)len);
+        }
+    }
+
     /* Print the instruction */
-    if (instr.print(&instr, out, state->flags) < 0)
+    if ((len = instr.print(&instr, out, state->flags)) < 0)
         goto fprintf_error;
 
     /* Print a newline */
     if (fprintf(out, "\n") < 0)
         goto fprintf_error;
 
+    PROFILE_COUNT(PROFILE_BYTES_WRITTEN, (uint64_t)len + 1);
+    PROFILE_TIME(PROFILE_TIMER_FORMAT, start);
+
     return 0;
 
     fprintf_error:
@@ -6,10 +6,16 @@
 #include <disasm_stream.h>
 #include <stream_error.h>
 #include <instruction.h>
+#include <symbol_table.h>
+#include <line_table.h>
 
 struct PrintStream {
     /* Input stream */
     struct DisasmStream *in;
+    /* Program symbols to label the output with, or NULL */
+    const struct SymbolTable *symbols;
+    /* Source lines to annotate the output with, or NULL */
+    struct LineTable *lines;
     /* Stream state */
     void *state;
     /* Error */
@@ -31,6 +37,10 @@ struct print_stream_state {
     int origin_initialized;
     /* Next Expected address */
     uint32_t next_address;
+    /* Line table cursor, and last printed source file and line */
+    unsigned int line_cursor;
+    uint32_t line_file;
+    uint32_t line_number;
 };
 
 /* Print Stream Option Flags */
@@ -43,6 +53,7 @@ enum {
     PRINT_FLAG_DATA_DEC                = (1<<5),
     PRINT_FLAG_OPCODES                 = (1<<6),
     PRINT_FLAG_OBJDUMP_COMP            = (1<<7),
+    PRINT_FLAG_SOURCE                  = (1<<8),
 };
 
 /* Print Stream Support */
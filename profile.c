@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _MSC_VER
+#include <pthread.h>
+#else
+#include <windows.h>
+#endif
+
+#include <profile.h>
+
+/******************************************************************************/
+/* Profile Support */
+/******************************************************************************/
+
+#ifndef _MSC_VER
+#define PROFILE_THREAD_LOCAL    __thread
+#else
+#define PROFILE_THREAD_LOCAL    __declspec(thread)
+#endif
+
+/* Counters and timers of one thread, on a list of all threads */
+struct profile_thread {
+    uint64_t counters[PROFILE_NUM_COUNTERS];
+    uint64_t timers[PROFILE_NUM_TIMERS];
+    struct profile_thread *next;
+};
+
+int profile_enabled = 0;
+
+static struct profile_thread *profile_threads = NULL;
+static PROFILE_THREAD_LOCAL struct profile_thread *profile_local = NULL;
+static uint64_t profile_start;
+#ifndef _MSC_VER
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Counters and timers of the calling thread, added to the list on first use */
+static struct profile_thread *util_profile_thread(void) {
+    if (profile_local != NULL)
+        return profile_local;
+
+    /* Dropped if out of memory */
+    if ((profile_local = calloc(1, sizeof(struct profile_thread))) == NULL)
+        return NULL;
+
+#ifndef _MSC_VER
+    pthread_mutex_lock(&profile_lock);
+#endif
+    profile_local->next = profile_threads;
+    profile_threads = profile_local;
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&profile_lock);
+#endif
+
+    return profile_local;
+}
+
+uint64_t profile_now(void) {
+#ifndef _MSC_VER
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+#else
+    LARGE_INTEGER count, frequency;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+
+    return (uint64_t)((double)count.QuadPart*1e9/(double)frequency.QuadPart);
+#endif
+}
+
+void profile_init(void) {
+    profile_enabled = 1;
+    profile_start = profile_now();
+}
+
+void profile_count(int counter, uint64_t n) {
+    struct profile_thread *thread = util_profile_thread();
+
+    if (thread != NULL)
+        thread->counters[counter] += n;
+}
+
+void profile_time(int timer, uint64_t ns) {
+    struct profile_thread *thread = util_profile_thread();
+
+    if (thread != NULL)
+        thread->timers[timer] += ns;
+}
+
+int profile_print(FILE *out, int json) {
+    const struct profile_thread *thread;
+    uint64_t counters[PROFILE_NUM_COUNTERS] = {0};
+    uint64_t timers[PROFILE_NUM_TIMERS] = {0};
+    double total, parse, decode, format;
+    unsigned int i;
+
+    static const char *counterNames[PROFILE_NUM_COUNTERS] = {
+        "bytes_read", "records_parsed", "instructions_16", "instructions_32",
+        "db_fallbacks", "dw_fallbacks", "origins", "bytes_written",
+    };
+
+    total = (double)(profile_now() - profile_start)*1e-9;
+
+    /* Sum the threads */
+#ifndef _MSC_VER
+    pthread_mutex_lock(&profile_lock);
+#endif
+    for (thread = profile_threads; thread != NULL; thread = thread->next) {
+        for (i = 0; i < PROFILE_NUM_COUNTERS; i++)
+            counters[i] += thread->counters[i];
+        for (i = 0; i < PROFILE_NUM_TIMERS; i++)
+            timers[i] += thread->timers[i];
+    }
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&profile_lock);
+#endif
+
+    /* Stage times, excluding the parsing nested in disassembly from decode */
+    parse = (double)(timers[PROFILE_TIMER_READ] + timers[PROFILE_TIMER_PARSE])*1e-9;
+    decode = (timers[PROFILE_TIMER_DISASM] > timers[PROFILE_TIMER_PARSE]) ? (double)(timers[PROFILE_TIMER_DISASM] - timers[PROFILE_TIMER_PARSE])*1e-9 : 0.0;
+    format = (double)timers[PROFILE_TIMER_FORMAT]*1e-9;
+
+    if (json) {
+        fprintf(out, "{\n  \"counters\": {\n");
+        for (i = 0; i < PROFILE_NUM_COUNTERS; i++)
+            fprintf(out, "    \"%s\": %llu%s\n", counterNames[i], (unsigned long long)counters[i], (i+1 < PROFILE_NUM_COUNTERS) ? "," : "");
+        fprintf(out, "  },\n  \"seconds\": {\n");
+        fprintf(out, "    \"parse\": %.6f,\n    \"decode\": %.6f,\n    \"format\": %.6f,\n    \"total\": %.6f\n", parse, decode, format, total);
+        fprintf(out, "  }\n}\n");
+    } else {
+        fprintf(out, "Profile\n");
+        for (i = 0; i < PROFILE_NUM_COUNTERS; i++)
+            fprintf(out, "  %-20s %14llu\n", counterNames[i], (unsigned long long)counters[i]);
+        fprintf(out, "  %-20s %14.6f s\n", "parse", parse);
+        fprintf(out, "  %-20s %14.6f s\n", "decode", decode);
+        fprintf(out, "  %-20s %14.6f s\n", "format", format);
+        fprintf(out, "  %-20s %14.6f s\n", "total", total);
+    }
+
+    return ferror(out) ? -1 : 0;
+}
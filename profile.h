@@ -0,0 +1,55 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Profile counters */
+enum {
+    PROFILE_BYTES_READ,             /* Program bytes read from input files */
+    PROFILE_RECORDS,                /* Records parsed from record formats */
+    PROFILE_INSTRUCTIONS_16,        /* 16-bit instructions decoded */
+    PROFILE_INSTRUCTIONS_32,        /* 32-bit instructions decoded */
+    PROFILE_DATA_BYTES,             /* .db fallbacks */
+    PROFILE_DATA_WORDS,             /* .dw fallbacks */
+    PROFILE_ORIGINS,                /* Origins printed at address discontinuities */
+    PROFILE_BYTES_WRITTEN,          /* Bytes of output written */
+    PROFILE_NUM_COUNTERS,
+};
+
+/* Profile timers, in nanoseconds */
+enum {
+    PROFILE_TIMER_READ,             /* Reading whole programs into images */
+    PROFILE_TIMER_PARSE,            /* Byte Stream reads of Disasm Streams */
+    PROFILE_TIMER_DISASM,           /* Disasm Stream reads, including parsing */
+    PROFILE_TIMER_FORMAT,           /* Formatting and writing instructions */
+    PROFILE_NUM_TIMERS,
+};
+
+/* Profile Support. Counters and timers are kept per thread, and summed on
+ * print. They are compiled in, and cost one flag test while profiling is
+ * disabled. Defining PROFILE_DISABLE compiles them out, as for the library. */
+#ifndef PROFILE_DISABLE
+
+extern int profile_enabled;
+
+void profile_init(void);
+void profile_count(int counter, uint64_t n);
+void profile_time(int timer, uint64_t ns);
+uint64_t profile_now(void);
+int profile_print(FILE *out, int json);
+
+#define PROFILE_COUNT(counter, n)   do { if (profile_enabled) profile_count((counter), (n)); } while (0)
+#define PROFILE_NOW()               (profile_enabled ? profile_now() : 0)
+#define PROFILE_TIME(timer, start)  do { if (profile_enabled) profile_time((timer), profile_now() - (start)); } while (0)
+
+#else
+
+#define PROFILE_COUNT(counter, n)   do { } while (0)
+#define PROFILE_NOW()               0
+#define PROFILE_TIME(timer, start)  do { (void)(start); } while (0)
+
+#endif
+
+#endif
+
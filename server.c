@@ -0,0 +1,927 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#ifndef _MSC_VER
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#include <byte_stream.h>
+#include <disasm_stream.h>
+#include <print_stream.h>
+#include <thread_pool.h>
+#include <server.h>
+#include <trace.h>
+
+#include "file/file_support.h"
+#include "avr/avr_support.h"
+#include "avr/avr_analysis.h"
+
+#ifndef _MSC_VER
+
+/******************************************************************************/
+/* Disassembly Server State */
+/******************************************************************************/
+
+/* Interval for checking the stop flag while waiting, in milliseconds */
+#define SERVER_POLL_MS          250
+/* Accepted connections waiting for a worker */
+#define SERVER_QUEUE_LEN        64
+/* Longest program name */
+#define SERVER_NAME_LEN         64
+/* Longest request line */
+#define SERVER_LINE_LEN         512
+
+/* Request commands */
+enum {
+    SERVER_CMD_LOAD,
+    SERVER_CMD_UNLOAD,
+    SERVER_CMD_DISASM,
+    SERVER_CMD_XREF,
+    SERVER_CMD_STATS,
+    SERVER_TOTAL_CMDS,
+};
+
+static const char *Server_Command_Names[SERVER_TOTAL_CMDS] = {
+    "load", "unload", "disasm", "xref", "stats",
+};
+
+/* Reference from an instruction to its branch, jump or call target */
+struct server_xref {
+    uint32_t target;
+    /* Index of the referencing instruction in the program */
+    unsigned int index;
+};
+
+/* Loaded program, shared between workers */
+struct server_program {
+    char name[SERVER_NAME_LEN];
+    struct ByteImage image;
+    /* Instructions, sorted by address */
+    struct avrProgram program;
+    /* References, sorted by target */
+    struct server_xref *xrefs;
+    unsigned int numXrefs;
+    /* Reference count, including the program table's */
+    unsigned int refs;
+    struct server_program *next;
+};
+
+/* Request latency of a command */
+struct server_latency {
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+};
+
+struct server_state {
+    /* Print Option Bit Flags */
+    int flags;
+    int listen_fd;
+
+    /* Loaded programs */
+    pthread_mutex_t programs_lock;
+    struct server_program *programs;
+
+    /* Accepted connections waiting for a worker */
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_cond;
+    int queue[SERVER_QUEUE_LEN];
+    unsigned int queue_head;
+    unsigned int queue_len;
+
+    /* Request latency, indexed by command */
+    pthread_mutex_t latency_lock;
+    struct server_latency latency[SERVER_TOTAL_CMDS];
+};
+
+/* Set by SIGINT or SIGTERM */
+static volatile sig_atomic_t server_stop = 0;
+
+static void util_signal_stop(int sig) {
+    (void)sig;
+    server_stop = 1;
+}
+
+static uint64_t util_time_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + (uint64_t)ts.tv_nsec/1000;
+}
+
+/******************************************************************************/
+/* Response Buffer */
+/******************************************************************************/
+
+struct server_buffer {
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+static int util_buffer_reserve(struct server_buffer *buf, size_t len) {
+    size_t capacity;
+    char *newData;
+
+    if (buf->capacity - buf->len >= len)
+        return 0;
+
+    capacity = (buf->capacity == 0) ? 4096 : buf->capacity;
+    while (capacity - buf->len < len)
+        capacity *= 2;
+    if ((newData = realloc(buf->data, capacity)) == NULL)
+        return -1;
+    buf->data = newData;
+    buf->capacity = capacity;
+
+    return 0;
+}
+
+static int util_buffer_printf(struct server_buffer *buf, const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    /* Format once to measure, and again if the buffer had to grow */
+    if (util_buffer_reserve(buf, 128) < 0)
+        return -1;
+    va_start(ap, fmt);
+    n = vsnprintf(buf->data + buf->len, buf->capacity - buf->len, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return -1;
+
+    if ((size_t)n >= buf->capacity - buf->len) {
+        if (util_buffer_reserve(buf, (size_t)n + 1) < 0)
+            return -1;
+        va_start(ap, fmt);
+        n = vsnprintf(buf->data + buf->len, buf->capacity - buf->len, fmt, ap);
+        va_end(ap);
+        if (n < 0)
+            return -1;
+    }
+
+    buf->len += n;
+    return 0;
+}
+
+/* Append a formatted instruction line, preceded by an origin directive if
+ * origin is set */
+static int util_buffer_instruction(struct server_buffer *buf, const struct avrInstructionDisasm *instrDisasm, int origin, int flags) {
+    int n;
+
+    if (origin) {
+        if (util_buffer_reserve(buf, 64) < 0)
+            return -1;
+        if ((n = avr_instruction_format_origin(instrDisasm->address, buf->data + buf->len, buf->capacity - buf->len, flags)) < 0)
+            return -1;
+        if ((size_t)n >= buf->capacity - buf->len)
+            return -1;
+        buf->len += n;
+    }
+
+    if (util_buffer_reserve(buf, 128) < 0)
+        return -1;
+    if ((n = avr_instruction_format(instrDisasm, buf->data + buf->len, buf->capacity - buf->len, flags)) < 0)
+        return -1;
+    if ((size_t)n >= buf->capacity - buf->len) {
+        if (util_buffer_reserve(buf, (size_t)n + 1) < 0)
+            return -1;
+        if ((n = avr_instruction_format(instrDisasm, buf->data + buf->len, buf->capacity - buf->len, flags)) < 0)
+            return -1;
+    }
+    buf->len += n;
+
+    return util_buffer_printf(buf, "\n");
+}
+
+/******************************************************************************/
+/* Framed Socket I/O */
+/******************************************************************************/
+
+/* Wait for a socket to become readable or writable, returns -1 on error or
+ * server stop */
+static int util_socket_wait(int fd, short events) {
+    struct pollfd pfd;
+    int ret;
+
+    while (!server_stop) {
+        pfd.fd = fd;
+        pfd.events = events;
+        pfd.revents = 0;
+        ret = poll(&pfd, 1, SERVER_POLL_MS);
+        if (ret > 0)
+            return 0;
+        if (ret < 0 && errno != EINTR)
+            return -1;
+    }
+
+    return -1;
+}
+
+/* Read exactly len bytes, returns 1 on end of stream before any byte */
+static int util_socket_read(int fd, void *data, size_t len) {
+    size_t offset;
+    ssize_t n;
+
+    for (offset = 0; offset < len; offset += n) {
+        if (util_socket_wait(fd, POLLIN) < 0)
+            return -1;
+        n = read(fd, (uint8_t *)data + offset, len - offset);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            n = 0;
+            continue;
+        }
+        if (n == 0)
+            return (offset == 0) ? 1 : -1;
+        if (n < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int util_socket_write(int fd, const void *data, size_t len) {
+    size_t offset;
+    ssize_t n;
+
+    for (offset = 0; offset < len; offset += n) {
+        if (util_socket_wait(fd, POLLOUT) < 0)
+            return -1;
+        n = write(fd, (const uint8_t *)data + offset, len - offset);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            n = 0;
+            continue;
+        }
+        if (n < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Read a frame of a 32-bit big-endian length and a payload, returns 1 on end
+ * of stream */
+static int util_frame_read(int fd, struct server_buffer *frame) {
+    uint8_t header[4];
+    uint32_t len;
+    int ret;
+
+    if ((ret = util_socket_read(fd, header, sizeof(header))) != 0)
+        return ret;
+
+    len = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) | ((uint32_t)header[2] << 8) | (uint32_t)header[3];
+    if (len > SERVER_MAX_FRAME_LEN)
+        return -1;
+
+    frame->len = 0;
+    if (util_buffer_reserve(frame, (size_t)len + 1) < 0)
+        return -1;
+    if (len > 0 && util_socket_read(fd, frame->data, len) != 0)
+        return -1;
+    frame->len = len;
+    /* Terminate for parsing the request line */
+    frame->data[len] = '\0';
+
+    return 0;
+}
+
+/* Write a frame of a status line followed by a body */
+static int util_frame_write(int fd, const char *status, const struct server_buffer *body) {
+    uint8_t header[4];
+    size_t len;
+
+    len = strlen(status) + ((body != NULL) ? body->len : 0);
+    if (len > SERVER_MAX_FRAME_LEN)
+        return -1;
+
+    header[0] = (uint8_t)(len >> 24); header[1] = (uint8_t)(len >> 16);
+    header[2] = (uint8_t)(len >> 8); header[3] = (uint8_t)len;
+
+    if (util_socket_write(fd, header, sizeof(header)) < 0)
+        return -1;
+    if (util_socket_write(fd, status, strlen(status)) < 0)
+        return -1;
+    if (body != NULL && body->len > 0 && util_socket_write(fd, body->data, body->len) < 0)
+        return -1;
+
+    return 0;
+}
+
+/******************************************************************************/
+/* Loaded Programs */
+/******************************************************************************/
+
+static void util_program_free(struct server_program *p) {
+    byte_image_free(&p->image);
+    avr_program_free(&p->program);
+    free(p->xrefs);
+    free(p);
+}
+
+static int util_xref_compare(const void *a, const void *b) {
+    const struct server_xref *xa = (const struct server_xref *)a;
+    const struct server_xref *xb = (const struct server_xref *)b;
+
+    if (xa->target != xb->target)
+        return (xa->target < xb->target) ? -1 : 1;
+    if (xa->index != xb->index)
+        return (xa->index < xb->index) ? -1 : 1;
+    return 0;
+}
+
+/* Parse and decode a program image of a file type from a memory buffer */
+static struct server_program *util_program_load(const char *name, const char *file_type_str, const uint8_t *data, size_t len, const char **error) {
+    struct server_program *p;
+    struct ByteStream bs;
+    uint32_t target;
+    unsigned int i;
+
+    memset(&bs, 0, sizeof(struct ByteStream));
+    bs.in_buf = data;
+    bs.in_len = len;
+    if (strcmp(file_type_str, "generic") == 0) {
+        bs.stream_init = byte_stream_generic_memory_init;
+        bs.stream_close = byte_stream_generic_close;
+        bs.stream_read = byte_stream_generic_read;
+    } else if (strcmp(file_type_str, "ihex") == 0) {
+        bs.stream_init = byte_stream_ihex_memory_init;
+        bs.stream_close = byte_stream_ihex_close;
+        bs.stream_read = byte_stream_ihex_read;
+    } else if (strcmp(file_type_str, "srec") == 0) {
+        bs.stream_init = byte_stream_srecord_memory_init;
+        bs.stream_close = byte_stream_srecord_close;
+        bs.stream_read = byte_stream_srecord_read;
+    } else if (strcmp(file_type_str, "ascii") == 0) {
+        bs.stream_init = byte_stream_asciihex_memory_init;
+        bs.stream_close = byte_stream_asciihex_close;
+        bs.stream_read = byte_stream_asciihex_read;
+    } else if (strcmp(file_type_str, "binary") == 0) {
+        bs.stream_init = byte_stream_binary_memory_init;
+        bs.stream_close = byte_stream_binary_memory_close;
+        bs.stream_read = byte_stream_binary_memory_read;
+        bs.stream_span = byte_stream_binary_memory_span;
+    } else {
+        *error = "unknown file type";
+        return NULL;
+    }
+
+    if ((p = calloc(1, sizeof(struct server_program))) == NULL) {
+        *error = "out of memory";
+        return NULL;
+    }
+    snprintf(p->name, sizeof(p->name), "%s", name);
+    p->refs = 1;
+
+    /* Parse the image */
+    if (byte_image_read(&p->image, &bs) < 0) {
+        *error = (bs.error != NULL) ? bs.error : "error reading program";
+        free(p);
+        return NULL;
+    }
+
+    /* Decode the program and sort it for range queries */
+    if (avr_program_decode(&p->program, &p->image) < 0) {
+        *error = "error decoding program";
+        byte_image_free(&p->image);
+        free(p);
+        return NULL;
+    }
+    avr_program_sort(&p->program);
+
+    /* Index the references to branch, jump and call targets */
+    p->xrefs = malloc(((p->program.len > 0) ? p->program.len : 1)*sizeof(struct server_xref));
+    if (p->xrefs == NULL) {
+        *error = "out of memory";
+        util_program_free(p);
+        return NULL;
+    }
+    for (i = 0; i < p->program.len; i++) {
+        if (avr_instruction_target(&p->program.instructions[i], &target)) {
+            p->xrefs[p->numXrefs].target = target;
+            p->xrefs[p->numXrefs++].index = i;
+        }
+    }
+    qsort(p->xrefs, p->numXrefs, sizeof(struct server_xref), util_xref_compare);
+
+    return p;
+}
+
+/* Unlink a program from the table, with the programs lock held, returns 1 if
+ * the last reference was released */
+static int util_program_unlink(struct server_state *state, const char *name) {
+    struct server_program **pp, *p;
+
+    for (pp = &state->programs; *pp != NULL; pp = &(*pp)->next) {
+        if (strcmp((*pp)->name, name) == 0) {
+            p = *pp;
+            *pp = p->next;
+            if (--p->refs == 0) {
+                util_program_free(p);
+                return 1;
+            }
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static struct server_program *util_program_acquire(struct server_state *state, const char *name) {
+    struct server_program *p;
+
+    pthread_mutex_lock(&state->programs_lock);
+    for (p = state->programs; p != NULL; p = p->next) {
+        if (strcmp(p->name, name) == 0) {
+            p->refs++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&state->programs_lock);
+
+    return p;
+}
+
+static void util_program_release(struct server_state *state, struct server_program *p) {
+    int last;
+
+    pthread_mutex_lock(&state->programs_lock);
+    last = (--p->refs == 0);
+    pthread_mutex_unlock(&state->programs_lock);
+
+    if (last)
+        util_program_free(p);
+}
+
+/******************************************************************************/
+/* Request Handling */
+/******************************************************************************/
+
+/* Index of the first instruction at or after address, including an
+ * instruction straddling address */
+static unsigned int util_program_lower_bound(const struct avrProgram *program, uint32_t address) {
+    unsigned int lo, hi, mid;
+
+    lo = 0;
+    hi = program->len;
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if (program->instructions[mid].address < address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo > 0 && program->instructions[lo-1].address + program->instructions[lo-1].instructionInfo->width > address)
+        lo--;
+
+    return lo;
+}
+
+static int util_request_load(struct server_state *state, const char *name, const char *file_type_str, const uint8_t *data, size_t len, struct server_buffer *body, const char **error) {
+    struct server_program *p;
+
+    if (name[0] == '\0' || file_type_str[0] == '\0') {
+        *error = "usage: load <name> <file type>";
+        return -1;
+    }
+
+    /* Parse and decode outside of the programs lock */
+    if ((p = util_program_load(name, file_type_str, data, len, error)) == NULL)
+        return -1;
+
+    if (util_buffer_printf(body, "%s bytes %u segments %u instructions %u\n", p->name, p->image.len, p->image.numSegments, p->program.len) < 0) {
+        util_program_free(p);
+        *error = "out of memory";
+        return -1;
+    }
+
+    /* Replace any program of the same name */
+    pthread_mutex_lock(&state->programs_lock);
+    util_program_unlink(state, p->name);
+    p->next = state->programs;
+    state->programs = p;
+    pthread_mutex_unlock(&state->programs_lock);
+
+    return 0;
+}
+
+static int util_request_unload(struct server_state *state, const char *name, const char **error) {
+    int ret;
+
+    pthread_mutex_lock(&state->programs_lock);
+    ret = util_program_unlink(state, name);
+    pthread_mutex_unlock(&state->programs_lock);
+
+    if (ret < 0) {
+        *error = "no such program";
+        return -1;
+    }
+
+    return 0;
+}
+
+static int util_request_disasm(struct server_state *state, const char *name, uint32_t start, uint32_t end, struct server_buffer *body, const char **error) {
+    struct server_program *p;
+    const struct avrInstructionDisasm *instrDisasm;
+    uint32_t next_address = 0;
+    unsigned int i;
+    int ret = 0;
+
+    if ((p = util_program_acquire(state, name)) == NULL) {
+        *error = "no such program";
+        return -1;
+    }
+
+    /* Format the instructions overlapping [start, end) */
+    for (i = util_program_lower_bound(&p->program, start); i < p->program.len; i++) {
+        instrDisasm = &p->program.instructions[i];
+        if (instrDisasm->address >= end)
+            break;
+        if (util_buffer_instruction(body, instrDisasm, body->len == 0 || instrDisasm->address != next_address, state->flags) < 0) {
+            *error = "out of memory";
+            ret = -1;
+            break;
+        }
+        next_address = instrDisasm->address + instrDisasm->instructionInfo->width;
+    }
+
+    util_program_release(state, p);
+
+    return ret;
+}
+
+static int util_request_xref(struct server_state *state, const char *name, uint32_t target, struct server_buffer *body, const char **error) {
+    struct server_program *p;
+    unsigned int lo, hi, mid;
+    int ret = 0;
+
+    if ((p = util_program_acquire(state, name)) == NULL) {
+        *error = "no such program";
+        return -1;
+    }
+
+    /* Binary search for the first reference to target */
+    lo = 0;
+    hi = p->numXrefs;
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if (p->xrefs[mid].target < target)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /* Format each referencing instruction */
+    for (; lo < p->numXrefs && p->xrefs[lo].target == target; lo++) {
+        if (util_buffer_instruction(body, &p->program.instructions[p->xrefs[lo].index], 0, state->flags) < 0) {
+            *error = "out of memory";
+            ret = -1;
+            break;
+        }
+    }
+
+    util_program_release(state, p);
+
+    return ret;
+}
+
+static int util_request_stats(struct server_state *state, struct server_buffer *body, const char **error) {
+    struct server_latency latency[SERVER_TOTAL_CMDS];
+    struct server_program *p;
+    unsigned int numPrograms;
+    int i;
+
+    pthread_mutex_lock(&state->latency_lock);
+    memcpy(latency, state->latency, sizeof(latency));
+    pthread_mutex_unlock(&state->latency_lock);
+
+    pthread_mutex_lock(&state->programs_lock);
+    for (p = state->programs, numPrograms = 0; p != NULL; p = p->next)
+        numPrograms++;
+    pthread_mutex_unlock(&state->programs_lock);
+
+    if (util_buffer_printf(body, "programs %u\n", numPrograms) < 0)
+        goto printf_error;
+    for (i = 0; i < SERVER_TOTAL_CMDS; i++) {
+        if (util_buffer_printf(body, "%s count %llu mean_us %llu max_us %llu\n", Server_Command_Names[i],
+                (unsigned long long)latency[i].count,
+                (unsigned long long)((latency[i].count > 0) ? latency[i].total_us/latency[i].count : 0),
+                (unsigned long long)latency[i].max_us) < 0)
+            goto printf_error;
+    }
+
+    return 0;
+
+    printf_error:
+    *error = "out of memory";
+    return -1;
+}
+
+/* Handle a request frame of a command line followed by an optional body,
+ * returns the command index, or -1 for an unknown command */
+static int util_request_handle(struct server_state *state, const struct server_buffer *frame, struct server_buffer *body, const char **error) {
+    char line[SERVER_LINE_LEN];
+    /* Tokens of the line, which fit in buffers as long as the line */
+    char cmd[SERVER_LINE_LEN] = {0}, arg1[SERVER_LINE_LEN] = {0}, arg2[SERVER_LINE_LEN] = {0}, arg3[SERVER_LINE_LEN] = {0};
+    const char *newline;
+    const uint8_t *data;
+    size_t lineLen, len;
+    int i;
+
+    /* Split off the request line */
+    newline = memchr(frame->data, '\n', frame->len);
+    lineLen = (newline != NULL) ? (size_t)(newline - frame->data) : frame->len;
+    if (lineLen >= sizeof(line)) {
+        *error = "request line too long";
+        return -1;
+    }
+    memcpy(line, frame->data, lineLen);
+    line[lineLen] = '\0';
+    data = (newline != NULL) ? (const uint8_t *)newline + 1 : (const uint8_t *)frame->data + frame->len;
+    len = frame->len - (size_t)(data - (const uint8_t *)frame->data);
+
+    sscanf(line, "%s %s %s %s", cmd, arg1, arg2, arg3);
+
+    for (i = 0; i < SERVER_TOTAL_CMDS; i++) {
+        if (strcmp(cmd, Server_Command_Names[i]) == 0)
+            break;
+    }
+
+    /* Reject program names that don't fit rather than truncating them into
+     * another program's name */
+    if (strlen(arg1) >= SERVER_NAME_LEN) {
+        *error = "program name too long";
+        return -1;
+    }
+
+    TRACE_BEGIN("request", line);
+    switch (i) {
+        case SERVER_CMD_LOAD:
+            util_request_load(state, arg1, arg2, data, len, body, error);
+            break;
+        case SERVER_CMD_UNLOAD:
+            util_request_unload(state, arg1, error);
+            break;
+        case SERVER_CMD_DISASM:
+            util_request_disasm(state, arg1, (uint32_t)strtoul(arg2, NULL, 0), (arg3[0] != '\0') ? (uint32_t)strtoul(arg3, NULL, 0) : UINT32_MAX, body, error);
+            break;
+        case SERVER_CMD_XREF:
+            util_request_xref(state, arg1, (uint32_t)strtoul(arg2, NULL, 0), body, error);
+            break;
+        case SERVER_CMD_STATS:
+            util_request_stats(state, body, error);
+            break;
+        default:
+            *error = "unknown command";
+            i = -1;
+            break;
+    }
+    TRACE_END("request");
+
+    return i;
+}
+
+/******************************************************************************/
+/* Server Workers */
+/******************************************************************************/
+
+/* Serve the requests of a client until it disconnects */
+static void util_serve_client(struct server_state *state, int fd) {
+    struct server_buffer frame, body;
+    const char *error;
+    char status[128];
+    uint64_t start, elapsed;
+    int cmd;
+
+    memset(&frame, 0, sizeof(frame));
+    memset(&body, 0, sizeof(body));
+
+    while (util_frame_read(fd, &frame) == 0) {
+        start = util_time_us();
+
+        body.len = 0;
+        error = NULL;
+        cmd = util_request_handle(state, &frame, &body, &error);
+
+        elapsed = util_time_us() - start;
+
+        /* Record the latency of the command */
+        if (cmd >= 0) {
+            pthread_mutex_lock(&state->latency_lock);
+            state->latency[cmd].count++;
+            state->latency[cmd].total_us += elapsed;
+            if (elapsed > state->latency[cmd].max_us)
+                state->latency[cmd].max_us = elapsed;
+            pthread_mutex_unlock(&state->latency_lock);
+        }
+
+        /* Respond with "ok <latency us>" and the body, or "error <message>" */
+        if (error != NULL)
+            snprintf(status, sizeof(status), "error %s\n", error);
+        else
+            snprintf(status, sizeof(status), "ok %llu\n", (unsigned long long)elapsed);
+
+        if (util_frame_write(fd, status, (error != NULL) ? NULL : &body) < 0)
+            break;
+    }
+
+    free(frame.data);
+    free(body.data);
+    close(fd);
+}
+
+/* Accept connections into the queue until the server is stopped */
+static void util_serve_accept(struct server_state *state) {
+    int fd;
+
+    while (util_socket_wait(state->listen_fd, POLLIN) == 0) {
+        if ((fd = accept(state->listen_fd, NULL, NULL)) < 0)
+            continue;
+
+        pthread_mutex_lock(&state->queue_lock);
+        if (state->queue_len == SERVER_QUEUE_LEN) {
+            /* Refuse connections beyond the queue */
+            pthread_mutex_unlock(&state->queue_lock);
+            close(fd);
+            continue;
+        }
+        state->queue[(state->queue_head + state->queue_len) % SERVER_QUEUE_LEN] = fd;
+        state->queue_len++;
+        pthread_cond_signal(&state->queue_cond);
+        pthread_mutex_unlock(&state->queue_lock);
+    }
+
+    /* Wake up the workers to exit */
+    pthread_mutex_lock(&state->queue_lock);
+    pthread_cond_broadcast(&state->queue_cond);
+    pthread_mutex_unlock(&state->queue_lock);
+}
+
+/* Serve queued connections until the server is stopped */
+static void util_serve_worker(struct server_state *state) {
+    int fd;
+
+    while (1) {
+        pthread_mutex_lock(&state->queue_lock);
+        while (state->queue_len == 0 && !server_stop)
+            pthread_cond_wait(&state->queue_cond, &state->queue_lock);
+        if (state->queue_len == 0) {
+            pthread_mutex_unlock(&state->queue_lock);
+            break;
+        }
+        fd = state->queue[state->queue_head];
+        state->queue_head = (state->queue_head + 1) % SERVER_QUEUE_LEN;
+        state->queue_len--;
+        pthread_mutex_unlock(&state->queue_lock);
+
+        util_serve_client(state, fd);
+    }
+}
+
+/* Thread pool job: job 0 accepts connections, the others serve them */
+static void server_job(void *arg, unsigned int worker, unsigned int job) {
+    struct server_state *state = (struct server_state *)arg;
+
+    (void)worker;
+
+    if (job == 0)
+        util_serve_accept(state);
+    else
+        util_serve_worker(state);
+}
+
+int server_run(const char *socket_path, unsigned int num_workers, int flags) {
+    struct server_state state;
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    struct stat st;
+    struct server_program *p;
+    mode_t mask;
+    int i, ret = -1;
+
+    if (num_workers == 0)
+        num_workers = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path %s is too long.\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    memset(&state, 0, sizeof(state));
+    state.flags = flags;
+
+    if ((state.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("Error: Cannot create socket");
+        return -1;
+    }
+
+    /* Remove a stale socket of a previous server, but not the socket of a
+     * server still accepting connections on it */
+    if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (connect(state.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            fprintf(stderr, "Error: Another server is listening on %s.\n", socket_path);
+            close(state.listen_fd);
+            return -1;
+        }
+        if (errno == ECONNREFUSED)
+            unlink(socket_path);
+        close(state.listen_fd);
+        if ((state.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+            perror("Error: Cannot create socket");
+            return -1;
+        }
+    }
+
+    /* Only the user may connect to the socket */
+    mask = umask(077);
+    if (bind(state.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(state.listen_fd, SERVER_QUEUE_LEN) < 0) {
+        umask(mask);
+        fprintf(stderr, "Error: Cannot listen on %s: ", socket_path);
+        perror(NULL);
+        close(state.listen_fd);
+        return -1;
+    }
+    umask(mask);
+
+    /* Stop on SIGINT or SIGTERM, and report closed clients as write errors */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = util_signal_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_mutex_init(&state.programs_lock, NULL);
+    pthread_mutex_init(&state.queue_lock, NULL);
+    pthread_cond_init(&state.queue_cond, NULL);
+    pthread_mutex_init(&state.latency_lock, NULL);
+
+    /* Build the opcode lookup table before serving */
+    avr_iset_lookup_init();
+
+    fprintf(stderr, "Serving on %s with %u workers.\n", socket_path, num_workers);
+
+    /* One job accepts connections, the others serve them */
+    if (thread_pool_run(num_workers + 1, num_workers + 1, server_job, &state) < 0)
+        fprintf(stderr, "Error: Cannot start server threads!\n");
+    else
+        ret = 0;
+
+    close(state.listen_fd);
+    unlink(socket_path);
+
+    /* Close connections still waiting for a worker */
+    while (state.queue_len > 0) {
+        close(state.queue[state.queue_head]);
+        state.queue_head = (state.queue_head + 1) % SERVER_QUEUE_LEN;
+        state.queue_len--;
+    }
+
+    /* Free loaded programs */
+    while ((p = state.programs) != NULL) {
+        state.programs = p->next;
+        util_program_free(p);
+    }
+
+    /* Report request latency */
+    for (i = 0; i < SERVER_TOTAL_CMDS; i++) {
+        if (state.latency[i].count == 0)
+            continue;
+        fprintf(stderr, "%-8s %10llu requests, mean %llu us, max %llu us\n", Server_Command_Names[i],
+                (unsigned long long)state.latency[i].count,
+                (unsigned long long)(state.latency[i].total_us/state.latency[i].count),
+                (unsigned long long)state.latency[i].max_us);
+    }
+
+    pthread_mutex_destroy(&state.programs_lock);
+    pthread_mutex_destroy(&state.queue_lock);
+    pthread_cond_destroy(&state.queue_cond);
+    pthread_mutex_destroy(&state.latency_lock);
+
+    return ret;
+}
+
+#else
+
+int server_run(const char *socket_path, unsigned int num_workers, int flags) {
+    /* No UNIX domain socket support */
+    fprintf(stderr, "Error: --serve is not supported on this platform.\n");
+    return -1;
+}
+
+#endif
+
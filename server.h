@@ -0,0 +1,16 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/* Disassembly Server. Keeps loaded programs resident and serves framed
+ * requests on a local UNIX domain socket, with num_workers threads serving
+ * clients, until SIGINT or SIGTERM. Instructions are formatted with the
+ * PRINT_FLAG_* bit flags. */
+
+/* Largest request or response frame, in bytes */
+#define SERVER_MAX_FRAME_LEN    (64*1024*1024)
+
+/* Server Support */
+int server_run(const char *socket_path, unsigned int num_workers, int flags);
+
+#endif
+
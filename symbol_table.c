@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <symbol_table.h>
+
+/******************************************************************************/
+/* Symbol Table Support */
+/******************************************************************************/
+
+void symbol_table_init(struct SymbolTable *table) {
+    memset(table, 0, sizeof(struct SymbolTable));
+    table->sorted = 1;
+}
+
+void symbol_table_free(struct SymbolTable *table) {
+    unsigned int i;
+
+    for (i = 0; i < table->len; i++)
+        free(table->symbols[i].name);
+    free(table->symbols);
+
+    symbol_table_init(table);
+}
+
+int symbol_table_add(struct SymbolTable *table, uint32_t address, const char *name) {
+    /* Grow the symbol array if needed */
+    if (table->len == table->capacity) {
+        unsigned int capacity = (table->capacity == 0) ? 64 : table->capacity*2;
+        struct symbol *symbols = realloc(table->symbols, capacity*sizeof(struct symbol));
+        if (symbols == NULL)
+            return -1;
+        table->symbols = symbols;
+        table->capacity = capacity;
+    }
+
+    table->symbols[table->len].address = address;
+    table->symbols[table->len].name = strdup(name);
+    if (table->symbols[table->len].name == NULL)
+        return -1;
+
+    /* Keep track of whether we're still sorted */
+    if (table->len > 0 && table->symbols[table->len-1].address > address)
+        table->sorted = 0;
+    table->len++;
+
+    return 0;
+}
+
+static int util_symbol_compare(const void *a, const void *b) {
+    const struct symbol *sa = (const struct symbol *)a;
+    const struct symbol *sb = (const struct symbol *)b;
+
+    if (sa->address < sb->address)
+        return -1;
+    else if (sa->address > sb->address)
+        return 1;
+    /* Order symbols at the same address by name, for deterministic output */
+    return strcmp(sa->name, sb->name);
+}
+
+void symbol_table_sort(struct SymbolTable *table) {
+    if (table->sorted)
+        return;
+
+    qsort(table->symbols, table->len, sizeof(struct symbol), util_symbol_compare);
+    table->sorted = 1;
+}
+
+const char *symbol_table_lookup(const struct SymbolTable *table, uint32_t address) {
+    unsigned int lo, hi, mid;
+
+    /* Binary search for the first symbol at address */
+    lo = 0;
+    hi = table->len;
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if (table->symbols[mid].address < address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < table->len && table->symbols[lo].address == address)
+        return table->symbols[lo].name;
+
+    return NULL;
+}
+
+int symbol_table_load_nm(struct SymbolTable *table, FILE *in) {
+    char line[512];
+    char field[256], name[256];
+    unsigned int address;
+    int n;
+
+    /* Parse lines of the form "<hex address> <type> <name>", as produced by
+     * nm, or "<hex address> <name>" */
+    while (fgets(line, sizeof(line), in) != NULL) {
+        n = sscanf(line, "%x %255s %255s", &address, field, name);
+        if (n == 3 && strlen(field) == 1) {
+            /* Only import program memory symbols */
+            if (strchr("TtWw", field[0]) == NULL)
+                continue;
+        } else if (n == 2) {
+            strcpy(name, field);
+        } else {
+            /* Skip blank lines and undefined symbols */
+            continue;
+        }
+
+        if (symbol_table_add(table, address, name) < 0)
+            return -1;
+    }
+
+    if (ferror(in))
+        return -1;
+
+    symbol_table_sort(table);
+
+    return 0;
+}
+
@@ -0,0 +1,36 @@
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Symbol */
+struct symbol {
+    /* Symbol address */
+    uint32_t address;
+    /* Symbol name */
+    char *name;
+};
+
+/* Address sorted symbol table */
+struct SymbolTable {
+    /* Symbols */
+    struct symbol *symbols;
+    /* Number of symbols */
+    unsigned int len;
+    /* Allocated number of symbols */
+    unsigned int capacity;
+    /* Sorted flag */
+    int sorted;
+};
+
+/* Symbol Table Support */
+void symbol_table_init(struct SymbolTable *table);
+void symbol_table_free(struct SymbolTable *table);
+int symbol_table_add(struct SymbolTable *table, uint32_t address, const char *name);
+void symbol_table_sort(struct SymbolTable *table);
+const char *symbol_table_lookup(const struct SymbolTable *table, uint32_t address);
+int symbol_table_load_nm(struct SymbolTable *table, FILE *in);
+
+#endif
+
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _MSC_VER
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include <thread_pool.h>
+
+/******************************************************************************/
+/* Thread Pool Support */
+/******************************************************************************/
+
+/* Per-worker state. Each worker owns a range of jobs [head, tail), which it
+ * runs from the head. An idle worker steals the upper half of the remaining
+ * range of the busiest worker. */
+struct thread_pool_worker {
+    struct thread_pool_state *pool;
+    unsigned int index;
+    unsigned int head;
+    unsigned int tail;
+#ifndef _MSC_VER
+    pthread_mutex_t lock;
+#endif
+};
+
+/* Shared pool state */
+struct thread_pool_state {
+    thread_pool_job_t job;
+    void *arg;
+    struct thread_pool_worker *workers;
+    unsigned int num_workers;
+};
+
+unsigned int thread_pool_default_workers(void) {
+#if !defined(_MSC_VER) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0)
+        return (unsigned int)n;
+#endif
+    return 1;
+}
+
+#ifndef _MSC_VER
+#define util_worker_lock(w)     pthread_mutex_lock(&(w)->lock)
+#define util_worker_unlock(w)   pthread_mutex_unlock(&(w)->lock)
+#else
+#define util_worker_lock(w)
+#define util_worker_unlock(w)
+#endif
+
+/* Claim the next job of a worker's own range, returns 0 if it is empty */
+static int util_worker_claim(struct thread_pool_worker *worker, unsigned int *job) {
+    int claimed = 0;
+
+    util_worker_lock(worker);
+    if (worker->head < worker->tail) {
+        *job = worker->head++;
+        claimed = 1;
+    }
+    util_worker_unlock(worker);
+
+    return claimed;
+}
+
+/* Steal half of the busiest worker's remaining jobs into a worker's own
+ * range, returns 0 if there was nothing left to steal */
+static int util_worker_steal(struct thread_pool_worker *worker) {
+    struct thread_pool_state *pool = worker->pool;
+    struct thread_pool_worker *victim;
+    unsigned int i, remaining, best, head, tail;
+
+    while (1) {
+        /* Find the worker with the most remaining jobs */
+        victim = NULL;
+        best = 0;
+        for (i = 0; i < pool->num_workers; i++) {
+            if (&pool->workers[i] == worker)
+                continue;
+            util_worker_lock(&pool->workers[i]);
+            remaining = pool->workers[i].tail - pool->workers[i].head;
+            util_worker_unlock(&pool->workers[i]);
+            if (remaining > best) {
+                best = remaining;
+                victim = &pool->workers[i];
+            }
+        }
+        if (victim == NULL)
+            return 0;
+
+        /* Take the upper half, rounded up, of its range */
+        util_worker_lock(victim);
+        remaining = victim->tail - victim->head;
+        if (remaining == 0) {
+            /* Drained meanwhile, look again */
+            util_worker_unlock(victim);
+            continue;
+        }
+        tail = victim->tail;
+        head = tail - (remaining + 1)/2;
+        victim->tail = head;
+        util_worker_unlock(victim);
+
+        util_worker_lock(worker);
+        worker->head = head;
+        worker->tail = tail;
+        util_worker_unlock(worker);
+
+        return 1;
+    }
+}
+
+static void *thread_pool_worker_run(void *arg) {
+    struct thread_pool_worker *worker = (struct thread_pool_worker *)arg;
+    struct thread_pool_state *pool = worker->pool;
+    unsigned int job;
+
+    /* Run own jobs, then steal more, until there are none left */
+    while (1) {
+        while (util_worker_claim(worker, &job))
+            pool->job(pool->arg, worker->index, job);
+        if (!util_worker_steal(worker))
+            break;
+    }
+
+    return NULL;
+}
+
+int thread_pool_run(unsigned int num_workers, unsigned int num_jobs, thread_pool_job_t job, void *arg) {
+    struct thread_pool_state pool;
+    struct thread_pool_worker *workers;
+    unsigned int i;
+#ifndef _MSC_VER
+    pthread_t *threads;
+    unsigned int num_started;
+#endif
+
+    memset(&pool, 0, sizeof(pool));
+    pool.job = job;
+    pool.arg = arg;
+
+    /* No more workers than jobs */
+    if (num_workers > num_jobs)
+        num_workers = num_jobs;
+    if (num_workers == 0)
+        return 0;
+
+    workers = calloc(num_workers, sizeof(struct thread_pool_worker));
+    if (workers == NULL)
+        return -1;
+#ifdef _MSC_VER
+    /* No thread support, a single worker runs all jobs */
+    num_workers = 1;
+#endif
+    pool.workers = workers;
+    pool.num_workers = num_workers;
+
+    /* Split the jobs evenly between workers */
+    for (i = 0; i < num_workers; i++) {
+        workers[i].pool = &pool;
+        workers[i].index = i;
+        workers[i].head = (unsigned int)(((unsigned long long)num_jobs*i)/num_workers);
+        workers[i].tail = (unsigned int)(((unsigned long long)num_jobs*(i+1))/num_workers);
+#ifndef _MSC_VER
+        pthread_mutex_init(&workers[i].lock, NULL);
+#endif
+    }
+
+#ifndef _MSC_VER
+    /* Worker 0 runs on the calling thread */
+    threads = calloc(num_workers, sizeof(pthread_t));
+    if (threads == NULL) {
+        for (i = 0; i < num_workers; i++)
+            pthread_mutex_destroy(&workers[i].lock);
+        free(workers);
+        return -1;
+    }
+    for (num_started = 1; num_started < num_workers; num_started++) {
+        if (pthread_create(&threads[num_started], NULL, thread_pool_worker_run, &workers[num_started]) != 0)
+            break;
+    }
+    thread_pool_worker_run(&workers[0]);
+    for (i = 1; i < num_started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    for (i = 0; i < num_workers; i++)
+        pthread_mutex_destroy(&workers[i].lock);
+#else
+    thread_pool_worker_run(&workers[0]);
+#endif
+
+    free(workers);
+
+    return 0;
+}
+
@@ -0,0 +1,13 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/* Job function, called with the pool argument, the index of the worker
+ * running the job, and the index of the job */
+typedef void (*thread_pool_job_t)(void *arg, unsigned int worker, unsigned int job);
+
+/* Thread Pool Support */
+unsigned int thread_pool_default_workers(void);
+int thread_pool_run(unsigned int num_workers, unsigned int num_jobs, thread_pool_job_t job, void *arg);
+
+#endif
+
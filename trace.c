@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
+
+#include <trace.h>
+#include <profile.h>
+
+/******************************************************************************/
+/* Trace Recorder Support */
+/******************************************************************************/
+
+#ifndef _MSC_VER
+#define TRACE_THREAD_LOCAL      __thread
+#else
+#define TRACE_THREAD_LOCAL      __declspec(thread)
+#endif
+
+/* Events per buffer chunk */
+#define TRACE_CHUNK_LEN         4096
+
+struct trace_event {
+    /* Event name, a string literal */
+    const char *name;
+    /* Detail of begin events, e.g. a file name */
+    char detail[48];
+    /* 'B' begin or 'E' end */
+    char phase;
+    /* Nanoseconds since trace_init() */
+    uint64_t timestamp;
+};
+
+struct trace_chunk {
+    struct trace_event events[TRACE_CHUNK_LEN];
+    unsigned int len;
+    struct trace_chunk *next;
+};
+
+/* Event buffer of one thread, only appended to by its thread. Threads are
+ * linked on a list when they record their first event. */
+struct trace_thread {
+    unsigned int tid;
+    struct trace_chunk *head;
+    struct trace_chunk *tail;
+    struct trace_thread *next;
+};
+
+int trace_enabled = 0;
+
+static struct trace_thread *trace_threads = NULL;
+static unsigned int trace_num_threads = 0;
+static TRACE_THREAD_LOCAL struct trace_thread *trace_local = NULL;
+static uint64_t trace_start;
+#ifndef _MSC_VER
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Next free event of the calling thread's buffer, growing it by a chunk when
+ * full. Returns NULL if out of memory. */
+static struct trace_event *util_trace_event(void) {
+    struct trace_chunk *chunk;
+
+    if (trace_local == NULL) {
+        if ((trace_local = calloc(1, sizeof(struct trace_thread))) == NULL)
+            return NULL;
+#ifndef _MSC_VER
+        pthread_mutex_lock(&trace_lock);
+#endif
+        trace_local->tid = ++trace_num_threads;
+        trace_local->next = trace_threads;
+        trace_threads = trace_local;
+#ifndef _MSC_VER
+        pthread_mutex_unlock(&trace_lock);
+#endif
+    }
+
+    if (trace_local->tail == NULL || trace_local->tail->len == TRACE_CHUNK_LEN) {
+        if ((chunk = malloc(sizeof(struct trace_chunk))) == NULL)
+            return NULL;
+        chunk->len = 0;
+        chunk->next = NULL;
+        if (trace_local->tail != NULL)
+            trace_local->tail->next = chunk;
+        else
+            trace_local->head = chunk;
+        trace_local->tail = chunk;
+    }
+
+    return &trace_local->tail->events[trace_local->tail->len++];
+}
+
+void trace_init(void) {
+    trace_enabled = 1;
+    trace_start = profile_now();
+}
+
+void trace_begin(const char *name, const char *detail) {
+    struct trace_event *event = util_trace_event();
+
+    if (event == NULL)
+        return;
+
+    event->name = name;
+    event->phase = 'B';
+    event->detail[0] = '\0';
+    if (detail != NULL)
+        snprintf(event->detail, sizeof(event->detail), "%s", detail);
+    event->timestamp = profile_now() - trace_start;
+}
+
+void trace_end(const char *name) {
+    struct trace_event *event = util_trace_event();
+
+    if (event == NULL)
+        return;
+
+    event->timestamp = profile_now() - trace_start;
+    event->name = name;
+    event->phase = 'E';
+    event->detail[0] = '\0';
+}
+
+/* Write a JSON string, escaping quotes, backslashes and control characters */
+static void util_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char)*s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+int trace_write(FILE *out) {
+    const struct trace_thread *thread;
+    const struct trace_chunk *chunk;
+    const struct trace_event *event;
+    unsigned int i;
+    int first = 1;
+
+    /* Called at exit, after all threads have stopped recording */
+#ifndef _MSC_VER
+    pthread_mutex_lock(&trace_lock);
+#endif
+    fprintf(out, "{\"traceEvents\": [\n");
+    for (thread = trace_threads; thread != NULL; thread = thread->next) {
+        fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"thread %u\"}}", first ? "" : ",\n", thread->tid, thread->tid);
+        first = 0;
+
+        for (chunk = thread->head; chunk != NULL; chunk = chunk->next) {
+            for (i = 0; i < chunk->len; i++) {
+                event = &chunk->events[i];
+                fprintf(out, ",\n{\"name\": ");
+                util_json_string(out, event->name);
+                fprintf(out, ", \"cat\": \"vavrdisasm\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %u", event->phase, (double)event->timestamp/1000.0, thread->tid);
+                if (event->detail[0] != '\0') {
+                    fprintf(out, ", \"args\": {\"detail\": ");
+                    util_json_string(out, event->detail);
+                    fprintf(out, "}");
+                }
+                fprintf(out, "}");
+            }
+        }
+    }
+    fprintf(out, "\n], \"displayTimeUnit\": \"ms\"}\n");
+#ifndef _MSC_VER
+    pthread_mutex_unlock(&trace_lock);
+#endif
+
+    return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,24 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+/* Instructions per traced batch of streaming disassembly */
+#define TRACE_BATCH_LEN     4096
+
+/* Trace Recorder Support. Records begin and end events of the pipeline stages
+ * per thread, into buffers owned by each thread, and writes them as Chrome
+ * trace-event JSON. Event names must be string literals; details are copied.
+ * Each event costs one flag test while tracing is disabled. */
+extern int trace_enabled;
+
+void trace_init(void);
+void trace_begin(const char *name, const char *detail);
+void trace_end(const char *name);
+int trace_write(FILE *out);
+
+#define TRACE_BEGIN(name, detail)   do { if (trace_enabled) trace_begin((name), (detail)); } while (0)
+#define TRACE_END(name)             do { if (trace_enabled) trace_end(name); } while (0)
+
+#endif
+
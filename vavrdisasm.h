@@ -0,0 +1,68 @@
+#ifndef VAVRDISASM_H
+#define VAVRDISASM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* libvavrdisasm: reentrant AVR disassembly of memory buffers. Functions keep
+ * no state between calls and may be called concurrently from many threads.
+ * This header is self-contained, and the library exports only the
+ * vavrdisasm_* functions. */
+
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define VAVRDISASM_API  __attribute__((visibility("default")))
+#else
+#define VAVRDISASM_API
+#endif
+
+/* Decoded instruction. The address, opcode bytes and width may be read, the
+ * remaining fields are private to the library. */
+struct vavrdisasm_instruction {
+    uint32_t address;
+    uint8_t opcode[4];
+    /* Width in bytes */
+    unsigned int width;
+    /* Private */
+    const void *info;
+    int32_t operands[2];
+};
+
+/* Format flags */
+enum {
+    VAVRDISASM_FLAG_ASSEMBLY            = (1<<0),
+    VAVRDISASM_FLAG_ADDRESSES           = (1<<1),
+    VAVRDISASM_FLAG_DESTINATION_COMMENT = (1<<2),
+    VAVRDISASM_FLAG_DATA_HEX            = (1<<3),
+    VAVRDISASM_FLAG_DATA_BIN            = (1<<4),
+    VAVRDISASM_FLAG_DATA_DEC            = (1<<5),
+    VAVRDISASM_FLAG_OPCODES             = (1<<6),
+    VAVRDISASM_FLAG_OBJDUMP_COMP        = (1<<7),
+};
+
+/* Decode up to max instructions from the len consecutive bytes of data
+ * starting at address, into the caller's instructions array. The end of data
+ * is treated as the end of the program, like an address change or EOF in a
+ * file. Returns the number of instructions decoded, and the number of bytes
+ * they span in consumed, if not NULL. */
+VAVRDISASM_API size_t vavrdisasm_decode(const uint8_t *data, size_t len, uint32_t address, struct vavrdisasm_instruction *instructions, size_t max, size_t *consumed);
+
+/* Size in bytes of the instruction-boundary bitmap of len bytes of data, and
+ * build it into the caller's bitmap, with a bit set for each byte of data
+ * that starts an instruction. */
+VAVRDISASM_API size_t vavrdisasm_index_size(size_t len);
+VAVRDISASM_API void vavrdisasm_index_build(const uint8_t *data, size_t len, uint8_t *bitmap);
+
+/* Decode up to max instructions overlapping addresses [start, end) of the len
+ * consecutive bytes of data starting at address, seeking to the first with
+ * the instruction-boundary bitmap of data instead of decoding from the
+ * start. Returns the number of instructions decoded. */
+VAVRDISASM_API size_t vavrdisasm_decode_range(const uint8_t *data, size_t len, uint32_t address, const uint8_t *bitmap, uint32_t start, uint32_t end, struct vavrdisasm_instruction *instructions, size_t max);
+
+/* Format an instruction, or the origin directive for an address, into the
+ * caller's buffer like snprintf, with the VAVRDISASM_FLAG_* bit flags.
+ * Returns the untruncated length, or -1 on error. */
+VAVRDISASM_API int vavrdisasm_format(const struct vavrdisasm_instruction *instruction, char *buf, size_t size, int flags);
+VAVRDISASM_API int vavrdisasm_format_origin(uint32_t address, char *buf, size_t size, int flags);
+
+#endif
+